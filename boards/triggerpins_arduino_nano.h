@@ -29,4 +29,18 @@
 #define IN06_PIN -1
 #define IN07_PIN -1
 
+// Analog inputs, A6 and A7 are analog only
+#define AIN00_PIN 20
+#define AIN01_PIN 21
+#define AIN02_PIN -1
+#define AIN03_PIN -1
+#define AIN04_PIN -1
+#define AIN05_PIN -1
+#define AIN06_PIN -1
+#define AIN07_PIN -1
+
+// Timer1 input capture (ICP1) is pin 8, OUT04 above. Move IN00 there and set
+// 0x01 to timestamp it in hardware.
+#define IN_CAPTURE_INPUTS 0
+
 #endif
\ No newline at end of file
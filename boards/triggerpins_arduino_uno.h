@@ -1,6 +1,9 @@
 #ifndef _TRIGGERPINS_ARDUINO_UNO
 #define _TRIGGERPINS_ARDUINO_UNO
 
+// Timer1 input capture (ICP1) is pin 8, OUT08 in the generic table. Move an
+// input there and set IN_CAPTURE_INPUTS to timestamp it in hardware.
+
 #include "triggerpins_generic.h"
 
 #endif
\ No newline at end of file
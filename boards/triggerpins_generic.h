@@ -29,4 +29,25 @@
 #define IN06_PIN 22
 #define IN07_PIN 23
 
+// Analog inputs AIN0..AIN7 for sampling in step with the pulses
+// (analog_sampler.h), -1 -> none. All analog pins of the boards are taken
+// by the inputs and outputs above unless the board header sets others.
+#ifndef AIN00_PIN
+#define AIN00_PIN -1
+#define AIN01_PIN -1
+#define AIN02_PIN -1
+#define AIN03_PIN -1
+#define AIN04_PIN -1
+#define AIN05_PIN -1
+#define AIN06_PIN -1
+#define AIN07_PIN -1
+#endif
+
+// Inputs timestamped by timer input capture hardware instead of micros(),
+// IN0..IN7 as bits; 0 -> off. Only some pins reach a capture unit, see
+// input_capture.h
+#ifndef IN_CAPTURE_INPUTS
+#define IN_CAPTURE_INPUTS 0
+#endif
+
 #endif
\ No newline at end of file
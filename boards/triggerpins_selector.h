@@ -17,6 +17,8 @@
 #include "triggerpins_arduino_nano.h"
 #elif ARDUINO_AVR_UNO
 #include "triggerpins_arduino_uno.h"
+#elif TRIGGER_SIM
+#include "triggerpins_sim.h"
 #else
 #error "Error: Unknown Board"
 #endif
@@ -0,0 +1,19 @@
+#ifndef _TRIGGERPINS_SIM
+#define _TRIGGERPINS_SIM
+
+// IN00 goes through the simulated capture unit
+#define IN_CAPTURE_INPUTS 0x01
+
+// Analog inputs of the simulated ADC, beyond the digital pins
+#define AIN00_PIN 24
+#define AIN01_PIN 25
+#define AIN02_PIN 26
+#define AIN03_PIN 27
+#define AIN04_PIN -1
+#define AIN05_PIN -1
+#define AIN06_PIN -1
+#define AIN07_PIN -1
+
+#include "triggerpins_generic.h"
+
+#endif
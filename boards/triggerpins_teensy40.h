@@ -1,6 +1,20 @@
 #ifndef _TRIGGERPINS_TEENSY41
 #define _TRIGGERPINS_TEENSY41
 
+// IN02 (pin 18) and IN03 (pin 19) reach QTIMER3, 0x0C timestamps both with
+// its input capture
+#define IN_CAPTURE_INPUTS 0
+
+// Analog inputs on the pads under the board, A10 and A11 reach ADC1
+#define AIN00_PIN 24
+#define AIN01_PIN 25
+#define AIN02_PIN -1
+#define AIN03_PIN -1
+#define AIN04_PIN -1
+#define AIN05_PIN -1
+#define AIN06_PIN -1
+#define AIN07_PIN -1
+
 #include "triggerpins_generic.h"
 
 #endif
\ No newline at end of file
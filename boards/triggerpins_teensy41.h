@@ -1,6 +1,21 @@
 #ifndef _TRIGGERPINS_TEENSY41
 #define _TRIGGERPINS_TEENSY41
 
+// IN02 (pin 18) and IN03 (pin 19) reach QTIMER3, 0x0C timestamps both with
+// its input capture
+#define IN_CAPTURE_INPUTS 0
+
+// Analog inputs that reach ADC1: A10, A11, A16 and A17. A12 to A15 (pins
+// 26, 27, 38, 39) are on ADC2 only.
+#define AIN00_PIN 24
+#define AIN01_PIN 25
+#define AIN02_PIN 40
+#define AIN03_PIN 41
+#define AIN04_PIN -1
+#define AIN05_PIN -1
+#define AIN06_PIN -1
+#define AIN07_PIN -1
+
 #include "triggerpins_generic.h"
 
 #endif
\ No newline at end of file
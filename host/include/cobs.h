@@ -0,0 +1,25 @@
+#ifndef _COBS_H
+#define _COBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Consistent Overhead Byte Stuffing as used by PacketSerial, frames are
+// delimited by 0x00 on the wire.
+
+/// @brief Worst case encoded size, without the delimiter
+#define COBS_ENCODED_SIZE(size) ((size) + (size) / 254 + 1)
+
+/// @brief Encode size bytes of buffer into encoded
+/// @return encoded length, the 0x00 delimiter is not appended
+size_t cobsEncode(const uint8_t *buffer, size_t size, uint8_t *encoded);
+
+/// @brief Decode a frame (without delimiter) in place
+///
+/// The decoded data never is longer than the encoded data and every byte is
+/// written at or before the position it is read from, so the frame buffer
+/// holds the decoded message afterwards.
+/// @return decoded length, 0 if the frame is malformed
+size_t cobsDecodeInPlace(uint8_t *buffer, size_t size);
+
+#endif
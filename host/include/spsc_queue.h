@@ -0,0 +1,90 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+/// @brief Bounded single producer / single consumer queue
+///
+/// Slots are allocated once at construction and written in place: the
+/// producer fills the slot returned by beginPush() and publishes it with
+/// endPush(), the consumer reads front() and releases it with pop(). Head
+/// and tail live on their own cache lines and every side caches the index
+/// of the other one, so the shared indices are only touched when the cached
+/// copy says the queue is full or empty.
+template <typename T> class SpscQueue {
+  public:
+    /// @param capacity rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        _slots.resize(size);
+        _mask = size - 1;
+    }
+
+    size_t capacity() const { return _mask + 1; }
+
+    /// @brief Slot for the next element, nullptr if the queue is full
+    T *beginPush() {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head_cache > _mask) {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (tail - _head_cache > _mask) {
+                return nullptr;
+            }
+        }
+        return &_slots[tail & _mask];
+    }
+    /// @brief Publish the slot returned by beginPush()
+    void endPush() {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+    bool push(const T &value) {
+        T *slot = beginPush();
+        if (!slot) {
+            return false;
+        }
+        *slot = value;
+        endPush();
+        return true;
+    }
+
+    /// @brief Oldest element, nullptr if the queue is empty
+    const T *front() {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail_cache) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head == _tail_cache) {
+                return nullptr;
+            }
+        }
+        return &_slots[head & _mask];
+    }
+    /// @brief Release the element returned by front()
+    void pop() {
+        _head.store(_head.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+    /// @brief Approximate, exact only on the consumer side
+    size_t size() const {
+        return _tail.load(std::memory_order_acquire) -
+               _head.load(std::memory_order_acquire);
+    }
+
+  private:
+    std::vector<T> _slots;
+    size_t _mask;
+    // consumer
+    alignas(64) std::atomic<size_t> _head{0};
+    size_t _tail_cache = 0;
+    // producer
+    alignas(64) std::atomic<size_t> _tail{0};
+    size_t _head_cache = 0;
+};
+
+#endif
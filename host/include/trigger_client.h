@@ -0,0 +1,535 @@
+#ifndef _TRIGGER_CLIENT_H
+#define _TRIGGER_CLIENT_H
+
+// Host side client for the trigger firmware.
+//
+// A reader thread pulls bytes from the serial port, decodes COBS frames in
+// place in a reusable buffer, checks them and turns them into TriggerEvents
+// that are written straight into an SPSC queue. Batched input frames are
+// expanded into one event per input change. The application thread takes
+// events with poll()/wait() or dispatch(), nothing is allocated per frame.
+// With sequence() the reader holds back the frames after a missing one and
+// asks the device for it again, so the events stay complete and in order.
+
+#include "cobs.h"
+#include "serial_messages.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRIGGER_CLIENT_MAX_PAYLOAD_SIZE 0xFF // header.length is one byte
+#define TRIGGER_CLIENT_MAX_FRAME_SIZE                                          \
+    (LENGTH_MSG_HEADER + TRIGGER_CLIENT_MAX_PAYLOAD_SIZE)
+#define TRIGGER_CLIENT_DEFAULT_QUEUE_SIZE 4096
+#define TRIGGER_CLIENT_ANALOG_INPUTS 8 // AIN0..AIN7
+// Sequenced frames held back after a gap, a power of two up to 2^15
+#define TRIGGER_CLIENT_RESEND_WINDOW 1024
+
+// TYPE_INPUTS, also every event of a TYPE_INPUTS_BATCH
+struct trigger_input_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t inputs_state;
+};
+
+// TYPE_INPUT_CAPTURE, an edge of an input with timer input capture
+struct trigger_capture_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t inputs_state;
+    uint8_t input;  // IN0..IN7 index of the edge
+    uint64_t ticks; // latched at the edge, see triggerCaptureNs()
+};
+
+// TYPE_SEGMENT, a channel started a segment of its schedule
+struct trigger_segment_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id; // first pulse of the segment
+    uint8_t channel;
+    uint8_t segment; // index in TriggerSchedule::segments
+    uint16_t pass;   // from 0
+};
+
+// TYPE_TIMED, a timed command took effect, see timed_reply_message
+struct trigger_timed_t {
+    uint64_t applied_us; // device clock
+    uint32_t pulse_id;   // first pulse of a setup or reset, last of a stop
+    uint8_t id;
+    uint8_t channel;
+    uint8_t status; // timed_status
+};
+
+// TYPE_PATTERN, a half of the output pattern played, see
+// pattern_status_message
+struct trigger_pattern_t {
+    uint32_t uptime_us;
+    uint32_t halves; // played since the start
+    uint16_t first;  // first step of the half
+    uint8_t status;  // pattern_status
+};
+
+// TYPE_BURST, an input edge triggered a burst, see burst_reply_message
+struct trigger_burst_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;   // first pulse of the burst
+    uint32_t latency_ns; // input edge to first rising edge, BURST_NO_LATENCY
+    uint8_t channel;
+    uint8_t input;
+    uint8_t status; // burst_status
+};
+
+// TYPE_ANALOG_SAMPLES, every set of a frame, see analog_samples_message
+struct trigger_analog_t {
+    uint32_t uptime_us; // start of the first set of its frame
+    uint32_t pulse_id;
+    uint32_t sets;    // converted since the setup, at the frame
+    uint32_t dropped; // since the setup, at the frame
+    uint8_t channel;
+    uint8_t pins;  // AIN0..AIN7 bits of values
+    uint8_t index; // set of the pulse, 0 .. divider - 1
+    uint8_t divider;
+    uint8_t count; // values, one per bit of pins
+    uint16_t values[TRIGGER_CLIENT_ANALOG_INPUTS]; // lowest pin first
+};
+
+// TYPE_RESEND, sequenced frames that are lost: the device no longer held
+// them or they were not resent in time
+struct trigger_resend_t {
+    uint16_t first; // sequence number
+    uint16_t count;
+};
+
+// TYPE_INFO
+struct trigger_info_t {
+    uint32_t cpu_hz;
+    uint16_t output_skew_cycles;
+    uint8_t output_ports;
+    uint32_t capture_hz;    // 0 -> no input capture
+    uint8_t capture_inputs; // IN0..IN7 with input capture
+};
+
+// TYPE_STATS, performance counters of the device since start or the last
+// reset, see stats_message
+struct trigger_device_stats_t {
+    uint32_t elapsed_ms;
+    uint32_t loop_count;
+    uint32_t loop_max_us;
+    uint32_t edge_count;
+    uint32_t edge_late_max_us;
+    uint32_t input_captures;
+    uint32_t input_edges;
+    uint32_t input_events; // input_edges - input_events were merged
+    uint32_t input_lost;
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t tx_dropped;
+    uint32_t rx_frames;
+    uint16_t rx_errors[STATS_RX_ERROR_BITS]; // per SERIAL_PEER_ERROR_CODE bit
+    uint16_t tx_free_min;
+    uint8_t input_high_water;
+    uint8_t capture_high_water;
+    uint16_t loop_histogram[STATS_HISTOGRAM_BUCKETS]; // log2 us buckets
+    uint16_t edge_late_histogram[STATS_HISTOGRAM_BUCKETS];
+};
+
+// TYPE_EVENT_OVERFLOW
+struct trigger_overflow_t {
+    uint32_t lost_events;
+};
+
+// TYPE_TIME_SYNC
+struct trigger_time_sync_t {
+    uint64_t host_tx;
+    uint64_t device_rx_us;
+    uint64_t device_tx_us;
+};
+
+// TYPE_ERROR, render with triggerErrorText()
+struct trigger_error_t {
+    uint8_t error_flags; // SERIAL_PEER_ERROR_CODE bits
+    uint8_t type;        // header of the rejected message, 0 if none
+    uint8_t length;
+    uint8_t crc;
+    uint8_t calc_crc; // crc the device calculated
+    uint16_t received_len;
+    uint16_t expected_len; // 0 -> no length error
+};
+typedef struct trigger_error_t TriggerError;
+
+// TYPE_TXT, TYPE_ECHO: raw payload
+struct trigger_payload_t {
+    uint8_t length;
+    uint8_t data[TRIGGER_CLIENT_MAX_PAYLOAD_SIZE];
+};
+
+struct trigger_event_t {
+    uint8_t type;        // message_type
+    uint64_t host_rx_ns; // steady clock when the frame was read
+    union {
+        struct trigger_input_t input;
+        struct trigger_capture_t capture;
+        struct trigger_segment_t segment;
+        struct trigger_timed_t timed;
+        struct trigger_pattern_t pattern;
+        struct trigger_burst_t burst;
+        struct trigger_analog_t analog;
+        struct trigger_resend_t resend;
+        struct trigger_info_t info;
+        struct trigger_device_stats_t device_stats;
+        struct trigger_overflow_t overflow;
+        struct trigger_time_sync_t time_sync;
+        struct trigger_error_t error;
+        struct trigger_payload_t payload;
+    };
+};
+typedef struct trigger_event_t TriggerEvent;
+
+struct trigger_setup_t {
+    uint32_t pulse_millihz = 0; // 0 -> OFF
+    uint32_t pulse_limit = 0;   // 0 -> unlimited pulses
+    uint32_t delay_us = 0;      // delay until the first pulse
+    uint32_t high_us = 0;       // high time of every pulse; 0 -> 50% duty
+    uint8_t flags = 0;          // setup_flags
+};
+typedef struct trigger_setup_t TriggerSetup;
+
+struct trigger_channel_setup_t {
+    uint8_t channel = 0;
+    uint16_t outputs = 0;       // OUT00..OUT15 driven by the channel
+    uint8_t inputs = 0;         // IN0..IN7 reported with its pulse_id
+    uint32_t pulse_millihz = 0; // 0 -> stop after the next falling edge
+    uint32_t phase_us = 0;      // offset of the first rising edge
+    uint32_t pulse_limit = 0;   // 0 -> unlimited pulses
+    uint8_t flags = 0;          // setup_flags
+    uint32_t high_us = 0;       // high time of every pulse; 0 -> 50% duty
+};
+typedef struct trigger_channel_setup_t TriggerChannelSetup;
+
+// Leader/follower role of a channel, see cascade_message
+struct trigger_cascade_setup_t {
+    uint8_t channel = 0;
+    uint8_t clock_input = CASCADE_NO_INPUT; // IN0..IN7 index of a follower
+    uint8_t sync_input = CASCADE_NO_INPUT;  // restarts pulse_id at 0
+    uint16_t sync_outputs = 0;              // high during pulse_id 0
+};
+typedef struct trigger_cascade_setup_t TriggerCascadeSetup;
+
+// External trigger of a channel, see burst_message
+struct trigger_burst_setup_t {
+    uint8_t channel = 0;
+    uint8_t input = BURST_NO_INPUT; // IN0..IN7 index; BURST_NO_INPUT -> off
+    uint8_t flags = 0;              // burst_flags
+    uint32_t pulse_count = 1;
+    uint32_t pulse_millihz = 0; // rate within the burst
+    uint32_t high_us = 0;       // high time of every pulse; 0 -> 50% duty
+};
+typedef struct trigger_burst_setup_t TriggerBurst;
+
+// Analog inputs sampled in step with a channel, see analog_message
+struct trigger_analog_setup_t {
+    uint8_t channel = 0;
+    uint8_t pins = 0;            // AIN0..AIN7 bits; 0 -> off
+    uint8_t divider = 1;         // sets per pulse, a power of two
+    uint32_t max_latency_us = 0; // send a frame once its first set is as old
+};
+typedef struct trigger_analog_setup_t TriggerAnalogSetup;
+
+// Setup, stop or reset applied by the device at a device time or before a
+// pulse, see timed_message
+struct trigger_timed_command_t {
+    uint8_t id = 0; // echoed in the TYPE_TIMED reply
+    uint8_t channel = 0;
+    uint8_t action = TIMED_SETUP;  // timed_action
+    uint8_t trigger = TIMED_AT_US; // timed_trigger
+    uint64_t at = 0;               // device clock in us or pulse_id
+    uint32_t pulse_millihz = 0;    // TIMED_SETUP, 0 -> stop
+    uint32_t pulse_limit = 0;      // 0 -> unlimited pulses
+    uint32_t high_us = 0;          // high time of every pulse; 0 -> 50% duty
+    uint8_t flags = 0;             // setup_flags
+};
+typedef struct trigger_timed_command_t TriggerTimedCommand;
+
+struct trigger_schedule_segment_t {
+    uint32_t pulse_millihz = 0;
+    uint32_t pulse_count = 0; // at least one
+    uint32_t gap_us = 0;      // pause before the next segment
+    uint32_t high_us = 0;     // high time of every pulse; 0 -> 50% duty
+    uint8_t flags = 0;        // segment_flags
+};
+typedef struct trigger_schedule_segment_t TriggerScheduleSegment;
+
+// Pulse schedule the device plays back on its own, see schedule_message
+struct trigger_schedule_t {
+    uint8_t channel = 0;
+    uint8_t flags = 0;   // setup_flags
+    uint16_t repeat = 0; // passes through the table; 0 -> until stopped
+    std::vector<TriggerScheduleSegment> segments;
+};
+typedef struct trigger_schedule_t TriggerSchedule;
+
+// Output pattern the device plays back from hardware, see pattern_message
+struct trigger_pattern_setup_t {
+    uint16_t outputs = 0;        // OUT00..OUT15 driven by the pattern
+    uint32_t tick_ns = 0;        // time per step
+    uint8_t flags = 0;           // pattern_flags
+    std::vector<uint16_t> steps; // OUT00..OUT15 levels, even length
+};
+typedef struct trigger_pattern_setup_t TriggerPattern;
+
+/// @brief high_us for a duty cycle, the device only knows high times
+/// @param duty 0..1 of the period
+inline uint32_t triggerHighUs(uint32_t pulse_millihz, double duty) {
+    if (!pulse_millihz || duty <= 0) {
+        return 0;
+    }
+    return (uint32_t)(duty * 1e9 / pulse_millihz + 0.5);
+}
+
+/// @brief Device time of a capture in ns
+/// @param capture_hz from the TYPE_INFO of the device
+inline uint64_t triggerCaptureNs(uint64_t ticks, uint32_t capture_hz) {
+    if (!capture_hz) {
+        return 0;
+    }
+    // Split so that ticks * 1e9 can not overflow
+    return ticks / capture_hz * 1000000000ULL +
+           ticks % capture_hz * 1000000000ULL / capture_hz;
+}
+
+// Result of benchmark(), round trips of timestamped TYPE_ECHO frames
+struct trigger_benchmark_t {
+    uint32_t sent;
+    uint32_t received;
+    uint32_t lost;       // not back within the timeout
+    uint64_t bad_frames; // COBS, length or crc errors meanwhile
+    double rtt_min_us;
+    double rtt_mean_us;
+    double rtt_max_us;
+    double frames_per_s;
+    double bytes_per_s; // on the wire, both directions
+};
+typedef struct trigger_benchmark_t TriggerBenchmark;
+
+// Echo payload of benchmark(): sequence number and host send time
+#define TRIGGER_CLIENT_BENCHMARK_MIN_PAYLOAD 12
+
+// Reader statistics, read from any thread
+struct trigger_client_stats_t {
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t events;
+    uint64_t dropped_events; // queue full
+    uint64_t bad_frames;     // COBS, length or crc errors
+    uint64_t resend_requests;
+    uint64_t resent_frames; // closed a gap in the sequence
+    uint64_t lost_frames;   // reported in TYPE_RESEND events
+};
+typedef struct trigger_client_stats_t TriggerClientStats;
+
+class TriggerClient {
+
+  public:
+    typedef void (*EventHandler)(const TriggerEvent &event, void *context);
+    typedef void (*NotifyFunction)(void *context);
+
+    explicit TriggerClient(
+        size_t queue_size = TRIGGER_CLIENT_DEFAULT_QUEUE_SIZE);
+    ~TriggerClient();
+
+    /// @brief Open a serial device (raw 8N1) and start the reader thread
+    bool open(const char *path, uint32_t baudrate = 115200);
+    void close();
+    bool isOpen() const { return _fd >= 0; }
+
+    // ######################################################### Receive side
+    /// @brief Copy the oldest event out of the queue
+    bool poll(TriggerEvent *event);
+    /// @brief Like poll(), waits up to timeout for an event
+    bool wait(TriggerEvent *event, std::chrono::milliseconds timeout);
+    /// @brief Hand every queued event to handler without copying it
+    /// @return number of events handled
+    size_t dispatch(EventHandler handler, void *context = nullptr);
+    /// @brief Oldest event in place, nullptr if the queue is empty. It stays
+    /// valid until pop().
+    const TriggerEvent *front() { return _queue.front(); }
+    /// @brief Release the event returned by front()
+    void pop() { _queue.pop(); }
+    /// @brief Have the reader thread call notify after every read that
+    /// queued events, to wake a thread that waits on several clients. Set it
+    /// before open().
+    void setNotify(NotifyFunction notify, void *context);
+    TriggerClientStats getStats() const;
+
+    // ############################################################ Send side
+    bool sendSetup(const TriggerSetup &setup);
+    /// @brief Send a setup and wait for the device to acknowledge it
+    /// @return false on timeout or if the device answered with an error
+    bool setup(const TriggerSetup &setup, std::chrono::milliseconds timeout);
+    bool sendChannelSetup(const TriggerChannelSetup &setup);
+    /// @brief Send a channel setup and wait for the device to acknowledge it
+    bool channelSetup(const TriggerChannelSetup &setup,
+                      std::chrono::milliseconds timeout);
+    bool sendCascade(const TriggerCascadeSetup &setup);
+    /// @brief Make a channel a follower or leader and wait for the ack
+    bool cascade(const TriggerCascadeSetup &setup,
+                 std::chrono::milliseconds timeout);
+    bool sendBurst(const TriggerBurst &burst);
+    /// @brief Arm or disarm the external trigger of a channel and wait for
+    /// the ack. Every edge is answered with a TYPE_BURST event.
+    bool burst(const TriggerBurst &burst, std::chrono::milliseconds timeout);
+    bool sendAnalog(const TriggerAnalogSetup &setup);
+    /// @brief Start, change or stop analog sampling and wait for the ack.
+    /// Every converted set is a TYPE_ANALOG_SAMPLES event.
+    bool analog(const TriggerAnalogSetup &setup,
+                std::chrono::milliseconds timeout);
+    /// @brief Send segments first..first + count of a schedule as one piece,
+    /// count at most SCHEDULE_MESSAGE_MAX_SEGMENTS
+    bool sendSchedule(const TriggerSchedule &schedule, uint8_t first,
+                      uint8_t count);
+    /// @brief Send a schedule piece by piece, every piece has to be
+    /// acknowledged. The channel starts when the last one is.
+    bool schedule(const TriggerSchedule &schedule,
+                  std::chrono::milliseconds timeout);
+    bool sendTimed(const TriggerTimedCommand &command);
+    /// @brief Queue a timed command on the device and wait for the ack, the
+    /// TYPE_TIMED event follows once it took effect. Device times come from
+    /// the clock of TYPE_TIME_SYNC.
+    /// @return false on timeout, an invalid command or a full device queue
+    bool timed(const TriggerTimedCommand &command,
+               std::chrono::milliseconds timeout);
+    /// @brief Send steps first..first + count of a pattern as one piece,
+    /// count at most PATTERN_MESSAGE_MAX_STEPS
+    /// @param action pattern_action
+    bool sendPattern(uint8_t action, const TriggerPattern &pattern,
+                     uint16_t first, uint8_t count);
+    /// @brief Upload a pattern piece by piece and start it, every piece has
+    /// to be acknowledged. A running pattern is stopped first.
+    bool startPattern(const TriggerPattern &pattern,
+                      std::chrono::milliseconds timeout);
+    /// @brief Load steps first..first + count of a streamed pattern again,
+    /// after a TYPE_PATTERN event reported their half as played
+    bool loadPattern(const TriggerPattern &pattern, uint16_t first,
+                     uint16_t count, std::chrono::milliseconds timeout);
+    bool stopPattern(std::chrono::milliseconds timeout);
+    bool sendBatchConfig(uint8_t max_bytes, uint32_t max_latency_us);
+    bool sendSequence(bool on);
+    /// @brief Number the frames of the event stream and wait for the ack.
+    /// Frames after a missing one are held back until the device sent it
+    /// again; frames it can not resend end up as a TYPE_RESEND event.
+    bool sequence(bool on, std::chrono::milliseconds timeout);
+    bool sendResend(uint16_t first, uint16_t count);
+    bool sendInfoRequest();
+    /// @brief Request the TYPE_STATS counters
+    /// @param reset restart them on the device after the response
+    bool sendStatsRequest(bool reset = false);
+    bool sendTimeSync(uint64_t host_tx);
+    bool sendMessage(uint8_t type, const void *payload, uint8_t length);
+
+    // ################################################################# Link
+    /// @brief Propose a rate to the device, setBaudrate() does the handshake
+    bool sendBaudRequest(uint32_t baudrate);
+    /// @brief Switch device and port to another rate: proposal, ack at the
+    /// old rate, verify at the new one. Both sides fall back to the old rate
+    /// if the verify is not answered, then this returns after the device
+    /// timeout (BAUD_VERIFY_TIMEOUT_MS).
+    bool setBaudrate(uint32_t baudrate, std::chrono::milliseconds timeout);
+    uint32_t getBaudrate() const { return _baudrate; }
+    /// @brief Send count echo frames, at most window of them in flight, and
+    /// measure their round trips. Takes every event out of the queue while
+    /// it runs. A window beyond the device receive buffer loses frames.
+    /// @param payload_len at least TRIGGER_CLIENT_BENCHMARK_MIN_PAYLOAD
+    /// @param timeout frames not back within it count as lost
+    bool benchmark(uint32_t count, uint8_t payload_len, uint32_t window,
+                   std::chrono::milliseconds timeout,
+                   TriggerBenchmark *result);
+
+  private:
+    void _readerLoop();
+    void _handleBytes(const uint8_t *bytes, size_t len, uint64_t host_rx_ns);
+    void _handleFrame(uint8_t *frame, size_t len, uint64_t host_rx_ns);
+    TriggerEvent *_beginEvent(uint8_t type, uint64_t host_rx_ns);
+    void _endEvent();
+    void _handleAnalog(const analog_samples_message *msg, size_t len,
+                       uint64_t host_rx_ns);
+    void _handleBatch(const input_batch_message *batch, size_t len,
+                      uint64_t host_rx_ns);
+    void _handleSequenced(uint8_t *frame, size_t len, uint64_t host_rx_ns);
+    void _deliverHeld();
+    void _restartSequence();
+    void _skipGap(uint16_t end, uint64_t host_rx_ns);
+    void _requestResend(uint64_t now_ns);
+    void _checkResend(uint64_t now_ns);
+    void _wakeWaiters(uint64_t events);
+    void _notifyReply(uint8_t type);
+    template <typename Sender>
+    bool _sendAndWaitAck(Sender send, std::chrono::milliseconds timeout);
+    /// @brief Change the port rate after the pending output is out
+    bool _setSpeed(uint32_t baudrate);
+
+    int _fd = -1;
+    std::atomic<uint32_t> _baudrate{0};
+    std::thread _reader;
+    std::atomic<bool> _stop{false};
+
+    // reader thread only
+    uint8_t _frame[COBS_ENCODED_SIZE(TRIGGER_CLIENT_MAX_FRAME_SIZE)];
+    size_t _frame_len = 0;
+    uint8_t _frame_overflow = false;
+
+    // Sequence numbers, set by sequence(), the rest is reader thread only
+    std::atomic<bool> _sequence_on{false};
+    std::atomic<bool> _sequence_restart{false};
+    uint16_t _sequence_next = 0;
+    uint64_t _sequence_rx_ns = 0; // last sequenced frame
+    // Frames after a gap, slot sequence % TRIGGER_CLIENT_RESEND_WINDOW
+    std::vector<uint8_t> _held;
+    uint16_t _held_len[TRIGGER_CLIENT_RESEND_WINDOW] = {}; // 0 -> empty
+    uint64_t _held_rx_ns[TRIGGER_CLIENT_RESEND_WINDOW] = {};
+    uint16_t _held_count = 0;
+    uint64_t _resend_ns = 0; // last request, 0 -> none outstanding
+    uint16_t _resend_end = 0; // end of the gap it asked for
+    uint8_t _resend_tries = 0;
+    uint64_t _probe_ns = 0;
+
+    SpscQueue<TriggerEvent> _queue;
+    std::mutex _wait_mutex;
+    std::condition_variable _wait_cv;
+    std::atomic<int> _waiters{0};
+    NotifyFunction _notify = nullptr;
+    void *_notify_context = nullptr;
+
+    // acks, errors and baud verifies for setup() and setBaudrate()
+    std::mutex _reply_mutex;
+    std::condition_variable _reply_cv;
+    uint64_t _acks = 0;
+    uint64_t _errors = 0;
+    uint32_t _baud_verified = 0; // rate of the last TYPE_BAUD verify reply
+
+    std::mutex _write_mutex;
+
+    std::atomic<uint64_t> _stat_bytes{0};
+    std::atomic<uint64_t> _stat_frames{0};
+    std::atomic<uint64_t> _stat_events{0};
+    std::atomic<uint64_t> _stat_dropped_events{0};
+    std::atomic<uint64_t> _stat_bad_frames{0};
+    std::atomic<uint64_t> _stat_resend_requests{0};
+    std::atomic<uint64_t> _stat_resent_frames{0};
+    std::atomic<uint64_t> _stat_lost_frames{0};
+};
+
+/// @brief Readable description of a device error, one clause per flag
+std::string triggerErrorText(const TriggerError &error);
+
+/// @brief Header version 1 crc, byte sum over the payload. The client sends
+/// version 2 (crc8.h) and accepts both.
+uint8_t triggerCrc(const uint8_t *payload, size_t len);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _TRIGGER_MERGER_H
+#define _TRIGGER_MERGER_H
+
+// Time ordered merge of the event streams of several devices.
+//
+// Every device has its own TriggerClient, so its own reader thread and
+// queue. Device times are mapped onto a common timebase: the 32 bit
+// uptime_us of a device is extended across its wraps to the 64 bit device
+// clock and shifted by the offset of the device. A min-heap holds the oldest
+// event of every device queue in place, the merge hands out its top once
+// every other device has shown an event at or after that time. A device that
+// stays silent holds the others back for at most max_latency after the
+// event was read, then the event goes out anyway. Events of a device keep
+// their stream order, events without a device time (info, stats, time
+// sync, text, errors) take the time of the event before them.
+//
+// Offsets come from setOffset() or from the TYPE_TIME_SYNC round trips of
+// sendTimeSync(): the common timebase is then the host steady clock in us.
+
+#include "trigger_client.h"
+
+#include <memory>
+
+#define TRIGGER_MERGER_DEFAULT_LATENCY_US 20000
+// time_us of the events of a device before its first device time
+#define TRIGGER_MERGER_NO_TIME INT64_MIN
+
+struct trigger_merged_event_t {
+    uint8_t device;  // index in the merger, in the order of open()
+    int64_t time_us; // common timebase
+    TriggerEvent event;
+};
+typedef struct trigger_merged_event_t TriggerMergedEvent;
+
+struct trigger_merger_stats_t {
+    uint64_t events;
+    uint64_t timeouts; // handed out after max_latency, some device was silent
+    uint64_t late;     // older than an event handed out before, out of order
+};
+typedef struct trigger_merger_stats_t TriggerMergerStats;
+
+class TriggerMerger {
+
+  public:
+    typedef void (*EventHandler)(const TriggerEvent &event, uint8_t device,
+                                 int64_t time_us, void *context);
+
+    explicit TriggerMerger(
+        std::chrono::microseconds max_latency =
+            std::chrono::microseconds(TRIGGER_MERGER_DEFAULT_LATENCY_US),
+        size_t queue_size = TRIGGER_CLIENT_DEFAULT_QUEUE_SIZE);
+    ~TriggerMerger();
+
+    /// @brief Open one more device, see TriggerClient::open()
+    /// @return its index, -1 if it could not be opened
+    int open(const char *path, uint32_t baudrate = 115200);
+    void close();
+    size_t size() const { return _sources.size(); }
+    /// @brief Client of a device for setups and other requests. Its events
+    /// must be taken through the merger only.
+    TriggerClient &device(uint8_t device) { return *_sources[device].client; }
+
+    /// @brief Common time of device time 0
+    void setOffset(uint8_t device, int64_t offset_us);
+    int64_t getOffset(uint8_t device) const;
+    /// @brief Send a TYPE_TIME_SYNC to every device. Each reply sets the
+    /// offset of its device to the middle of the round trip.
+    bool sendTimeSync();
+
+    // ######################################################### Receive side
+    /// @brief Copy the next event in time order out of the merge
+    bool poll(TriggerMergedEvent *event);
+    /// @brief Like poll(), waits up to timeout for an event
+    bool wait(TriggerMergedEvent *event, std::chrono::milliseconds timeout);
+    /// @brief Hand every event that is due to handler without copying it
+    /// @return number of events handled
+    size_t dispatch(EventHandler handler, void *context = nullptr);
+    TriggerMergerStats getStats() const { return _stats; }
+
+  private:
+    struct Source {
+        std::unique_ptr<TriggerClient> client;
+        int64_t offset_us = 0;
+        uint64_t clock_us = 0; // extended device time of the last event
+        uint8_t has_clock = false;
+        uint8_t in_heap = false;
+        int64_t time_us = TRIGGER_MERGER_NO_TIME; // of the last event taken
+        uint64_t sync_host_tx = 0;                // of the last sendTimeSync()
+    };
+    struct Head {
+        int64_t time_us;
+        uint8_t device;
+    };
+
+    /// @brief Heap order, the smallest time on top and the lower device
+    /// first
+    static bool _later(const Head &a, const Head &b);
+    static void _notify(void *context);
+    /// @brief Device of the next event that is due, -1 if there is none
+    int _next();
+    void _take(uint8_t device);
+    void _timeSync(Source *source, const TriggerEvent &event);
+    /// @brief Pop the head of device from the heap, front() is the event
+    int64_t _release(uint8_t device);
+
+    std::chrono::microseconds _max_latency;
+    size_t _queue_size;
+    std::vector<Source> _sources;
+    std::vector<Head> _heap; // smallest time on top
+    int64_t _last_us = INT64_MIN;
+    uint64_t _timeout_ns = 0; // steady clock when the blocked top is due
+    TriggerMergerStats _stats = {};
+
+    std::mutex _wait_mutex;
+    std::condition_variable _wait_cv;
+    std::atomic<int> _waiters{0};
+    std::atomic<bool> _notified{false};
+};
+
+#endif
@@ -0,0 +1,54 @@
+/*******************************************************************************
+ * File:        cobs.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "cobs.h"
+
+size_t cobsEncode(const uint8_t *buffer, size_t size, uint8_t *encoded) {
+    size_t read_index = 0;
+    size_t write_index = 1;
+    size_t code_index = 0;
+    uint8_t code = 1;
+    while (read_index < size) {
+        if (buffer[read_index] == 0) {
+            encoded[code_index] = code;
+            code = 1;
+            code_index = write_index++;
+            read_index++;
+        } else {
+            encoded[write_index++] = buffer[read_index++];
+            code++;
+            if (code == 0xFF) {
+                encoded[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+            }
+        }
+    }
+    encoded[code_index] = code;
+    return write_index;
+}
+
+size_t cobsDecodeInPlace(uint8_t *buffer, size_t size) {
+    size_t read_index = 0;
+    size_t write_index = 0;
+    while (read_index < size) {
+        uint8_t code = buffer[read_index];
+        if (code == 0 || read_index + code > size) {
+            return 0;
+        }
+        read_index++;
+        for (uint8_t i = 1; i < code; i++) {
+            buffer[write_index++] = buffer[read_index++];
+        }
+        if (code != 0xFF && read_index != size) {
+            buffer[write_index++] = 0;
+        }
+    }
+    return write_index;
+}
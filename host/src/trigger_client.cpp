@@ -0,0 +1,1330 @@
+/*******************************************************************************
+ * File:        trigger_client.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "trigger_client.h"
+#include "crc8.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define TRIGGER_CLIENT_READ_SIZE 4096
+#define TRIGGER_CLIENT_POLL_MS 50
+// Interval of the verify messages while the device switches
+#define TRIGGER_CLIENT_BAUD_RETRY_MS 20
+// A resend request not served in time is repeated, a few times at most
+#define TRIGGER_CLIENT_RESEND_MS 50
+#define TRIGGER_CLIENT_RESEND_TRIES 5
+// Quiet time after a sequenced frame before the reader asks for the one
+// after it, a lost last frame has no later one to show the gap
+#define TRIGGER_CLIENT_PROBE_MS 250
+#define TRIGGER_CLIENT_RESEND_SLOT(sequence)                                   \
+    ((sequence) & (TRIGGER_CLIENT_RESEND_WINDOW - 1))
+
+static_assert((TRIGGER_CLIENT_RESEND_WINDOW &
+               (TRIGGER_CLIENT_RESEND_WINDOW - 1)) == 0 &&
+                  TRIGGER_CLIENT_RESEND_WINDOW <= 0x8000,
+              "TRIGGER_CLIENT_RESEND_WINDOW must be a power of two");
+
+uint8_t triggerCrc(const uint8_t *payload, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc += payload[i];
+    }
+    return crc;
+}
+
+std::string triggerErrorText(const TriggerError &error) {
+    char text[256];
+    size_t len = 0;
+    uint8_t type = error.type & HEADER_TYPE_MASK;
+    if (error.error_flags & SERIAL_PEER_ERROR_CRC) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        " # CRC ERROR / header.crc: %u / calc crc: %u",
+                        error.crc, error.calc_crc);
+    }
+    if (error.error_flags & SERIAL_PEER_ERROR_LENGTH) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        " # LENGTH ERROR / header.length: %u / len: %u / "
+                        "expected len: %u",
+                        error.length, error.received_len, error.expected_len);
+    }
+    if (error.error_flags & SERIAL_PEER_ERROR_NOT_IMPLEMENTED) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        " # NOT IMPLEMENTED ERROR / header.type: %u", type);
+    }
+    if (error.error_flags & SERIAL_PEER_ERROR_INVALID_VALUE) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        " # INVALID VALUE ERROR / header.type: %u", type);
+    }
+    if (error.error_flags & SERIAL_PEER_ERROR_UNKNOWN_PACKET) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        " # UNKNOWN PACKET ERROR / header.type: %u", type);
+    }
+    if (error.error_flags & SERIAL_PEER_ERROR_RX_OVERFLOW) {
+        len += snprintf(text + len, sizeof(text) - len,
+                        " # RX OVERFLOW ERROR");
+    }
+    return std::string(text, len < sizeof(text) ? len : sizeof(text) - 1);
+}
+
+static uint64_t _steadyNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/// @return false if termios has no constant for the rate
+static bool _baudrateToSpeed(uint32_t baudrate, speed_t *speed) {
+    switch (baudrate) {
+    case 9600:
+        *speed = B9600;
+        return true;
+    case 19200:
+        *speed = B19200;
+        return true;
+    case 38400:
+        *speed = B38400;
+        return true;
+    case 57600:
+        *speed = B57600;
+        return true;
+    case 115200:
+        *speed = B115200;
+        return true;
+    case 230400:
+        *speed = B230400;
+        return true;
+    case 460800:
+        *speed = B460800;
+        return true;
+#ifdef B500000
+    case 500000:
+        *speed = B500000;
+        return true;
+#endif
+    case 921600:
+        *speed = B921600;
+        return true;
+    case 1000000:
+        *speed = B1000000;
+        return true;
+#ifdef B1500000
+    case 1500000:
+        *speed = B1500000;
+        return true;
+#endif
+    case 2000000:
+        *speed = B2000000;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// @brief Read an unsigned LEB128 varint, at most 5 bytes
+/// @return false if the varint runs past end
+static bool _readVarint(const uint8_t **cursor, const uint8_t *end,
+                        uint32_t *value) {
+    *value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (*cursor >= end) {
+            return false;
+        }
+        uint8_t byte = *(*cursor)++;
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TriggerClient::TriggerClient(size_t queue_size)
+    : _held(TRIGGER_CLIENT_RESEND_WINDOW * TRIGGER_CLIENT_MAX_FRAME_SIZE),
+      _queue(queue_size) {}
+
+TriggerClient::~TriggerClient() { close(); }
+
+bool TriggerClient::open(const char *path, uint32_t baudrate) {
+    close();
+    int fd = ::open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        return false;
+    }
+    speed_t speed;
+    if (!_baudrateToSpeed(baudrate, &speed)) {
+        baudrate = 115200;
+        speed = B115200;
+    }
+    struct termios tty;
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cc[VMIN] = 1;
+        tty.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+    _fd = fd;
+    _baudrate = baudrate;
+    _frame_len = 0;
+    _frame_overflow = false;
+    _sequence_on = false;
+    _stop = false;
+    _reader = std::thread(&TriggerClient::_readerLoop, this);
+    return true;
+}
+
+void TriggerClient::close() {
+    if (_fd < 0) {
+        return;
+    }
+    _stop = true;
+    if (_reader.joinable()) {
+        _reader.join();
+    }
+    ::close(_fd);
+    _fd = -1;
+}
+
+// ################################################################ Reader side
+void TriggerClient::_readerLoop() {
+    uint8_t bytes[TRIGGER_CLIENT_READ_SIZE];
+    struct pollfd poll_fd = {_fd, POLLIN, 0};
+    while (!_stop) {
+        int ready = ::poll(&poll_fd, 1, TRIGGER_CLIENT_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready <= 0) {
+            uint64_t events = _stat_events.load(std::memory_order_relaxed);
+            _checkResend(_steadyNs());
+            _wakeWaiters(events);
+            continue;
+        }
+        if (poll_fd.revents & (POLLERR | POLLNVAL)) {
+            break;
+        }
+        ssize_t len = ::read(_fd, bytes, sizeof(bytes));
+        if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (len <= 0) {
+            if (poll_fd.revents & POLLHUP) {
+                // pty peer not (yet) open, do not spin
+                usleep(TRIGGER_CLIENT_POLL_MS * 1000);
+            }
+            continue;
+        }
+        _stat_bytes.fetch_add(len, std::memory_order_relaxed);
+        uint64_t events = _stat_events.load(std::memory_order_relaxed);
+        uint64_t now_ns = _steadyNs();
+        _handleBytes(bytes, len, now_ns);
+        _checkResend(now_ns);
+        _wakeWaiters(events);
+    }
+}
+
+/// @brief Wake wait() and call the notify function if events were queued
+/// @param events _stat_events before
+void TriggerClient::_wakeWaiters(uint64_t events) {
+    if (_stat_events.load(std::memory_order_relaxed) == events) {
+        return;
+    }
+    // pairs with the fence in wait(), either the waiter sees the new
+    // events or the reader sees the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_waiters.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(_wait_mutex);
+        _wait_cv.notify_all();
+    }
+    if (_notify) {
+        _notify(_notify_context);
+    }
+}
+
+void TriggerClient::_handleBytes(const uint8_t *bytes, size_t len,
+                                 uint64_t host_rx_ns) {
+    for (size_t i = 0; i < len; i++) {
+        if (bytes[i] != 0) {
+            if (_frame_len < sizeof(_frame)) {
+                _frame[_frame_len++] = bytes[i];
+            } else {
+                _frame_overflow = true;
+            }
+            continue;
+        }
+        if (_frame_overflow) {
+            _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+        } else if (_frame_len) {
+            size_t frame_len = cobsDecodeInPlace(_frame, _frame_len);
+            _handleFrame(_frame, frame_len, host_rx_ns);
+        }
+        _frame_len = 0;
+        _frame_overflow = false;
+    }
+}
+
+TriggerEvent *TriggerClient::_beginEvent(uint8_t type, uint64_t host_rx_ns) {
+    TriggerEvent *event = _queue.beginPush();
+    if (!event) {
+        _stat_dropped_events.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    event->type = type;
+    event->host_rx_ns = host_rx_ns;
+    return event;
+}
+
+void TriggerClient::_endEvent() {
+    _queue.endPush();
+    _stat_events.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TriggerClient::_handleFrame(uint8_t *frame, size_t len,
+                                 uint64_t host_rx_ns) {
+    const message *type_message = (const message *)frame;
+    if (len < MIN_LENGTH_MESSAGE ||
+        len - LENGTH_MSG_HEADER != type_message->header.length) {
+        _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // Frames sent before the device saw our first message are version 1
+    uint8_t crc = type_message->header.type & HEADER_V2
+                      ? crc8Message(&type_message->header)
+                      : triggerCrc(type_message->value,
+                                   type_message->header.length);
+    if (crc != type_message->header.crc) {
+        _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint8_t type = type_message->header.type & HEADER_TYPE_MASK;
+    if (type == TYPE_SEQUENCE) {
+        // counted once, as the frame it carries
+        _handleSequenced(frame, len, host_rx_ns);
+        return;
+    }
+    _stat_frames.fetch_add(1, std::memory_order_relaxed);
+
+    TriggerEvent *event;
+    switch (type) {
+    case TYPE_INPUTS: {
+        if (len != LENGTH_INPUT_STATE_MESSAGE) {
+            break;
+        }
+        const input_state_message *msg = (const input_state_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->input.uptime_us = msg->uptime_us;
+            event->input.pulse_id = msg->pulse_id;
+            event->input.inputs_state = msg->inputs_state;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_INPUTS_BATCH:
+        if (len >= MIN_LENGTH_INPUT_BATCH_MESSAGE) {
+            _handleBatch((const input_batch_message *)frame, len, host_rx_ns);
+        }
+        break;
+    case TYPE_INPUT_CAPTURE: {
+        if (len != LENGTH_INPUT_CAPTURE_MESSAGE) {
+            break;
+        }
+        const input_capture_message *msg = (const input_capture_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->capture.uptime_us = msg->uptime_us;
+            event->capture.pulse_id = msg->pulse_id;
+            event->capture.inputs_state = msg->inputs_state;
+            event->capture.input = msg->input;
+            event->capture.ticks = msg->ticks;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_SEGMENT: {
+        if (len != LENGTH_SEGMENT_MESSAGE) {
+            break;
+        }
+        const segment_message *msg = (const segment_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->segment.uptime_us = msg->uptime_us;
+            event->segment.pulse_id = msg->pulse_id;
+            event->segment.channel = msg->channel;
+            event->segment.segment = msg->segment;
+            event->segment.pass = msg->pass;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_TIMED: {
+        if (len != LENGTH_TIMED_REPLY_MESSAGE) {
+            break;
+        }
+        const timed_reply_message *msg = (const timed_reply_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->timed.applied_us = msg->applied_us;
+            event->timed.pulse_id = msg->pulse_id;
+            event->timed.id = msg->id;
+            event->timed.channel = msg->channel;
+            event->timed.status = msg->status;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_PATTERN: {
+        if (len != LENGTH_PATTERN_STATUS_MESSAGE) {
+            break;
+        }
+        const pattern_status_message *msg =
+            (const pattern_status_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->pattern.uptime_us = msg->uptime_us;
+            event->pattern.halves = msg->halves;
+            event->pattern.first = msg->first;
+            event->pattern.status = msg->status;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_BURST: {
+        if (len != LENGTH_BURST_REPLY_MESSAGE) {
+            break;
+        }
+        const burst_reply_message *msg = (const burst_reply_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->burst.uptime_us = msg->uptime_us;
+            event->burst.pulse_id = msg->pulse_id;
+            event->burst.latency_ns = msg->latency_ns;
+            event->burst.channel = msg->channel;
+            event->burst.input = msg->input;
+            event->burst.status = msg->status;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_ANALOG_SAMPLES:
+        if (len >= MIN_LENGTH_ANALOG_SAMPLES_MESSAGE) {
+            _handleAnalog((const analog_samples_message *)frame, len,
+                          host_rx_ns);
+        }
+        break;
+    case TYPE_INFO: {
+        if (len != LENGTH_INFO_MESSAGE && len != LENGTH_INFO_MESSAGE_V1) {
+            break;
+        }
+        const info_message *msg = (const info_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->info.cpu_hz = msg->cpu_hz;
+            event->info.output_skew_cycles = msg->output_skew_cycles;
+            event->info.output_ports = msg->output_ports;
+            // Firmware without input capture
+            event->info.capture_hz = 0;
+            event->info.capture_inputs = 0;
+            if (len == LENGTH_INFO_MESSAGE) {
+                event->info.capture_hz = msg->capture_hz;
+                event->info.capture_inputs = msg->capture_inputs;
+            }
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_STATS: {
+        if (len != LENGTH_STATS_MESSAGE) {
+            break;
+        }
+        const stats_message *msg = (const stats_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            struct trigger_device_stats_t *stats = &event->device_stats;
+            stats->elapsed_ms = msg->elapsed_ms;
+            stats->loop_count = msg->loop_count;
+            stats->loop_max_us = msg->loop_max_us;
+            stats->edge_count = msg->edge_count;
+            stats->edge_late_max_us = msg->edge_late_max_us;
+            stats->input_captures = msg->input_captures;
+            stats->input_edges = msg->input_edges;
+            stats->input_events = msg->input_events;
+            stats->input_lost = msg->input_lost;
+            stats->tx_frames = msg->tx_frames;
+            stats->tx_bytes = msg->tx_bytes;
+            stats->tx_dropped = msg->tx_dropped;
+            stats->rx_frames = msg->rx_frames;
+            memcpy(stats->rx_errors, msg->rx_errors, sizeof(msg->rx_errors));
+            stats->tx_free_min = msg->tx_free_min;
+            stats->input_high_water = msg->input_high_water;
+            stats->capture_high_water = msg->capture_high_water;
+            memcpy(stats->loop_histogram, msg->loop_histogram,
+                   sizeof(msg->loop_histogram));
+            memcpy(stats->edge_late_histogram, msg->edge_late_histogram,
+                   sizeof(msg->edge_late_histogram));
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_EVENT_OVERFLOW: {
+        if (len != LENGTH_EVENT_OVERFLOW_MESSAGE) {
+            break;
+        }
+        const event_overflow_message *msg =
+            (const event_overflow_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->overflow.lost_events = msg->lost_events;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_TIME_SYNC: {
+        if (len != LENGTH_TIME_SYNC_MESSAGE) {
+            break;
+        }
+        const time_sync_message *msg = (const time_sync_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->time_sync.host_tx = msg->host_tx;
+            event->time_sync.device_rx_us = msg->device_rx_us;
+            event->time_sync.device_tx_us = msg->device_tx_us;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_RESEND: {
+        if (len != LENGTH_RESEND_MESSAGE) {
+            break;
+        }
+        // Frames the device no longer held
+        const resend_message *msg = (const resend_message *)frame;
+        if (_sequence_on.load(std::memory_order_relaxed)) {
+            _restartSequence();
+            _skipGap(msg->first + msg->count, host_rx_ns);
+        }
+        break;
+    }
+    case TYPE_ACK:
+        _notifyReply(type);
+        break;
+    case TYPE_BAUD: {
+        if (len != LENGTH_BAUD_MESSAGE) {
+            break;
+        }
+        const baud_message *msg = (const baud_message *)frame;
+        if (msg->flags & BAUD_VERIFY) {
+            std::lock_guard<std::mutex> lock(_reply_mutex);
+            _baud_verified = msg->baudrate;
+            _reply_cv.notify_all();
+        }
+        break;
+    }
+    case TYPE_ERROR: {
+        if (len != LENGTH_ERROR_MESSAGE) {
+            break;
+        }
+        // reported to setup() and as event
+        _notifyReply(type);
+        const error_message *msg = (const error_message *)frame;
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->error.error_flags = msg->error_flags;
+            event->error.type = msg->type;
+            event->error.length = msg->length;
+            event->error.crc = msg->crc;
+            event->error.calc_crc = msg->calc_crc;
+            event->error.received_len = msg->received_len;
+            event->error.expected_len = msg->expected_len;
+            _endEvent();
+        }
+        break;
+    }
+    case TYPE_TXT:
+    case TYPE_ECHO:
+        if ((event = _beginEvent(type, host_rx_ns))) {
+            event->payload.length = type_message->header.length;
+            memcpy(event->payload.data, type_message->value,
+                   type_message->header.length);
+            _endEvent();
+        }
+        break;
+    }
+}
+
+void TriggerClient::_handleBatch(const input_batch_message *batch, size_t len,
+                                 uint64_t host_rx_ns) {
+    const uint8_t *cursor = batch->deltas;
+    const uint8_t *end = (const uint8_t *)batch + len;
+    uint32_t uptime_us = batch->uptime_us;
+    uint32_t pulse_id = batch->pulse_id;
+    uint8_t inputs_state = batch->inputs_state;
+    for (uint8_t i = 0; i < batch->count; i++) {
+        if (i) {
+            uint32_t d_uptime_us;
+            uint32_t d_pulse_id;
+            if (cursor >= end) {
+                _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            inputs_state = *cursor++;
+            if (!_readVarint(&cursor, end, &d_uptime_us) ||
+                !_readVarint(&cursor, end, &d_pulse_id)) {
+                _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            uptime_us += d_uptime_us;
+            pulse_id += d_pulse_id;
+        }
+        TriggerEvent *event = _beginEvent(TYPE_INPUTS, host_rx_ns);
+        if (event) {
+            event->input.uptime_us = uptime_us;
+            event->input.pulse_id = pulse_id;
+            event->input.inputs_state = inputs_state;
+            _endEvent();
+        }
+    }
+}
+
+void TriggerClient::_handleAnalog(const analog_samples_message *msg,
+                                  size_t len, uint64_t host_rx_ns) {
+    uint8_t count = __builtin_popcount(msg->pins);
+    if (!msg->divider ||
+        len != MIN_LENGTH_ANALOG_SAMPLES_MESSAGE +
+                   msg->count * count * sizeof(uint16_t)) {
+        _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t pulse_id = msg->pulse_id;
+    uint8_t index = msg->index;
+    for (uint8_t i = 0; i < msg->count; i++) {
+        TriggerEvent *event = _beginEvent(TYPE_ANALOG_SAMPLES, host_rx_ns);
+        if (event) {
+            event->analog.uptime_us = msg->uptime_us;
+            event->analog.pulse_id = pulse_id;
+            event->analog.sets = msg->sets;
+            event->analog.dropped = msg->dropped;
+            event->analog.channel = msg->channel;
+            event->analog.pins = msg->pins;
+            event->analog.index = index;
+            event->analog.divider = msg->divider;
+            event->analog.count = count;
+            memcpy(event->analog.values, msg->values + i * count,
+                   count * sizeof(uint16_t));
+            _endEvent();
+        }
+        // The sets of a frame follow each other
+        if (++index >= msg->divider) {
+            index = 0;
+            pulse_id++;
+        }
+    }
+}
+
+// ########################################################### Sequence numbers
+/// @brief Start over at sequence number 0 after sendSequence()
+void TriggerClient::_restartSequence() {
+    if (!_sequence_restart.exchange(false)) {
+        return;
+    }
+    _sequence_next = 0;
+    _sequence_rx_ns = 0;
+    memset(_held_len, 0, sizeof(_held_len));
+    _held_count = 0;
+    _resend_ns = 0;
+    _resend_tries = 0;
+    _probe_ns = 0;
+}
+
+void TriggerClient::_handleSequenced(uint8_t *frame, size_t len,
+                                     uint64_t host_rx_ns) {
+    if (len < MIN_LENGTH_SEQUENCED_MESSAGE + LENGTH_MSG_HEADER) {
+        _stat_bad_frames.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    sequenced_message *msg = (sequenced_message *)frame;
+    len -= MIN_LENGTH_SEQUENCED_MESSAGE;
+    if (!_sequence_on.load(std::memory_order_relaxed)) {
+        _handleFrame(msg->frame, len, host_rx_ns);
+        return;
+    }
+    _restartSequence();
+    uint16_t sequence = msg->sequence;
+    if ((int16_t)(sequence - _sequence_next) < 0) {
+        return; // resent after it arrived, or from before a restart
+    }
+    _sequence_rx_ns = host_rx_ns;
+    // The frames that do not fit the window any more are given up
+    if ((uint16_t)(sequence - _sequence_next) >=
+        TRIGGER_CLIENT_RESEND_WINDOW) {
+        _skipGap(sequence - TRIGGER_CLIENT_RESEND_WINDOW + 1, host_rx_ns);
+    }
+    if (sequence == _sequence_next) {
+        if (_held_count) {
+            _stat_resent_frames.fetch_add(1, std::memory_order_relaxed);
+        }
+        _sequence_next++;
+        _handleFrame(msg->frame, len, host_rx_ns);
+        _deliverHeld();
+        return;
+    }
+    uint16_t slot = TRIGGER_CLIENT_RESEND_SLOT(sequence);
+    if (_held_len[slot]) {
+        return; // resent twice
+    }
+    memcpy(&_held[slot * TRIGGER_CLIENT_MAX_FRAME_SIZE], msg->frame, len);
+    _held_len[slot] = len;
+    _held_rx_ns[slot] = host_rx_ns;
+    _held_count++;
+}
+
+/// @brief Hand on the held frames that follow without a gap
+void TriggerClient::_deliverHeld() {
+    while (_held_count) {
+        uint16_t slot = TRIGGER_CLIENT_RESEND_SLOT(_sequence_next);
+        size_t len = _held_len[slot];
+        if (!len) {
+            break;
+        }
+        _held_len[slot] = 0;
+        _held_count--;
+        _sequence_next++;
+        _handleFrame(&_held[slot * TRIGGER_CLIENT_MAX_FRAME_SIZE], len,
+                     _held_rx_ns[slot]);
+    }
+}
+
+/// @brief Give up the missing frames before end, each run of them is
+/// reported in a TYPE_RESEND event, and hand on the held ones
+void TriggerClient::_skipGap(uint16_t end, uint64_t host_rx_ns) {
+    while ((int16_t)(end - _sequence_next) > 0) {
+        uint16_t first = _sequence_next;
+        while ((int16_t)(end - _sequence_next) > 0 &&
+               !_held_len[TRIGGER_CLIENT_RESEND_SLOT(_sequence_next)]) {
+            _sequence_next++;
+        }
+        uint16_t count = _sequence_next - first;
+        if (count) {
+            _stat_lost_frames.fetch_add(count, std::memory_order_relaxed);
+            TriggerEvent *event = _beginEvent(TYPE_RESEND, host_rx_ns);
+            if (event) {
+                event->resend.first = first;
+                event->resend.count = count;
+                _endEvent();
+            }
+        }
+        _deliverHeld();
+    }
+}
+
+/// @brief Ask for the first gap, up to the oldest frame held after it
+void TriggerClient::_requestResend(uint64_t now_ns) {
+    uint16_t end = _sequence_next;
+    while (!_held_len[TRIGGER_CLIENT_RESEND_SLOT(end)]) {
+        end++;
+    }
+    if (sendResend(_sequence_next, end - _sequence_next)) {
+        _stat_resend_requests.fetch_add(1, std::memory_order_relaxed);
+    }
+    _resend_ns = now_ns;
+    _resend_end = end;
+    _resend_tries++;
+}
+
+/// @brief Request gaps, repeat requests that were not served and give up
+/// after TRIGGER_CLIENT_RESEND_TRIES, called from the reader loop
+void TriggerClient::_checkResend(uint64_t now_ns) {
+    if (!_sequence_on.load(std::memory_order_relaxed)) {
+        return;
+    }
+    _restartSequence();
+    if (_resend_ns && (int16_t)(_sequence_next - _resend_end) >= 0) {
+        _resend_ns = 0; // the gap is closed
+        _resend_tries = 0;
+    }
+    if (_resend_ns &&
+        now_ns - _resend_ns >= TRIGGER_CLIENT_RESEND_MS * 1000000ULL) {
+        _resend_ns = 0;
+        if (_resend_tries >= TRIGGER_CLIENT_RESEND_TRIES) {
+            _resend_tries = 0;
+            _skipGap(_resend_end, now_ns);
+        }
+    }
+    if (_held_count) {
+        if (!_resend_ns) {
+            _requestResend(now_ns);
+        }
+        return;
+    }
+    // Once per quiet time; the device ignores a request for a frame it has
+    // not sent yet
+    if (_probe_ns < _sequence_rx_ns &&
+        now_ns - _sequence_rx_ns >= TRIGGER_CLIENT_PROBE_MS * 1000000ULL) {
+        _probe_ns = now_ns;
+        sendResend(_sequence_next, 1);
+    }
+}
+
+void TriggerClient::_notifyReply(uint8_t type) {
+    std::lock_guard<std::mutex> lock(_reply_mutex);
+    if (type == TYPE_ACK) {
+        _acks++;
+    } else {
+        _errors++;
+    }
+    _reply_cv.notify_all();
+}
+
+// ############################################################### Receive side
+bool TriggerClient::poll(TriggerEvent *event) {
+    const TriggerEvent *front = _queue.front();
+    if (!front) {
+        return false;
+    }
+    *event = *front;
+    _queue.pop();
+    return true;
+}
+
+bool TriggerClient::wait(TriggerEvent *event,
+                         std::chrono::milliseconds timeout) {
+    if (poll(event)) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(_wait_mutex);
+    _waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ready = _wait_cv.wait_for(
+        lock, timeout, [this] { return _queue.front() != nullptr; });
+    _waiters.fetch_sub(1, std::memory_order_relaxed);
+    lock.unlock();
+    return ready && poll(event);
+}
+
+size_t TriggerClient::dispatch(EventHandler handler, void *context) {
+    size_t handled = 0;
+    const TriggerEvent *event;
+    while ((event = _queue.front())) {
+        handler(*event, context);
+        _queue.pop();
+        handled++;
+    }
+    return handled;
+}
+
+void TriggerClient::setNotify(NotifyFunction notify, void *context) {
+    _notify = notify;
+    _notify_context = context;
+}
+
+TriggerClientStats TriggerClient::getStats() const {
+    TriggerClientStats stats;
+    stats.bytes = _stat_bytes.load(std::memory_order_relaxed);
+    stats.frames = _stat_frames.load(std::memory_order_relaxed);
+    stats.events = _stat_events.load(std::memory_order_relaxed);
+    stats.dropped_events =
+        _stat_dropped_events.load(std::memory_order_relaxed);
+    stats.bad_frames = _stat_bad_frames.load(std::memory_order_relaxed);
+    stats.resend_requests =
+        _stat_resend_requests.load(std::memory_order_relaxed);
+    stats.resent_frames = _stat_resent_frames.load(std::memory_order_relaxed);
+    stats.lost_frames = _stat_lost_frames.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// ################################################################## Send side
+bool TriggerClient::sendMessage(uint8_t type, const void *payload,
+                                uint8_t length) {
+    uint8_t msg[TRIGGER_CLIENT_MAX_FRAME_SIZE];
+    uint8_t encoded[COBS_ENCODED_SIZE(TRIGGER_CLIENT_MAX_FRAME_SIZE) + 1];
+    msg_header *header = (msg_header *)msg;
+    header->type = type | HEADER_V2;
+    header->length = length;
+    if (length) {
+        memcpy(msg + LENGTH_MSG_HEADER, payload, length);
+    }
+    header->crc = crc8Message(header);
+    size_t encoded_len =
+        cobsEncode(msg, LENGTH_MSG_HEADER + length, encoded);
+    encoded[encoded_len++] = 0;
+
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    if (_fd < 0) {
+        return false;
+    }
+    size_t written = 0;
+    while (written < encoded_len) {
+        ssize_t len = ::write(_fd, encoded + written, encoded_len - written);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return false;
+        }
+        written += len;
+    }
+    return true;
+}
+
+bool TriggerClient::sendSetup(const TriggerSetup &setup) {
+    setup_message msg;
+    memset(&msg, 0, sizeof(msg));
+    // pulse_hz for firmware that does not know pulse_millihz yet
+    uint32_t pulse_hz = setup.pulse_millihz / MILLIHZ_PER_HZ;
+    msg.pulse_hz = pulse_hz > 0xFF ? 0xFF : pulse_hz;
+    msg.pulse_limit = setup.pulse_limit;
+    msg.delay_us = setup.delay_us;
+    msg.flags = setup.flags;
+    msg.pulse_millihz = setup.pulse_millihz;
+    msg.high_us = setup.high_us;
+    // Without a width firmware that does not know high_us takes it as well
+    size_t length = setup.high_us ? LENGTH_SETUP_MESSAGE
+                                  : LENGTH_SETUP_MESSAGE_V2;
+    return sendMessage(TYPE_SETUP, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       length - LENGTH_MSG_HEADER);
+}
+
+template <typename Sender>
+bool TriggerClient::_sendAndWaitAck(Sender send,
+                                    std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(_reply_mutex);
+    uint64_t acks = _acks;
+    uint64_t errors = _errors;
+    lock.unlock();
+    if (!send()) {
+        return false;
+    }
+    lock.lock();
+    _reply_cv.wait_for(lock, timeout, [&] {
+        return _acks != acks || _errors != errors;
+    });
+    return _acks != acks && _errors == errors;
+}
+
+bool TriggerClient::setup(const TriggerSetup &setup,
+                          std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendSetup(setup); }, timeout);
+}
+
+bool TriggerClient::sendChannelSetup(const TriggerChannelSetup &setup) {
+    channel_setup_message msg;
+    msg.channel = setup.channel;
+    msg.outputs = setup.outputs;
+    msg.inputs = setup.inputs;
+    msg.pulse_millihz = setup.pulse_millihz;
+    msg.phase_us = setup.phase_us;
+    msg.pulse_limit = setup.pulse_limit;
+    msg.flags = setup.flags;
+    msg.high_us = setup.high_us;
+    return sendMessage(TYPE_CHANNEL_SETUP,
+                       (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_CHANNEL_SETUP_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::channelSetup(const TriggerChannelSetup &setup,
+                                 std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendChannelSetup(setup); }, timeout);
+}
+
+bool TriggerClient::sendCascade(const TriggerCascadeSetup &setup) {
+    cascade_message msg;
+    msg.channel = setup.channel;
+    msg.clock_input = setup.clock_input;
+    msg.sync_input = setup.sync_input;
+    msg.sync_outputs = setup.sync_outputs;
+    return sendMessage(TYPE_CASCADE, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_CASCADE_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::cascade(const TriggerCascadeSetup &setup,
+                            std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendCascade(setup); }, timeout);
+}
+
+bool TriggerClient::sendBurst(const TriggerBurst &burst) {
+    burst_message msg;
+    msg.channel = burst.channel;
+    msg.input = burst.input;
+    msg.flags = burst.flags;
+    msg.pulse_count = burst.pulse_count;
+    msg.pulse_millihz = burst.pulse_millihz;
+    msg.high_us = burst.high_us;
+    return sendMessage(TYPE_BURST, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_BURST_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::burst(const TriggerBurst &burst,
+                          std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendBurst(burst); }, timeout);
+}
+
+bool TriggerClient::sendAnalog(const TriggerAnalogSetup &setup) {
+    analog_message msg;
+    msg.channel = setup.channel;
+    msg.pins = setup.pins;
+    msg.divider = setup.divider;
+    msg.max_latency_us = setup.max_latency_us;
+    return sendMessage(TYPE_ANALOG, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_ANALOG_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::analog(const TriggerAnalogSetup &setup,
+                           std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendAnalog(setup); }, timeout);
+}
+
+bool TriggerClient::sendSchedule(const TriggerSchedule &schedule,
+                                 uint8_t first, uint8_t count) {
+    if (count > SCHEDULE_MESSAGE_MAX_SEGMENTS ||
+        first + count > schedule.segments.size() ||
+        schedule.segments.size() > 0xFF) {
+        return false;
+    }
+    uint8_t buffer[TRIGGER_CLIENT_MAX_FRAME_SIZE];
+    schedule_message *msg = (schedule_message *)buffer;
+    msg->channel = schedule.channel;
+    msg->flags = schedule.flags;
+    msg->repeat = schedule.repeat;
+    msg->first = first;
+    msg->count = count;
+    msg->total = schedule.segments.size();
+    for (uint8_t i = 0; i < count; i++) {
+        const TriggerScheduleSegment &segment = schedule.segments[first + i];
+        msg->segments[i].pulse_millihz = segment.pulse_millihz;
+        msg->segments[i].pulse_count = segment.pulse_count;
+        msg->segments[i].gap_us = segment.gap_us;
+        msg->segments[i].high_us = segment.high_us;
+        msg->segments[i].flags = segment.flags;
+    }
+    return sendMessage(TYPE_SCHEDULE, buffer + LENGTH_MSG_HEADER,
+                       MIN_LENGTH_SCHEDULE_MESSAGE - LENGTH_MSG_HEADER +
+                           count * LENGTH_SCHEDULE_SEGMENT);
+}
+
+bool TriggerClient::schedule(const TriggerSchedule &schedule,
+                             std::chrono::milliseconds timeout) {
+    size_t total = schedule.segments.size();
+    if (!total) {
+        return false;
+    }
+    for (size_t first = 0; first < total;
+         first += SCHEDULE_MESSAGE_MAX_SEGMENTS) {
+        size_t count = total - first;
+        if (count > SCHEDULE_MESSAGE_MAX_SEGMENTS) {
+            count = SCHEDULE_MESSAGE_MAX_SEGMENTS;
+        }
+        if (!_sendAndWaitAck(
+                [&] { return sendSchedule(schedule, first, count); },
+                timeout)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TriggerClient::sendTimed(const TriggerTimedCommand &command) {
+    timed_message msg;
+    msg.id = command.id;
+    msg.channel = command.channel;
+    msg.action = command.action;
+    msg.trigger = command.trigger;
+    msg.at = command.at;
+    msg.pulse_millihz = command.pulse_millihz;
+    msg.pulse_limit = command.pulse_limit;
+    msg.high_us = command.high_us;
+    msg.flags = command.flags;
+    return sendMessage(TYPE_TIMED, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_TIMED_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::timed(const TriggerTimedCommand &command,
+                          std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendTimed(command); }, timeout);
+}
+
+bool TriggerClient::sendPattern(uint8_t action, const TriggerPattern &pattern,
+                                uint16_t first, uint8_t count) {
+    if (count > PATTERN_MESSAGE_MAX_STEPS ||
+        first + count > pattern.steps.size() ||
+        pattern.steps.size() > 0xFFFF) {
+        return false;
+    }
+    uint8_t buffer[TRIGGER_CLIENT_MAX_FRAME_SIZE];
+    pattern_message *msg = (pattern_message *)buffer;
+    msg->action = action;
+    msg->flags = pattern.flags;
+    msg->first = first;
+    msg->count = count;
+    msg->length = pattern.steps.size();
+    msg->outputs = pattern.outputs;
+    msg->tick_ns = pattern.tick_ns;
+    if (count) {
+        memcpy(msg->steps, &pattern.steps[first], count * sizeof(uint16_t));
+    }
+    return sendMessage(TYPE_PATTERN, buffer + LENGTH_MSG_HEADER,
+                       MIN_LENGTH_PATTERN_MESSAGE - LENGTH_MSG_HEADER +
+                           count * sizeof(uint16_t));
+}
+
+bool TriggerClient::startPattern(const TriggerPattern &pattern,
+                                 std::chrono::milliseconds timeout) {
+    size_t total = pattern.steps.size();
+    if (!total || !stopPattern(timeout)) {
+        return false;
+    }
+    // The rest first, the start carries the first piece
+    size_t count = total < PATTERN_MESSAGE_MAX_STEPS
+                       ? total
+                       : PATTERN_MESSAGE_MAX_STEPS;
+    if (!loadPattern(pattern, count, total - count, timeout)) {
+        return false;
+    }
+    return _sendAndWaitAck(
+        [&] { return sendPattern(PATTERN_START, pattern, 0, count); },
+        timeout);
+}
+
+bool TriggerClient::loadPattern(const TriggerPattern &pattern, uint16_t first,
+                                uint16_t count,
+                                std::chrono::milliseconds timeout) {
+    for (size_t done = 0; done < count; done += PATTERN_MESSAGE_MAX_STEPS) {
+        size_t piece = count - done;
+        if (piece > PATTERN_MESSAGE_MAX_STEPS) {
+            piece = PATTERN_MESSAGE_MAX_STEPS;
+        }
+        if (!_sendAndWaitAck(
+                [&] {
+                    return sendPattern(PATTERN_LOAD, pattern, first + done,
+                                       piece);
+                },
+                timeout)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TriggerClient::stopPattern(std::chrono::milliseconds timeout) {
+    TriggerPattern pattern;
+    return _sendAndWaitAck(
+        [&] { return sendPattern(PATTERN_STOP, pattern, 0, 0); }, timeout);
+}
+
+bool TriggerClient::sendBatchConfig(uint8_t max_bytes,
+                                    uint32_t max_latency_us) {
+    batch_config_message msg;
+    msg.max_bytes = max_bytes;
+    msg.max_latency_us = max_latency_us;
+    return sendMessage(TYPE_BATCH_CONFIG, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_BATCH_CONFIG_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::sendSequence(bool on) {
+    sequence_message msg;
+    msg.flags = on ? SEQUENCE_ON : 0;
+    // the device numbers from 0 again
+    _sequence_restart = true;
+    _sequence_on = on;
+    return sendMessage(TYPE_SEQUENCE, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_SEQUENCE_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::sequence(bool on, std::chrono::milliseconds timeout) {
+    return _sendAndWaitAck([&] { return sendSequence(on); }, timeout);
+}
+
+bool TriggerClient::sendResend(uint16_t first, uint16_t count) {
+    resend_message msg;
+    msg.first = first;
+    msg.count = count;
+    return sendMessage(TYPE_RESEND, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_RESEND_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::sendInfoRequest() {
+    return sendMessage(TYPE_INFO, nullptr, 0);
+}
+
+bool TriggerClient::sendStatsRequest(bool reset) {
+    stats_request_message msg;
+    msg.flags = reset ? STATS_RESET : 0;
+    return sendMessage(TYPE_STATS, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_STATS_REQUEST_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::sendTimeSync(uint64_t host_tx) {
+    time_sync_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.host_tx = host_tx;
+    return sendMessage(TYPE_TIME_SYNC, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_TIME_SYNC_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+// ####################################################################### Link
+bool TriggerClient::_setSpeed(uint32_t baudrate) {
+    speed_t speed;
+    if (!_baudrateToSpeed(baudrate, &speed)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_write_mutex);
+    struct termios tty;
+    if (_fd < 0 || tcgetattr(_fd, &tty) != 0) {
+        return false;
+    }
+    // Everything written so far still goes out at the old rate
+    tcdrain(_fd);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(_fd, TCSANOW, &tty) != 0) {
+        return false;
+    }
+    _baudrate = baudrate;
+    return true;
+}
+
+bool TriggerClient::sendBaudRequest(uint32_t baudrate) {
+    baud_message msg;
+    msg.baudrate = baudrate;
+    msg.flags = 0;
+    return sendMessage(TYPE_BAUD, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                       LENGTH_BAUD_MESSAGE - LENGTH_MSG_HEADER);
+}
+
+bool TriggerClient::setBaudrate(uint32_t baudrate,
+                                std::chrono::milliseconds timeout) {
+    speed_t speed;
+    if (!_baudrateToSpeed(baudrate, &speed)) {
+        return false;
+    }
+    uint32_t old_baudrate = _baudrate;
+    if (!_sendAndWaitAck([&] { return sendBaudRequest(baudrate); },
+                         timeout)) {
+        // Device stays at the old rate
+        return false;
+    }
+    auto acked = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(_reply_mutex);
+        _baud_verified = 0;
+    }
+    if (!_setSpeed(baudrate)) {
+        return false;
+    }
+
+    // The device switches once its ack is out and loop() comes by. Verifies
+    // that arrive before are garbage to it, so repeat them. Stop well before
+    // the device gives up: a verify it answers keeps it at the new rate.
+    auto deadline =
+        acked + std::min(timeout, std::chrono::milliseconds(
+                                      BAUD_VERIFY_TIMEOUT_MS / 2));
+    baud_message msg;
+    msg.baudrate = baudrate;
+    msg.flags = BAUD_VERIFY;
+    bool verified = false;
+    while (!verified && std::chrono::steady_clock::now() < deadline) {
+        if (!sendMessage(TYPE_BAUD, (uint8_t *)&msg + LENGTH_MSG_HEADER,
+                         LENGTH_BAUD_MESSAGE - LENGTH_MSG_HEADER)) {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(_reply_mutex);
+        verified = _reply_cv.wait_for(
+            lock, std::chrono::milliseconds(TRIGGER_CLIENT_BAUD_RETRY_MS),
+            [&] { return _baud_verified == baudrate; });
+    }
+    if (verified) {
+        return true;
+    }
+    // The device falls back on its own after the verify timeout
+    _setSpeed(old_baudrate);
+    std::this_thread::sleep_until(
+        acked + std::chrono::milliseconds(BAUD_VERIFY_TIMEOUT_MS +
+                                          TRIGGER_CLIENT_BAUD_RETRY_MS));
+    return false;
+}
+
+bool TriggerClient::benchmark(uint32_t count, uint8_t payload_len,
+                              uint32_t window,
+                              std::chrono::milliseconds timeout,
+                              TriggerBenchmark *result) {
+    memset(result, 0, sizeof(*result));
+    if (payload_len < TRIGGER_CLIENT_BENCHMARK_MIN_PAYLOAD || !window ||
+        _fd < 0) {
+        return false;
+    }
+    uint8_t payload[TRIGGER_CLIENT_MAX_PAYLOAD_SIZE];
+    memset(payload, 0x55, sizeof(payload));
+    std::vector<uint8_t> seen(count, false);
+    uint64_t bad_frames = _stat_bad_frames.load(std::memory_order_relaxed);
+    uint64_t rtt_sum_ns = 0;
+    uint64_t rtt_min_ns = UINT64_MAX;
+    uint64_t rtt_max_ns = 0;
+    uint32_t in_flight = 0;
+    uint64_t start_ns = _steadyNs();
+
+    while (true) {
+        while (result->sent < count && in_flight < window) {
+            // Sequence number and send time, echoed back unchanged
+            uint64_t host_tx_ns = _steadyNs();
+            memcpy(payload, &result->sent, sizeof(result->sent));
+            memcpy(payload + sizeof(result->sent), &host_tx_ns,
+                   sizeof(host_tx_ns));
+            if (!sendMessage(TYPE_ECHO, payload, payload_len)) {
+                return false;
+            }
+            result->sent++;
+            in_flight++;
+        }
+        if (!in_flight) {
+            break;
+        }
+        TriggerEvent event;
+        if (!wait(&event, timeout)) {
+            // The frames in flight are lost, late ones are ignored
+            in_flight = 0;
+            continue;
+        }
+        if (event.type != TYPE_ECHO || event.payload.length != payload_len) {
+            continue;
+        }
+        uint32_t seq;
+        uint64_t host_tx_ns;
+        memcpy(&seq, event.payload.data, sizeof(seq));
+        memcpy(&host_tx_ns, event.payload.data + sizeof(seq),
+               sizeof(host_tx_ns));
+        if (seq >= result->sent || seen[seq]) {
+            continue;
+        }
+        seen[seq] = true;
+        result->received++;
+        if (in_flight) {
+            in_flight--;
+        }
+        uint64_t rtt_ns = event.host_rx_ns - host_tx_ns;
+        rtt_sum_ns += rtt_ns;
+        rtt_min_ns = std::min(rtt_min_ns, rtt_ns);
+        rtt_max_ns = std::max(rtt_max_ns, rtt_ns);
+    }
+
+    double elapsed_s = (_steadyNs() - start_ns) / 1e9;
+    result->lost = result->sent - result->received;
+    result->bad_frames =
+        _stat_bad_frames.load(std::memory_order_relaxed) - bad_frames;
+    if (result->received) {
+        result->rtt_min_us = rtt_min_ns / 1e3;
+        result->rtt_mean_us = rtt_sum_ns / 1e3 / result->received;
+        result->rtt_max_us = rtt_max_ns / 1e3;
+    }
+    if (elapsed_s > 0) {
+        // COBS adds one byte below 254, plus the marker, both directions
+        size_t wire_len = LENGTH_MSG_HEADER + payload_len + 2;
+        result->frames_per_s = result->received / elapsed_s;
+        result->bytes_per_s = 2.0 * wire_len * result->received / elapsed_s;
+    }
+    return true;
+}
@@ -0,0 +1,262 @@
+/*******************************************************************************
+ * File:        trigger_merger.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "trigger_merger.h"
+
+#include <algorithm>
+#include <time.h>
+
+static uint64_t _steadyNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+TriggerMerger::TriggerMerger(std::chrono::microseconds max_latency,
+                             size_t queue_size)
+    : _max_latency(max_latency), _queue_size(queue_size) {}
+
+TriggerMerger::~TriggerMerger() { close(); }
+
+int TriggerMerger::open(const char *path, uint32_t baudrate) {
+    if (_sources.size() > UINT8_MAX) {
+        return -1;
+    }
+    Source source;
+    source.client.reset(new TriggerClient(_queue_size));
+    source.client->setNotify(&TriggerMerger::_notify, this);
+    if (!source.client->open(path, baudrate)) {
+        return -1;
+    }
+    _sources.push_back(std::move(source));
+    _heap.reserve(_sources.size());
+    return _sources.size() - 1;
+}
+
+void TriggerMerger::close() {
+    for (Source &source : _sources) {
+        source.client->close();
+    }
+}
+
+void TriggerMerger::setOffset(uint8_t device, int64_t offset_us) {
+    _sources[device].offset_us = offset_us;
+}
+
+int64_t TriggerMerger::getOffset(uint8_t device) const {
+    return _sources[device].offset_us;
+}
+
+bool TriggerMerger::sendTimeSync() {
+    bool sent = true;
+    for (Source &source : _sources) {
+        source.sync_host_tx = _steadyNs();
+        sent &= source.client->sendTimeSync(source.sync_host_tx);
+    }
+    return sent;
+}
+
+void TriggerMerger::_notify(void *context) {
+    TriggerMerger *merger = (TriggerMerger *)context;
+    merger->_notified.store(true, std::memory_order_relaxed);
+    // pairs with the fence in wait(), either the waiter sees the flag or the
+    // reader sees the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (merger->_waiters.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(merger->_wait_mutex);
+        merger->_wait_cv.notify_all();
+    }
+}
+
+// ###################################################################### Merge
+bool TriggerMerger::_later(const Head &a, const Head &b) {
+    return a.time_us != b.time_us ? a.time_us > b.time_us
+                                  : a.device > b.device;
+}
+
+/// @brief Device time of an event, false if it has none
+/// @param clock_us extended device time of the event before, if has_clock
+static bool _eventClockUs(const TriggerEvent &event, uint8_t has_clock,
+                          uint64_t clock_us, uint64_t *event_us) {
+    uint32_t uptime_us;
+    switch (event.type) {
+    case TYPE_INPUTS:
+        uptime_us = event.input.uptime_us;
+        break;
+    case TYPE_INPUT_CAPTURE:
+        uptime_us = event.capture.uptime_us;
+        break;
+    case TYPE_SEGMENT:
+        uptime_us = event.segment.uptime_us;
+        break;
+    case TYPE_PATTERN:
+        uptime_us = event.pattern.uptime_us;
+        break;
+    case TYPE_BURST:
+        uptime_us = event.burst.uptime_us;
+        break;
+    case TYPE_ANALOG_SAMPLES:
+        uptime_us = event.analog.uptime_us;
+        break;
+    case TYPE_TIMED:
+        *event_us = event.timed.applied_us;
+        return true;
+    default:
+        return false;
+    }
+    if (!has_clock) {
+        *event_us = uptime_us;
+        return true;
+    }
+    // The nearest time to the event before, in either direction
+    *event_us = clock_us + (int32_t)(uptime_us - (uint32_t)clock_us);
+    return true;
+}
+
+void TriggerMerger::_timeSync(Source *source, const TriggerEvent &event) {
+    // Time sync replies skip the device transmit queue, their time is no
+    // bound for the events behind them. They anchor the extension of
+    // uptime_us to the 64 bit device clock.
+    source->clock_us = event.time_sync.device_tx_us;
+    source->has_clock = true;
+    if (event.time_sync.host_tx != source->sync_host_tx) {
+        return; // not ours
+    }
+    int64_t host_us = (source->sync_host_tx + event.host_rx_ns) / 2000;
+    int64_t device_us =
+        (event.time_sync.device_rx_us + event.time_sync.device_tx_us) / 2;
+    source->offset_us = host_us - device_us;
+}
+
+void TriggerMerger::_take(uint8_t device) {
+    Source &source = _sources[device];
+    const TriggerEvent *event = source.client->front();
+    if (!event) {
+        return;
+    }
+    uint64_t event_us;
+    if (_eventClockUs(*event, source.has_clock, source.clock_us, &event_us)) {
+        source.clock_us = event_us;
+        source.has_clock = true;
+        source.time_us = (int64_t)event_us + source.offset_us;
+    } else if (event->type == TYPE_TIME_SYNC) {
+        _timeSync(&source, *event);
+    }
+    _heap.push_back({source.time_us, device});
+    std::push_heap(_heap.begin(), _heap.end(), &_later);
+    source.in_heap = true;
+}
+
+int TriggerMerger::_next() {
+    for (size_t i = 0; i < _sources.size(); i++) {
+        if (!_sources[i].in_heap) {
+            _take(i);
+        }
+    }
+    _timeout_ns = 0;
+    if (_heap.empty()) {
+        return -1;
+    }
+    const Head &top = _heap.front();
+    if (top.time_us == TRIGGER_MERGER_NO_TIME) {
+        // Before the first device time, anywhere is right
+        return top.device;
+    }
+    for (size_t i = 0; i < _sources.size(); i++) {
+        const Source &source = _sources[i];
+        // A device in the heap is at or after the top already
+        if (source.in_heap || !source.client->isOpen() ||
+            source.time_us >= top.time_us) {
+            continue;
+        }
+        // Silent device, wait for it up to max_latency after the read
+        uint64_t host_rx_ns = _sources[top.device].client->front()->host_rx_ns;
+        uint64_t timeout_ns =
+            host_rx_ns +
+            std::chrono::duration_cast<std::chrono::nanoseconds>(_max_latency)
+                .count();
+        if (_steadyNs() < timeout_ns) {
+            _timeout_ns = timeout_ns;
+            return -1;
+        }
+        _stats.timeouts++;
+        break;
+    }
+    return top.device;
+}
+
+int64_t TriggerMerger::_release(uint8_t device) {
+    std::pop_heap(_heap.begin(), _heap.end(), &_later);
+    _heap.pop_back();
+    _sources[device].in_heap = false;
+    int64_t time_us = _sources[device].time_us;
+    if (time_us < _last_us && time_us != TRIGGER_MERGER_NO_TIME) {
+        _stats.late++;
+    } else {
+        _last_us = time_us;
+    }
+    _stats.events++;
+    return time_us;
+}
+
+bool TriggerMerger::poll(TriggerMergedEvent *event) {
+    int device = _next();
+    if (device < 0) {
+        return false;
+    }
+    TriggerClient *client = _sources[device].client.get();
+    event->device = device;
+    event->time_us = _release(device);
+    event->event = *client->front();
+    client->pop();
+    return true;
+}
+
+bool TriggerMerger::wait(TriggerMergedEvent *event,
+                         std::chrono::milliseconds timeout) {
+    uint64_t deadline_ns =
+        _steadyNs() +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+    while (true) {
+        _notified.store(false, std::memory_order_relaxed);
+        if (poll(event)) {
+            return true;
+        }
+        uint64_t now_ns = _steadyNs();
+        if (now_ns >= deadline_ns) {
+            return false;
+        }
+        // Until new events are read or the blocked top is due
+        uint64_t wake_ns = deadline_ns;
+        if (_timeout_ns && _timeout_ns < wake_ns) {
+            wake_ns = _timeout_ns;
+        }
+        std::unique_lock<std::mutex> lock(_wait_mutex);
+        _waiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _wait_cv.wait_for(
+            lock, std::chrono::nanoseconds(wake_ns > now_ns ? wake_ns - now_ns
+                                                            : 0),
+            [this] { return _notified.load(std::memory_order_relaxed); });
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+size_t TriggerMerger::dispatch(EventHandler handler, void *context) {
+    size_t handled = 0;
+    int device;
+    while ((device = _next()) >= 0) {
+        TriggerClient *client = _sources[device].client.get();
+        int64_t time_us = _release(device);
+        handler(*client->front(), device, time_us, context);
+        client->pop();
+        handled++;
+    }
+    return handled;
+}
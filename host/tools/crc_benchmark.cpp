@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * File:        crc_benchmark.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+// Throughput of the message checksums on the build machine: the version 1
+// byte sum, the version 2 table driven CRC-8 and, for reference, the same
+// CRC-8 computed bit by bit. Numbers are relative; on an AVR every table
+// lookup is an extra flash read (pgm_read_byte, 3 cycles).
+//
+//   crc_benchmark [megabytes]
+
+#include "crc8.h"
+#include "trigger_client.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCHMARK_DEFAULT_MB 256
+
+// Results go here, so the compiler cannot drop the loops
+static volatile uint8_t _sink;
+
+static uint8_t _crc8Bitwise(const uint8_t *buffer, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= buffer[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ CRC8_POLYNOMIAL
+                             : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static uint8_t _crc8Table(const uint8_t *buffer, size_t len) {
+    return crc8(0, buffer, len);
+}
+
+/// @brief Run a checksum over frames of frame_len bytes
+/// @return bytes per microsecond
+template <typename Checksum>
+static double _measure(Checksum checksum, const uint8_t *data,
+                       size_t frame_len, size_t total_bytes) {
+    size_t frames = total_bytes / frame_len;
+    uint8_t result = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < frames; i++) {
+        // The frame start moves, so the loop cannot be hoisted
+        result ^= checksum(data + (i & 0xFF), frame_len);
+    }
+    double elapsed_us = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+    _sink ^= result;
+    return frames * frame_len / elapsed_us;
+}
+
+int main(int argc, char **argv) {
+    size_t total_bytes = (size_t)BENCHMARK_DEFAULT_MB << 20;
+    if (argc > 1) {
+        total_bytes = strtoul(argv[1], nullptr, 0) << 20;
+    }
+
+    uint8_t data[2 * 0xFF + 0x100];
+    uint32_t random = 1;
+    for (size_t i = 0; i < sizeof(data); i++) {
+        random = random * 1103515245 + 12345;
+        data[i] = random >> 16;
+    }
+    // Both crc implementations have to agree
+    for (size_t len = 0; len <= 0xFF; len++) {
+        if (_crc8Bitwise(data, len) != _crc8Table(data, len)) {
+            printf("crc8 table mismatch at length %zu\n", len);
+            return 1;
+        }
+    }
+
+    // Sizes of an input event, a time sync reply and full batches
+    static const size_t frame_lengths[] = {9, 24, 64, 252};
+    printf("%-10s %14s %14s %14s\n", "frame", "sum", "crc8 table",
+           "crc8 bitwise");
+    for (size_t frame_len : frame_lengths) {
+        printf("%4zu bytes %9.0f B/us %9.0f B/us %9.0f B/us\n", frame_len,
+               _measure(&triggerCrc, data, frame_len, total_bytes),
+               _measure(&_crc8Table, data, frame_len, total_bytes),
+               _measure(&_crc8Bitwise, data, frame_len, total_bytes / 8));
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+/*******************************************************************************
+ * File:        merge_benchmark.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+// Merge benchmark of TriggerMerger over Linux pseudo terminals.
+//
+// One thread per device plays a board on a pty master and streams delta
+// encoded TYPE_INPUTS_BATCH frames. Every device starts its uptime_us at its
+// own point shortly before the 32 bit wrap, the merger gets the offsets that
+// map them onto one timebase. The device clocks run as fast as the host
+// merges, none gets more than a window ahead of the merged stream, like
+// boards that follow the same wall clock. The main thread checks that the
+// merged stream is in time order and every device stream complete and in
+// order, and reports the throughput and the time from the read of an event
+// to its merge.
+//
+//   merge_benchmark [devices] [events per device]
+
+#include "crc8.h"
+#include "trigger_merger.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MERGE_DEFAULT_DEVICES 8
+#define MERGE_MAX_DEVICES 64
+#define MERGE_DEFAULT_EVENTS 200000
+#define MERGE_MAX_BATCH 20
+#define MERGE_QUEUE_SIZE (1 << 14)
+// Device time a device may run ahead of the merged stream
+#define MERGE_WINDOW_US 100000
+// Device time before the wrap at the start, per device index + 1
+#define MERGE_WRAP_STEP_US 20000000UL
+
+// ############################################################ Event generator
+struct merge_generator_t {
+    uint32_t random;
+    uint64_t time_us; // common timebase
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t inputs_state;
+};
+typedef struct merge_generator_t MergeGenerator;
+
+static uint32_t _startUptimeUs(uint8_t device) {
+    return 0xFFFFFFFFUL - (device + 1) * MERGE_WRAP_STEP_US;
+}
+
+static void _startGenerator(MergeGenerator *generator, uint8_t device) {
+    generator->random = device + 1;
+    generator->time_us = 0;
+    generator->uptime_us = _startUptimeUs(device);
+    generator->pulse_id = 0;
+    generator->inputs_state = 0;
+}
+
+static uint32_t _nextRandom(uint32_t *random) {
+    *random = *random * 1103515245 + 12345;
+    return *random >> 8;
+}
+
+static void _nextEvent(MergeGenerator *generator) {
+    uint32_t random = _nextRandom(&generator->random);
+    // half a millisecond apart on average
+    uint32_t step_us = random & 0x3FF;
+    generator->time_us += step_us;
+    generator->uptime_us += step_us;
+    generator->pulse_id += (random >> 12) & 1;
+    generator->inputs_state ^= 1 << (random & 7);
+}
+
+// #################################################################### Devices
+static uint8_t _num_devices = MERGE_DEFAULT_DEVICES;
+static uint32_t _num_events = MERGE_DEFAULT_EVENTS;
+static int _device_fds[MERGE_MAX_DEVICES];
+static std::atomic<int64_t> _merged_us{0}; // common time of the merge
+
+static uint8_t _writeVarint(uint8_t *buffer, uint32_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        buffer[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[len++] = value;
+    return len;
+}
+
+static void _deviceSend(int fd, uint8_t *msg, size_t len) {
+    uint8_t encoded[COBS_ENCODED_SIZE(TRIGGER_CLIENT_MAX_FRAME_SIZE) + 1];
+    msg_header *header = (msg_header *)msg;
+    header->type |= HEADER_V2;
+    header->length = len - LENGTH_MSG_HEADER;
+    header->crc = crc8Message(header);
+    size_t encoded_len = cobsEncode(msg, len, encoded);
+    encoded[encoded_len++] = 0;
+    size_t written = 0;
+    while (written < encoded_len) {
+        ssize_t ret = write(fd, encoded + written, encoded_len - written);
+        if (ret <= 0) {
+            return;
+        }
+        written += ret;
+    }
+}
+
+static void _deviceLoop(uint8_t device) {
+    MergeGenerator generator;
+    _startGenerator(&generator, device);
+    uint32_t batch_random = ~device;
+    uint32_t sent = 0;
+    while (sent < _num_events) {
+        while ((int64_t)generator.time_us >
+               _merged_us.load(std::memory_order_relaxed) + MERGE_WINDOW_US) {
+            usleep(100);
+        }
+        uint32_t count = _nextRandom(&batch_random) % MERGE_MAX_BATCH + 1;
+        if (count > _num_events - sent) {
+            count = _num_events - sent;
+        }
+        uint8_t buffer[TRIGGER_CLIENT_MAX_FRAME_SIZE];
+        input_batch_message *batch = (input_batch_message *)buffer;
+        _nextEvent(&generator);
+        batch->header.type = TYPE_INPUTS_BATCH;
+        batch->count = count;
+        batch->inputs_state = generator.inputs_state;
+        batch->uptime_us = generator.uptime_us;
+        batch->pulse_id = generator.pulse_id;
+        size_t len = MIN_LENGTH_INPUT_BATCH_MESSAGE;
+        for (uint32_t i = 1; i < count; i++) {
+            uint32_t uptime_us = generator.uptime_us;
+            uint32_t pulse_id = generator.pulse_id;
+            _nextEvent(&generator);
+            buffer[len++] = generator.inputs_state;
+            len += _writeVarint(buffer + len, generator.uptime_us - uptime_us);
+            len += _writeVarint(buffer + len, generator.pulse_id - pulse_id);
+        }
+        _deviceSend(_device_fds[device], buffer, len);
+        sent += count;
+    }
+}
+
+// ####################################################################### Host
+struct merge_check_t {
+    MergeGenerator expected[MERGE_MAX_DEVICES];
+    uint32_t received[MERGE_MAX_DEVICES];
+    uint64_t total;
+    uint64_t mismatches; // not the next event of its device
+    uint64_t out_of_order;
+    int64_t last_us;
+    double latency_sum_us;
+    double latency_max_us;
+};
+typedef struct merge_check_t MergeCheck;
+
+static uint64_t _steadyNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void _checkEvent(const TriggerEvent &event, uint8_t device,
+                        int64_t time_us, void *context) {
+    MergeCheck *check = (MergeCheck *)context;
+    double latency_us = (_steadyNs() - event.host_rx_ns) / 1e3;
+    check->latency_sum_us += latency_us;
+    if (latency_us > check->latency_max_us) {
+        check->latency_max_us = latency_us;
+    }
+    check->total++;
+    if (event.type != TYPE_INPUTS) {
+        check->mismatches++;
+        return;
+    }
+    if (time_us < check->last_us) {
+        check->out_of_order++;
+    } else {
+        check->last_us = time_us;
+    }
+    MergeGenerator *expected = &check->expected[device];
+    _nextEvent(expected);
+    if (time_us != (int64_t)expected->time_us ||
+        event.input.uptime_us != expected->uptime_us ||
+        event.input.pulse_id != expected->pulse_id ||
+        event.input.inputs_state != expected->inputs_state) {
+        check->mismatches++;
+    }
+    check->received[device]++;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        _num_devices = strtoul(argv[1], nullptr, 0);
+        if (!_num_devices || _num_devices > MERGE_MAX_DEVICES) {
+            printf("1 to %u devices\n", MERGE_MAX_DEVICES);
+            return 1;
+        }
+    }
+    if (argc > 2) {
+        _num_events = strtoul(argv[2], nullptr, 0);
+    }
+
+    TriggerMerger merger(
+        std::chrono::microseconds(TRIGGER_MERGER_DEFAULT_LATENCY_US),
+        MERGE_QUEUE_SIZE);
+    for (uint8_t i = 0; i < _num_devices; i++) {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+            perror("posix_openpt");
+            return 1;
+        }
+        struct termios tty;
+        tcgetattr(fd, &tty);
+        cfmakeraw(&tty);
+        tcsetattr(fd, TCSANOW, &tty);
+        _device_fds[i] = fd;
+        if (merger.open(ptsname(fd)) != i) {
+            perror("open");
+            return 1;
+        }
+        // device time 0 of the generator is common time 0
+        merger.setOffset(i, -(int64_t)_startUptimeUs(i));
+    }
+
+    static MergeCheck check = {};
+    check.last_us = INT64_MIN;
+    for (uint8_t i = 0; i < _num_devices; i++) {
+        _startGenerator(&check.expected[i], i);
+    }
+    std::vector<std::thread> devices;
+    auto start = std::chrono::steady_clock::now();
+    for (uint8_t i = 0; i < _num_devices; i++) {
+        devices.push_back(std::thread(&_deviceLoop, i));
+    }
+
+    uint64_t num_total = (uint64_t)_num_devices * _num_events;
+    TriggerMergedEvent event;
+    while (check.total < num_total) {
+        if (!merger.dispatch(&_checkEvent, &check)) {
+            if (!merger.wait(&event, std::chrono::milliseconds(1000))) {
+                break;
+            }
+            _checkEvent(event.event, event.device, event.time_us, &check);
+        }
+        _merged_us.store(check.last_us, std::memory_order_relaxed);
+    }
+    double elapsed_s = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    // release devices still held back by a lost event
+    _merged_us.store(INT64_MAX, std::memory_order_relaxed);
+    for (std::thread &device : devices) {
+        device.join();
+    }
+
+    TriggerMergerStats stats = merger.getStats();
+    uint64_t bytes = 0;
+    uint64_t dropped = 0;
+    uint64_t bad_frames = 0;
+    for (uint8_t i = 0; i < _num_devices; i++) {
+        TriggerClientStats client = merger.device(i).getStats();
+        bytes += client.bytes;
+        dropped += client.dropped_events;
+        bad_frames += client.bad_frames;
+    }
+    merger.close();
+    for (uint8_t i = 0; i < _num_devices; i++) {
+        close(_device_fds[i]);
+    }
+
+    printf("devices     %u\n", _num_devices);
+    printf("events      %llu of %llu, %llu mismatches\n",
+           (unsigned long long)check.total, (unsigned long long)num_total,
+           (unsigned long long)check.mismatches);
+    printf("order       %llu out of order, %llu late, %llu timeouts\n",
+           (unsigned long long)check.out_of_order,
+           (unsigned long long)stats.late,
+           (unsigned long long)stats.timeouts);
+    printf("frames      %llu bytes, %llu bad, %llu dropped\n",
+           (unsigned long long)bytes, (unsigned long long)bad_frames,
+           (unsigned long long)dropped);
+    printf("throughput  %.0f events/s, %.1f MB/s\n", check.total / elapsed_s,
+           bytes / elapsed_s / 1e6);
+    printf("latency     %.1f us mean, %.1f us max, read to merge\n",
+           check.total ? check.latency_sum_us / check.total : 0.0,
+           check.latency_max_us);
+    // Out of order events are fine as long as the merger counted them late,
+    // after a timeout
+    return check.total == num_total && !check.mismatches && !dropped &&
+                   !bad_frames && check.out_of_order == stats.late
+               ? 0
+               : 1;
+}
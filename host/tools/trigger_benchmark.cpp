@@ -0,0 +1,103 @@
+/*******************************************************************************
+ * File:        trigger_benchmark.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+// Link speed benchmark against a connected device.
+//
+// Measures echo round trips and throughput at the default rate, then
+// switches to every candidate rate with the TYPE_BAUD handshake and measures
+// again. A rate is reliable if the switch was verified and no frame was lost
+// or corrupted. The device is put back to the default rate at the end, the
+// fastest reliable rate is printed for the application to use.
+//
+//   trigger_benchmark <device> [baudrate ...]
+
+#include "trigger_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCHMARK_FRAMES 2000
+#define BENCHMARK_PAYLOAD 16
+// Two frames in flight fit into the 64 byte receive buffer of the Uno
+#define BENCHMARK_WINDOW 2
+#define BENCHMARK_TIMEOUT_MS 200
+#define BENCHMARK_SWITCH_TIMEOUT_MS 500
+
+static const uint32_t _default_rates[] = {230400, 460800,  500000,
+                                          921600, 1000000, 2000000};
+
+/// @brief Benchmark at the current rate and print one line
+/// @return true if every frame came back intact
+static bool _run(TriggerClient *client) {
+    TriggerBenchmark result;
+    if (!client->benchmark(BENCHMARK_FRAMES, BENCHMARK_PAYLOAD,
+                           BENCHMARK_WINDOW,
+                           std::chrono::milliseconds(BENCHMARK_TIMEOUT_MS),
+                           &result)) {
+        printf("%8u  benchmark failed\n", client->getBaudrate());
+        return false;
+    }
+    // 8N1, ten bits per byte and direction
+    double line_use = result.bytes_per_s / 2 * 10 / client->getBaudrate();
+    printf("%8u  rtt %7.1f / %7.1f / %7.1f us  %7.0f frames/s  %5.1f %% "
+           "line  %u lost  %llu bad\n",
+           client->getBaudrate(), result.rtt_min_us, result.rtt_mean_us,
+           result.rtt_max_us, result.frames_per_s, 100 * line_use,
+           result.lost, (unsigned long long)result.bad_frames);
+    return !result.lost && !result.bad_frames;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("usage: %s <device> [baudrate ...]\n", argv[0]);
+        return 1;
+    }
+    TriggerClient client;
+    if (!client.open(argv[1], BAUD_DEFAULT)) {
+        perror("open");
+        return 1;
+    }
+
+    printf("baudrate  rtt min / mean / max\n");
+    uint32_t best = 0;
+    if (_run(&client)) {
+        best = client.getBaudrate();
+    }
+    size_t num_rates = argc > 2 ? argc - 2
+                                : sizeof(_default_rates) /
+                                      sizeof(_default_rates[0]);
+    for (size_t i = 0; i < num_rates; i++) {
+        uint32_t baudrate = argc > 2 ? strtoul(argv[i + 2], nullptr, 0)
+                                     : _default_rates[i];
+        if (!client.setBaudrate(
+                baudrate,
+                std::chrono::milliseconds(BENCHMARK_SWITCH_TIMEOUT_MS))) {
+            printf("%8u  not verified, back at %u\n", baudrate,
+                   client.getBaudrate());
+            continue;
+        }
+        if (_run(&client) && baudrate > best) {
+            best = baudrate;
+        }
+    }
+
+    if (client.getBaudrate() != BAUD_DEFAULT &&
+        !client.setBaudrate(
+            BAUD_DEFAULT,
+            std::chrono::milliseconds(BENCHMARK_SWITCH_TIMEOUT_MS))) {
+        printf("could not return to %u\n", BAUD_DEFAULT);
+    }
+    client.close();
+    if (!best) {
+        printf("no reliable rate\n");
+        return 1;
+    }
+    printf("fastest reliable rate %u\n", best);
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*******************************************************************************
+ * File:        trigger_loopback.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+// Loopback check of TriggerClient over a Linux pseudo terminal.
+//
+// A thread plays the device on the pty master: it acknowledges the setup and
+// then streams input events as TYPE_INPUTS and delta encoded
+// TYPE_INPUTS_BATCH frames as fast as the pty takes them. The client opens
+// the pty slave like a serial port, the main thread checks every event
+// against the same generator and reports the throughput.
+//
+//   trigger_loopback [events]
+
+#include "crc8.h"
+#include "trigger_client.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define LOOPBACK_DEFAULT_EVENTS 1000000
+#define LOOPBACK_MAX_BATCH 20
+
+// ############################################################ Event generator
+struct loopback_generator_t {
+    uint32_t random;
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t inputs_state;
+};
+typedef struct loopback_generator_t LoopbackGenerator;
+
+static uint32_t _nextRandom(LoopbackGenerator *generator) {
+    generator->random = generator->random * 1103515245 + 12345;
+    return generator->random >> 8;
+}
+
+static void _nextEvent(LoopbackGenerator *generator) {
+    uint32_t random = _nextRandom(generator);
+    // mostly small steps, now and then a multi byte varint and a wrap
+    generator->uptime_us += random & 0x1000 ? random : random & 0x3FF;
+    generator->pulse_id += (random >> 12) & 1;
+    generator->inputs_state ^= 1 << (random & 7);
+}
+
+// ##################################################################### Device
+static int _device_fd = -1;
+static uint32_t _num_events = LOOPBACK_DEFAULT_EVENTS;
+static uint8_t _device_header_v2 = false;
+
+static uint8_t _writeVarint(uint8_t *buffer, uint32_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        buffer[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[len++] = value;
+    return len;
+}
+
+static void _deviceSend(uint8_t *msg, size_t len) {
+    uint8_t encoded[COBS_ENCODED_SIZE(TRIGGER_CLIENT_MAX_FRAME_SIZE) + 1];
+    msg_header *header = (msg_header *)msg;
+    header->length = len - LENGTH_MSG_HEADER;
+    if (_device_header_v2) {
+        header->type |= HEADER_V2;
+        header->crc = crc8Message(header);
+    } else {
+        header->crc = triggerCrc(msg + LENGTH_MSG_HEADER, header->length);
+    }
+    size_t encoded_len = cobsEncode(msg, len, encoded);
+    encoded[encoded_len++] = 0;
+    size_t written = 0;
+    while (written < encoded_len) {
+        ssize_t ret = write(_device_fd, encoded + written,
+                            encoded_len - written);
+        if (ret <= 0) {
+            return;
+        }
+        written += ret;
+    }
+}
+
+/// @brief Wait for the setup, acknowledge it and stream the events
+static void _deviceLoop() {
+    uint8_t frame[COBS_ENCODED_SIZE(TRIGGER_CLIENT_MAX_FRAME_SIZE)];
+    size_t frame_len = 0;
+    uint8_t byte;
+    while (read(_device_fd, &byte, 1) == 1) {
+        if (byte != 0) {
+            if (frame_len < sizeof(frame)) {
+                frame[frame_len++] = byte;
+            }
+            continue;
+        }
+        size_t len = cobsDecodeInPlace(frame, frame_len);
+        frame_len = 0;
+        if (len >= LENGTH_MSG_HEADER &&
+            (frame[0] & HEADER_TYPE_MASK) == TYPE_SETUP) {
+            // Answer in the header version of the host, as the firmware
+            _device_header_v2 = frame[0] & HEADER_V2;
+            break;
+        }
+    }
+    uint8_t ack[LENGTH_ACK_MESSAGE] = {TYPE_ACK};
+    _deviceSend(ack, sizeof(ack));
+
+    LoopbackGenerator generator = {1, 0, 0, 0};
+    uint32_t sent = 0;
+    while (sent < _num_events) {
+        uint32_t count = _nextRandom(&generator) % LOOPBACK_MAX_BATCH + 1;
+        if (count > _num_events - sent) {
+            count = _num_events - sent;
+        }
+        _nextEvent(&generator);
+        if (count == 1) {
+            input_state_message msg;
+            msg.header.type = TYPE_INPUTS;
+            msg.inputs_state = generator.inputs_state;
+            msg.uptime_us = generator.uptime_us;
+            msg.pulse_id = generator.pulse_id;
+            _deviceSend((uint8_t *)&msg, sizeof(msg));
+            sent++;
+            continue;
+        }
+        uint8_t buffer[TRIGGER_CLIENT_MAX_FRAME_SIZE];
+        input_batch_message *batch = (input_batch_message *)buffer;
+        batch->header.type = TYPE_INPUTS_BATCH;
+        batch->count = count;
+        batch->inputs_state = generator.inputs_state;
+        batch->uptime_us = generator.uptime_us;
+        batch->pulse_id = generator.pulse_id;
+        size_t len = MIN_LENGTH_INPUT_BATCH_MESSAGE;
+        for (uint32_t i = 1; i < count; i++) {
+            uint32_t uptime_us = generator.uptime_us;
+            uint32_t pulse_id = generator.pulse_id;
+            _nextEvent(&generator);
+            buffer[len++] = generator.inputs_state;
+            len += _writeVarint(buffer + len, generator.uptime_us - uptime_us);
+            len += _writeVarint(buffer + len, generator.pulse_id - pulse_id);
+        }
+        _deviceSend(buffer, len);
+        sent += count;
+    }
+}
+
+// ####################################################################### Host
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        _num_events = strtoul(argv[1], nullptr, 0);
+    }
+
+    _device_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (_device_fd < 0 || grantpt(_device_fd) || unlockpt(_device_fd)) {
+        perror("posix_openpt");
+        return 1;
+    }
+    struct termios tty;
+    tcgetattr(_device_fd, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(_device_fd, TCSANOW, &tty);
+
+    TriggerClient client(1 << 16);
+    if (!client.open(ptsname(_device_fd))) {
+        perror("open");
+        return 1;
+    }
+    std::thread device(&_deviceLoop);
+
+    TriggerSetup setup;
+    setup.pulse_millihz = 100 * MILLIHZ_PER_HZ;
+    if (!client.setup(setup, std::chrono::milliseconds(1000))) {
+        printf("setup not acknowledged\n");
+        return 1;
+    }
+
+    LoopbackGenerator expected = {1, 0, 0, 0};
+    uint32_t received = 0;
+    uint32_t mismatches = 0;
+    uint32_t batch_left = 0;
+    TriggerEvent event;
+    auto start = std::chrono::steady_clock::now();
+    while (received < _num_events &&
+           client.wait(&event, std::chrono::milliseconds(1000))) {
+        if (event.type != TYPE_INPUTS) {
+            continue;
+        }
+        // replay the device side draws to follow the batch boundaries
+        if (!batch_left) {
+            batch_left = _nextRandom(&expected) % LOOPBACK_MAX_BATCH + 1;
+        }
+        batch_left--;
+        _nextEvent(&expected);
+        if (event.input.uptime_us != expected.uptime_us ||
+            event.input.pulse_id != expected.pulse_id ||
+            event.input.inputs_state != expected.inputs_state) {
+            mismatches++;
+        }
+        received++;
+    }
+    double elapsed_s = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    device.join();
+
+    TriggerClientStats stats = client.getStats();
+    client.close();
+    close(_device_fd);
+
+    printf("events      %u of %u, %u mismatches\n", received, _num_events,
+           mismatches);
+    printf("frames      %llu, %llu bytes, %llu bad\n",
+           (unsigned long long)stats.frames, (unsigned long long)stats.bytes,
+           (unsigned long long)stats.bad_frames);
+    printf("dropped     %llu\n", (unsigned long long)stats.dropped_events);
+    printf("throughput  %.0f events/s, %.1f MB/s\n", received / elapsed_s,
+           stats.bytes / elapsed_s / 1e6);
+    return received == _num_events && !mismatches && !stats.dropped_events &&
+                   !stats.bad_frames
+               ? 0
+               : 1;
+}
@@ -0,0 +1,67 @@
+#ifndef _ANALOG_SAMPLER_H
+#define _ANALOG_SAMPLER_H
+
+#include "triggerpins_selector.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// Analog inputs AIN0..AIN7 converted in step with the pulses (TYPE_ANALOG).
+//
+// The pulse interrupt starts a set, one conversion of every selected input.
+// The conversions run on their own and chain from the conversion complete
+// interrupt, which hands the finished set over after its last value. Neither
+// the pulse interrupt nor loop() waits for the ADC, a set started while the
+// one before is still converting is dropped.
+//
+// ATmega328P: ADC at 500 kHz, 26 us per conversion
+// Teensy 4:   ADC1, 10 bit like analogRead(), about 3 us per conversion
+// Simulator:  the HAL models the conversion time and the input signals
+// Others:     no sampling, TYPE_ANALOG is NOT_IMPLEMENTED
+
+#define NUM_ANALOG_PINS 8
+
+constexpr int16_t ANALOG_PINS[NUM_ANALOG_PINS] = {
+    AIN00_PIN, AIN01_PIN, AIN02_PIN, AIN03_PIN,
+    AIN04_PIN, AIN05_PIN, AIN06_PIN, AIN07_PIN,
+};
+
+/// @brief AIN0..AIN7 bits of the analog inputs that exist on the board
+constexpr uint8_t validAnalogInputs(uint8_t i = 0) {
+    return i >= NUM_ANALOG_PINS
+               ? 0
+               : (ANALOG_PINS[i] >= 0 ? 1 << i : 0) | validAnalogInputs(i + 1);
+}
+
+#if defined(__AVR_ATmega328P__) || defined(__IMXRT1062__) ||                 \
+    defined(TRIGGER_SIM)
+#define ANALOG_SAMPLING 1
+#else
+#define ANALOG_SAMPLING 0
+#endif
+
+#if ANALOG_SAMPLING
+// Inputs per set, a set of 4 already takes 104 us on AVR
+#if defined(__AVR__)
+#define ANALOG_MAX_PINS 4
+#else
+#define ANALOG_MAX_PINS NUM_ANALOG_PINS
+#endif
+
+/// @brief Called from the conversion complete interrupt with a finished set
+/// @param values one per selected input, lowest input first
+/// @param count number of values
+typedef void (*AnalogSetHandler)(const uint16_t *values, uint8_t count);
+
+/// @brief Set the handler of finished sets and set up the ADC
+void analogSamplerBegin(AnalogSetHandler handler);
+/// @brief Inputs converted by the next sets, called from loop(). Waits for
+/// a set that is still converting.
+/// @param pins AIN0..AIN7 bits, at most ANALOG_MAX_PINS
+/// @return false if an input does not exist
+uint8_t analogSamplerSelect(uint8_t pins);
+/// @brief Start a set, called from interrupts
+/// @return false if the set before is still converting or none is selected
+uint8_t analogSamplerStart();
+#endif
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _CRC8_H
+#define _CRC8_H
+
+#include "serial_messages.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), initial value 0, no final xor.
+// Table driven, one lookup per byte. Shared with the host library, so this
+// header does not depend on Arduino.h.
+#define CRC8_POLYNOMIAL 0x07
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+// 256 bytes are an eighth of the RAM of an ATmega328, the table stays in
+// flash
+extern const uint8_t crc8_table[256] PROGMEM;
+#define CRC8_TABLE(index) pgm_read_byte(&crc8_table[index])
+#else
+extern const uint8_t crc8_table[256];
+#define CRC8_TABLE(index) crc8_table[index]
+#endif
+
+/// @brief Table entry, crc of one byte, shifted bit by bit at compile time
+constexpr uint8_t crc8Shift(uint8_t crc, uint8_t bits) {
+    return bits ? crc8Shift(crc & 0x80 ? (uint8_t)(crc << 1) ^ CRC8_POLYNOMIAL
+                                       : (uint8_t)(crc << 1),
+                            bits - 1)
+                : crc;
+}
+
+inline uint8_t crc8Update(uint8_t crc, uint8_t byte) {
+    return CRC8_TABLE(crc ^ byte);
+}
+
+inline uint8_t crc8(uint8_t crc, const uint8_t *buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc8Update(crc, buffer[i]);
+    }
+    return crc;
+}
+
+/// @brief Finish the HEADER_V2 crc of a message
+/// @param crc crc8 over payload[1..length-1], so that writers can run it
+/// while they append
+inline uint8_t crc8FinishMessage(uint8_t crc, const msg_header *header) {
+    const uint8_t *payload = (const uint8_t *)header + LENGTH_MSG_HEADER;
+    if (header->length) {
+        crc = crc8Update(crc, payload[0]);
+    }
+    crc = crc8Update(crc, header->length);
+    return crc8Update(crc, header->type);
+}
+
+/// @brief HEADER_V2 crc of a message, header->length bytes of payload
+inline uint8_t crc8Message(const msg_header *header) {
+    const uint8_t *payload = (const uint8_t *)header + LENGTH_MSG_HEADER;
+    uint8_t crc = 0;
+    if (header->length) {
+        crc = crc8(crc, payload + 1, header->length - 1);
+    }
+    return crc8FinishMessage(crc, header);
+}
+
+#endif
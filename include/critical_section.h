@@ -0,0 +1,48 @@
+#ifndef _CRITICAL_SECTION_H
+#define _CRITICAL_SECTION_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#if defined(TRIGGER_SIM)
+#include "sim.h"
+#endif
+
+// Disables interrupts for the lifetime of the object and restores the
+// previous state afterwards. Unlike noInterrupts()/interrupts() this is safe
+// inside interrupt handlers, where interrupts must stay disabled on exit.
+class CriticalSection {
+
+  public:
+#if defined(__AVR__)
+    CriticalSection() : _sreg(SREG) { cli(); }
+    ~CriticalSection() { SREG = _sreg; }
+
+  private:
+    uint8_t _sreg;
+#elif defined(TRIGGER_SIM)
+    CriticalSection() : _enabled(simInterruptsEnabled()) { noInterrupts(); }
+    ~CriticalSection() {
+        if (_enabled) {
+            interrupts();
+        }
+    }
+
+  private:
+    uint8_t _enabled;
+#else
+    CriticalSection() {
+        __asm__ volatile("mrs %0, primask" : "=r"(_primask)::"memory");
+        __disable_irq();
+    }
+    ~CriticalSection() {
+        if (!_primask) {
+            __enable_irq();
+        }
+    }
+
+  private:
+    uint32_t _primask;
+#endif
+};
+
+#endif
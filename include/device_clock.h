@@ -0,0 +1,14 @@
+#ifndef _DEVICE_CLOCK_H
+#define _DEVICE_CLOCK_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/// @brief micros() extended to 64 bit, does not wrap after ~71 minutes
+///
+/// The wrap of micros() is detected between two calls, so this has to be
+/// called at least once per wrap. loop() does that on every pass. Safe to
+/// call from interrupts.
+uint64_t deviceClockUs();
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _DEVICE_STATS_H
+#define _DEVICE_STATS_H
+
+#include "serial_messages.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// Performance counters of the running firmware, reported with TYPE_STATS.
+//
+// The record functions are cheap enough for interrupt handlers: a few adds
+// and a log2 bucket. Histogram bucket 0 counts values below 1 us, bucket i
+// values from 2^(i-1) up to 2^i us and the last bucket everything above.
+// Histogram and error counters saturate at 0xFFFF, all others wrap. The
+// event buffer fields (input_lost, *_high_water) are filled in by loop().
+
+// Fields as in stats_message
+struct device_stats_t {
+    uint32_t elapsed_ms;
+    uint32_t loop_count;
+    uint32_t loop_max_us;
+    uint32_t edge_count;
+    uint32_t edge_late_max_us;
+    uint32_t input_captures;
+    uint32_t input_edges;
+    uint32_t input_events;
+    uint32_t input_lost;
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t tx_dropped;
+    uint32_t rx_frames;
+    uint16_t rx_errors[STATS_RX_ERROR_BITS];
+    uint16_t tx_free_min;
+    uint8_t input_high_water;
+    uint8_t capture_high_water;
+    uint16_t loop_histogram[STATS_HISTOGRAM_BUCKETS];
+    uint16_t edge_late_histogram[STATS_HISTOGRAM_BUCKETS];
+};
+typedef struct device_stats_t DeviceStats;
+
+/// @brief Pass of loop()
+/// @param loop_us time since the previous pass
+void deviceStatsLoop(uint32_t loop_us);
+/// @brief Pulse timer interrupt, called from the interrupt
+/// @param late_us time between the compare match and the interrupt
+void deviceStatsEdge(uint32_t late_us);
+/// @brief Input interrupt with changes, called from the interrupt
+/// @param edges number of changed inputs
+/// @param events number of events queued for them
+void deviceStatsInputs(uint8_t edges, uint8_t events);
+/// @brief Frame handed to the transmit queue
+/// @param bytes frame size before the COBS encoding
+/// @param tx_free free space of the serial transmit buffer
+/// @param queued false if the frame was dropped
+void deviceStatsTx(size_t bytes, int tx_free, uint8_t queued);
+/// @brief Frame received
+/// @param error_flags SERIAL_PEER_ERROR_CODE bits, 0 if it was fine
+void deviceStatsRx(uint8_t error_flags);
+
+/// @brief Consistent copy of the counters
+void deviceStatsRead(DeviceStats *stats);
+/// @brief Restart all counters and the elapsed time, once from setup() and
+/// on request
+void deviceStatsReset();
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _EVENT_RING_H
+#define _EVENT_RING_H
+
+#include "critical_section.h"
+#include <stdint.h>
+
+// Fixed size ring buffer to hand events from interrupts to loop().
+//
+// push() is called from interrupt handlers, pop() only from loop(). The
+// consumer never disables interrupts: the producer publishes an element by
+// advancing _head after it is written and the consumer frees it by advancing
+// _tail after it is read. Both indices are single bytes and free running,
+// so every access is atomic on AVR as well. Several interrupt handlers may
+// push, push() serializes them with a short critical section because
+// interrupts can nest on ARM.
+//
+// A full ring drops the new event and counts it in getOverflows().
+template <typename T, uint8_t N> class EventRing {
+    static_assert(N && (N & (N - 1)) == 0, "size must be a power of two");
+    static_assert(N <= 128, "size must fit the 8 bit free running indices");
+
+  public:
+    uint8_t push(const T &event) {
+        CriticalSection critical_section;
+        uint8_t head = _head;
+        if ((uint8_t)(head - _tail) >= N) {
+            _overflows++;
+            return false;
+        }
+        _events[head & (N - 1)] = event;
+        __asm__ volatile("" ::: "memory"); // write element before publishing
+        _head = head + 1;
+        if ((uint8_t)(_head - _tail) > _high_water) {
+            _high_water = _head - _tail;
+        }
+        return true;
+    }
+
+    uint8_t pop(T *event) {
+        uint8_t tail = _tail;
+        if (tail == _head) {
+            return false;
+        }
+        *event = _events[tail & (N - 1)];
+        __asm__ volatile("" ::: "memory"); // read element before freeing it
+        _tail = tail + 1;
+        return true;
+    }
+
+    /// @brief Copy the oldest event without taking it, only from loop()
+    uint8_t peek(T *event) {
+        uint8_t tail = _tail;
+        if (tail == _head) {
+            return false;
+        }
+        *event = _events[tail & (N - 1)];
+        return true;
+    }
+
+    /// @brief Events waiting, only from loop()
+    uint8_t size() { return _head - _tail; }
+
+    /// @brief Events dropped because the ring was full
+    uint32_t getOverflows() {
+        CriticalSection critical_section;
+        return _overflows;
+    }
+
+    /// @brief Highest fill level since start or resetHighWater()
+    uint8_t getHighWater() { return _high_water; }
+    void resetHighWater() {
+        CriticalSection critical_section;
+        _high_water = _head - _tail;
+    }
+
+  private:
+    T _events[N];
+    volatile uint8_t _head = 0;
+    volatile uint8_t _tail = 0;
+    volatile uint8_t _high_water = 0;
+    volatile uint32_t _overflows = 0;
+};
+
+#endif
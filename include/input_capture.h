@@ -0,0 +1,77 @@
+#ifndef _INPUT_CAPTURE_H
+#define _INPUT_CAPTURE_H
+
+#include "trigger_inputs.h"
+#include "triggerpins_selector.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// Timer input capture for the inputs in IN_CAPTURE_INPUTS (board header).
+//
+// The timer latches its count in hardware at the edge, so the timestamp
+// neither has the 4 us steps of micros() on AVR nor the interrupt latency or
+// the time interrupts were masked. The 16 bit counts are extended with an
+// overflow counter to 48 bit ticks of inputCaptureHz().
+//
+// AVR:       ICP1 (pin 8) on Timer1 at F_CPU / 8, shared with the pulse timer
+// Teensy 4:  QTIMER3 timers 0..3 (pins 19, 18, 14, 15) at the bus clock / 8
+// Simulator: one input latched at 16 MHz
+
+#if defined(__AVR_ATmega328P__)
+#define INPUT_CAPTURE_MAX_INPUTS 1
+constexpr bool capturePin(int16_t pin) { return pin == 8; }
+#elif defined(__IMXRT1062__)
+#define INPUT_CAPTURE_MAX_INPUTS 4
+/// @brief QTIMER3 timer the pin is routed to, -1 if none
+constexpr int8_t teensy4CaptureTimer(int16_t pin) {
+    return pin == 19   ? 0
+           : pin == 18 ? 1
+           : pin == 14 ? 2
+           : pin == 15 ? 3
+                       : -1;
+}
+constexpr bool capturePin(int16_t pin) {
+    return teensy4CaptureTimer(pin) >= 0;
+}
+#elif defined(TRIGGER_SIM)
+#define INPUT_CAPTURE_MAX_INPUTS 1
+constexpr bool capturePin(int16_t pin) { return validInputPin(pin); }
+#else
+#define INPUT_CAPTURE_MAX_INPUTS 0
+constexpr bool capturePin(int16_t) { return false; }
+#endif
+
+/// @brief IN0..IN7 bits of the inputs timestamped by the capture hardware
+constexpr uint8_t captureInputs() { return IN_CAPTURE_INPUTS; }
+
+constexpr bool validCaptureInputs(uint8_t i = 0) {
+    return i >= NUM_INPUT_PINS ||
+           ((!(captureInputs() & (1 << i)) || capturePin(INPUT_PINS[i])) &&
+            validCaptureInputs(i + 1));
+}
+
+static_assert((IN_CAPTURE_INPUTS & ~validInputs()) == 0,
+              "IN_CAPTURE_INPUTS has an input the board does not have");
+static_assert(validCaptureInputs(),
+              "IN_CAPTURE_INPUTS has an input without capture hardware");
+static_assert(__builtin_popcount(IN_CAPTURE_INPUTS) <=
+                  INPUT_CAPTURE_MAX_INPUTS,
+              "IN_CAPTURE_INPUTS has more inputs than capture channels");
+
+/// @brief Called from the capture interrupt
+/// @param ticks extended count latched at the edge
+/// @param input IN0..IN7 index
+/// @param level level after the edge
+typedef void (*InputCaptureHandler)(uint64_t ticks, uint8_t input,
+                                    uint8_t level);
+
+/// @brief Start the capture timer, interrupts off. Does nothing if the board
+/// has no capture inputs.
+void inputCaptureBegin(InputCaptureHandler handler);
+/// @brief Tick rate of the capture timestamps, 0 without capture inputs
+uint32_t inputCaptureHz();
+/// @brief Low 16 bits of the capture timer now, to measure the time since a
+/// captured edge; 0 without capture inputs
+uint16_t inputCaptureCount();
+
+#endif
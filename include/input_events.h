@@ -0,0 +1,137 @@
+#ifndef _INPUT_EVENTS_H
+#define _INPUT_EVENTS_H
+
+#include "analog_sampler.h"
+#include "event_ring.h"
+#include <stdint.h>
+
+struct input_event_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t inputs_state;
+};
+typedef struct input_event_t InputEvent;
+
+#ifndef INPUT_EVENT_BUFFER_SIZE
+#if defined(__AVR__)
+#define INPUT_EVENT_BUFFER_SIZE 16
+#else
+#define INPUT_EVENT_BUFFER_SIZE 128
+#endif
+#endif
+typedef EventRing<InputEvent, INPUT_EVENT_BUFFER_SIZE> InputEventRing;
+
+// Edges of inputs with timer input capture (input_capture.h)
+struct capture_event_t {
+    uint64_t ticks;
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t inputs_state;
+    uint8_t input;
+};
+typedef struct capture_event_t CaptureEvent;
+
+#ifndef CAPTURE_EVENT_BUFFER_SIZE
+#if defined(__AVR__)
+#define CAPTURE_EVENT_BUFFER_SIZE 8
+#else
+#define CAPTURE_EVENT_BUFFER_SIZE 32
+#endif
+#endif
+typedef EventRing<CaptureEvent, CAPTURE_EVENT_BUFFER_SIZE> CaptureEventRing;
+
+// Starts of pulse schedule segments (PulseEngine::setSegmentHandler)
+struct segment_event_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t channel;
+    uint8_t segment;
+    uint16_t pass;
+};
+typedef struct segment_event_t SegmentEvent;
+
+#ifndef SEGMENT_EVENT_BUFFER_SIZE
+#if defined(__AVR__)
+#define SEGMENT_EVENT_BUFFER_SIZE 2
+#else
+#define SEGMENT_EVENT_BUFFER_SIZE 16
+#endif
+#endif
+typedef EventRing<SegmentEvent, SEGMENT_EVENT_BUFFER_SIZE> SegmentEventRing;
+
+// Timed commands that took effect (PulseEngine::setTimedHandler)
+struct timed_event_t {
+    uint64_t applied_us;
+    uint32_t pulse_id;
+    uint8_t id;
+    uint8_t channel;
+    uint8_t status;
+};
+typedef struct timed_event_t TimedEvent;
+
+// One per queued command, it stays queued until its event is sent
+#ifndef TIMED_EVENT_BUFFER_SIZE
+#if defined(__AVR__)
+#define TIMED_EVENT_BUFFER_SIZE 2
+#else
+#define TIMED_EVENT_BUFFER_SIZE 16
+#endif
+#endif
+typedef EventRing<TimedEvent, TIMED_EVENT_BUFFER_SIZE> TimedEventRing;
+
+// Triggered bursts (PulseEngine::setBurstHandler)
+struct burst_event_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint32_t latency_ticks; // capture ticks or BURST_NO_LATENCY
+    uint8_t channel;
+    uint8_t input;
+    uint8_t status;
+};
+typedef struct burst_event_t BurstEvent;
+
+#ifndef BURST_EVENT_BUFFER_SIZE
+#if defined(__AVR__)
+#define BURST_EVENT_BUFFER_SIZE 2
+#else
+#define BURST_EVENT_BUFFER_SIZE 16
+#endif
+#endif
+typedef EventRing<BurstEvent, BURST_EVENT_BUFFER_SIZE> BurstEventRing;
+
+// Played halves of a streamed output pattern (pattern_output.h)
+struct pattern_event_t {
+    uint32_t uptime_us;
+    uint32_t halves;
+    uint16_t first;
+    uint8_t status;
+};
+typedef struct pattern_event_t PatternEvent;
+
+// The host refills one half at a time, a few events are plenty
+#ifndef PATTERN_EVENT_BUFFER_SIZE
+#define PATTERN_EVENT_BUFFER_SIZE 4
+#endif
+typedef EventRing<PatternEvent, PATTERN_EVENT_BUFFER_SIZE> PatternEventRing;
+
+#if ANALOG_SAMPLING
+// Converted analog sets, keyed by the pulse they belong to (analog_sampler.h)
+struct analog_set_t {
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t index; // set of the pulse, 0 at its rising edge
+    uint16_t values[ANALOG_MAX_PINS];
+};
+typedef struct analog_set_t AnalogSet;
+
+#ifndef ANALOG_SET_BUFFER_SIZE
+#if defined(__AVR__)
+#define ANALOG_SET_BUFFER_SIZE 4
+#else
+#define ANALOG_SET_BUFFER_SIZE 64
+#endif
+#endif
+typedef EventRing<AnalogSet, ANALOG_SET_BUFFER_SIZE> AnalogSetRing;
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _PATTERN_OUTPUT_H
+#define _PATTERN_OUTPUT_H
+
+#include "serial_messages.h"
+#include "trigger_outputs.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// Output patterns played back by hardware (TYPE_PATTERN).
+//
+// The host uploads one bitmap of OUT00..OUT15 per tick. They are
+// precomputed into toggle masks per GPIO port, step i holds the bits that
+// change from step i - 1 to step i, and a timer paced DMA channel writes one
+// mask per tick to the DR_TOGGLE register of every port. The CPU is not
+// involved while the pattern plays, so the step times are exact to the
+// timer clock and the interrupts of inputs and serial run undisturbed. The
+// outputs of a pattern must not be driven by a pulse channel meanwhile, a
+// write to them would invert the rest of the pattern.
+//
+// The buffer plays in two halves, the DMA interrupts at the end of each.
+// Streamed patterns refill the played half while the other one plays.
+//
+// Teensy 4:  QTIMER4 timer 0 requests a DMA chain, bus clock resolution
+// Simulator: the HAL stream models the DMA chain on its one port
+// Others:    no pattern output, TYPE_PATTERN is NOT_IMPLEMENTED
+
+#if defined(__IMXRT1062__) || defined(TRIGGER_SIM)
+#define PATTERN_OUTPUT 1
+// Linked DMA channels count the steps in 9 bits
+#define PATTERN_MAX_STEPS 256
+// Shortest tick the DMA chain of 4 ports keeps up with
+#define PATTERN_MIN_TICK_NS 1000UL
+// 16 bit compare at the largest QTIMER prescaler
+#define PATTERN_MAX_TICK_NS 50000000UL
+#else
+#define PATTERN_OUTPUT 0
+#endif
+
+#if PATTERN_OUTPUT
+/// @brief Called from the DMA interrupt
+/// @param status pattern_status
+/// @param first first step of the half
+/// @param halves halves played since the start
+typedef void (*PatternHandler)(uint8_t status, uint16_t first,
+                               uint32_t halves);
+
+/// @brief Set the handler of played halves, after triggerOutputsBegin()
+void patternOutputBegin(PatternHandler handler);
+/// @brief Write steps first..first + count - 1 of the buffer. While a
+/// pattern plays only the free half of a stream can be written.
+/// @param steps count OUT00..OUT15 bitmaps, may be unaligned
+/// @return false if the steps are out of range or in use
+uint8_t patternOutputLoad(uint16_t first, const void *steps, uint8_t count);
+/// @brief Play steps 0..length - 1 over and over, a running pattern is
+/// stopped first. The outputs take the levels of the last step right away
+/// and the ones of step 0 one tick later.
+/// @param length even, at most PATTERN_MAX_STEPS
+/// @param flags pattern_flags
+/// @return false if a value is out of range
+uint8_t patternOutputStart(uint16_t length, uint16_t outputs, uint32_t tick_ns,
+                           uint8_t flags);
+/// @brief Stop playback and clear the outputs of the pattern
+void patternOutputStop();
+uint8_t patternOutputRunning();
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _PULSE_CHANNEL_H
+#define _PULSE_CHANNEL_H
+
+#include <stdint.h>
+
+// Number of independent pulse channels. Every channel drives its own group
+// of outputs with its own rate, phase and pulse limit. Channel 0 is the one
+// configured by TYPE_SETUP and owns all outputs and inputs until they are
+// assigned to other channels. The ATmega328P has the RAM for one.
+#if defined(__AVR__)
+#define PULSE_CHANNELS 1
+#else
+#define PULSE_CHANNELS 8
+#endif
+
+// Segments of the pulse schedule (TYPE_SCHEDULE), one table that one channel
+// at a time plays back
+#if defined(__AVR__)
+#define SCHEDULE_MAX_SEGMENTS 2
+#else
+#define SCHEDULE_MAX_SEGMENTS 64
+#endif
+
+#define ALL_INPUTS 0xFF // IN0..IN7 as bits
+
+struct pulse_channel_setup_t {
+    uint16_t outputs;       // OUT00..OUT15 driven by the channel
+    uint8_t inputs;         // IN0..IN7 reported with the channel's pulse_id
+    uint32_t pulse_millihz; // 0 -> stop after the next falling edge
+    uint32_t phase_us;      // first rising edge after the engine start
+    uint32_t pulse_limit;   // 0 -> unlimited pulses
+    uint8_t flags;          // setup_flags
+    uint32_t high_us;       // 0 -> half the period
+};
+typedef struct pulse_channel_setup_t PulseChannelSetup;
+
+// Leader/follower role of a channel, see cascade_message
+struct pulse_cascade_setup_t {
+    uint8_t clock_input;   // IN0..IN7 index the pulses come from
+    uint8_t sync_input;    // IN0..IN7 index that restarts pulse_id at 0
+    uint16_t sync_outputs; // OUT00..OUT15 high during pulse_id 0
+};
+typedef struct pulse_cascade_setup_t PulseCascadeSetup;
+
+// External trigger of a channel, see burst_message
+struct pulse_burst_setup_t {
+    uint8_t input;          // IN0..IN7 index; BURST_NO_INPUT -> disarm
+    uint8_t flags;          // burst_flags
+    uint32_t pulse_count;   // at least one
+    uint32_t pulse_millihz; // rate within the burst
+    uint32_t high_us;       // 0 -> half the period
+};
+typedef struct pulse_burst_setup_t PulseBurstSetup;
+
+// Setup, stop or reset waiting for its time, see timed_message
+struct pulse_timed_command_t {
+    uint64_t at; // device clock in us or pulse_id, see trigger
+    uint32_t pulse_millihz;
+    uint32_t pulse_limit;
+    uint32_t high_us;
+    uint8_t id;
+    uint8_t channel;
+    uint8_t action;  // timed_action
+    uint8_t trigger; // timed_trigger
+    uint8_t flags;   // setup_flags
+    uint8_t armed;   // handed to the pulse engine
+};
+typedef struct pulse_timed_command_t PulseTimedCommand;
+
+#endif
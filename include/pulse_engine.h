@@ -0,0 +1,293 @@
+#ifndef _PULSE_ENGINE_H
+#define _PULSE_ENGINE_H
+
+#include "pulse_channel.h"
+#include "pulse_timer.h"
+#include "serial_messages.h"
+#include "trigger_outputs.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+#define RESET_PULSE_COUNT UINT32_MAX
+#define NUM_INPUTS 8
+#define PULSE_NO_SEGMENT 0xFF
+#define PULSE_NO_SAMPLE 0xFF
+// Farthest the generator runs ahead while bursts are armed. The first
+// falling edge of a burst can not come before the generated batches.
+#define BURST_LOOKAHEAD_TICKS (16 * PULSE_TIMER_MIN_TICKS)
+
+// Time in timer ticks as 32.32 fixed point. The fraction of the period is
+// accumulated pulse by pulse (phase accumulator), a carry lengthens that
+// interval by one tick, so the average rate is exact and does not drift.
+struct fixed_ticks_t {
+    uint32_t ticks;
+    uint32_t frac; // 1/2^32 ticks
+};
+typedef struct fixed_ticks_t FixedTicks;
+
+// Segment of the pulse schedule in timer ticks, see schedule_message
+struct schedule_segment_ticks_t {
+    uint32_t pulse_millihz;
+    FixedTicks period;
+    FixedTicks high;
+    uint32_t pulse_count;
+    uint32_t gap_ticks;
+    uint8_t flags; // segment_flags
+};
+typedef struct schedule_segment_ticks_t ScheduleSegment;
+
+// Timed command armed on a running channel, checked at every falling edge
+struct timed_action_t {
+    uint8_t action;  // timed_action, 0 -> none armed
+    uint8_t trigger; // timed_trigger
+    uint8_t id;
+    uint8_t status; // timed_status, reported once applied
+    uint32_t target; // rising edge ticks modulo 2^32 or pulse_id
+    uint32_t pulse_millihz;
+    FixedTicks period;
+    FixedTicks high;
+    uint32_t pulse_limit;
+    uint8_t flags; // setup_flags
+};
+typedef struct timed_action_t TimedAction;
+
+// Burst armed on a channel, started by an edge of its input
+struct burst_trigger_t {
+    uint32_t pulse_millihz; // 0 -> not armed
+    FixedTicks period;
+    FixedTicks high;
+    uint32_t pulse_count;
+    uint8_t input;
+    uint8_t falling_edge;
+};
+typedef struct burst_trigger_t BurstTrigger;
+
+enum timed_report_state {
+    TIMED_REPORT_NONE,
+    TIMED_REPORT_RISE,  // with the next rising edge
+    TIMED_REPORT_BATCH, // with the batch it is in
+};
+
+// One pulse train. The generator part runs ahead of the outputs (see
+// PulseEngine), the output part is the state the outputs are in.
+struct pulse_channel_t {
+    // Configuration, written from loop() with interrupts off
+    TriggerOutputMask outputs;
+    TriggerOutputMask sync_outputs; // high during pulse_id 0
+    uint8_t clock_input; // CASCADE_NO_INPUT -> own generator, else follower
+    uint8_t sync_input;  // of a follower, CASCADE_NO_INPUT -> none
+    uint32_t req_pulse_millihz;
+    FixedTicks req_period;
+    FixedTicks req_high;
+    uint8_t req_changed;  // applied at the next falling edge
+    uint8_t req_schedule; // the change starts the schedule
+    uint32_t pulse_limit;
+    uint8_t sync_rising_edge;
+    // Edge generator
+    uint32_t pulse_millihz; // 0 -> not scheduled
+    FixedTicks period;
+    FixedTicks high;     // rising to falling edge
+    uint32_t phase;      // fraction of rise_ticks
+    uint32_t rise_ticks; // latest rising edge, modulo 2^32
+    uint32_t due_ticks;  // next edge, modulo 2^32
+    uint32_t gen_pulse_count;
+    uint8_t gen_wave_state;
+    // Schedule playback, part of the generator
+    uint8_t segment;         // PULSE_NO_SEGMENT -> not following it
+    uint8_t segment_report;  // the next rising edge starts a segment
+    uint16_t pass;           // passes through the table so far
+    uint32_t segment_pulses; // rising edges left in the segment
+    uint8_t timed_report;    // timed_report_state of the applied command
+    uint32_t burst_pulses;   // rising edges left in the burst, 0 -> none
+    // Outputs
+    volatile uint32_t pulse_count;
+};
+typedef struct pulse_channel_t PulseChannel;
+
+// Edges of several channels that are written together
+struct edge_batch_t {
+    uint32_t at_ticks;
+    uint8_t rising;  // channel bits
+    uint8_t falling; // channel bits
+    // Schedule segment started by a rising edge, PULSE_NO_SEGMENT if none
+    uint8_t segment;
+    uint8_t segment_channel;
+    uint16_t pass;
+    uint8_t reset; // channel bits, pulse_id restarts before this batch
+    uint8_t timed; // channel bits, timed command applied
+    uint8_t sample; // analog set of the sampled channel, PULSE_NO_SAMPLE
+};
+typedef struct edge_batch_t EdgeBatch;
+
+// Pulse generator for PULSE_CHANNELS channels driven by the pulse timer
+// interrupt. Every compare match of the timer is one batch of edges, so edge
+// timing does not depend on how long loop() is busy with serial traffic.
+//
+// The channels sit in a min heap ordered by their next edge, so finding the
+// next edge costs O(log channels) no matter how many channels run. Because
+// the timer needs one interval of lookahead, the generator stays two batches
+// ahead of the outputs; pulse counts, sync and limits follow the outputs.
+class PulseEngine {
+
+  public:
+    typedef void (*OutputWriterFunction)(const TriggerOutputMask *set,
+                                         const TriggerOutputMask *clear);
+    typedef void (*SyncHandlerFunction)(uint8_t channel);
+    typedef void (*SegmentHandlerFunction)(uint8_t channel, uint8_t segment,
+                                           uint16_t pass);
+    typedef void (*TimedHandlerFunction)(uint8_t channel, uint8_t id,
+                                         uint8_t status, uint64_t applied_us);
+    typedef void (*BurstHandlerFunction)(uint8_t channel, uint8_t input,
+                                         uint8_t status,
+                                         uint32_t latency_ticks);
+    typedef void (*SampleHandlerFunction)(uint8_t channel, uint8_t index);
+
+    /// @brief Called from the timer interrupt to set the trigger outputs
+    void setOutputWriter(OutputWriterFunction outputWriterFunction) {
+        _outputWriterFunction = outputWriterFunction;
+    }
+    /// @brief Called from the timer interrupt on the pulse_count == 0 sync
+    /// edge of a channel
+    void setSyncHandler(SyncHandlerFunction syncHandlerFunction) {
+        _syncHandlerFunction = syncHandlerFunction;
+    }
+    /// @brief Called from the timer interrupt on the first rising edge of a
+    /// schedule segment, after its pulse has been counted
+    void setSegmentHandler(SegmentHandlerFunction segmentHandlerFunction) {
+        _segmentHandlerFunction = segmentHandlerFunction;
+    }
+    /// @brief Called when a timed command took effect, from the timer
+    /// interrupt at its edge or from armTimed() for a stopped channel
+    void setTimedHandler(TimedHandlerFunction timedHandlerFunction) {
+        _timedHandlerFunction = timedHandlerFunction;
+    }
+    /// @brief Called from the input interrupt for every burst trigger, after
+    /// the first rising edge was written
+    /// @param latency_ticks capture ticks from the edge to the write,
+    /// BURST_NO_LATENCY if the input is not timestamped by the capture timer
+    void setBurstHandler(BurstHandlerFunction burstHandlerFunction) {
+        _burstHandlerFunction = burstHandlerFunction;
+    }
+    /// @brief Called for every analog set of the sampled channel, from the
+    /// timer interrupt or for bursts and followers from the input interrupt,
+    /// after the pulse of the set has been counted
+    /// @param index set of the pulse, 0 at its rising edge
+    void setSampleHandler(SampleHandlerFunction sampleHandlerFunction) {
+        _sampleHandlerFunction = sampleHandlerFunction;
+    }
+
+    PulseEngine();
+    /// @brief Channel 0 owns all outputs and inputs, after triggerOutputsBegin
+    void begin();
+    void setup(uint32_t pulse_millihz, uint32_t pulse_limit, uint32_t high_us,
+               uint8_t sync_rising_edge, uint8_t reset_counter);
+    uint8_t setupChannel(uint8_t channel, const PulseChannelSetup *setup);
+    uint8_t setupCascade(uint8_t channel, const PulseCascadeSetup *setup);
+    uint8_t loadSchedule(uint8_t channel, uint8_t flags, uint16_t repeat,
+                         uint8_t first, uint8_t total,
+                         const schedule_segment *segments, uint8_t count);
+    uint8_t armTimed(const PulseTimedCommand *command);
+    uint8_t setupBurst(uint8_t channel, const PulseBurstSetup *setup);
+    uint8_t setupSampling(uint8_t channel, uint8_t divider);
+    uint32_t takeSamplesSkipped();
+    uint8_t takeTimedDropped();
+    uint32_t getPulseCount(uint8_t channel = 0);
+    uint32_t getInputPulseCount(uint8_t input);
+    uint8_t getInputChannel(uint8_t input) { return _input_channels[input]; }
+    uint8_t isRunning();
+
+    uint32_t handleEdge();
+    uint8_t followInputs(uint8_t state, uint8_t changed,
+                         uint16_t capture_count);
+
+  private:
+    static FixedTicks period(uint32_t pulse_millihz);
+    static FixedTicks highTime(const FixedTicks *period, uint32_t high_us);
+    void configure(uint8_t channel, uint32_t pulse_millihz, uint32_t high_us,
+                   uint32_t phase_ticks, uint32_t pulse_limit,
+                   uint8_t sync_rising_edge, uint8_t reset_counter);
+    void request(uint8_t channel, uint32_t pulse_millihz,
+                 const FixedTicks *period_ticks, const FixedTicks *high_ticks,
+                 uint64_t phase_ticks, uint32_t pulse_limit,
+                 uint8_t sync_rising_edge, uint8_t reset_counter,
+                 uint8_t start_schedule);
+    void schedule(uint8_t channel, uint64_t phase_ticks);
+    void startTimer();
+    uint8_t applyTimed(EdgeBatch *batch, uint8_t channel);
+    void dropTimed(uint8_t channel);
+    void assignOutputs(uint8_t channel, uint16_t outputs,
+                       uint16_t sync_outputs);
+    void updateFollowers();
+    void updateBursts();
+    void triggerBursts(uint8_t triggered, uint16_t capture_count);
+    void startBursts(uint8_t started, uint8_t *late);
+    void enterSegment(PulseChannel *ch, uint8_t segment);
+    uint8_t nextSegment(PulseChannel *ch);
+    void startSamples(const PulseChannel *ch);
+    void nextSample();
+    void generateBatch(EdgeBatch *batch);
+    void heapPush(uint8_t channel);
+    void heapSiftDown(uint8_t index);
+    void heapRemoveTop();
+    uint8_t pendingRisingEdges(uint8_t channel);
+
+    PulseChannel _channels[PULSE_CHANNELS];
+    uint8_t _input_channels[NUM_INPUTS];
+    uint16_t _channel_outputs[PULSE_CHANNELS];
+    uint16_t _sync_outputs[PULSE_CHANNELS];
+
+    // Followers, read by the input interrupt
+    uint8_t _followers = 0;     // channel bits
+    uint8_t _sync_channels = 0; // channel bits, with sync outputs
+    uint8_t _clock_inputs = 0;  // IN0..IN7 bits
+    uint8_t _sync_inputs = 0;   // IN0..IN7 bits
+
+    // Schedule table, _schedule_size stays 0 while a table is loaded
+    ScheduleSegment _schedule[SCHEDULE_MAX_SEGMENTS];
+    uint8_t _schedule_size = 0;
+    uint8_t _schedule_loaded = 0;
+    uint16_t _schedule_repeat = 0;
+    uint8_t _schedule_channel = PULSE_NO_SEGMENT; // channel following it
+
+    // Timed commands, one per channel, written from loop() with interrupts
+    // off. Dropped ones lost their channel before they were applied.
+    TimedAction _timed[PULSE_CHANNELS];
+    uint8_t _timed_dropped = 0; // channel bits
+
+    // External triggers, read by the input interrupt
+    BurstTrigger _bursts[PULSE_CHANNELS];
+    uint8_t _burst_channels = 0; // channel bits, armed
+    uint8_t _burst_rising = 0;   // IN0..IN7 bits
+    uint8_t _burst_falling = 0;  // IN0..IN7 bits
+
+    // Analog sampling: a set at every rising edge of one channel and
+    // divider - 1 sets between them, one period / divider apart
+    uint8_t _sample_channel = PULSE_NO_SAMPLE;
+    uint8_t _sample_shift = 0;      // log2 of the divider
+    uint8_t _sample_index = 0;      // next set between the edges, 0 -> none
+    uint32_t _sample_due_ticks = 0; // of that set, modulo 2^32
+    uint32_t _sample_phase = 0;     // fraction of _sample_due_ticks
+    FixedTicks _sample_step = {0, 0};
+    uint32_t _samples_skipped = 0; // sets not taken, the next pulse came first
+
+    // Edge scheduler
+    uint8_t _heap[PULSE_CHANNELS];
+    uint8_t _heap_size = 0;
+    EdgeBatch _batches[2]; // the next compare match and the one after
+    uint8_t _batch_next = 0;
+    uint32_t _horizon_ticks = 0;   // latest generated batch
+    uint64_t _horizon_ticks64 = 0; // same, since the engine started
+    uint64_t _start_us = 0;        // device clock of tick 0
+    volatile uint8_t _running = false;
+
+    OutputWriterFunction _outputWriterFunction = nullptr;
+    SyncHandlerFunction _syncHandlerFunction = nullptr;
+    SegmentHandlerFunction _segmentHandlerFunction = nullptr;
+    TimedHandlerFunction _timedHandlerFunction = nullptr;
+    BurstHandlerFunction _burstHandlerFunction = nullptr;
+    SampleHandlerFunction _sampleHandlerFunction = nullptr;
+};
+
+extern PulseEngine pulse_engine;
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _PULSE_TIMER_H
+#define _PULSE_TIMER_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Board abstraction for the hardware timer that paces the trigger edges.
+//
+// The timer runs on an absolute compare schedule: every interval is counted
+// from the previous compare match and not from the moment the interrupt was
+// served, so interrupt latency never accumulates into the edge times.
+//
+// The callback runs in interrupt context at every compare match. It returns
+// the number of ticks between the *following* compare match and the one after
+// it (one interval of lookahead). This maps directly onto the reload register
+// of a periodic timer (PIT) and is emulated with a pending value on free
+// running compare timers (AVR Timer1).
+#if defined(__AVR__)
+// Timer1, prescaler 8
+#define PULSE_TIMER_HZ (F_CPU / 8)
+// 9 min, edge times are compared modulo 2^32
+#define PULSE_TIMER_MAX_TICKS 0x3FFFFFFFUL
+#elif defined(TEENSYDUINO)
+// PIT through IntervalTimer, microsecond resolution
+#define PULSE_TIMER_HZ 1000000UL
+// 30 s, inside the PIT range of all Teensy bus clocks
+#define PULSE_TIMER_MAX_TICKS 30000000UL
+#elif defined(TRIGGER_SIM)
+// Simulated compare timer, AVR resolution
+#define PULSE_TIMER_HZ 2000000UL
+#define PULSE_TIMER_MAX_TICKS 0x3FFFFFFFUL
+#else
+#error "Error: No pulse timer for this board"
+#endif
+
+#define PULSE_TIMER_TICKS_PER_US (PULSE_TIMER_HZ / 1000000UL)
+// Shortest interval the interrupt keeps up with at normal latency. A match
+// that other interrupts delay past the next one fires late, never a counter
+// wrap later.
+#define PULSE_TIMER_MIN_TICKS (8 * PULSE_TIMER_TICKS_PER_US)
+
+typedef uint32_t (*PulseTimerCallback)();
+
+/// @brief Start the timer
+/// @param callback called at every compare match
+/// @param first_ticks ticks until the first compare match
+/// @param second_ticks ticks between the first and the second compare match
+void pulseTimerStart(PulseTimerCallback callback, uint32_t first_ticks,
+                     uint32_t second_ticks);
+/// @brief Stop the timer, no further callbacks after this returns
+void pulseTimerStop();
+/// @brief Ticks the interrupt of the compare match being served started
+/// after the match, only valid inside the callback
+uint32_t pulseTimerLateTicks();
+/// @brief Ticks until the next compare match, negative once it passed and
+/// its interrupt is pending, interrupts off
+int32_t pulseTimerTicksToMatch();
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef _REPLAY_BUFFER_H
+#define _REPLAY_BUFFER_H
+
+#include <stdint.h>
+
+// The latest sequenced frames as they were sent, for TYPE_RESEND.
+//
+// Frames are kept back to back in one byte ring, each one a complete
+// message, so its header tells its length. They carry consecutive sequence
+// numbers, the oldest one is first(). A new frame drops the oldest ones
+// until it fits. Used from loop() only, not built on AVR (serial_peer.h).
+#define REPLAY_BUFFER_SIZE 4096
+
+class ReplayBuffer {
+    static_assert(REPLAY_BUFFER_SIZE &&
+                      (REPLAY_BUFFER_SIZE & (REPLAY_BUFFER_SIZE - 1)) == 0,
+                  "REPLAY_BUFFER_SIZE must be a power of two");
+
+  public:
+    /// @brief Drop every frame, the next one gets sequence number 0
+    void clear();
+    /// @brief Keep a frame under sequence number next()
+    /// @param len at most REPLAY_BUFFER_SIZE
+    void push(const uint8_t *frame, uint16_t len);
+    /// @brief Copy a frame that is still held
+    /// @return its length, 0 if it is not held
+    uint16_t get(uint16_t sequence, uint8_t *frame);
+    /// @brief Sequence number of the oldest frame held
+    uint16_t first() { return _first; }
+    /// @brief Sequence number of the next frame
+    uint16_t next() { return _first + _count; }
+
+  private:
+    uint16_t _frameLength(uint16_t at);
+
+    uint8_t _data[REPLAY_BUFFER_SIZE];
+    uint16_t _head = 0; // free running
+    uint16_t _tail = 0;
+    uint16_t _first = 0;
+    uint16_t _count = 0;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _SERIAL_LINK_H
+#define _SERIAL_LINK_H
+
+#include "serial_messages.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// Baudrate of the serial link to the host, changed at runtime (TYPE_BAUD).
+//
+// The host proposes a rate, the device acknowledges it at the old rate and
+// switches once the acknowledgement is out. The host switches as well and
+// sends a verify message at the new rate. Without a verify within
+// BAUD_VERIFY_TIMEOUT_MS the device falls back to the old rate, a rate the
+// cable can not carry never cuts the link for good. USB serial (Teensy)
+// takes any rate and always runs at USB speed.
+#define SERIAL_LINK_DEFAULT_BAUDRATE BAUD_DEFAULT
+
+/// @brief The UART can run at the rate with at most 2.5 % error
+uint8_t serialLinkSupported(uint32_t baudrate);
+void serialLinkBegin(uint32_t baudrate);
+uint32_t serialLinkBaudrate();
+/// @brief Switch to a new rate once the transmit queue ran empty
+void serialLinkPropose(uint32_t baudrate);
+/// @brief The host confirmed the current rate
+void serialLinkVerified();
+/// @brief Switch or fall back, called from loop()
+/// @param tx_idle nothing is queued for the old rate anymore
+void serialLinkUpdate(uint8_t tx_idle);
+
+#endif
@@ -13,8 +13,29 @@ enum message_type {
     TYPE_ACK,
     TYPE_TXT,
     TYPE_ERROR,
+    TYPE_INFO,
+    TYPE_EVENT_OVERFLOW,
+    TYPE_INPUTS_BATCH,
+    TYPE_BATCH_CONFIG,
+    TYPE_TIME_SYNC,
+    TYPE_CHANNEL_SETUP,
+    TYPE_INPUT_CAPTURE,
+    TYPE_STATS,
+    TYPE_BAUD,
+    TYPE_SCHEDULE,
+    TYPE_SEGMENT,
+    TYPE_CASCADE,
+    TYPE_TIMED,
+    TYPE_PATTERN,
+    TYPE_BURST,
+    TYPE_ANALOG,
+    TYPE_ANALOG_SAMPLES,
+    TYPE_SEQUENCE,
+    TYPE_RESEND,
 };
 
+#define MILLIHZ_PER_HZ 1000UL
+
 enum setup_flags {
     RESET_COUNTER = 1 << 0,
     SYNC_RISING_EDGE = 1 << 1,
@@ -31,6 +52,15 @@ struct header_t {
 typedef struct header_t msg_header;
 #define LENGTH_MSG_HEADER sizeof(msg_header)
 
+// Header version, top bit of type. Version 1 crc is the byte sum of the
+// payload. Version 2 crc is a CRC-8 (crc8.h) over payload[1..], payload[0],
+// length and type; the bytes that are final last go last, so the batch
+// writer runs the crc while it appends. The device answers in the version
+// of the last valid message it received, hosts that only know version 1
+// keep working.
+#define HEADER_V2 0x80
+#define HEADER_TYPE_MASK 0x7F
+
 // +-------+-------+-------+-------+
 // |         header        | val_0 |
 // +-------+-------+-------+-------+
@@ -44,11 +74,40 @@ struct message_t {
 typedef struct message_t message;
 #define LENGTH_ACK_MESSAGE MIN_LENGTH_MESSAGE
 typedef struct message_t ack_message;
-#define MIN_LENGTH_ERROR_MESSAGE MIN_LENGTH_MESSAGE
-typedef struct message_t error_message;
 #define MIN_LENGTH_TXT_MESSAGE MIN_LENGTH_MESSAGE
 typedef struct message_t txt_message;
 
+enum SERIAL_PEER_ERROR_CODE {
+    SERIAL_PEER_ERROR_LENGTH = 1 << 0,
+    SERIAL_PEER_ERROR_CRC = 1 << 1,
+    SERIAL_PEER_ERROR_NOT_IMPLEMENTED = 1 << 2,
+    SERIAL_PEER_ERROR_UNKNOWN_PACKET = 1 << 3,
+    SERIAL_PEER_ERROR_INVALID_VALUE = 1 << 4,
+    SERIAL_PEER_ERROR_RX_OVERFLOW = 1 << 5, // frame longer than the buffer
+};
+
+// Why the device rejected a message, the host renders the text:
+// +-------+-------+-------+-------+
+// |         header        | flags |
+// +-------+-------+-------+-------+
+// | r_typ | r_len | r_crc | c_crc |
+// +-------+-------+-------+-------+
+// |  received_len |  expected_len |
+// +-------+-------+-------+-------+
+// r_* are the header fields of the rejected message, zero if there is none.
+struct error_message_t {
+    msg_header header;
+    uint8_t error_flags;   // SERIAL_PEER_ERROR_CODE bits
+    uint8_t type;          // header.type of the rejected message
+    uint8_t length;        // header.length of the rejected message
+    uint8_t crc;           // header.crc of the rejected message
+    uint8_t calc_crc;      // crc the device calculated for it
+    uint16_t received_len; // bytes received
+    uint16_t expected_len; // bytes expected; 0 -> no length error
+};
+typedef struct error_message_t error_message;
+#define LENGTH_ERROR_MESSAGE sizeof(error_message)
+
 // +-------+-------+-------+-------+
 // |         header        | is_se |
 // +-------+-------+-------+-------+
@@ -72,15 +131,725 @@ typedef struct input_state_message_t input_state_message;
 // +-------+-------+-------+-------+
 // |           delay_us            |
 // +-------+-------+-------+-------+
+// | flags |     pulse_millihz     |
+// +-------+-------+-------+-------+
+// | p_mhz |        high_us        |
+// +-------+-------+-------+-------+
+// | hi_us |
+// +-------+
 struct setup_message_t {
     msg_header header;
-    uint8_t pulse_hz;     // Frequency in herz 1-255; 0 -> OFF
-    uint32_t pulse_limit; // 0 -> unlimited pulses
-    uint32_t delay_us;    // delay until first pulse
-    uint8_t flags;        // booleans see setup_flags
+    uint8_t pulse_hz;       // Frequency in herz 1-255; 0 -> OFF
+    uint32_t pulse_limit;   // 0 -> unlimited pulses
+    uint32_t delay_us;      // delay until first pulse
+    uint8_t flags;          // booleans see setup_flags
+    uint32_t pulse_millihz; // Frequency in millihertz, replaces pulse_hz
+    uint32_t high_us;       // High time of every pulse; 0 -> half the period
 };
 typedef struct setup_message_t setup_message;
 #define LENGTH_SETUP_MESSAGE sizeof(setup_message)
+// Setup without high_us, 50% duty cycle
+#define LENGTH_SETUP_MESSAGE_V2 (LENGTH_SETUP_MESSAGE - sizeof(uint32_t))
+// Setup without pulse_millihz, sent by older hosts
+#define LENGTH_SETUP_MESSAGE_V1 (LENGTH_SETUP_MESSAGE_V2 - sizeof(uint32_t))
+
+// Request: header only, Response:
+// +-------+-------+-------+-------+
+// |         header        | cpu_h |
+// +-------+-------+-------+-------+
+// |      cpu_hz           | o_ske |
+// +-------+-------+-------+-------+
+// | o_ske | o_prt |  capture_hz   |
+// +-------+-------+-------+-------+
+// |  capture_hz   | c_inp |
+// +-------+-------+-------+
+struct info_message_t {
+    msg_header header;
+    uint32_t cpu_hz;             // core clock of the board
+    uint16_t output_skew_cycles; // cpu cycles of one write of all outputs
+    uint8_t output_ports;        // number of GPIO ports the outputs span
+    uint32_t capture_hz;         // ticks per second of TYPE_INPUT_CAPTURE
+    uint8_t capture_inputs;      // IN0..IN7 with timer input capture
+};
+typedef struct info_message_t info_message;
+#define LENGTH_INFO_MESSAGE sizeof(info_message)
+// Info of firmware without input capture
+#define LENGTH_INFO_MESSAGE_V1                                                 \
+    (LENGTH_INFO_MESSAGE - sizeof(uint32_t) - sizeof(uint8_t))
+
+// +-------+-------+-------+-------+
+// |         header        | lost_ |
+// +-------+-------+-------+-------+
+// |     lost_events       |
+// +-------+-------+-------+
+struct event_overflow_message_t {
+    msg_header header;
+    uint32_t lost_events; // input events dropped since start
+};
+typedef struct event_overflow_message_t event_overflow_message;
+#define LENGTH_EVENT_OVERFLOW_MESSAGE sizeof(event_overflow_message)
+
+// Several input events in one frame. The first event is absolute, every
+// further event in deltas[] is relative to the one before it:
+// +-------+-------+-------+-------+
+// |         header        | count |
+// +-------+-------+-------+-------+
+// | is_se |       uptime_us       |
+// +-------+-------+-------+-------+
+// | up_us |       pulse_id        |
+// +-------+-------+-------+-------+
+// | pu_id | is_se | d_uptime_us   |
+// +-------+-------+-------+-------+
+// |  ...  | d_pulse_id    |  ...  |
+// +-------+-------+-------+-------+
+// d_uptime_us and d_pulse_id are unsigned LEB128 varints (7 bits per byte,
+// low bits first, MSB set on all but the last byte) of the difference to the
+// previous event, modulo 2^32.
+struct input_batch_message_t {
+    msg_header header;
+    uint8_t count; // number of events including the first one
+    uint8_t inputs_state;
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t deltas[];
+};
+typedef struct input_batch_message_t input_batch_message;
+#define MIN_LENGTH_INPUT_BATCH_MESSAGE sizeof(input_batch_message)
+// inputs_state + two 5 byte varints
+#define MAX_LENGTH_INPUT_BATCH_DELTA 11
+
+// Batching of input events, max_bytes is cut to 48 on the Uno/Nano.
+// +-------+-------+-------+-------+
+// |         header        | max_b |
+// +-------+-------+-------+-------+
+// |        max_latency_us         |
+// +-------+-------+-------+-------+
+struct batch_config_message_t {
+    msg_header header;
+    uint8_t max_bytes;       // flush at this frame size; 0 -> TYPE_INPUTS
+    uint32_t max_latency_us; // flush when the first event is this old
+};
+typedef struct batch_config_message_t batch_config_message;
+#define LENGTH_BATCH_CONFIG_MESSAGE sizeof(batch_config_message)
+
+// Timestamp exchange, NTP style. The host sends host_tx (any host clock,
+// echoed back unchanged), the device answers with the 64 bit device clock
+// when the request was handled and right before the response was sent. That
+// is when the transmit queue starts the response, after the frame on the
+// wire; only the bytes the serial port still buffers go out before it (up
+// to 64 on the Uno/Nano):
+// +-------+-------+-------+-------+
+// |         header        | host_ |
+// +-------+-------+-------+-------+
+// |            host_tx            |
+// +-------+-------+-------+-------+
+// |    host_tx            | dev_r |
+// +-------+-------+-------+-------+
+// |          device_rx_us         |
+// +-------+-------+-------+-------+
+// |    device_rx_us       | dev_t |
+// +-------+-------+-------+-------+
+// |          device_tx_us         |
+// +-------+-------+-------+-------+
+// |    device_tx_us       |
+// +-------+-------+-------+
+struct time_sync_message_t {
+    msg_header header;
+    uint64_t host_tx;      // request time on the host, echoed
+    uint64_t device_rx_us; // device clock when the request was handled
+    uint64_t device_tx_us; // device clock when the response was sent
+};
+typedef struct time_sync_message_t time_sync_message;
+#define LENGTH_TIME_SYNC_MESSAGE sizeof(time_sync_message)
+
+// Setup of one pulse channel, applied right away:
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// |    outputs    | input | p_mhz |
+// +-------+-------+-------+-------+
+// |     pulse_millihz     | phase |
+// +-------+-------+-------+-------+
+// |       phase_us        | p_lim |
+// +-------+-------+-------+-------+
+// |      pulse_limit      | flags |
+// +-------+-------+-------+-------+
+// |            high_us            |
+// +-------+-------+-------+-------+
+// Outputs and inputs are moved to the channel from the ones they belonged to
+// before. All channels share one time grid that starts with the first
+// channel: a channel started while others are running places its rising
+// edges at phase_us + n periods after that start. Edges of channels less than
+// 8 us apart go out together at the last of them, up to 8 us late. The
+// Uno/Nano have one channel, other channels are answered with INVALID_VALUE.
+struct channel_setup_message_t {
+    msg_header header;
+    uint8_t channel;        // 0 .. PULSE_CHANNELS - 1
+    uint16_t outputs;       // OUT00..OUT15 driven by the channel
+    uint8_t inputs;         // IN0..IN7 reported with the channel's pulse_id
+    uint32_t pulse_millihz; // 0 -> stop after the next falling edge
+    uint32_t phase_us;      // offset of the first rising edge
+    uint32_t pulse_limit;   // 0 -> unlimited pulses
+    uint8_t flags;          // booleans see setup_flags
+    uint32_t high_us;       // High time of every pulse; 0 -> half the period
+};
+typedef struct channel_setup_message_t channel_setup_message;
+#define LENGTH_CHANNEL_SETUP_MESSAGE sizeof(channel_setup_message)
+
+// Edge of an input with timer input capture, in place of TYPE_INPUTS. ticks
+// is the timer count latched by the hardware at the edge; ns = ticks * 1e9 /
+// capture_hz of TYPE_INFO. uptime_us is micros() when it was handled.
+// +-------+-------+-------+-------+
+// |         header        | is_se |
+// +-------+-------+-------+-------+
+// |           uptime_us           |
+// +-------+-------+-------+-------+
+// |           pulse_id            |
+// +-------+-------+-------+-------+
+// | input |         ticks         |
+// +-------+-------+-------+-------+
+// |             ticks             |
+// +-------+-------+-------+-------+
+// | ticks |
+// +-------+
+struct input_capture_message_t {
+    msg_header header;
+    uint8_t inputs_state;
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t input;  // IN0..IN7 index of the edge
+    uint64_t ticks; // capture timestamp
+};
+typedef struct input_capture_message_t input_capture_message;
+#define LENGTH_INPUT_CAPTURE_MESSAGE sizeof(input_capture_message)
+
+// Request: header only or with flags, Response: the performance counters of
+// the device (device_stats.h) since start or the last reset
+// +-------+-------+-------+-------+
+// |         header        | flags |
+// +-------+-------+-------+-------+
+enum stats_flags {
+    STATS_RESET = 1 << 0, // restart the counters after the response
+};
+struct stats_request_message_t {
+    msg_header header;
+    uint8_t flags; // booleans see stats_flags
+};
+typedef struct stats_request_message_t stats_request_message;
+#define LENGTH_STATS_REQUEST_MESSAGE sizeof(stats_request_message)
+
+// +-------+-------+-------+-------+
+// |         header        | elaps |
+// +-------+-------+-------+-------+
+// |      elapsed_ms       | loop_ |
+// +-------+-------+-------+-------+
+// |              ...              |
+// +-------+-------+-------+-------+
+// | ev_hw | cp_hw | edge_late_his |
+// +-------+-------+-------+-------+
+// Histograms have STATS_HISTOGRAM_BUCKETS power of two microsecond buckets:
+// < 1 us, < 2 us, < 4 us, ... , >= 1024 us.
+#define STATS_HISTOGRAM_BUCKETS 12
+#define STATS_RX_ERROR_BITS 6 // one counter per SERIAL_PEER_ERROR_CODE bit
+struct stats_message_t {
+    msg_header header;
+    uint32_t elapsed_ms;        // since start or the last reset
+    uint32_t loop_count;        // passes of loop()
+    uint32_t loop_max_us;       // longest pass
+    uint32_t edge_count;        // pulse timer interrupts
+    uint32_t edge_late_max_us;  // longest compare match to interrupt time
+    uint32_t input_captures;    // input interrupts that found a change
+    uint32_t input_edges;       // changed inputs in them
+    uint32_t input_events;      // queued for them, the rest was merged
+    uint32_t input_lost;        // events dropped, buffer full
+    uint32_t tx_frames;         // frames handed to the serial port
+    uint32_t tx_bytes;          // their size before the COBS encoding
+    uint32_t tx_dropped;        // frames dropped, transmit queue full
+    uint32_t rx_frames;         // frames received
+    uint16_t rx_errors[STATS_RX_ERROR_BITS]; // frames with the error bit
+    uint16_t tx_free_min;       // least free space of the transmit buffer
+    uint8_t input_high_water;   // highest fill of the input event buffer
+    uint8_t capture_high_water; // highest fill of the capture event buffer
+    uint16_t loop_histogram[STATS_HISTOGRAM_BUCKETS];      // pass times
+    uint16_t edge_late_histogram[STATS_HISTOGRAM_BUCKETS]; // edge lateness
+};
+typedef struct stats_message_t stats_message;
+#define LENGTH_STATS_MESSAGE sizeof(stats_message)
+
+// Link speed change, see serial_link.h. Proposal, answered with TYPE_ACK or
+// TYPE_ERROR at the old rate:
+// +-------+-------+-------+-------+
+// |         header        | baudr |
+// +-------+-------+-------+-------+
+// |       baudrate        | flags |
+// +-------+-------+-------+-------+
+// With BAUD_VERIFY the host checks the new rate, the device answers with
+// BAUD_VERIFY and the rate it runs at. Unverified rates are dropped after
+// BAUD_VERIFY_TIMEOUT_MS.
+enum baud_flags {
+    BAUD_VERIFY = 1 << 0,
+};
+#define BAUD_VERIFY_TIMEOUT_MS 1000
+#define BAUD_DEFAULT 115200 // after reset
+struct baud_message_t {
+    msg_header header;
+    uint32_t baudrate;
+    uint8_t flags; // booleans see baud_flags
+};
+typedef struct baud_message_t baud_message;
+#define LENGTH_BAUD_MESSAGE sizeof(baud_message)
+
+// Pulse schedule: a table of segments one channel plays back to back
+// without the host. A segment is pulse_count pulses at pulse_millihz, then
+// gap_us without pulses until the next segment starts. Tables longer than
+// one message are sent in pieces in order, first is the table index of the
+// piece's first segment. The channel starts once all total segments
+// arrived, a running schedule is replaced at its next falling edge. Every
+// piece is answered with TYPE_ACK or TYPE_ERROR. A table holds up to 2
+// segments on the Uno/Nano and 64 on Teensy, longer ones are INVALID_VALUE.
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// | flags |    repeat     | first |
+// +-------+-------+-------+-------+
+// | count | total | segments ...
+// +-------+-------+-------+
+// Segment:
+// +-------+-------+-------+-------+
+// |         pulse_millihz         |
+// +-------+-------+-------+-------+
+// |          pulse_count          |
+// +-------+-------+-------+-------+
+// |            gap_us             |
+// +-------+-------+-------+-------+
+// |            high_us            |
+// +-------+-------+-------+-------+
+// | flags |
+// +-------+
+enum segment_flags {
+    SEGMENT_SILENT = 1 << 0, // no TYPE_SEGMENT at the start of the segment
+};
+struct schedule_segment_t {
+    uint32_t pulse_millihz; // not 0
+    uint32_t pulse_count;   // not 0
+    uint32_t gap_us;        // pause from where the next pulse would rise
+    uint32_t high_us;       // High time of every pulse; 0 -> half the period
+    uint8_t flags;          // booleans see segment_flags
+};
+typedef struct schedule_segment_t schedule_segment;
+#define LENGTH_SCHEDULE_SEGMENT sizeof(schedule_segment)
+struct schedule_message_t {
+    msg_header header;
+    uint8_t channel; // 0 .. PULSE_CHANNELS - 1
+    uint8_t flags;   // booleans see setup_flags, applied at the start
+    uint16_t repeat; // passes through the table; 0 -> until stopped
+    uint8_t first;
+    uint8_t count; // segments in this message
+    uint8_t total; // segments in the table
+    schedule_segment segments[];
+};
+typedef struct schedule_message_t schedule_message;
+#define MIN_LENGTH_SCHEDULE_MESSAGE sizeof(schedule_message)
+#define SCHEDULE_MESSAGE_MAX_SEGMENTS                                          \
+    ((0xFF + LENGTH_MSG_HEADER - MIN_LENGTH_SCHEDULE_MESSAGE) /                \
+     LENGTH_SCHEDULE_SEGMENT)
+
+// Start of a schedule segment, sent with the input events. pulse_id is the
+// one of the first pulse of the segment, pass counts from 0.
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// |           uptime_us           |
+// +-------+-------+-------+-------+
+// |           pulse_id            |
+// +-------+-------+-------+-------+
+// | segm  |     pass      |
+// +-------+-------+-------+
+struct segment_message_t {
+    msg_header header;
+    uint8_t channel;
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint8_t segment; // index in the table
+    uint16_t pass;
+};
+typedef struct segment_message_t segment_message;
+#define LENGTH_SEGMENT_MESSAGE sizeof(segment_message)
+
+// Cascading boards. A follower channel takes its pulses from clock_input,
+// wired to an output of the leader, and copies every edge to its outputs
+// from the input interrupt; its pulse_id counts these pulses. The rising
+// edge of sync_input, wired to a sync output of the leader, makes the pulse
+// it comes with pulse_id 0. The inputs of a follower are not reported.
+// sync_outputs are high during the pulse with pulse_id 0 of the channel, on
+// leaders and followers. A setup with a rate ends following.
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// | clock | sync  | sync_outputs  |
+// +-------+-------+-------+-------+
+#define CASCADE_NO_INPUT 0xFF
+struct cascade_message_t {
+    msg_header header;
+    uint8_t channel;
+    uint8_t clock_input;   // IN0..IN7 index; CASCADE_NO_INPUT -> generator
+    uint8_t sync_input;    // IN0..IN7 index; CASCADE_NO_INPUT -> none
+    uint16_t sync_outputs; // OUT00..OUT15 as bits
+};
+typedef struct cascade_message_t cascade_message;
+#define LENGTH_CASCADE_MESSAGE sizeof(cascade_message)
+
+// Timed command: a setup, stop or pulse_id reset of one channel that the
+// pulse interrupt applies exactly at a device time or right before a pulse.
+// Commands wait on the device in a queue, in order per channel. The message
+// is answered with TYPE_ACK once queued (TYPE_ERROR if invalid or the queue
+// is full) and with a timed_reply_message once applied. The queue holds 2
+// commands on the Uno/Nano and 16 on Teensy.
+// +-------+-------+-------+-------+
+// |         header        |  id   |
+// +-------+-------+-------+-------+
+// | chann | actio | trigg |  at   |
+// +-------+-------+-------+-------+
+// |              at               |
+// +-------+-------+-------+-------+
+// |          at           | p_mhz |
+// +-------+-------+-------+-------+
+// |     pulse_millihz     | p_lim |
+// +-------+-------+-------+-------+
+// |      pulse_limit      | hi_us |
+// +-------+-------+-------+-------+
+// |        high_us        | flags |
+// +-------+-------+-------+-------+
+// TIMED_AT_US: at is the 64 bit device clock (see TYPE_TIME_SYNC). A setup
+// makes its first pulse rise at at, after a stop no pulse rises at or after
+// at, after a reset the first pulse from at on has pulse_id 0.
+// TIMED_AT_PULSE: at is a pulse_id of the channel, the command applies
+// right before that pulse: it is the first pulse of a setup, the one before
+// it the last of a stop, and a reset makes it pulse_id 0.
+enum timed_action {
+    TIMED_SETUP = 1, // pulse_millihz 0 -> stop
+    TIMED_STOP,
+    TIMED_RESET,
+};
+enum timed_trigger {
+    TIMED_AT_US,
+    TIMED_AT_PULSE,
+};
+struct timed_message_t {
+    msg_header header;
+    uint8_t id;      // echoed in the reply
+    uint8_t channel; // 0 .. PULSE_CHANNELS - 1
+    uint8_t action;  // timed_action
+    uint8_t trigger; // timed_trigger
+    uint64_t at;     // device clock in us or pulse_id, see trigger
+    uint32_t pulse_millihz; // TIMED_SETUP only
+    uint32_t pulse_limit;   // 0 -> unlimited pulses
+    uint32_t high_us;       // High time of every pulse; 0 -> half the period
+    uint8_t flags;          // booleans see setup_flags
+};
+typedef struct timed_message_t timed_message;
+#define LENGTH_TIMED_MESSAGE sizeof(timed_message)
+
+// Timed command applied, sent with the input events:
+// +-------+-------+-------+-------+
+// |         header        |  id   |
+// +-------+-------+-------+-------+
+// | chann | statu |  applied_us   |
+// +-------+-------+-------+-------+
+// |          applied_us           |
+// +-------+-------+-------+-------+
+// |  applied_us   |   pulse_id    |
+// +-------+-------+-------+-------+
+// |   pulse_id    |
+// +-------+-------+
+// applied_us is the device clock of the edge the command took effect at:
+// the first rising edge of a setup or reset, the last falling edge of a
+// stop. A command for a stopped channel applies when loop() gets to it.
+enum timed_status {
+    TIMED_APPLIED,
+    TIMED_LATE, // time passed or pulse_id not reachable, applied right away
+};
+struct timed_reply_message_t {
+    msg_header header;
+    uint8_t id;
+    uint8_t channel;
+    uint8_t status;      // timed_status
+    uint64_t applied_us; // device clock
+    uint32_t pulse_id;   // first pulse of a setup or reset, last of a stop
+};
+typedef struct timed_reply_message_t timed_reply_message;
+#define LENGTH_TIMED_REPLY_MESSAGE sizeof(timed_reply_message)
+
+// Output pattern: a buffer of per-tick bitmaps of the outputs that the
+// device plays back from hardware, a timer paced DMA channel writes them to
+// the GPIO ports without the CPU (Teensy 4.x only, NOT_IMPLEMENTED on other
+// boards). PATTERN_LOAD writes count steps from first on, PATTERN_START
+// writes its steps too and then plays steps 0..length - 1 every tick_ns
+// over and over, PATTERN_STOP ends playback and clears the outputs of the
+// pattern. Answered with TYPE_ACK or TYPE_ERROR.
+// +-------+-------+-------+-------+
+// |         header        | actio |
+// +-------+-------+-------+-------+
+// | flags |     first     | count |
+// +-------+-------+-------+-------+
+// |    length     |    outputs    |
+// +-------+-------+-------+-------+
+// |            tick_ns            |
+// +-------+-------+-------+-------+
+// |     steps ...
+// +-------+-------+
+// PATTERN_STREAM splits the buffer into two halves that are refilled while
+// the other one plays: every played half is reported with a
+// pattern_status_message and can then be loaded again, in one or more
+// pieces in order. A half whose last step was not loaded again by the time
+// it is due stops the pattern. Without PATTERN_STREAM the buffer can not be
+// loaded while it plays.
+enum pattern_action {
+    PATTERN_LOAD,
+    PATTERN_START,
+    PATTERN_STOP,
+};
+enum pattern_flags {
+    PATTERN_STREAM = 1 << 0,
+};
+struct pattern_message_t {
+    msg_header header;
+    uint8_t action;   // pattern_action
+    uint8_t flags;    // booleans see pattern_flags, PATTERN_START only
+    uint16_t first;   // buffer index of steps[0]
+    uint8_t count;    // steps in this message
+    uint16_t length;  // PATTERN_START: steps played, even
+    uint16_t outputs; // PATTERN_START: OUT00..OUT15 driven by the pattern
+    uint32_t tick_ns; // PATTERN_START: time per step
+    uint16_t steps[]; // OUT00..OUT15 levels as bits
+};
+typedef struct pattern_message_t pattern_message;
+#define MIN_LENGTH_PATTERN_MESSAGE sizeof(pattern_message)
+// Frame and COBS overhead stay within the 256 byte receive buffer of
+// PacketSerial
+#define PATTERN_MESSAGE_MAX_STEPS 112
+
+// Output pattern progress, sent with the input events. first is the first
+// step of the half the status is about, halves counts the played halves
+// since PATTERN_START.
+// +-------+-------+-------+-------+
+// |         header        | statu |
+// +-------+-------+-------+-------+
+// |     first     |   uptime_us   |
+// +-------+-------+-------+-------+
+// |   uptime_us   |    halves     |
+// +-------+-------+-------+-------+
+// |    halves     |
+// +-------+-------+
+enum pattern_status {
+    PATTERN_REFILL,   // half played, load it again
+    PATTERN_UNDERRUN, // half not loaded in time, the pattern stopped
+};
+struct pattern_status_message_t {
+    msg_header header;
+    uint8_t status; // pattern_status
+    uint16_t first;
+    uint32_t uptime_us;
+    uint32_t halves;
+};
+typedef struct pattern_status_message_t pattern_status_message;
+#define LENGTH_PATTERN_STATUS_MESSAGE sizeof(pattern_status_message)
+
+// External trigger: an edge of input starts a burst of pulse_count pulses
+// on the outputs of the channel. The input interrupt writes the rising edge
+// of the first pulse to the ports before it even timestamps the edge, the
+// pulse interrupt plays the rest. Edges during a burst are ignored. The
+// channel keeps its outputs, inputs and pulse_id, a setup with a rate or a
+// cascade ends triggering. Answered with TYPE_ACK or TYPE_ERROR.
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// | input | flags |  pulse_count  |
+// +-------+-------+-------+-------+
+// |  pulse_count  | pulse_millihz |
+// +-------+-------+-------+-------+
+// | pulse_millihz |    high_us    |
+// +-------+-------+-------+-------+
+// |    high_us    |
+// +-------+-------+
+#define BURST_NO_INPUT 0xFF
+enum burst_flags {
+    BURST_FALLING_EDGE = 1 << 0, // trigger on the falling edge of input
+};
+struct burst_message_t {
+    msg_header header;
+    uint8_t channel;
+    uint8_t input;          // IN0..IN7 index; BURST_NO_INPUT -> disarm
+    uint8_t flags;          // booleans see burst_flags
+    uint32_t pulse_count;   // at least one
+    uint32_t pulse_millihz; // rate within the burst
+    uint32_t high_us;       // High time of every pulse; 0 -> half the period
+};
+typedef struct burst_message_t burst_message;
+#define LENGTH_BURST_MESSAGE sizeof(burst_message)
+
+// Burst triggered, sent with the input events:
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// | input | statu |   uptime_us   |
+// +-------+-------+-------+-------+
+// |   uptime_us   |   pulse_id    |
+// +-------+-------+-------+-------+
+// |   pulse_id    |  latency_ns   |
+// +-------+-------+-------+-------+
+// |  latency_ns   |
+// +-------+-------+
+// pulse_id is the one of the first pulse. latency_ns is the time from the
+// input edge to the first rising edge, measured against the capture timer
+// for inputs in IN_CAPTURE_INPUTS; other inputs have no timestamp of the
+// edge itself and report BURST_NO_LATENCY.
+#define BURST_NO_LATENCY 0xFFFFFFFFUL
+enum burst_status {
+    BURST_STARTED,
+    BURST_LATE, // first pulse longer, the pulse interrupt had planned ahead
+    BURST_BUSY, // edge during a burst, ignored
+};
+struct burst_reply_message_t {
+    msg_header header;
+    uint8_t channel;
+    uint8_t input;
+    uint8_t status; // burst_status
+    uint32_t uptime_us;
+    uint32_t pulse_id;
+    uint32_t latency_ns;
+};
+typedef struct burst_reply_message_t burst_reply_message;
+#define LENGTH_BURST_REPLY_MESSAGE sizeof(burst_reply_message)
+
+// Analog sampling in step with the pulses of one channel: every rising edge
+// of the channel converts the analog inputs in pins, divider > 1 adds
+// divider - 1 sets evenly spread over the period, so the channel is sampled
+// at divider times its pulse rate. Sets are sent in analog_samples_message
+// frames with the input events, a frame goes out once it is full or its
+// first set is max_latency_us old. A setup replaces the one before, pins 0
+// stops sampling. Answered with TYPE_ACK or TYPE_ERROR, NOT_IMPLEMENTED on
+// boards without an ADC the firmware drives.
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// | pins  | divid |max_latency_us |
+// +-------+-------+-------+-------+
+// |max_latency_us |
+// +-------+-------+
+// Bursts are sampled from their first rising edge on, followers at their
+// rising edges only, they have no period to divide.
+// Dividers are powers of two, the pulse interrupt divides by shifting
+#define ANALOG_MAX_DIVIDER 64
+struct analog_message_t {
+    msg_header header;
+    uint8_t channel;         // 0 .. PULSE_CHANNELS - 1
+    uint8_t pins;            // AIN0..AIN7 as bits; 0 -> off
+    uint8_t divider;         // sets per pulse, 1, 2, 4 .. ANALOG_MAX_DIVIDER
+    uint32_t max_latency_us; // send a frame when its first set is this old
+};
+typedef struct analog_message_t analog_message;
+#define LENGTH_ANALOG_MESSAGE sizeof(analog_message)
+
+// Converted sets of one analog setup, sent with the input events:
+// +-------+-------+-------+-------+
+// |         header        | chann |
+// +-------+-------+-------+-------+
+// | pins  | divid | index | count |
+// +-------+-------+-------+-------+
+// |           pulse_id            |
+// +-------+-------+-------+-------+
+// |           uptime_us           |
+// +-------+-------+-------+-------+
+// |             sets              |
+// +-------+-------+-------+-------+
+// |            dropped            |
+// +-------+-------+-------+-------+
+// |    values ...
+// +-------+-------+
+// The sets of a frame follow each other without a gap: pulse_id and index
+// are the ones of the first set, every further set has the next index, after
+// divider - 1 index 0 of the next pulse_id. Set index i of a pulse was
+// converted i / divider periods after its rising edge, uptime_us is micros()
+// at the start of the first set. values holds count sets of one value per
+// bit of pins, lowest pin first, in ADC counts (10 bit on AVR and Teensy).
+// sets counts the sets converted since the setup, dropped the ones lost
+// because the ADC was still busy or the buffer full.
+struct analog_samples_message_t {
+    msg_header header;
+    uint8_t channel;
+    uint8_t pins;
+    uint8_t divider;
+    uint8_t index;
+    uint8_t count;
+    uint32_t pulse_id;
+    uint32_t uptime_us;
+    uint32_t sets;
+    uint32_t dropped;
+    uint16_t values[];
+};
+typedef struct analog_samples_message_t analog_samples_message;
+#define MIN_LENGTH_ANALOG_SAMPLES_MESSAGE sizeof(analog_samples_message)
+
+// Sequence numbers on the event stream, for hosts that have to record
+// without a gap. With SEQUENCE_ON every frame of the event stream (inputs,
+// captures, segments, timed, pattern, burst and analog reports, overflow
+// reports) goes out wrapped in a sequenced_message, numbered from 0. The
+// device keeps the latest of them as sent; a host that sees a number
+// missing asks for it with a resend_message and holds back the frames
+// after the gap until it arrives. Nothing is acknowledged, on a clean link
+// the wrapper is all that is added. Answered with TYPE_ACK.
+// Only the event stream is numbered, not every frame of the device. Acks,
+// time sync, info, baud and stats replies, errors and text go out
+// unnumbered from their own transmit classes and overtake the event
+// stream, so one numbering would not reach the host in order. A lost reply
+// shows as a request without an answer, a lost error or text goes
+// unnoticed. The Uno/Nano answer TYPE_SEQUENCE with NOT_IMPLEMENTED.
+// +-------+-------+-------+-------+
+// |         header        | flags |
+// +-------+-------+-------+-------+
+enum sequence_flags {
+    SEQUENCE_ON = 1 << 0, // 0 -> frames are sent as they are
+};
+struct sequence_message_t {
+    msg_header header;
+    uint8_t flags; // sequence_flags
+};
+typedef struct sequence_message_t sequence_message;
+#define LENGTH_SEQUENCE_MESSAGE sizeof(sequence_message)
+
+// A frame of the event stream and its number, modulo 2^16:
+// +-------+-------+-------+-------+
+// |         header        | seque |
+// +-------+-------+-------+-------+
+// | seque | frame ...
+// +-------+-------+
+// frame is the message as it is sent without sequence numbers, header
+// included. A resent frame has the same bytes as the first time.
+struct sequenced_message_t {
+    msg_header header;
+    uint16_t sequence;
+    uint8_t frame[];
+};
+typedef struct sequenced_message_t sequenced_message;
+#define MIN_LENGTH_SEQUENCED_MESSAGE sizeof(sequenced_message)
+
+// Host: send the frames first .. first + count - 1 again. Device: these of
+// them are no longer held and lost, sent ahead of the frames it still has.
+// The device answers nothing else, a host repeats a request that is not
+// served in time.
+// +-------+-------+-------+-------+
+// |         header        | first |
+// +-------+-------+-------+-------+
+// | first |     count     |
+// +-------+-------+-------+
+struct resend_message_t {
+    msg_header header;
+    uint16_t first;
+    uint16_t count;
+};
+typedef struct resend_message_t resend_message;
+#define LENGTH_RESEND_MESSAGE sizeof(resend_message)
 
 #pragma pack(pop)
 
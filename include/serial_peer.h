@@ -2,54 +2,217 @@
                        // once by including the header multiple times.
 #define _SERIAL_PEER_H
 
+#include "device_stats.h"
+#include "pulse_channel.h"
+#include "serial_link.h"
 #include "serial_messages.h"
+#include "tx_queue.h"
 #include <Arduino.h>
 
-#define SERIAL_PEER_MAX_BUFFER_SIZE (0xFF - MIN_LENGTH_ERROR_MESSAGE)
+// Outgoing messages other than input batches, the largest is the stats
+#if defined(__AVR__)
+#define SERIAL_PEER_MAX_BUFFER_SIZE 128
+#else
+#define SERIAL_PEER_MAX_BUFFER_SIZE (0xFF - MIN_LENGTH_MESSAGE)
+#endif
+static_assert(SERIAL_PEER_MAX_BUFFER_SIZE >= LENGTH_STATS_MESSAGE,
+              "SERIAL_PEER_MAX_BUFFER_SIZE can not take a stats message");
+// Link errors (no rejected message) with the same flags are sent at most
+// once per holdoff, a persistent receive overflow would report on every pass
+#define SERIAL_PEER_ERROR_HOLDOFF_MS 100
+#if defined(__AVR__)
+#define SERIAL_PEER_MAX_BATCH_SIZE 48
+#else
+#define SERIAL_PEER_MAX_BATCH_SIZE SERIAL_PEER_MAX_BUFFER_SIZE
+#endif
+// Sequence numbers and resends of the event stream (TYPE_SEQUENCE). The
+// replay buffer does not fit the 2 kB of the ATmega328P next to the rest,
+// there TYPE_SEQUENCE is NOT_IMPLEMENTED.
+#if defined(__AVR__)
+#define SERIAL_PEER_SEQUENCING 0
+#else
+#define SERIAL_PEER_SEQUENCING 1
+#endif
+#if SERIAL_PEER_SEQUENCING
+#include "replay_buffer.h"
+// Event stream frames are at most a batch long, sequenced they are wrapped
+#define SERIAL_PEER_MAX_SEQUENCED_SIZE                                         \
+    (MIN_LENGTH_SEQUENCED_MESSAGE + SERIAL_PEER_MAX_BATCH_SIZE)
+static_assert(SERIAL_PEER_MAX_SEQUENCED_SIZE <= REPLAY_BUFFER_SIZE,
+              "REPLAY_BUFFER_SIZE can not take a full batch");
+#else
+#define SERIAL_PEER_MAX_SEQUENCED_SIZE SERIAL_PEER_MAX_BATCH_SIZE
+#endif
 struct setup_struct_t {
-    uint32_t delay_us;    // delay until first pulse
-    uint32_t pulse_limit; // 0 -> unlimited pulses
-    uint8_t pulse_hz;     // Frequency in herz 1-255; 0 -> OFF
-    uint8_t flags;        // booleans
+    uint32_t delay_us;      // delay until first pulse
+    uint32_t pulse_limit;   // 0 -> unlimited pulses
+    uint32_t pulse_millihz; // Frequency in millihertz; 0 -> OFF
+    uint32_t high_us;       // High time of every pulse; 0 -> half the period
+    uint8_t flags;          // booleans
 };
 typedef struct setup_struct_t SetupStruct;
 #define LENGTH_SETUP_STRUCT sizeof(SetupStruct)
 
-enum SERIAL_PEER_ERROR_CODE {
-    SERIAL_PEER_ERROR_LENGTH = 1 << 0,
-    SERIAL_PEER_ERROR_CRC = 1 << 1,
-    SERIAL_PEER_ERROR_NOT_IMPLEMENTED = 1 << 2,
-    SERIAL_PEER_ERROR_UNKNOWN_PACKET = 1 << 3,
-
-};
 class SerialPeer {
 
   public:
-    typedef void (*PacketSenderFunction)(const uint8_t *buffer, size_t size);
+    /// @param priority tx_priority of the message type
+    typedef void (*PacketSenderFunction)(const uint8_t *buffer, size_t size,
+                                         uint8_t priority);
+    typedef uint64_t (*ClockFunction)();
+    /// @return false if the piece does not fit the table being loaded
+    typedef uint8_t (*ScheduleLoaderFunction)(const schedule_message *msg);
+    /// @return false if the queue is full
+    typedef uint8_t (*TimedQueueFunction)(const timed_message *msg);
+    /// @return false if a value is out of range or the steps are in use
+    typedef uint8_t (*PatternLoaderFunction)(const pattern_message *msg);
+    /// @return false if a value is out of range
+    typedef uint8_t (*AnalogSetupFunction)(const analog_message *msg);
 
     void setPacketSender(PacketSenderFunction sendPacketFunction) {
         _sendPacketFunction = sendPacketFunction;
     }
+    /// @brief 64 bit device clock for time sync responses
+    void setClock(ClockFunction clockFunction) {
+        _clockFunction = clockFunction;
+    }
+    /// @brief Loads TYPE_SCHEDULE pieces right away, the ack tells the host
+    /// whether the piece was taken
+    void setScheduleLoader(ScheduleLoaderFunction scheduleLoaderFunction) {
+        _scheduleLoaderFunction = scheduleLoaderFunction;
+    }
+    /// @brief Queues TYPE_TIMED commands right away, acknowledged once
+    /// queued
+    void setTimedQueue(TimedQueueFunction timedQueueFunction) {
+        _timedQueueFunction = timedQueueFunction;
+    }
+    /// @brief Hands TYPE_PATTERN messages over right away, without a loader
+    /// they are NOT_IMPLEMENTED
+    void setPatternLoader(PatternLoaderFunction patternLoaderFunction) {
+        _patternLoaderFunction = patternLoaderFunction;
+    }
+    /// @brief Applies TYPE_ANALOG setups right away, without it they are
+    /// NOT_IMPLEMENTED
+    void setAnalogSetup(AnalogSetupFunction analogSetupFunction) {
+        _analogSetupFunction = analogSetupFunction;
+    }
 
     SerialPeer();
     uint8_t handleMessage(uint8_t *msg, size_t len);
     uint8_t getSetup(SetupStruct *setup);
     void handleSetup(setup_message *msg, size_t len);
+    uint8_t getChannelSetup(uint8_t channel, PulseChannelSetup *setup);
+    uint8_t getCascadeSetup(uint8_t channel, PulseCascadeSetup *setup);
+    uint8_t getBurstSetup(uint8_t channel, PulseBurstSetup *setup);
+    uint8_t getInfoRequest();
+    uint8_t getStatsRequest(uint8_t *reset);
+    uint8_t getBaudRequest(uint32_t *baudrate);
+    uint8_t getBaudVerify();
 
     void sendMessage(uint8_t *msg, size_t len);
+#if SERIAL_PEER_SEQUENCING
+    uint8_t resendNext();
+#endif
     void sendInputs(uint32_t uptime_us, uint32_t pulse_id,
                     uint8_t inputs_state);
-    void sendError(uint8_t *msg, uint8_t len);
+    void queueInputs(uint32_t uptime_us, uint32_t pulse_id,
+                     uint8_t inputs_state);
+    size_t inputsFrameLength();
+    void updateBatch(uint32_t current_us);
+    void flushBatch();
+    void sendError(uint8_t error_flags, const msg_header *rejected = nullptr,
+                   uint8_t calc_crc = 0, uint16_t received_len = 0,
+                   uint16_t expected_len = 0);
     void sendTxt(uint8_t *msg, uint8_t len);
     void sendAck();
+    void sendInfo(uint32_t cpu_hz, uint16_t output_skew_cycles,
+                  uint8_t output_ports, uint32_t capture_hz,
+                  uint8_t capture_inputs);
+    void sendInputCapture(uint32_t uptime_us, uint32_t pulse_id,
+                          uint8_t inputs_state, uint8_t input,
+                          uint64_t ticks);
+    void sendEventOverflow(uint32_t lost_events);
+    void sendStats(const DeviceStats *stats);
+    void sendBaud(uint32_t baudrate, uint8_t flags);
+    void sendTimeSync();
+    void sendSegment(uint8_t channel, uint32_t uptime_us, uint32_t pulse_id,
+                     uint8_t segment, uint16_t pass);
+    void sendTimed(uint8_t id, uint8_t channel, uint8_t status,
+                   uint64_t applied_us, uint32_t pulse_id);
+    void sendPattern(uint8_t status, uint16_t first, uint32_t uptime_us,
+                     uint32_t halves);
+    void sendBurst(uint8_t channel, uint8_t input, uint8_t status,
+                   uint32_t uptime_us, uint32_t pulse_id, uint32_t latency_ns);
+    /// @brief Values of the next sendAnalogSamples(), written in place. No
+    /// other message may be sent in between.
+    uint16_t *analogSampleValues() {
+        return ((analog_samples_message *)_buffer)->values;
+    }
+    void sendAnalogSamples(uint8_t channel, uint8_t pins, uint8_t divider,
+                           uint8_t index, uint8_t count, uint32_t pulse_id,
+                           uint32_t uptime_us, uint32_t sets,
+                           uint32_t dropped);
 
   private:
     void _sendTypedMessage(uint8_t type, uint8_t *msg, uint8_t len);
+    void finishHeader(msg_header *header);
+    void handleBatchConfig(batch_config_message *msg);
+    void handleChannelSetup(channel_setup_message *msg);
+    void handleCascade(cascade_message *msg);
+    void handleBurst(burst_message *msg);
+    void handleBaud(baud_message *msg);
+#if SERIAL_PEER_SEQUENCING
+    void handleSequence(sequence_message *msg);
+    void handleResend(resend_message *msg);
+    void sendSequenced(const uint8_t *frame, size_t len);
+    void sendResendLost(uint16_t first, uint16_t count);
+#endif
+    void handleTimeSync(time_sync_message *msg, uint64_t device_rx_us);
     uint8_t calculateCrc(uint8_t *payload, size_t len);
     uint8_t _buffer[SERIAL_PEER_MAX_BUFFER_SIZE];
+    uint8_t _header_v2 = false; // version of the last valid message
     SetupStruct _setup;
     uint8_t _setup_changed = false;
+    // Every channel has its own slot, several setups can arrive at once
+    PulseChannelSetup _channel_setups[PULSE_CHANNELS];
+    uint8_t _channel_setups_changed = 0; // channel bits
+    PulseCascadeSetup _cascade_setups[PULSE_CHANNELS];
+    uint8_t _cascade_setups_changed = 0; // channel bits
+    PulseBurstSetup _burst_setups[PULSE_CHANNELS];
+    uint8_t _burst_setups_changed = 0; // channel bits
+    uint8_t _info_requested = false;
+    uint32_t _baud_proposed = 0;
+    uint8_t _baud_verify_requested = false;
+    uint8_t _link_error_flags = 0; // last link error and when it was sent
+    uint32_t _link_error_ms = 0;
+    uint8_t _stats_requested = false;
+    uint8_t _stats_flags = 0; // stats_flags of the request
+    uint8_t _time_sync_pending = false; // reply held for the next frame
+    uint64_t _time_sync_host_tx = 0;
+    uint64_t _time_sync_rx_us = 0;
+#if SERIAL_PEER_SEQUENCING
+    // Sequence numbers of the event stream, off until TYPE_SEQUENCE
+    uint8_t _sequence_on = false;
+    uint8_t _sequence_buffer[SERIAL_PEER_MAX_SEQUENCED_SIZE];
+    ReplayBuffer _replay;
+    uint16_t _resend_next = 0; // frames of TYPE_RESEND requests left
+    uint16_t _resend_end = 0;
+#endif
+    // Input batching, off until the host sends a TYPE_BATCH_CONFIG
+    uint8_t _batch_buffer[SERIAL_PEER_MAX_BATCH_SIZE];
+    uint8_t _batch_len = 0;
+    uint8_t _batch_crc8 = 0; // over the payload after count
+    uint8_t _batch_sum = 0;
+    uint8_t _batch_max_bytes = 0;
+    uint32_t _batch_max_latency_us = 0;
+    uint32_t _batch_last_uptime_us = 0;
+    uint32_t _batch_last_pulse_id = 0;
     PacketSenderFunction _sendPacketFunction = nullptr;
+    ClockFunction _clockFunction = nullptr;
+    ScheduleLoaderFunction _scheduleLoaderFunction = nullptr;
+    TimedQueueFunction _timedQueueFunction = nullptr;
+    PatternLoaderFunction _patternLoaderFunction = nullptr;
+    AnalogSetupFunction _analogSetupFunction = nullptr;
 };
 
 #endif
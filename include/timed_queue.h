@@ -0,0 +1,39 @@
+#ifndef _TIMED_QUEUE_H
+#define _TIMED_QUEUE_H
+
+#include "pulse_channel.h"
+#include <stdint.h>
+
+// Timed commands (TYPE_TIMED) waiting for their time, used from loop() only.
+//
+// Commands are kept in arrival order and handed to the pulse engine one per
+// channel: the oldest command of a channel is armed, the next one follows
+// once it has been reported. A command stays in the queue until its report
+// went out.
+#if defined(__AVR__)
+#define TIMED_QUEUE_SIZE 2
+#else
+#define TIMED_QUEUE_SIZE 16
+#endif
+// Time triggered commands are armed this long before their time. A stopped
+// channel starting from a timed setup has to wait up to this in one timer
+// interval.
+#define TIMED_ARM_US 200000UL
+
+class TimedQueue {
+
+  public:
+    /// @brief Append a command
+    /// @return false if the queue is full
+    uint8_t push(const PulseTimedCommand *command);
+    /// @brief Oldest command of a channel, nullptr if there is none
+    PulseTimedCommand *first(uint8_t channel);
+    /// @brief Remove a command returned by first()
+    void remove(PulseTimedCommand *command);
+
+  private:
+    PulseTimedCommand _commands[TIMED_QUEUE_SIZE];
+    uint8_t _size = 0;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef _TRIGGER_INPUTS_H
+#define _TRIGGER_INPUTS_H
+
+#include "trigger_outputs.h"
+#include "triggerpins_selector.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// The inputs IN0..IN7, captured a whole GPIO port at a time. Edges that
+// arrive together (several cameras answering the same trigger) are read with
+// one register read and reported as one change with one timestamp instead of
+// one interrupt, digitalRead() and micros() per pin. Pins that do not exist
+// on the board (e.g. -1) are dropped at compile time.
+
+#define NUM_INPUT_PINS 8
+
+#ifndef IN_CAPTURE_INPUTS
+#define IN_CAPTURE_INPUTS 0
+#endif
+
+constexpr int16_t INPUT_PINS[NUM_INPUT_PINS] = {
+    IN00_PIN, IN01_PIN, IN02_PIN, IN03_PIN,
+    IN04_PIN, IN05_PIN, IN06_PIN, IN07_PIN,
+};
+
+constexpr bool validInputPin(int16_t pin) {
+    return pin >= 0 && pin < NUM_DIGITAL_PINS;
+}
+
+/// @brief IN0..IN7 bits of the inputs that exist on the board
+constexpr uint8_t validInputs(uint8_t i = 0) {
+    return i >= NUM_INPUT_PINS
+               ? 0
+               : (validInputPin(INPUT_PINS[i]) ? 1 << i : 0) |
+                     validInputs(i + 1);
+}
+
+/// @brief IN0..IN7 bits of the inputs captured by port, the ones in
+/// IN_CAPTURE_INPUTS are latched by a timer instead (input_capture.h)
+constexpr uint8_t portInputs() { return validInputs() & ~IN_CAPTURE_INPUTS; }
+
+#if defined(__AVR_ATmega328P__)
+// Pin change interrupts: PCINT0 -> PORTB, PCINT1 -> PORTC, PCINT2 -> PORTD
+constexpr uint8_t avrInputPortMask(uint8_t port, uint8_t i = 0) {
+    return i >= NUM_INPUT_PINS
+               ? 0
+               : (((portInputs() & (1 << i)) &&
+                           avrPinPort(INPUT_PINS[i]) == port
+                       ? 1 << avrPinBit(INPUT_PINS[i])
+                       : 0) |
+                  avrInputPortMask(port, i + 1));
+}
+/// @brief IN0..IN7 bits of the inputs on a port
+constexpr uint8_t avrPortInputs(uint8_t port, uint8_t i = 0) {
+    return i >= NUM_INPUT_PINS
+               ? 0
+               : ((validInputPin(INPUT_PINS[i]) &&
+                           avrPinPort(INPUT_PINS[i]) == port
+                       ? 1 << i
+                       : 0) |
+                  avrPortInputs(port, i + 1));
+}
+
+#define IN_PORTB_MASK avrInputPortMask(AVR_PORTB)
+#define IN_PORTC_MASK avrInputPortMask(AVR_PORTC)
+#define IN_PORTD_MASK avrInputPortMask(AVR_PORTD)
+#endif
+
+/// @brief Called from the capture interrupt
+/// @param uptime_us micros() of the capture, shared by all changed inputs
+/// @param state levels of IN0..IN7
+/// @param changed inputs that changed since the last capture
+typedef void (*TriggerInputsHandler)(uint32_t uptime_us, uint8_t state,
+                                     uint8_t changed);
+
+/// @brief Called from the capture interrupt for edges of the inputs in
+/// IN_CAPTURE_INPUTS
+/// @param uptime_us micros() when the edge was handled
+/// @param ticks input capture timestamp, see inputCaptureHz()
+/// @param state levels of IN0..IN7
+/// @param input IN0..IN7 index of the edge
+typedef void (*TriggerCaptureHandler)(uint32_t uptime_us, uint64_t ticks,
+                                      uint8_t state, uint8_t input);
+
+/// @brief Called from the capture interrupt before the handler, before the
+/// edges are even timestamped
+/// @param state levels of IN0..IN7
+/// @param changed inputs that changed since the last capture
+/// @param capture_count low 16 bits of the capture timer at the edge, only
+/// for a single edge of a capture input
+/// @return inputs of changed it took, they are not passed to the handlers
+typedef uint8_t (*TriggerInputsFollower)(uint8_t state, uint8_t changed,
+                                         uint16_t capture_count);
+
+/// @brief Set pull ups and enable the capture interrupts. The handler is
+/// called once right away with all inputs as changed.
+/// @param capture_handler edges of timer captured inputs; nullptr -> handler
+void triggerInputsBegin(TriggerInputsHandler handler,
+                        TriggerCaptureHandler capture_handler = nullptr);
+/// @brief Hand edges to follower before they are reported, see
+/// PulseEngine::followInputs
+void triggerInputsSetFollower(TriggerInputsFollower follower);
+/// @brief Levels of IN0..IN7 at the last capture, safe to call from
+/// interrupts
+uint8_t triggerInputsState();
+
+#endif
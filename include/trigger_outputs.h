@@ -0,0 +1,104 @@
+#ifndef _TRIGGER_OUTPUTS_H
+#define _TRIGGER_OUTPUTS_H
+
+#include "triggerpins_selector.h"
+#include <Arduino.h>
+#include <stdint.h>
+
+// The trigger outputs OUT00..OUT15 grouped by GPIO port. All outputs on one
+// port change with a single register write, so there is no skew between them.
+// Pins that do not exist on the board (e.g. -1) are dropped at compile time.
+
+#define NUM_OUTPUT_PINS 16
+
+constexpr int16_t OUTPUT_PINS[NUM_OUTPUT_PINS] = {
+    OUT00_PIN, OUT01_PIN, OUT02_PIN, OUT03_PIN, OUT04_PIN, OUT05_PIN,
+    OUT06_PIN, OUT07_PIN, OUT08_PIN, OUT09_PIN, OUT10_PIN, OUT11_PIN,
+    OUT12_PIN, OUT13_PIN, OUT14_PIN, OUT15_PIN,
+};
+
+constexpr bool validOutputPin(int16_t pin) {
+    return pin >= 0 && pin < NUM_DIGITAL_PINS;
+}
+
+constexpr uint8_t countValidOutputPins(uint8_t i = 0) {
+    return i >= NUM_OUTPUT_PINS
+               ? 0
+               : validOutputPin(OUTPUT_PINS[i]) + countValidOutputPins(i + 1);
+}
+#define NUM_VALID_OUTPUT_PINS countValidOutputPins()
+
+#if defined(__AVR_ATmega328P__)
+// Arduino pin numbering of the ATmega328P variants (uno, nano):
+// 0-7 -> PORTD0-7, 8-13 -> PORTB0-5, 14-19 -> PORTC0-5
+enum AVR_PORT { AVR_PORTB, AVR_PORTC, AVR_PORTD };
+
+constexpr uint8_t avrPinPort(int16_t pin) {
+    return pin < 8 ? AVR_PORTD : (pin < 14 ? AVR_PORTB : AVR_PORTC);
+}
+constexpr uint8_t avrPinBit(int16_t pin) {
+    return pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14);
+}
+constexpr uint8_t avrOutputPortMask(uint8_t port, uint8_t i = 0) {
+    return i >= NUM_OUTPUT_PINS
+               ? 0
+               : ((validOutputPin(OUTPUT_PINS[i]) &&
+                           avrPinPort(OUTPUT_PINS[i]) == port
+                       ? 1 << avrPinBit(OUTPUT_PINS[i])
+                       : 0) |
+                  avrOutputPortMask(port, i + 1));
+}
+
+#define OUT_PORTB_MASK avrOutputPortMask(AVR_PORTB)
+#define OUT_PORTC_MASK avrOutputPortMask(AVR_PORTC)
+#define OUT_PORTD_MASK avrOutputPortMask(AVR_PORTD)
+#elif defined(__AVR__)
+#error "Error: No output port table for this AVR"
+#endif
+
+#define ALL_OUTPUTS 0xFFFF // OUT00..OUT15 as bits
+
+// Port masks of a subset of the outputs, resolved once from loop() so that
+// interrupts only combine and write them
+#if defined(__AVR__)
+struct trigger_output_mask_t {
+    uint8_t portb;
+    uint8_t portc;
+    uint8_t portd;
+};
+#elif defined(TEENSYDUINO)
+#define TRIGGER_OUTPUTS_MAX_PORTS                                              \
+    (NUM_VALID_OUTPUT_PINS > 0 ? NUM_VALID_OUTPUT_PINS : 1)
+struct trigger_output_mask_t {
+    uint32_t port[TRIGGER_OUTPUTS_MAX_PORTS];
+};
+#else
+struct trigger_output_mask_t {
+    uint32_t pins;
+};
+#endif
+typedef struct trigger_output_mask_t TriggerOutputMask;
+
+/// @brief Set pin modes and resolve the port table, measures the output skew
+void triggerOutputsBegin();
+/// @brief Resolve the port masks of outputs (bit i -> OUTii), after begin
+void triggerOutputsMask(uint16_t outputs, TriggerOutputMask *mask);
+/// @brief mask |= other, safe to call from interrupts
+void triggerOutputsMaskAdd(TriggerOutputMask *mask,
+                           const TriggerOutputMask *other);
+/// @brief Set and clear subsets of the outputs, one register write per port,
+/// safe to call from interrupts
+void triggerOutputsWriteMasks(const TriggerOutputMask *set,
+                              const TriggerOutputMask *clear);
+/// @brief Number of GPIO ports the outputs are spread over
+uint8_t triggerOutputsPorts();
+/// @brief Measured CPU cycles of a triggerOutputsWriteMasks() call that clears
+/// all outputs, upper bound of the skew between the first and the last output
+uint16_t triggerOutputsSkewCycles();
+#if defined(__IMXRT1062__)
+/// @brief GPIO DR_TOGGLE register of a port, for DMA. Mask bits of the port
+/// are the ones of TriggerOutputMask::port[port].
+volatile uint32_t *triggerOutputsToggleRegister(uint8_t port);
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _TX_QUEUE_H
+#define _TX_QUEUE_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+// Non-blocking transmit queue in front of the serial port.
+//
+// Frames are COBS encoded with their 0x00 marker straight into one byte ring
+// per priority class. update() writes only as many bytes as the port takes
+// without blocking, from the highest class that has data. A frame that was
+// started is always finished before another class gets its turn, so frames
+// never interleave on the wire. A frame that does not fit into its ring is
+// dropped and counted, loop() never waits for the port.
+enum tx_priority {
+    TX_PRIORITY_CONTROL, // acks, time sync and info replies
+    TX_PRIORITY_INPUTS,  // input events
+    TX_PRIORITY_STATS,
+    TX_PRIORITY_TEXT, // text, echo and errors
+    TX_PRIORITIES,
+};
+
+// Ring sizes per class, powers of two. The stats ring has to hold one
+// encoded stats_message.
+#if defined(__AVR__)
+#define TX_QUEUE_CONTROL_SIZE 32
+#define TX_QUEUE_INPUTS_SIZE 64
+#define TX_QUEUE_STATS_SIZE 128
+#define TX_QUEUE_TEXT_SIZE 32
+#else
+#define TX_QUEUE_CONTROL_SIZE 128
+#define TX_QUEUE_INPUTS_SIZE 1024
+#define TX_QUEUE_STATS_SIZE 256
+#define TX_QUEUE_TEXT_SIZE 512
+#endif
+
+/// @brief Ring space of a frame: COBS overhead and the 0x00 marker
+#define TX_QUEUE_FRAME_SPACE(len) ((len) + (len) / 254 + 2)
+
+class TxQueue {
+
+  public:
+    /// @brief Called by update() right before it picks the next frame, a
+    /// frame queued from it goes out next if its class is the highest
+    typedef void (*FrameStartFunction)();
+
+    TxQueue();
+    void setStream(Stream *stream) { _stream = stream; }
+    void setFrameStart(FrameStartFunction frameStartFunction) {
+        _frameStartFunction = frameStartFunction;
+    }
+
+    /// @brief Encode and queue a frame
+    /// @return false if it did not fit and was dropped
+    uint8_t push(uint8_t priority, const uint8_t *frame, size_t len);
+    /// @brief Free bytes in the ring of a class
+    uint16_t space(uint8_t priority);
+    /// @brief Hand queued bytes to the port as far as it takes them without
+    /// blocking, called from loop()
+    void update();
+    /// @brief Nothing left to write
+    uint8_t empty();
+    /// @brief Frames dropped because their ring was full
+    uint32_t getDropped() { return _dropped; }
+
+  private:
+    struct tx_ring_t {
+        uint8_t *data;
+        uint16_t mask;
+        uint16_t head; // free running
+        uint16_t tail;
+    };
+    uint8_t _control[TX_QUEUE_CONTROL_SIZE];
+    uint8_t _inputs[TX_QUEUE_INPUTS_SIZE];
+    uint8_t _stats[TX_QUEUE_STATS_SIZE];
+    uint8_t _text[TX_QUEUE_TEXT_SIZE];
+    struct tx_ring_t _rings[TX_PRIORITIES];
+    int8_t _current = -1; // class of the frame on the wire, -1 between frames
+    uint32_t _dropped = 0;
+    Stream *_stream = nullptr;
+    FrameStartFunction _frameStartFunction = nullptr;
+};
+
+#endif
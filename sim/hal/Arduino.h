@@ -0,0 +1,74 @@
+#ifndef _SIM_ARDUINO_H
+#define _SIM_ARDUINO_H
+
+// Subset of the Arduino API used by the firmware, backed by the virtual time
+// simulator in sim.h. Every call costs virtual time (see SimCosts) and is a
+// point where pending interrupts can be served.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// Emulates a 16 MHz AVR for everything derived from the core clock
+#define F_CPU 16000000UL
+
+#define NUM_DIGITAL_PINS 24
+#define NOT_A_PIN 0
+#define digitalPinToPort(pin)                                                  \
+    ((pin) >= 0 && (pin) < NUM_DIGITAL_PINS ? 1 : NOT_A_PIN)
+#define digitalPinToInterrupt(pin) (pin)
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t state);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*isr)(), int mode);
+void detachInterrupt(uint8_t interrupt);
+
+uint32_t micros();
+uint32_t millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void noInterrupts();
+void interrupts();
+
+class Stream {
+  public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+    virtual int availableForWrite() = 0;
+    virtual void flush() = 0;
+};
+
+// UART with a fixed size TX/RX FIFO, bytes move at the configured baudrate
+class SimSerial : public Stream {
+  public:
+    void begin(unsigned long baudrate);
+    void end();
+    int available() override;
+    int read() override;
+    size_t write(uint8_t byte) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int availableForWrite() override;
+    void flush() override;
+    operator bool() { return true; }
+};
+
+extern SimSerial Serial;
+
+#endif
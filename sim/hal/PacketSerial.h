@@ -0,0 +1,124 @@
+#ifndef _SIM_PACKET_SERIAL_H
+#define _SIM_PACKET_SERIAL_H
+
+// Stand-in for bakercp/PacketSerial with the same API and the same receive
+// behaviour (COBS framing, 0x00 packet marker, sticky overflow flag until
+// the next complete packet).
+
+#include <Arduino.h>
+
+class COBS {
+  public:
+    static size_t encode(const uint8_t *buffer, size_t size,
+                         uint8_t *encodedBuffer) {
+        size_t read_index = 0;
+        size_t write_index = 1;
+        size_t code_index = 0;
+        uint8_t code = 1;
+        while (read_index < size) {
+            if (buffer[read_index] == 0) {
+                encodedBuffer[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+                read_index++;
+            } else {
+                encodedBuffer[write_index++] = buffer[read_index++];
+                code++;
+                if (code == 0xFF) {
+                    encodedBuffer[code_index] = code;
+                    code = 1;
+                    code_index = write_index++;
+                }
+            }
+        }
+        encodedBuffer[code_index] = code;
+        return write_index;
+    }
+
+    static size_t decode(const uint8_t *encodedBuffer, size_t size,
+                         uint8_t *decodedBuffer) {
+        if (size == 0) {
+            return 0;
+        }
+        size_t read_index = 0;
+        size_t write_index = 0;
+        while (read_index < size) {
+            uint8_t code = encodedBuffer[read_index];
+            if (code == 0 || read_index + code > size) {
+                return 0;
+            }
+            read_index++;
+            for (uint8_t i = 1; i < code; i++) {
+                decodedBuffer[write_index++] = encodedBuffer[read_index++];
+            }
+            if (code != 0xFF && read_index != size) {
+                decodedBuffer[write_index++] = 0;
+            }
+        }
+        return write_index;
+    }
+
+    static size_t getEncodedBufferSize(size_t unencodedBufferSize) {
+        return unencodedBufferSize + unencodedBufferSize / 254 + 1;
+    }
+};
+
+template <typename EncoderType, uint8_t PacketMarker = 0,
+          size_t ReceiveBufferSize = 256>
+class PacketSerial_ {
+  public:
+    typedef void (*PacketHandlerFunction)(const uint8_t *buffer, size_t size);
+
+    void setStream(Stream *stream) { _stream = stream; }
+
+    void setPacketHandler(PacketHandlerFunction onPacketFunction) {
+        _onPacketFunction = onPacketFunction;
+    }
+
+    void update() {
+        if (_stream == nullptr) {
+            return;
+        }
+        while (_stream->available() > 0) {
+            uint8_t data = _stream->read();
+            if (data == PacketMarker) {
+                if (_onPacketFunction) {
+                    uint8_t decode_buffer[ReceiveBufferSize];
+                    size_t num_decoded = EncoderType::decode(
+                        _receive_buffer, _receive_buffer_index, decode_buffer);
+                    _receive_buffer_overflow = false;
+                    _onPacketFunction(decode_buffer, num_decoded);
+                }
+                _receive_buffer_index = 0;
+            } else if ((_receive_buffer_index + 1) < ReceiveBufferSize) {
+                _receive_buffer[_receive_buffer_index++] = data;
+            } else {
+                _receive_buffer_overflow = true;
+            }
+        }
+    }
+
+    void send(const uint8_t *buffer, size_t size) const {
+        if (_stream == nullptr || buffer == nullptr || size == 0) {
+            return;
+        }
+        uint8_t encode_buffer[EncoderType::getEncodedBufferSize(
+            ReceiveBufferSize)];
+        size_t num_encoded = EncoderType::encode(buffer, size, encode_buffer);
+        _stream->write(encode_buffer, num_encoded);
+        _stream->write(PacketMarker);
+    }
+
+    bool overflow() const { return _receive_buffer_overflow; }
+
+  private:
+    uint8_t _receive_buffer[ReceiveBufferSize];
+    size_t _receive_buffer_index = 0;
+    bool _receive_buffer_overflow = false;
+    Stream *_stream = nullptr;
+    PacketHandlerFunction _onPacketFunction = nullptr;
+};
+
+typedef PacketSerial_<COBS> PacketSerial;
+
+#endif
@@ -0,0 +1,621 @@
+/*******************************************************************************
+ * File:        sim.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "sim.h"
+
+#include <deque>
+#include <queue>
+#include <vector>
+
+const SimCosts SIM_COSTS_AVR = {
+    2000,  // loop_ns
+    3000,  // micros_ns
+    3500,  // digital_io_ns
+    190,   // port_write_ns, in/ori/out
+    3000,  // isr_entry_ns
+    2000,  // serial_byte_ns
+    0,     // baudrate
+    64,    // serial_tx_fifo
+    64,    // serial_rx_fifo
+    26000, // adc_conversion_ns, 13 ADC clocks at 500 kHz
+};
+
+const SimCosts SIM_COSTS_TEENSY4 = {
+    100,      // loop_ns
+    50,       // micros_ns
+    20,       // digital_io_ns
+    5,        // port_write_ns
+    100,      // isr_entry_ns
+    20,       // serial_byte_ns
+    12000000, // baudrate, USB full speed
+    512,      // serial_tx_fifo
+    512,      // serial_rx_fifo
+    3000,     // adc_conversion_ns
+};
+
+SimSerial Serial;
+
+enum SIM_EVENT_KIND {
+    SIM_EVENT_INPUT,
+    SIM_EVENT_HOST_BYTE,
+    SIM_EVENT_ADC,
+};
+
+struct sim_event_t {
+    uint64_t at_ns;
+    uint64_t seq; // keeps events with the same due time in order
+    uint8_t kind;
+    uint8_t pin;
+    uint8_t value;
+};
+typedef struct sim_event_t SimEvent;
+
+struct SimEventLater {
+    bool operator()(const SimEvent &a, const SimEvent &b) const {
+        return a.at_ns != b.at_ns ? a.at_ns > b.at_ns : a.seq > b.seq;
+    }
+};
+
+static SimCosts _costs;
+static uint64_t _now_ns = 0;
+static uint64_t _event_seq = 0;
+static std::priority_queue<SimEvent, std::vector<SimEvent>, SimEventLater>
+    _events;
+static uint8_t _interrupts_enabled = true;
+static uint32_t _interrupt_count = 0;
+static uint64_t _isr_raised_ns = 0;
+
+// Timer compare
+static SimIsr _timer_isr = nullptr;
+static uint64_t _timer_at_ns = 0;
+static uint8_t _timer_armed = false;
+static uint8_t _timer_pending = false;
+static uint64_t _timer_raised_ns = 0;
+
+// Pins
+static uint32_t _levels = 0;
+static SimIsr _pin_isr[NUM_DIGITAL_PINS];
+static int _pin_isr_mode[NUM_DIGITAL_PINS];
+static uint8_t _pin_pending[NUM_DIGITAL_PINS];
+static uint64_t _pin_raised_ns[NUM_DIGITAL_PINS];
+static SimOutputRecorder _output_recorder = nullptr;
+static SimIsr _port_isr = nullptr;
+static uint32_t _port_isr_mask = 0;
+static uint8_t _port_pending = false;
+static uint64_t _port_raised_ns = 0;
+static SimIsr _capture_isr = nullptr;
+static uint8_t _capture_pin = 0;
+static uint32_t _capture_hz = 0;
+static uint8_t _capture_pending = false;
+static uint64_t _capture_raised_ns = 0;
+static uint8_t _capture_level = 0;
+
+// ADC
+static SimIsr _adc_isr = nullptr;
+static uint8_t _adc_pending = false;
+static uint64_t _adc_raised_ns = 0;
+static uint16_t _adc_sampled = 0; // held since the start of the conversion
+static uint16_t _adc_result = 0;
+static SimAnalogSignal _analog_signal = nullptr;
+
+// DMA stream
+static const volatile uint32_t *_stream_words = nullptr;
+static uint16_t _stream_count = 0;
+static uint16_t _stream_position = 0;
+static uint64_t _stream_period_ns = 0;
+static uint64_t _stream_at_ns = 0;
+static uint8_t _stream_active = false;
+static SimIsr _stream_isr = nullptr;
+static uint8_t _stream_pending = false;
+static uint64_t _stream_raised_ns = 0;
+static SimOutputRecorder _stream_recorder = nullptr;
+
+// Serial
+static uint32_t _baudrate = 0;
+static uint64_t _byte_ns = 0;
+static uint64_t _host_byte_ns = 0; // 0 -> same rate as the device
+static std::deque<uint8_t> _rx_fifo;
+static uint32_t _rx_dropped = 0;
+static uint64_t _host_line_busy_ns = 0;   // host -> device
+static uint64_t _device_line_busy_ns = 0; // device -> host
+static SimHostReceiver _host_receiver = nullptr;
+
+/// @brief A byte received at another rate than it was sent at is garbage
+static uint8_t _lineByte(uint8_t byte) {
+    if (!_costs.baudrate && _host_byte_ns && _host_byte_ns != _byte_ns) {
+        return 0xFF;
+    }
+    return byte;
+}
+
+void simReset(const SimCosts &costs) {
+    _costs = costs;
+    _now_ns = 0;
+    _event_seq = 0;
+    _events = std::priority_queue<SimEvent, std::vector<SimEvent>,
+                                  SimEventLater>();
+    _interrupts_enabled = true;
+    _interrupt_count = 0;
+    _isr_raised_ns = 0;
+
+    _timer_isr = nullptr;
+    _timer_armed = false;
+    _timer_pending = false;
+
+    _levels = 0;
+    for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+        _pin_isr[pin] = nullptr;
+        _pin_pending[pin] = false;
+    }
+    _port_isr = nullptr;
+    _port_pending = false;
+    _capture_isr = nullptr;
+    _capture_pending = false;
+    _stream_active = false;
+    _stream_pending = false;
+    _adc_isr = nullptr;
+    _adc_pending = false;
+    _analog_signal = nullptr;
+
+    _baudrate = costs.baudrate;
+    _byte_ns = _baudrate ? 10 * SIM_NS_PER_S / _baudrate : 0;
+    _host_byte_ns = 0;
+    _rx_fifo.clear();
+    _rx_dropped = 0;
+    _host_line_busy_ns = 0;
+    _device_line_busy_ns = 0;
+}
+
+uint64_t simNowNs() { return _now_ns; }
+
+uint8_t simInterruptsEnabled() { return _interrupts_enabled; }
+
+uint32_t simInterruptCount() { return _interrupt_count; }
+
+uint64_t simIsrRaisedNs() { return _isr_raised_ns; }
+
+/// @brief Serve pending interrupts, oldest first, while interrupts are on
+static void _servePending() {
+    while (_interrupts_enabled) {
+        SimIsr isr = nullptr;
+        uint64_t raised_ns = UINT64_MAX;
+        // -1 timer, -2 port, -3 capture, -4 stream, -5 adc, otherwise pin
+        int8_t source = -1;
+        if (_timer_pending) {
+            isr = _timer_isr;
+            raised_ns = _timer_raised_ns;
+        }
+        if (_port_pending && _port_raised_ns < raised_ns) {
+            isr = _port_isr;
+            raised_ns = _port_raised_ns;
+            source = -2;
+        }
+        if (_capture_pending && _capture_raised_ns < raised_ns) {
+            isr = _capture_isr;
+            raised_ns = _capture_raised_ns;
+            source = -3;
+        }
+        if (_stream_pending && _stream_raised_ns < raised_ns) {
+            isr = _stream_isr;
+            raised_ns = _stream_raised_ns;
+            source = -4;
+        }
+        if (_adc_pending && _adc_raised_ns < raised_ns) {
+            isr = _adc_isr;
+            raised_ns = _adc_raised_ns;
+            source = -5;
+        }
+        for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+            if (_pin_pending[pin] && _pin_raised_ns[pin] < raised_ns) {
+                isr = _pin_isr[pin];
+                raised_ns = _pin_raised_ns[pin];
+                source = pin;
+            }
+        }
+        if (raised_ns == UINT64_MAX) {
+            return;
+        }
+        if (source == -1) {
+            _timer_pending = false;
+        } else if (source == -2) {
+            _port_pending = false;
+        } else if (source == -3) {
+            // Stays pending until simCaptureRead(), the ISR reads the latch
+        } else if (source == -4) {
+            _stream_pending = false;
+        } else if (source == -5) {
+            // Stays pending until simAdcRead(), the ISR reads the result
+        } else {
+            _pin_pending[source] = false;
+        }
+
+        _interrupts_enabled = false;
+        _interrupt_count++;
+        _isr_raised_ns = raised_ns;
+        simConsume(_costs.isr_entry_ns);
+        if (isr) {
+            isr();
+        }
+        _isr_raised_ns = 0;
+        _interrupts_enabled = true;
+    }
+}
+
+static uint64_t _nextEventNs() {
+    uint64_t next_ns = _events.empty() ? UINT64_MAX : _events.top().at_ns;
+    if (_timer_armed && _timer_at_ns < next_ns) {
+        next_ns = _timer_at_ns;
+    }
+    if (_stream_active && _stream_at_ns < next_ns) {
+        next_ns = _stream_at_ns;
+    }
+    return next_ns;
+}
+
+/// @brief One DMA transfer, the word lands in the port without the CPU
+static void _streamTransfer() {
+    uint32_t levels = _levels ^ _stream_words[_stream_position];
+    if (levels != _levels) {
+        _levels = levels;
+        if (_stream_recorder) {
+            _stream_recorder(_stream_at_ns, _levels);
+        }
+    }
+    _stream_position++;
+    if (_stream_position == _stream_count / 2 ||
+        _stream_position == _stream_count) {
+        // Like the DMA interrupt flag, a second raise while pending is lost
+        if (_stream_isr && !_stream_pending) {
+            _stream_pending = true;
+            _stream_raised_ns = _stream_at_ns;
+        }
+    }
+    if (_stream_position == _stream_count) {
+        _stream_position = 0;
+    }
+    _stream_at_ns += _stream_period_ns;
+}
+
+/// @brief Apply the next due hardware event and raise its interrupt
+static void _fireNextEvent() {
+    uint64_t event_ns = _events.empty() ? UINT64_MAX : _events.top().at_ns;
+    if (_timer_armed && _timer_at_ns <= event_ns &&
+        (!_stream_active || _timer_at_ns <= _stream_at_ns)) {
+        _timer_armed = false;
+        _timer_pending = true;
+        _timer_raised_ns = _timer_at_ns;
+        return;
+    }
+    if (_stream_active && _stream_at_ns <= event_ns) {
+        _streamTransfer();
+        return;
+    }
+    SimEvent event = _events.top();
+    _events.pop();
+    switch (event.kind) {
+    case SIM_EVENT_INPUT: {
+        uint8_t level = (_levels >> event.pin) & 1;
+        if (level == event.value) {
+            break;
+        }
+        _levels ^= 1UL << event.pin;
+        int mode = _pin_isr_mode[event.pin];
+        if (_pin_isr[event.pin] && !_pin_pending[event.pin] &&
+            (mode == CHANGE || (mode == RISING && event.value) ||
+             (mode == FALLING && !event.value))) {
+            _pin_pending[event.pin] = true;
+            _pin_raised_ns[event.pin] = event.at_ns;
+        }
+        if (_port_isr && ((_port_isr_mask >> event.pin) & 1) &&
+            !_port_pending) {
+            _port_pending = true;
+            _port_raised_ns = event.at_ns;
+        }
+        if (_capture_isr && event.pin == _capture_pin && !_capture_pending) {
+            _capture_pending = true;
+            _capture_raised_ns = event.at_ns;
+            _capture_level = event.value;
+        }
+        break;
+    }
+    case SIM_EVENT_HOST_BYTE:
+        if (_rx_fifo.size() < _costs.serial_rx_fifo) {
+            _rx_fifo.push_back(_lineByte(event.value));
+        } else {
+            _rx_dropped++;
+        }
+        break;
+    case SIM_EVENT_ADC:
+        _adc_result = _adc_sampled;
+        if (_adc_isr) {
+            _adc_pending = true;
+            _adc_raised_ns = event.at_ns;
+        }
+        break;
+    }
+}
+
+void simConsume(uint64_t ns) {
+    uint64_t remaining_ns = ns;
+    for (;;) {
+        _servePending();
+        uint64_t next_ns = _nextEventNs();
+        if (next_ns > _now_ns + remaining_ns) {
+            break;
+        }
+        if (next_ns > _now_ns) {
+            remaining_ns -= next_ns - _now_ns;
+            _now_ns = next_ns;
+        }
+        _fireNextEvent();
+    }
+    _now_ns += remaining_ns;
+    _servePending();
+}
+
+void simScheduleTimer(SimIsr isr, uint64_t at_ns) {
+    _timer_isr = isr;
+    _timer_at_ns = at_ns;
+    _timer_armed = true;
+}
+
+void simCancelTimer() {
+    _timer_armed = false;
+    _timer_pending = false;
+}
+
+static void _pushEvent(uint8_t kind, uint8_t pin, uint8_t value,
+                       uint64_t at_ns) {
+    SimEvent event = {at_ns, _event_seq++, kind, pin, value};
+    _events.push(event);
+}
+
+void simScheduleInput(uint8_t pin, uint8_t level, uint64_t at_ns) {
+    _pushEvent(SIM_EVENT_INPUT, pin, level, at_ns);
+}
+
+void simHostWrite(const uint8_t *bytes, size_t len, uint64_t at_ns) {
+    uint64_t byte_ns = _host_byte_ns ? _host_byte_ns : _byte_ns;
+    for (size_t i = 0; i < len; i++) {
+        uint64_t start_ns =
+            at_ns > _host_line_busy_ns ? at_ns : _host_line_busy_ns;
+        _host_line_busy_ns = start_ns + byte_ns;
+        _pushEvent(SIM_EVENT_HOST_BYTE, 0, bytes[i], _host_line_busy_ns);
+    }
+}
+
+void simSetHostBaudrate(uint32_t baudrate) {
+    _host_byte_ns = baudrate ? 10 * SIM_NS_PER_S / baudrate : 0;
+}
+
+void simSetHostReceiver(SimHostReceiver receiver) {
+    _host_receiver = receiver;
+}
+
+uint32_t simSerialRxDropped() { return _rx_dropped; }
+
+void simPortWrite(uint32_t set_mask, uint32_t clear_mask) {
+    simConsume(_costs.port_write_ns);
+    uint32_t levels = (_levels | set_mask) & ~clear_mask;
+    if (levels != _levels) {
+        _levels = levels;
+        if (_output_recorder) {
+            _output_recorder(_now_ns, _levels);
+        }
+    }
+}
+
+void simAttachPortInterrupt(uint32_t mask, SimIsr isr) {
+    _port_isr = isr;
+    _port_isr_mask = mask;
+    _port_pending = false;
+}
+
+uint32_t simPortRead() {
+    simConsume(_costs.port_write_ns);
+    return _levels;
+}
+
+static uint64_t _captureTicks(uint64_t ns) {
+    return ns / SIM_NS_PER_S * _capture_hz +
+           ns % SIM_NS_PER_S * _capture_hz / SIM_NS_PER_S;
+}
+
+void simAttachCaptureInterrupt(uint8_t pin, uint32_t hz, SimIsr isr) {
+    _capture_isr = isr;
+    _capture_pin = pin;
+    _capture_hz = hz;
+    _capture_pending = false;
+}
+
+uint64_t simCaptureRead(uint8_t *level) {
+    // Reading frees the latch for the next edge
+    *level = _capture_level;
+    uint64_t ticks = _captureTicks(_capture_raised_ns);
+    _capture_pending = false;
+    simConsume(_costs.port_write_ns);
+    return ticks;
+}
+
+uint64_t simCaptureCount() {
+    simConsume(_costs.port_write_ns);
+    return _captureTicks(_now_ns);
+}
+
+void simSetOutputRecorder(SimOutputRecorder recorder) {
+    _output_recorder = recorder;
+}
+
+void simStartStream(const volatile uint32_t *words, uint16_t count,
+                    uint64_t period_ns, SimIsr isr) {
+    _stream_words = words;
+    _stream_count = count;
+    _stream_position = 0;
+    _stream_period_ns = period_ns;
+    _stream_at_ns = _now_ns + period_ns;
+    _stream_isr = isr;
+    _stream_pending = false;
+    _stream_active = count > 0 && period_ns > 0;
+}
+
+void simStopStream() {
+    _stream_active = false;
+    _stream_pending = false;
+}
+
+uint16_t simStreamPosition() { return _stream_position; }
+
+void simSetStreamRecorder(SimOutputRecorder recorder) {
+    _stream_recorder = recorder;
+}
+
+void simAttachAdcInterrupt(SimIsr isr) {
+    _adc_isr = isr;
+    _adc_pending = false;
+}
+
+void simAdcStart(uint8_t pin) {
+    simConsume(_costs.port_write_ns);
+    _adc_sampled = _analog_signal ? _analog_signal(pin, _now_ns) : 0;
+    _pushEvent(SIM_EVENT_ADC, pin, 0, _now_ns + _costs.adc_conversion_ns);
+}
+
+uint16_t simAdcRead() {
+    _adc_pending = false;
+    simConsume(_costs.port_write_ns);
+    return _adc_result;
+}
+
+void simSetAnalogSignal(SimAnalogSignal signal) { _analog_signal = signal; }
+
+// ##################################################################### Pins
+void pinMode(uint8_t pin, uint8_t mode) {
+    simConsume(_costs.digital_io_ns);
+    if (pin < NUM_DIGITAL_PINS && mode == INPUT_PULLUP) {
+        _levels |= 1UL << pin;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t state) {
+    if (pin >= NUM_DIGITAL_PINS) {
+        simConsume(_costs.digital_io_ns);
+        return;
+    }
+    simPortWrite(state ? 1UL << pin : 0, state ? 0 : 1UL << pin);
+    simConsume(_costs.digital_io_ns - _costs.port_write_ns);
+}
+
+int digitalRead(uint8_t pin) {
+    simConsume(_costs.digital_io_ns);
+    return pin < NUM_DIGITAL_PINS ? (_levels >> pin) & 1 : LOW;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(), int mode) {
+    if (interrupt < NUM_DIGITAL_PINS) {
+        _pin_isr[interrupt] = isr;
+        _pin_isr_mode[interrupt] = mode;
+    }
+}
+
+void detachInterrupt(uint8_t interrupt) {
+    if (interrupt < NUM_DIGITAL_PINS) {
+        _pin_isr[interrupt] = nullptr;
+        _pin_pending[interrupt] = false;
+    }
+}
+
+// ##################################################################### Time
+uint32_t micros() {
+    simConsume(_costs.micros_ns);
+    return (uint32_t)(_now_ns / SIM_NS_PER_US);
+}
+
+uint32_t millis() {
+    simConsume(_costs.micros_ns);
+    return (uint32_t)(_now_ns / (SIM_NS_PER_US * 1000));
+}
+
+void delay(uint32_t ms) { simConsume(ms * SIM_NS_PER_US * 1000); }
+
+void delayMicroseconds(uint32_t us) { simConsume(us * SIM_NS_PER_US); }
+
+void noInterrupts() { _interrupts_enabled = false; }
+
+void interrupts() {
+    _interrupts_enabled = true;
+    _servePending();
+}
+
+// ################################################################### Serial
+void SimSerial::begin(unsigned long baudrate) {
+    if (!_costs.baudrate) {
+        _baudrate = baudrate;
+        _byte_ns = 10 * SIM_NS_PER_S / _baudrate;
+    }
+}
+
+void SimSerial::end() {}
+
+int SimSerial::available() {
+    simConsume(0);
+    return _rx_fifo.size();
+}
+
+int SimSerial::read() {
+    simConsume(_costs.serial_byte_ns);
+    if (_rx_fifo.empty()) {
+        return -1;
+    }
+    uint8_t byte = _rx_fifo.front();
+    _rx_fifo.pop_front();
+    return byte;
+}
+
+/// @brief Bytes still waiting in the TX FIFO, the shift register included
+static uint32_t _txLevel() {
+    if (_device_line_busy_ns <= _now_ns) {
+        return 0;
+    }
+    return (_device_line_busy_ns - _now_ns + _byte_ns - 1) / _byte_ns;
+}
+
+size_t SimSerial::write(uint8_t byte) {
+    simConsume(_costs.serial_byte_ns);
+    // A full FIFO blocks like HardwareSerial::write(), interrupts stay on
+    if (_txLevel() >= _costs.serial_tx_fifo) {
+        uint64_t free_ns =
+            _device_line_busy_ns - (_costs.serial_tx_fifo - 1) * _byte_ns;
+        simConsume(free_ns - _now_ns);
+    }
+    uint64_t start_ns =
+        _now_ns > _device_line_busy_ns ? _now_ns : _device_line_busy_ns;
+    _device_line_busy_ns = start_ns + _byte_ns;
+    if (_host_receiver) {
+        _host_receiver(_device_line_busy_ns, _lineByte(byte));
+    }
+    return 1;
+}
+
+size_t SimSerial::write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+int SimSerial::availableForWrite() {
+    simConsume(0);
+    return _costs.serial_tx_fifo - _txLevel();
+}
+
+void SimSerial::flush() {
+    if (_device_line_busy_ns > _now_ns) {
+        simConsume(_device_line_busy_ns - _now_ns);
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef _SIM_H
+#define _SIM_H
+
+// Discrete event simulator behind the Arduino HAL stand-in.
+//
+// Virtual time only moves when the firmware spends it: every HAL call and
+// every loop() pass costs a configurable number of nanoseconds. Hardware
+// events (timer compare, input edges, bytes from the host) are queued with
+// their due time. They raise a pending interrupt when they become due and
+// the interrupt is served as soon as interrupts are enabled, so masked
+// sections and long interrupt handlers show up as edge latency. Like on AVR
+// interrupts do not nest and several edges of one source while it is pending
+// collapse into one interrupt.
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#define SIM_NS_PER_US 1000ULL
+#define SIM_NS_PER_S 1000000000ULL
+
+struct sim_costs_t {
+    uint32_t loop_ns;        // fixed cost of one loop() pass
+    uint32_t micros_ns;      // micros() / millis()
+    uint32_t digital_io_ns;  // digitalRead() / digitalWrite() / pinMode()
+    uint32_t port_write_ns;  // one GPIO port register write
+    uint32_t isr_entry_ns;   // interrupt entry and exit
+    uint32_t serial_byte_ns; // CPU time per byte moved through Serial
+    uint32_t baudrate;       // 0 -> the one passed to Serial.begin()
+    uint16_t serial_tx_fifo;
+    uint16_t serial_rx_fifo;
+    uint32_t adc_conversion_ns; // start of a conversion to its interrupt
+};
+typedef struct sim_costs_t SimCosts;
+
+// 16 MHz ATmega328P with a 64 byte HardwareSerial
+extern const SimCosts SIM_COSTS_AVR;
+// 600 MHz Teensy 4.x with USB serial
+extern const SimCosts SIM_COSTS_TEENSY4;
+
+typedef void (*SimIsr)();
+typedef void (*SimOutputRecorder)(uint64_t time_ns, uint32_t high_mask);
+typedef void (*SimHostReceiver)(uint64_t time_ns, uint8_t byte);
+typedef uint16_t (*SimAnalogSignal)(uint8_t pin, uint64_t time_ns);
+
+void simReset(const SimCosts &costs);
+uint64_t simNowNs();
+/// @brief Spend CPU time, serves interrupts that become due meanwhile
+void simConsume(uint64_t ns);
+uint8_t simInterruptsEnabled();
+/// @brief Number of interrupts served since simReset()
+uint32_t simInterruptCount();
+/// @brief Due time of the interrupt being served, 0 outside of interrupts
+uint64_t simIsrRaisedNs();
+
+/// @brief Arm the single timer compare interrupt, replaces an armed one
+void simScheduleTimer(SimIsr isr, uint64_t at_ns);
+void simCancelTimer();
+
+/// @brief Drive an input pin to level at a future time
+void simScheduleInput(uint8_t pin, uint8_t level, uint64_t at_ns);
+
+/// @brief Bytes sent by the host, they arrive one byte time apart starting
+/// at at_ns (or after bytes still in flight)
+void simHostWrite(const uint8_t *bytes, size_t len, uint64_t at_ns);
+/// @brief Line rate of the host side, 0 follows Serial.begin(). Bytes
+/// between sides at different rates arrive as 0xFF.
+void simSetHostBaudrate(uint32_t baudrate);
+/// @brief Called for every byte the device sent, when its stop bit is out
+void simSetHostReceiver(SimHostReceiver receiver);
+/// @brief Bytes the host sent that did not fit into the RX FIFO
+uint32_t simSerialRxDropped();
+
+/// @brief Pin change interrupt of the port, raised by any edge of the pins
+/// in mask. Edges while it is pending collapse into it.
+void simAttachPortInterrupt(uint32_t mask, SimIsr isr);
+/// @brief Read all pin levels with one register access
+uint32_t simPortRead();
+/// @brief Timer input capture of one pin, counting at hz from time 0. The
+/// first edge latches the count and raises the interrupt, further edges
+/// while it is pending are not latched.
+void simAttachCaptureInterrupt(uint8_t pin, uint32_t hz, SimIsr isr);
+/// @brief Count and level latched by the pending capture
+uint64_t simCaptureRead(uint8_t *level);
+/// @brief Current count of the capture timer
+uint64_t simCaptureCount();
+/// @brief Write a port of all outputs with one register access
+void simPortWrite(uint32_t set_mask, uint32_t clear_mask);
+void simSetOutputRecorder(SimOutputRecorder recorder);
+
+/// @brief Timer paced DMA stream into the port toggle register: every
+/// period one word of the circular buffer is XORed into the pin levels, the
+/// first one a period from now. Costs no CPU time. isr is raised after the
+/// first half and after the whole buffer, the stream then starts over.
+void simStartStream(const volatile uint32_t *words, uint16_t count,
+                    uint64_t period_ns, SimIsr isr);
+void simStopStream();
+/// @brief Words written since the stream last started over
+uint16_t simStreamPosition();
+/// @brief Called for every stream word that changed pins, in place of the
+/// output recorder
+void simSetStreamRecorder(SimOutputRecorder recorder);
+
+/// @brief Conversion complete interrupt of the ADC
+void simAttachAdcInterrupt(SimIsr isr);
+/// @brief Start a conversion of an analog pin: the input is sampled now, the
+/// interrupt is raised adc_conversion_ns later
+void simAdcStart(uint8_t pin);
+/// @brief Result of the last conversion, clears its interrupt
+uint16_t simAdcRead();
+/// @brief Level of the analog pins over time, 0 if there is none
+void simSetAnalogSignal(SimAnalogSignal signal);
+
+#endif
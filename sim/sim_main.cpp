@@ -0,0 +1,2174 @@
+/*******************************************************************************
+ * File:        sim_main.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+// Scenario runner for the native build. Runs the unmodified firmware
+// (setup()/loop() from src/) on the virtual clock of sim/hal, plays a
+// scripted host and input edges against it and prints timing statistics.
+//
+//   program [scenario|all] [--teensy]
+
+#include "sim.h"
+#include "analog_sampler.h"
+
+#include "crc8.h"
+#include "input_events.h"
+#include "pulse_channel.h"
+#include "pulse_timer.h"
+#include "serial_link.h"
+#include "serial_messages.h"
+#include "trigger_inputs.h"
+#include "trigger_outputs.h"
+#include "triggerpins_selector.h"
+#include "tx_queue.h"
+#include <PacketSerial.h>
+
+#include <map>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+void setup();
+void loop();
+
+#define SIM_HISTOGRAM_BUCKETS 16
+#define SIM_INPUT_PINS 8
+
+static const int16_t _input_pins[SIM_INPUT_PINS] = {
+    IN00_PIN, IN01_PIN, IN02_PIN, IN03_PIN,
+    IN04_PIN, IN05_PIN, IN06_PIN, IN07_PIN,
+};
+
+// ###################################################################### Host
+struct sim_host_t {
+    std::vector<uint8_t> frame;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t input_events;
+    uint32_t input_edges; // changed bits between reported states
+    uint8_t inputs_state; // port captured inputs
+    uint8_t capture_state;
+    uint32_t capture_hz; // from TYPE_INFO
+    uint64_t capture_ticks; // last TYPE_INPUT_CAPTURE
+    uint32_t capture_backwards; // ticks before the ones of the last capture
+    uint32_t echoes;
+    uint32_t lost_events; // last TYPE_EVENT_OVERFLOW report
+    uint32_t acks;
+    uint32_t errors;
+    uint32_t crc_errors;
+    uint32_t baud_verified; // rate of the last TYPE_BAUD verify reply
+    uint32_t time_syncs; // TYPE_TIME_SYNC replies
+    uint64_t time_sync_delay_max_ns; // device_tx_us to the end of the reply
+    std::vector<segment_message> segments; // TYPE_SEGMENT in arrival order
+    std::vector<timed_reply_message> timed; // TYPE_TIMED in arrival order
+    std::vector<burst_reply_message> bursts; // TYPE_BURST in arrival order
+    uint8_t follower_inputs; // taken by a follower channel, not reported
+    uint8_t have_stats;
+    stats_message stats; // TYPE_STATS requested at the end of the run
+};
+static struct sim_host_t _host;
+
+// TYPE_BAUD proposals of the scenario, the host switches on their ack
+#define SIM_MAX_BAUD_PROPOSALS 4
+struct sim_baud_proposal_t {
+    uint64_t at_ns;
+    uint32_t baudrate;
+    uint8_t follow; // false: the cable can not carry it, the host stays
+    uint8_t acked;
+};
+static struct sim_baud_proposal_t _baud_proposals[SIM_MAX_BAUD_PROPOSALS];
+static uint8_t _num_baud_proposals = 0;
+
+static uint8_t _hostCrc(const uint8_t *payload, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc += payload[i];
+    }
+    return crc;
+}
+
+static uint32_t _readVarint(const uint8_t **cursor) {
+    uint32_t value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*cursor)++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+// Follower scenario: the leader's clock and sync lines are injected, the
+// rising edges of a camera input must carry the leader's pulse_id
+struct sim_cascade_t {
+    uint8_t camera_input; // IN0..IN7 index
+    std::vector<uint32_t> expected_ids;
+    uint32_t checked;
+    uint32_t wrong;
+};
+static struct sim_cascade_t _cascade;
+
+// Reported edges of one input against the injected ones, matched in order
+struct sim_input_timing_t {
+    std::vector<uint64_t> injected_ns;
+    size_t reported;
+    int64_t error_min_ns;
+    int64_t error_max_ns;
+    int64_t error_sum_ns;
+};
+static struct sim_input_timing_t _timing[SIM_INPUT_PINS];
+
+static void _hostTimeEdge(uint8_t input, uint64_t reported_ns) {
+    struct sim_input_timing_t *timing = &_timing[input];
+    if (timing->reported >= timing->injected_ns.size()) {
+        return;
+    }
+    int64_t error_ns =
+        (int64_t)(reported_ns - timing->injected_ns[timing->reported]);
+    if (!timing->reported || error_ns < timing->error_min_ns) {
+        timing->error_min_ns = error_ns;
+    }
+    if (!timing->reported || error_ns > timing->error_max_ns) {
+        timing->error_max_ns = error_ns;
+    }
+    timing->error_sum_ns += error_ns;
+    timing->reported++;
+}
+
+static void _hostInputState(uint8_t inputs_state, uint32_t uptime_us,
+                            uint32_t pulse_id) {
+    uint8_t changed = (inputs_state ^ _host.inputs_state) & portInputs() &
+                      ~_host.follower_inputs;
+    uint8_t camera = 1 << _cascade.camera_input;
+    if ((changed & inputs_state & camera) &&
+        _cascade.checked < _cascade.expected_ids.size()) {
+        _cascade.wrong += pulse_id != _cascade.expected_ids[_cascade.checked];
+        _cascade.checked++;
+    }
+    _host.input_events++;
+    _host.input_edges += __builtin_popcount(changed);
+    _host.inputs_state ^= changed;
+    for (uint8_t i = 0; i < SIM_INPUT_PINS; i++) {
+        if (changed & (1 << i)) {
+            _hostTimeEdge(i, uptime_us * SIM_NS_PER_US);
+        }
+    }
+}
+
+static void _hostInputCapture(const input_capture_message *msg) {
+    uint8_t bit = 1 << msg->input;
+    _host.input_events++;
+    _host.capture_backwards += msg->ticks < _host.capture_ticks;
+    _host.capture_ticks = msg->ticks;
+    if ((msg->inputs_state ^ _host.capture_state) & bit) {
+        _host.input_edges++;
+        _host.capture_state ^= bit;
+        if (_host.capture_hz) {
+            _hostTimeEdge(msg->input,
+                          msg->ticks * SIM_NS_PER_S / _host.capture_hz);
+        }
+    }
+}
+
+/// @brief Follow an acknowledged TYPE_BAUD proposal
+static void _hostBaudAck(uint64_t time_ns) {
+    for (uint8_t i = 0; i < _num_baud_proposals; i++) {
+        struct sim_baud_proposal_t *proposal = &_baud_proposals[i];
+        if (proposal->acked || proposal->at_ns > time_ns) {
+            continue;
+        }
+        proposal->acked = true;
+        if (proposal->follow) {
+            simSetHostBaudrate(proposal->baudrate);
+        }
+        return;
+    }
+}
+
+static void _hostPatternStatus(uint64_t time_ns,
+                               const pattern_status_message *msg);
+static void _hostAnalogSamples(const analog_samples_message *msg, size_t len);
+static void _hostSequenced(uint64_t time_ns, const sequenced_message *msg,
+                           size_t len);
+static void _hostResendLost(uint64_t time_ns, const resend_message *msg);
+static uint8_t _lineByte(uint8_t byte);
+
+static void _hostHandleFrame(uint64_t time_ns, const uint8_t *msg,
+                             size_t len) {
+    const message *type_message = (const message *)msg;
+    if (len < LENGTH_MSG_HEADER ||
+        len - LENGTH_MSG_HEADER != type_message->header.length) {
+        _host.errors++;
+        return;
+    }
+    uint8_t crc = type_message->header.type & HEADER_V2
+                      ? crc8Message(&type_message->header)
+                      : _hostCrc(type_message->value,
+                                 type_message->header.length);
+    if (crc != type_message->header.crc) {
+        _host.crc_errors++;
+        return;
+    }
+    switch (type_message->header.type & HEADER_TYPE_MASK) {
+    case TYPE_INPUTS: {
+        const input_state_message *inputs = (const input_state_message *)msg;
+        _hostInputState(inputs->inputs_state, inputs->uptime_us,
+                        inputs->pulse_id);
+        break;
+    }
+    case TYPE_INPUTS_BATCH: {
+        const input_batch_message *batch = (const input_batch_message *)msg;
+        const uint8_t *cursor = batch->deltas;
+        uint32_t uptime_us = batch->uptime_us;
+        uint32_t pulse_id = batch->pulse_id;
+        _hostInputState(batch->inputs_state, uptime_us, pulse_id);
+        for (uint8_t i = 1; i < batch->count; i++) {
+            uint8_t inputs_state = *cursor++;
+            uptime_us += _readVarint(&cursor);
+            pulse_id += _readVarint(&cursor);
+            _hostInputState(inputs_state, uptime_us, pulse_id);
+        }
+        if (cursor != msg + len) {
+            _host.errors++;
+        }
+        break;
+    }
+    case TYPE_INPUT_CAPTURE:
+        _hostInputCapture((const input_capture_message *)msg);
+        break;
+    case TYPE_INFO:
+        if (len == LENGTH_INFO_MESSAGE) {
+            _host.capture_hz = ((const info_message *)msg)->capture_hz;
+        }
+        break;
+    case TYPE_STATS:
+        if (len == LENGTH_STATS_MESSAGE) {
+            memcpy(&_host.stats, msg, LENGTH_STATS_MESSAGE);
+            _host.have_stats = true;
+        }
+        break;
+    case TYPE_EVENT_OVERFLOW:
+        _host.lost_events = ((const event_overflow_message *)msg)->lost_events;
+        break;
+    case TYPE_ACK:
+        _host.acks++;
+        _hostBaudAck(time_ns);
+        break;
+    case TYPE_ECHO:
+        _host.echoes++;
+        break;
+    case TYPE_TIME_SYNC:
+        if (len == LENGTH_TIME_SYNC_MESSAGE) {
+            // The device clock is micros() of the simulation
+            const time_sync_message *reply = (const time_sync_message *)msg;
+            uint64_t delay_ns = time_ns - reply->device_tx_us * SIM_NS_PER_US;
+            if (delay_ns > _host.time_sync_delay_max_ns) {
+                _host.time_sync_delay_max_ns = delay_ns;
+            }
+            _host.time_syncs++;
+        }
+        break;
+    case TYPE_BAUD:
+        if (len == LENGTH_BAUD_MESSAGE &&
+            ((const baud_message *)msg)->flags & BAUD_VERIFY) {
+            _host.baud_verified = ((const baud_message *)msg)->baudrate;
+        }
+        break;
+    case TYPE_SEGMENT:
+        if (len == LENGTH_SEGMENT_MESSAGE) {
+            _host.segments.push_back(*(const segment_message *)msg);
+        }
+        break;
+    case TYPE_TIMED:
+        if (len == LENGTH_TIMED_REPLY_MESSAGE) {
+            _host.timed.push_back(*(const timed_reply_message *)msg);
+        }
+        break;
+    case TYPE_PATTERN:
+        if (len == LENGTH_PATTERN_STATUS_MESSAGE) {
+            _hostPatternStatus(time_ns, (const pattern_status_message *)msg);
+        }
+        break;
+    case TYPE_BURST:
+        if (len == LENGTH_BURST_REPLY_MESSAGE) {
+            _host.bursts.push_back(*(const burst_reply_message *)msg);
+        }
+        break;
+    case TYPE_ANALOG_SAMPLES:
+        if (len >= MIN_LENGTH_ANALOG_SAMPLES_MESSAGE) {
+            _hostAnalogSamples((const analog_samples_message *)msg, len);
+        }
+        break;
+    case TYPE_SEQUENCE:
+        if (len >= MIN_LENGTH_SEQUENCED_MESSAGE + LENGTH_MSG_HEADER) {
+            _hostSequenced(time_ns, (const sequenced_message *)msg, len);
+        }
+        break;
+    case TYPE_RESEND:
+        if (len == LENGTH_RESEND_MESSAGE) {
+            _hostResendLost(time_ns, (const resend_message *)msg);
+        }
+        break;
+    case TYPE_ERROR:
+        _host.errors++;
+        break;
+    }
+}
+
+static void _hostReceive(uint64_t time_ns, uint8_t byte) {
+    _host.bytes++;
+    byte = _lineByte(byte);
+    if (byte != 0) {
+        _host.frame.push_back(byte);
+        return;
+    }
+    uint8_t decoded[512];
+    if (_host.frame.size() > sizeof(decoded)) {
+        // Garbage at a wrong rate
+        _host.frame.clear();
+        _host.errors++;
+        return;
+    }
+    size_t len = COBS::decode(_host.frame.data(), _host.frame.size(), decoded);
+    _host.frame.clear();
+    _host.frames++;
+    _hostHandleFrame(time_ns, decoded, len);
+}
+
+/// @brief Frame a message like the host library: header version 2, COBS,
+/// 0x00 marker
+static void _hostSend(void *msg, size_t len, uint64_t at_ns) {
+    msg_header *header = (msg_header *)msg;
+    header->type |= HEADER_V2;
+    header->length = len - LENGTH_MSG_HEADER;
+    header->crc = crc8Message(header);
+    uint8_t encoded[512];
+    size_t encoded_len = COBS::encode((uint8_t *)msg, len, encoded);
+    encoded[encoded_len++] = 0;
+    simHostWrite(encoded, encoded_len, at_ns);
+}
+
+static void _hostSendSetup(uint32_t pulse_millihz, uint32_t pulse_limit,
+                           uint32_t delay_us, uint32_t high_us, uint8_t flags,
+                           uint64_t at_ns) {
+    setup_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_SETUP;
+    msg.pulse_millihz = pulse_millihz;
+    msg.pulse_limit = pulse_limit;
+    msg.delay_us = delay_us;
+    msg.high_us = high_us;
+    msg.flags = flags;
+    _hostSend(&msg, LENGTH_SETUP_MESSAGE, at_ns);
+}
+
+static void _hostSendTimeSync(uint64_t at_ns) {
+    time_sync_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_TIME_SYNC;
+    msg.host_tx = at_ns;
+    _hostSend(&msg, LENGTH_TIME_SYNC_MESSAGE, at_ns);
+}
+
+static void _hostSendChannelSetup(uint8_t channel, uint16_t outputs,
+                                  uint8_t inputs, uint32_t pulse_millihz,
+                                  uint32_t phase_us, uint8_t flags,
+                                  uint64_t at_ns) {
+    channel_setup_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_CHANNEL_SETUP;
+    msg.channel = channel;
+    msg.outputs = outputs;
+    msg.inputs = inputs;
+    msg.pulse_millihz = pulse_millihz;
+    msg.phase_us = phase_us;
+    msg.flags = flags;
+    _hostSend(&msg, LENGTH_CHANNEL_SETUP_MESSAGE, at_ns);
+}
+
+// ##################################################################### Edges
+struct sim_edges_t {
+    uint32_t pulse_millihz;
+    uint64_t count;
+    uint64_t first_due_ns;
+    int64_t max_drift_ns; // due time against the exact rate
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+    uint64_t latency_histogram[SIM_HISTOGRAM_BUCKETS]; // log2(ns) buckets
+    uint32_t levels;
+    uint32_t toggles[NUM_OUTPUT_PINS];
+    // high time of OUT00, due to due time
+    uint64_t high_rise_ns;
+    uint64_t high_min_ns;
+    uint64_t high_max_ns;
+    uint32_t high_pulses;
+    std::vector<uint64_t> rises; // OUT00 due times, for the schedule
+    std::vector<uint64_t> strobe_rises; // OUT01 due times, for the stagger
+};
+static struct sim_edges_t _edges;
+
+static uint8_t _log2Bucket(uint64_t value) {
+    uint8_t bucket = 0;
+    while (value > 1 && bucket < SIM_HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void _recordBurst(uint64_t time_ns, uint64_t due_ns,
+                         uint32_t high_mask);
+
+static void _recordOutputs(uint64_t time_ns, uint32_t high_mask) {
+    uint64_t due_ns = simIsrRaisedNs();
+    if (!due_ns) {
+        return; // not written by the pulse timer
+    }
+    _recordBurst(time_ns, due_ns, high_mask);
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        if (validOutputPin(OUTPUT_PINS[i]) &&
+            ((high_mask ^ _edges.levels) >> OUTPUT_PINS[i]) & 1) {
+            _edges.toggles[i]++;
+        }
+    }
+    uint32_t out00 = 1UL << OUTPUT_PINS[0];
+    if ((high_mask & out00) && !(_edges.levels & out00)) {
+        _edges.high_rise_ns = due_ns;
+        _edges.rises.push_back(due_ns);
+    } else if (!(high_mask & out00) && (_edges.levels & out00)) {
+        uint64_t high_ns = due_ns - _edges.high_rise_ns;
+        if (!_edges.high_pulses || high_ns < _edges.high_min_ns) {
+            _edges.high_min_ns = high_ns;
+        }
+        if (high_ns > _edges.high_max_ns) {
+            _edges.high_max_ns = high_ns;
+        }
+        _edges.high_pulses++;
+    }
+    uint32_t out01 = 1UL << OUTPUT_PINS[1];
+    if ((high_mask & out01) && !(_edges.levels & out01)) {
+        _edges.strobe_rises.push_back(due_ns);
+    }
+    _edges.levels = high_mask;
+    if (!_edges.count) {
+        _edges.first_due_ns = due_ns;
+    }
+    // drift against the exact rate, for scenarios with a single rate
+    if (_edges.pulse_millihz) {
+        double half_period_ns = 1e12 / (2.0 * _edges.pulse_millihz);
+        int64_t drift_ns = (int64_t)due_ns -
+                           (int64_t)(_edges.first_due_ns +
+                                     llround(_edges.count * half_period_ns));
+        if (llabs(drift_ns) > llabs(_edges.max_drift_ns)) {
+            _edges.max_drift_ns = drift_ns;
+        }
+    }
+    uint64_t latency_ns = time_ns - due_ns;
+    _edges.latency_sum_ns += latency_ns;
+    if (latency_ns > _edges.latency_max_ns) {
+        _edges.latency_max_ns = latency_ns;
+    }
+    _edges.latency_histogram[_log2Bucket(latency_ns)]++;
+    _edges.count++;
+}
+
+// ################################################################# Scenarios
+struct sim_run_t {
+    uint64_t duration_ns;
+    uint32_t injected_edges;
+    uint64_t loop_passes;
+    uint64_t loop_sum_ns;
+    uint64_t loop_max_ns;
+    uint16_t serial_tx_fifo; // bytes the port buffers
+    uint32_t failed; // checks of the scenario that failed
+};
+static struct sim_run_t _run;
+
+/// @brief Check an expectation of the scenario, a failed one is reported
+/// and makes the scenario fail
+static void _check(uint8_t ok, const char *what) {
+    if (!ok) {
+        printf("FAILED                %s\n", what);
+        _run.failed++;
+    }
+}
+
+// Edges are due on the grid of the pulse timer ticks
+#define SIM_TICK_NS (SIM_NS_PER_US / PULSE_TIMER_TICKS_PER_US)
+
+static uint32_t _random_state = 1;
+static uint32_t _random() {
+    _random_state = _random_state * 1103515245 + 12345;
+    return _random_state >> 8;
+}
+
+/// @brief Toggle the inputs at rate_hz each, with random phase and jitter
+/// @param inputs IN0..IN7 bits
+static void _injectInputs(uint8_t inputs, uint32_t rate_hz, uint64_t from_ns,
+                          uint64_t to_ns) {
+    uint64_t period_ns = SIM_NS_PER_S / rate_hz;
+    for (uint8_t i = 0; i < SIM_INPUT_PINS; i++) {
+        if (!(inputs & (1 << i))) {
+            continue;
+        }
+        uint8_t level = LOW;
+        uint64_t at_ns = from_ns + _random() % period_ns;
+        while (at_ns < to_ns) {
+            simScheduleInput(_input_pins[i], level, at_ns);
+            _timing[i].injected_ns.push_back(at_ns);
+            level = !level;
+            _run.injected_edges++;
+            at_ns += period_ns / 2 + _random() % (period_ns / 4);
+        }
+    }
+}
+
+/// @brief Toggle the inputs together, every edge at the same time on all
+static void _injectCoincidentInputs(uint8_t inputs, uint32_t rate_hz,
+                                    uint64_t from_ns, uint64_t to_ns) {
+    uint64_t period_ns = SIM_NS_PER_S / rate_hz;
+    uint8_t level = LOW;
+    uint64_t at_ns = from_ns + _random() % period_ns;
+    while (at_ns < to_ns) {
+        for (uint8_t i = 0; i < SIM_INPUT_PINS; i++) {
+            if (inputs & (1 << i)) {
+                simScheduleInput(_input_pins[i], level, at_ns);
+                _timing[i].injected_ns.push_back(at_ns);
+                _run.injected_edges++;
+            }
+        }
+        level = !level;
+        at_ns += period_ns / 2 + _random() % (period_ns / 4);
+    }
+}
+
+static void _scenarioPulses() {
+    _edges.pulse_millihz = 100 * MILLIHZ_PER_HZ;
+    _hostSendSetup(_edges.pulse_millihz, 1000, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _run.duration_ns = 11 * SIM_NS_PER_S;
+}
+
+static void _checkPulses() {
+    // pulse_ids 0 .. pulse_limit
+    _check(_edges.high_pulses == 1001 &&
+               _edges.high_min_ns == 5000 * SIM_NS_PER_US &&
+               _edges.high_max_ns == 5000 * SIM_NS_PER_US,
+           "OUT00 pulses");
+}
+
+static void _scenarioFractional() {
+    _edges.pulse_millihz = 29970;
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _run.duration_ns = 600 * SIM_NS_PER_S;
+}
+
+static void _checkFractional() {
+    // One rise per period from the first one to the end of the run
+    uint64_t count = 0;
+    if (!_edges.rises.empty()) {
+        count = (_run.duration_ns - _edges.rises[0]) * _edges.pulse_millihz /
+                    (1000 * SIM_NS_PER_S) +
+                1;
+    }
+    printf("OUT00 rises           %u of %llu\n",
+           (unsigned)_edges.rises.size(), (unsigned long long)count);
+    _check(count && _edges.rises.size() == count, "pulses at 29.97 Hz");
+}
+
+/// @brief 8 inputs at the rate next to a 30 Hz channel
+static void _startInputs(uint32_t rate_hz) {
+    _edges.pulse_millihz = 30 * MILLIHZ_PER_HZ;
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    // Inputs with timer capture are timed by the capture scenario
+    _injectInputs(portInputs(), rate_hz, SIM_NS_PER_S / 5, 2 * SIM_NS_PER_S);
+    _run.duration_ns = 3 * SIM_NS_PER_S;
+}
+
+static void _sendBatchConfig() {
+    batch_config_message config;
+    config.header.type = TYPE_BATCH_CONFIG;
+    config.max_bytes = 0xFF;
+    config.max_latency_us = 5000;
+    _hostSend(&config, LENGTH_BATCH_CONFIG_MESSAGE, SIM_NS_PER_S / 20);
+}
+
+/// @brief Every event the device could not buffer is reported lost
+static void _checkInputs() {
+    _check(_host.have_stats && _host.lost_events == _host.stats.input_lost,
+           "lost input events reported");
+}
+
+static void _scenarioInputs() { _startInputs(500); }
+
+static void _scenarioInputsBatched() {
+    _sendBatchConfig();
+    _startInputs(500);
+}
+
+// About twice the events TYPE_INPUTS frames carry at 115200 baud
+#define SIM_LINK_INPUT_HZ 120
+
+static void _scenarioInputsLink() { _startInputs(SIM_LINK_INPUT_HZ); }
+
+static void _scenarioInputsLinkBatched() {
+    _sendBatchConfig();
+    _startInputs(SIM_LINK_INPUT_HZ);
+}
+
+static void _checkInputsLinkBatched() {
+    _checkInputs();
+    // Batches carry every event the link would drop as TYPE_INPUTS frames
+    _check(!_host.lost_events, "input events lost");
+}
+
+#define SIM_ECHOES 500
+#define SIM_TIME_SYNCS 50
+
+static void _scenarioSerialLoad() {
+    _edges.pulse_millihz = 100 * MILLIHZ_PER_HZ;
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    // Back to back echo frames, the device answers each one in full
+    uint8_t echo[200];
+    memset(echo, 0x55, sizeof(echo));
+    echo[0] = TYPE_ECHO;
+    for (uint16_t i = 0; i < SIM_ECHOES; i++) {
+        _hostSend(echo, sizeof(echo), SIM_NS_PER_S / 5);
+        // Time syncs in between, the echo replies keep the link busy
+        if (i % (SIM_ECHOES / SIM_TIME_SYNCS) == 0) {
+            _hostSendTimeSync(SIM_NS_PER_S / 5);
+        }
+    }
+    _run.duration_ns = 10 * SIM_NS_PER_S;
+}
+
+static void _checkSerialLoad() {
+    // The reply is stamped when the transmit queue starts it, behind at most
+    // a full port buffer, never behind the echo frame on the wire
+    uint64_t byte_ns = 10 * SIM_NS_PER_S / serialLinkBaudrate();
+    uint64_t bound_ns =
+        (_run.serial_tx_fifo + TX_QUEUE_FRAME_SPACE(LENGTH_TIME_SYNC_MESSAGE)) *
+        byte_ns;
+    printf("time sync             %u replies, stamp to end max %.3f us\n",
+           _host.time_syncs, _host.time_sync_delay_max_ns / 1e3);
+    _check(_host.echoes == SIM_ECHOES, "echo replies");
+    _check(_host.time_syncs == SIM_TIME_SYNCS &&
+               _host.time_sync_delay_max_ns <= bound_ns,
+           "time sync replies");
+}
+
+static void _scenarioChannels() {
+    // 200 Hz cameras on OUT00..07, a 25 Hz reference camera on OUT08 and a
+    // strobe on OUT09 at the camera rate, a quarter period late
+    _hostSendChannelSetup(0, 0x00FF, ALL_INPUTS, 200 * MILLIHZ_PER_HZ, 0,
+                          RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _hostSendChannelSetup(1, 0x0100, 0, 25 * MILLIHZ_PER_HZ, 0,
+                          RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _hostSendChannelSetup(2, 0x0200, 0, 200 * MILLIHZ_PER_HZ, 1250,
+                          RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _run.duration_ns = 10 * SIM_NS_PER_S;
+}
+
+// Closer to the camera edge than the timer resolves
+#define SIM_STAGGER_US 5
+
+static void _scenarioStagger() {
+    // A 100 Hz camera on OUT00 and a strobe on OUT01 that joins it later
+    _hostSendChannelSetup(0, 0x0001, 0, 100 * MILLIHZ_PER_HZ, 0,
+                          RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _hostSendChannelSetup(1, 0x0002, 0, 100 * MILLIHZ_PER_HZ, SIM_STAGGER_US,
+                          RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 2);
+    _run.duration_ns = 2 * SIM_NS_PER_S;
+}
+
+static void _checkStagger() {
+    // Edges on the 10 ms grid of the first camera edge, which is alone
+    uint64_t period_ns = 10000 * SIM_NS_PER_US;
+    uint64_t late_ns = PULSE_TIMER_MIN_TICKS * SIM_TICK_NS;
+    uint8_t ok = !_edges.rises.empty() && !_edges.strobe_rises.empty();
+    for (size_t i = 0; ok && i < _edges.rises.size(); i++) {
+        ok = (_edges.rises[i] - _edges.rises[0]) % period_ns <= late_ns;
+    }
+    _check(ok, "camera rises late at most by the timer resolution");
+    for (size_t i = 0; ok && i < _edges.strobe_rises.size(); i++) {
+        uint64_t offset_ns =
+            (_edges.strobe_rises[i] - _edges.rises[0]) % period_ns;
+        ok = offset_ns + SIM_TICK_NS >=
+                 SIM_STAGGER_US * SIM_NS_PER_US &&
+             offset_ns <= SIM_STAGGER_US * SIM_NS_PER_US + late_ns;
+    }
+    _check(ok, "strobe rises never before their offset");
+}
+
+static void _checkChannels() {
+    uint8_t ok = _edges.toggles[0] && _edges.toggles[8] && _edges.toggles[9];
+    for (uint8_t i = 1; i < 8; i++) {
+        ok &= _edges.toggles[i] == _edges.toggles[0];
+    }
+    for (uint8_t i = 10; i < NUM_OUTPUT_PINS; i++) {
+        ok &= !_edges.toggles[i];
+    }
+    _check(ok, "output edges of the channels");
+}
+
+static void _scenarioDuty() {
+    // 1 ms exposure at 100 Hz, then 50 Hz with 200 us; pulse counts must not
+    // change with the width
+    _hostSendSetup(100 * MILLIHZ_PER_HZ, 0, 0, 1000,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    _hostSendSetup(50 * MILLIHZ_PER_HZ, 0, 0, 200, SYNC_RISING_EDGE,
+                   5 * SIM_NS_PER_S);
+    _run.duration_ns = 10 * SIM_NS_PER_S;
+}
+
+static void _checkDuty() {
+    _check(_edges.high_min_ns == 200 * SIM_NS_PER_US &&
+               _edges.high_max_ns == 1000 * SIM_NS_PER_US,
+           "OUT00 high times");
+}
+
+static void _hostSendBaud(uint32_t baudrate, uint8_t follow, uint64_t at_ns) {
+    struct sim_baud_proposal_t *proposal =
+        &_baud_proposals[_num_baud_proposals++];
+    proposal->at_ns = at_ns;
+    proposal->baudrate = baudrate;
+    proposal->follow = follow;
+    proposal->acked = false;
+    baud_message msg;
+    msg.header.type = TYPE_BAUD;
+    msg.baudrate = baudrate;
+    msg.flags = 0;
+    _hostSend(&msg, LENGTH_BAUD_MESSAGE, at_ns);
+    if (follow) {
+        // Host messages are scheduled up front and go out in order, the
+        // verify is already on its way when the ack switches the host rate
+        msg.header.type = TYPE_BAUD;
+        msg.flags = BAUD_VERIFY;
+        _hostSend(&msg, LENGTH_BAUD_MESSAGE, at_ns + SIM_NS_PER_S / 50);
+    }
+}
+
+static void _scenarioBaud() {
+    // The inputs scenario at 1 Mbaud. Then 2 Mbaud that the cable can not
+    // carry: the host stays, the device falls back after the verify timeout
+    // and the stats request at the end still gets through.
+    _edges.pulse_millihz = 30 * MILLIHZ_PER_HZ;
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 5);
+    _hostSendBaud(1000000, true, SIM_NS_PER_S / 4);
+    _injectInputs(portInputs(), 500, SIM_NS_PER_S / 2, 2 * SIM_NS_PER_S);
+    _hostSendBaud(2000000, false, 2 * SIM_NS_PER_S + SIM_NS_PER_S / 5);
+    _run.duration_ns = 4 * SIM_NS_PER_S;
+}
+
+static void _checkBaud() {
+    // The device falls back from the second rate to the first
+    _check(_host.baud_verified == _baud_proposals[0].baudrate &&
+               serialLinkBaudrate() == _baud_proposals[0].baudrate,
+           "baudrate");
+}
+
+static void _scenarioCapture() {
+    // One input with timer capture and one without see the same edges while
+    // pulses and echo frames keep the interrupts busy
+    message info;
+    info.header.type = TYPE_INFO;
+    _hostSend(&info, MIN_LENGTH_MESSAGE, SIM_NS_PER_S / 20);
+    _edges.pulse_millihz = 100 * MILLIHZ_PER_HZ;
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, SIM_NS_PER_S / 10);
+    uint8_t echo[64];
+    memset(echo, 0x55, sizeof(echo));
+    echo[0] = TYPE_ECHO;
+    for (uint16_t i = 0; i < 100; i++) {
+        _hostSend(echo, sizeof(echo), SIM_NS_PER_S / 5);
+    }
+    uint8_t port_input = portInputs() & -portInputs();
+    _injectCoincidentInputs(IN_CAPTURE_INPUTS | port_input, 200,
+                            SIM_NS_PER_S / 5, 2 * SIM_NS_PER_S);
+    _run.duration_ns = 3 * SIM_NS_PER_S;
+}
+
+static void _checkCapture() {
+    // Captured edges are exact to a tick, micros() ones are not
+    uint8_t ok = _host.capture_hz && !_host.capture_backwards;
+    for (uint8_t i = 0; ok && i < SIM_INPUT_PINS; i++) {
+        const struct sim_input_timing_t *timing = &_timing[i];
+        if (!((IN_CAPTURE_INPUTS >> i) & 1) || timing->injected_ns.empty()) {
+            continue;
+        }
+        int64_t tick_ns = SIM_NS_PER_S / _host.capture_hz + 1;
+        ok = timing->reported == timing->injected_ns.size() &&
+             timing->error_min_ns > -tick_ns && timing->error_max_ns < tick_ns;
+    }
+    _check(ok, "capture timestamps");
+}
+
+// Table of the schedule scenario, checked against the OUT00 rises
+static std::vector<schedule_segment> _schedule;
+static uint16_t _schedule_repeat = 0;
+
+/// @brief Send the table in pieces of at most piece_size segments
+static void _hostSendSchedule(uint8_t channel, uint8_t flags, uint16_t repeat,
+                              uint8_t piece_size, uint64_t at_ns) {
+    uint8_t buffer[LENGTH_MSG_HEADER + 0xFF];
+    schedule_message *msg = (schedule_message *)buffer;
+    uint8_t total = _schedule.size();
+    for (uint8_t first = 0; first < total; first += piece_size) {
+        uint8_t count = total - first < piece_size ? total - first : piece_size;
+        msg->header.type = TYPE_SCHEDULE;
+        msg->channel = channel;
+        msg->flags = flags;
+        msg->repeat = repeat;
+        msg->first = first;
+        msg->count = count;
+        msg->total = total;
+        memcpy(msg->segments, &_schedule[first],
+               count * LENGTH_SCHEDULE_SEGMENT);
+        _hostSend(msg, MIN_LENGTH_SCHEDULE_MESSAGE +
+                           count * LENGTH_SCHEDULE_SEGMENT,
+                  at_ns);
+    }
+    _schedule_repeat = repeat;
+}
+
+static void _scenarioSchedule() {
+    // 5 pulses at 100 Hz, 50 ms pause, 3 silent pulses at 50 Hz, 4 pulses of
+    // 1 ms at 200 Hz, 20 ms pause; three passes, loaded in two pieces
+    schedule_segment segments[] = {
+        {100 * MILLIHZ_PER_HZ, 5, 50000, 0, 0},
+        {50 * MILLIHZ_PER_HZ, 3, 0, 0, SEGMENT_SILENT},
+        {200 * MILLIHZ_PER_HZ, 4, 20000, 1000, 0},
+    };
+    _schedule.assign(segments,
+                     segments + sizeof(segments) / sizeof(segments[0]));
+    _hostSendSchedule(0, RESET_COUNTER | SYNC_RISING_EDGE, 3, 2,
+                      SIM_NS_PER_S / 10);
+    _run.duration_ns = 2 * SIM_NS_PER_S;
+}
+
+/// @brief Compare OUT00 rises and TYPE_SEGMENT reports with the table
+static void _printScheduleReport() {
+    uint64_t expected_ns = _edges.rises.empty() ? 0 : _edges.rises[0];
+    int64_t max_error_ns = 0;
+    uint32_t expected_rises = 0;
+    uint32_t segment_reports = 0;
+    uint32_t segment_errors = 0;
+    for (uint16_t pass = 0; pass < _schedule_repeat; pass++) {
+        for (uint8_t i = 0; i < _schedule.size(); i++) {
+            const schedule_segment *segment = &_schedule[i];
+            if (!(segment->flags & SEGMENT_SILENT)) {
+                // Counters were reset, the first pulse has pulse_id 0
+                const segment_message *report =
+                    segment_reports < _host.segments.size()
+                        ? &_host.segments[segment_reports]
+                        : nullptr;
+                if (!report || report->segment != i || report->pass != pass ||
+                    report->pulse_id != expected_rises) {
+                    segment_errors++;
+                }
+                segment_reports++;
+            }
+            double period_ns = 1e12 / segment->pulse_millihz;
+            uint64_t start_ns = expected_ns;
+            for (uint32_t k = 0; k < segment->pulse_count; k++) {
+                expected_ns = start_ns + llround(k * period_ns);
+                if (expected_rises < _edges.rises.size()) {
+                    int64_t error_ns =
+                        (int64_t)_edges.rises[expected_rises] -
+                        (int64_t)expected_ns;
+                    if (llabs(error_ns) > llabs(max_error_ns)) {
+                        max_error_ns = error_ns;
+                    }
+                }
+                expected_rises++;
+            }
+            expected_ns = start_ns + llround(segment->pulse_count * period_ns) +
+                          (uint64_t)segment->gap_us * 1000;
+        }
+    }
+    printf("schedule              %u of %u rises, max error %lld ns, "
+           "%u of %u segment reports, %u wrong\n",
+           (unsigned)_edges.rises.size(), expected_rises,
+           (long long)max_error_ns, (unsigned)_host.segments.size(),
+           segment_reports, segment_errors);
+    _check(_edges.rises.size() == expected_rises &&
+               llabs(max_error_ns) <= SIM_TICK_NS,
+           "schedule rises");
+    _check(_host.segments.size() == segment_reports && !segment_errors,
+           "segment reports");
+}
+
+static void _hostSendCascade(uint8_t channel, uint8_t clock_input,
+                             uint8_t sync_input, uint16_t sync_outputs,
+                             uint64_t at_ns) {
+    cascade_message msg;
+    msg.header.type = TYPE_CASCADE;
+    msg.channel = channel;
+    msg.clock_input = clock_input;
+    msg.sync_input = sync_input;
+    msg.sync_outputs = sync_outputs;
+    _hostSend(&msg, LENGTH_CASCADE_MESSAGE, at_ns);
+}
+
+static void _scenarioCascade() {
+    // A leader at 100 Hz with 1 ms pulses on the clock input, its sync output
+    // on the sync input during pulse 0 and again during pulse 100 (a new
+    // recording). A camera answers every pulse 2 ms after its rising edge.
+    // Channel 0 follows and drives all outputs but the last, which is its
+    // sync output for the next board.
+    uint8_t inputs = portInputs();
+    uint8_t clock_input = __builtin_ctz(inputs);
+    inputs &= inputs - 1;
+    uint8_t sync_input = __builtin_ctz(inputs);
+    inputs &= inputs - 1;
+    _cascade.camera_input = __builtin_ctz(inputs);
+    _host.follower_inputs = (1 << clock_input) | (1 << sync_input);
+    _hostSendCascade(0, clock_input, sync_input, 1 << (NUM_OUTPUT_PINS - 1),
+                     SIM_NS_PER_S / 10);
+
+    // Pull ups hold the lines high until the leader drives them
+    simScheduleInput(_input_pins[clock_input], LOW, SIM_NS_PER_S / 20);
+    simScheduleInput(_input_pins[sync_input], LOW, SIM_NS_PER_S / 20);
+
+    uint64_t period_ns = SIM_NS_PER_S / 100;
+    uint64_t start_ns = SIM_NS_PER_S / 5;
+    for (uint32_t k = 0; k < 200; k++) {
+        uint64_t rise_ns = start_ns + k * period_ns;
+        simScheduleInput(_input_pins[clock_input], HIGH, rise_ns);
+        simScheduleInput(_input_pins[clock_input], LOW,
+                         rise_ns + SIM_NS_PER_S / 1000);
+        if (k % 100 == 0) {
+            simScheduleInput(_input_pins[sync_input], HIGH, rise_ns);
+            simScheduleInput(_input_pins[sync_input], LOW,
+                             rise_ns + SIM_NS_PER_S / 1000);
+        }
+        // Active low exposure of 2 ms, checked at its end
+        uint64_t exposure_ns = rise_ns + 2 * SIM_NS_PER_S / 1000;
+        uint8_t camera_pin = _input_pins[_cascade.camera_input];
+        simScheduleInput(camera_pin, LOW, exposure_ns);
+        simScheduleInput(camera_pin, HIGH,
+                         exposure_ns + 2 * SIM_NS_PER_S / 1000);
+        _timing[_cascade.camera_input].injected_ns.push_back(exposure_ns);
+        _timing[_cascade.camera_input].injected_ns.push_back(
+            exposure_ns + 2 * SIM_NS_PER_S / 1000);
+        _run.injected_edges += 2;
+        _cascade.expected_ids.push_back(k % 100);
+    }
+    _run.duration_ns = 3 * SIM_NS_PER_S;
+}
+
+// Timed commands of the timed scenario and the OUT00 rises they make
+struct sim_timed_expect_t {
+    uint8_t id;
+    uint8_t status;
+    uint64_t applied_us; // 0 -> not checked
+    uint32_t pulse_id;
+};
+static std::vector<sim_timed_expect_t> _timed_expected;
+#define SIM_TIMED_TOLERANCE_US 4
+static std::vector<uint64_t> _timed_rises_ns;
+
+static void _hostSendTimed(uint8_t id, uint8_t channel, uint8_t action,
+                           uint8_t trigger, uint64_t at,
+                           uint32_t pulse_millihz, uint32_t pulse_limit,
+                           uint8_t flags, uint64_t at_ns) {
+    timed_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_TIMED;
+    msg.id = id;
+    msg.channel = channel;
+    msg.action = action;
+    msg.trigger = trigger;
+    msg.at = at;
+    msg.pulse_millihz = pulse_millihz;
+    msg.pulse_limit = pulse_limit;
+    msg.flags = flags;
+    _hostSend(&msg, LENGTH_TIMED_MESSAGE, at_ns);
+}
+
+static void _scenarioTimed() {
+    // The sim device clock is the virtual time, so targets are given in it
+    // directly; a real host maps its clock with TYPE_TIME_SYNC.
+    // Channel 0 starts at 0.5 s at 100 Hz, its pulse_id restarts with the
+    // first pulse after 1.0025 s, pulse_id 100 switches it to 200 Hz and no
+    // pulse rises from 2.501 s on. Channel 1 joins the running engine at
+    // 0.7505 s. A setup for a time long gone comes last.
+    uint64_t ms = SIM_NS_PER_S / 1000;
+    _hostSendChannelSetup(1, 1 << 1, 0, 0, 0, 0, 50 * ms);
+    _hostSendTimed(1, 0, TIMED_SETUP, TIMED_AT_US, 500000,
+                   100 * MILLIHZ_PER_HZ, 0, RESET_COUNTER | SYNC_RISING_EDGE,
+                   100 * ms);
+    _hostSendTimed(6, 1, TIMED_SETUP, TIMED_AT_US, 750500,
+                   1000 * MILLIHZ_PER_HZ, 10, RESET_COUNTER, 150 * ms);
+    _hostSendTimed(2, 0, TIMED_RESET, TIMED_AT_US, 1002500, 0, 0, 0,
+                   200 * ms);
+    _hostSendTimed(3, 0, TIMED_SETUP, TIMED_AT_PULSE, 100,
+                   200 * MILLIHZ_PER_HZ, 0, SYNC_RISING_EDGE, 300 * ms);
+    _hostSendTimed(4, 0, TIMED_STOP, TIMED_AT_US, 2501000, 0, 0, 0,
+                   600 * ms);
+    _hostSendTimed(5, 0, TIMED_SETUP, TIMED_AT_US, 2000000,
+                   50 * MILLIHZ_PER_HZ, 5, RESET_COUNTER, 2600 * ms);
+
+    sim_timed_expect_t expected[] = {
+        {1, TIMED_APPLIED, 500000, 0},  {6, TIMED_APPLIED, 750500, 0},
+        {2, TIMED_APPLIED, 1010000, 0}, {3, TIMED_APPLIED, 2010000, 100},
+        {4, TIMED_APPLIED, 2502500, 198}, {5, TIMED_LATE, 0, 0},
+    };
+    _timed_expected.assign(expected,
+                           expected + sizeof(expected) / sizeof(expected[0]));
+    // 0.5 s .. 2.0 s at 100 Hz, 2.01 s .. 2.5 s at 200 Hz
+    for (uint32_t k = 0; k <= 150; k++) {
+        _timed_rises_ns.push_back(500 * ms + k * 10 * ms);
+    }
+    for (uint32_t k = 0; k <= 98; k++) {
+        _timed_rises_ns.push_back(2010 * ms + k * 5 * ms);
+    }
+    _run.duration_ns = 3 * SIM_NS_PER_S;
+}
+
+/// @brief Compare the TYPE_TIMED replies and OUT00 rises with the commands
+static void _printTimedReport() {
+    uint32_t wrong = 0;
+    for (size_t i = 0; i < _timed_expected.size(); i++) {
+        const sim_timed_expect_t *expect = &_timed_expected[i];
+        const timed_reply_message *reply = nullptr;
+        for (size_t j = 0; j < _host.timed.size(); j++) {
+            if (_host.timed[j].id == expect->id) {
+                reply = &_host.timed[j];
+            }
+        }
+        if (!reply) {
+            printf("timed id %u             no reply\n", expect->id);
+            wrong++;
+            continue;
+        }
+        // The engine starts as exact as micros() can tell
+        uint8_t ok = reply->status == expect->status &&
+                     reply->pulse_id == expect->pulse_id &&
+                     (!expect->applied_us ||
+                      llabs((int64_t)(reply->applied_us - expect->applied_us)) <=
+                          SIM_TIMED_TOLERANCE_US);
+        wrong += !ok;
+        printf("timed id %u             ch %u, %s at %llu us, pulse_id %u%s\n",
+               reply->id, reply->channel,
+               reply->status == TIMED_LATE ? "late" : "applied",
+               (unsigned long long)reply->applied_us, reply->pulse_id,
+               ok ? "" : " (wrong)");
+    }
+    // The late setup adds its pulses after the checked ones
+    int64_t max_error_ns = 0;
+    size_t checked = 0;
+    for (; checked < _timed_rises_ns.size() &&
+           checked < _edges.rises.size();
+         checked++) {
+        int64_t error_ns = (int64_t)_edges.rises[checked] -
+                           (int64_t)_timed_rises_ns[checked];
+        if (llabs(error_ns) > llabs(max_error_ns)) {
+            max_error_ns = error_ns;
+        }
+    }
+    printf("timed                 %u of %u replies right, %u of %u rises, "
+           "max error %lld ns, %u rises in total\n",
+           (unsigned)(_timed_expected.size() - wrong),
+           (unsigned)_timed_expected.size(), (unsigned)checked,
+           (unsigned)_timed_rises_ns.size(), (long long)max_error_ns,
+           (unsigned)_edges.rises.size());
+    _check(!wrong, "timed replies");
+    _check(checked == _timed_rises_ns.size() &&
+               llabs(max_error_ns) <=
+                   SIM_TIMED_TOLERANCE_US * (int64_t)SIM_NS_PER_US,
+           "timed rises");
+}
+
+// Output pattern scenario: a looped pattern, then a streamed one the host
+// refills from the TYPE_PATTERN events until it runs dry
+#define SIM_PATTERN_LOOP_LENGTH 8
+#define SIM_PATTERN_LOOP_TICK_NS 10000
+#define SIM_PATTERN_STREAM_LENGTH 224
+#define SIM_PATTERN_STREAM_TICK_NS 500000
+#define SIM_PATTERN_REFILLS 20
+#define SIM_PATTERN_HOST_LATENCY_NS (SIM_NS_PER_S / 1000)
+#define SIM_PATTERN_OUTPUTS 0x000F
+static const uint16_t _pattern_loop[SIM_PATTERN_LOOP_LENGTH] = {
+    0x1, 0x3, 0x2, 0x6, 0x4, 0xC, 0x8, 0x9,
+};
+struct sim_pattern_t {
+    uint8_t active;
+    uint32_t next_step;    // stream index of the next step the host sends
+    uint32_t refills_sent;
+    uint32_t refill_events;
+    uint32_t underruns;
+    uint32_t underrun_halves;
+    uint64_t stream_from_ns; // changes from here on belong to the stream
+    std::vector<std::pair<uint64_t, uint16_t>> changes; // OUT00..OUT15
+};
+static struct sim_pattern_t _pattern;
+
+/// @brief Step n of the streamed pattern, never repeats with the buffer
+static uint16_t _patternStreamStep(uint32_t n) {
+    return (n * 5 + n / 3) % 15 + 1;
+}
+
+static void _recordPattern(uint64_t time_ns, uint32_t high_mask) {
+    uint16_t outputs = 0;
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        if (validOutputPin(OUTPUT_PINS[i]) &&
+            (high_mask >> OUTPUT_PINS[i]) & 1) {
+            outputs |= 1 << i;
+        }
+    }
+    _pattern.changes.push_back(std::make_pair(time_ns, outputs));
+}
+
+static void _hostSendPattern(uint8_t action, uint8_t flags, uint16_t first,
+                             const uint16_t *steps, uint8_t count,
+                             uint16_t length, uint32_t tick_ns,
+                             uint64_t at_ns) {
+    uint8_t buffer[MIN_LENGTH_PATTERN_MESSAGE +
+                   PATTERN_MESSAGE_MAX_STEPS * sizeof(uint16_t)];
+    pattern_message *msg = (pattern_message *)buffer;
+    memset(msg, 0, MIN_LENGTH_PATTERN_MESSAGE);
+    msg->header.type = TYPE_PATTERN;
+    msg->action = action;
+    msg->flags = flags;
+    msg->first = first;
+    msg->count = count;
+    msg->length = length;
+    msg->outputs = SIM_PATTERN_OUTPUTS;
+    msg->tick_ns = tick_ns;
+    memcpy(buffer + MIN_LENGTH_PATTERN_MESSAGE, steps,
+           count * sizeof(uint16_t));
+    _hostSend(msg, MIN_LENGTH_PATTERN_MESSAGE + count * sizeof(uint16_t),
+              at_ns);
+}
+
+/// @brief Send the next steps of the stream into the half at first
+static void _hostSendStreamHalf(uint16_t first, uint8_t action,
+                                uint64_t at_ns) {
+    uint16_t steps[SIM_PATTERN_STREAM_LENGTH / 2];
+    for (uint16_t i = 0; i < SIM_PATTERN_STREAM_LENGTH / 2; i++) {
+        steps[i] = _patternStreamStep(_pattern.next_step++);
+    }
+    _hostSendPattern(action, PATTERN_STREAM, first, steps,
+                     SIM_PATTERN_STREAM_LENGTH / 2, SIM_PATTERN_STREAM_LENGTH,
+                     SIM_PATTERN_STREAM_TICK_NS, at_ns);
+}
+
+static void _hostPatternStatus(uint64_t time_ns,
+                               const pattern_status_message *msg) {
+    if (msg->status == PATTERN_UNDERRUN) {
+        _pattern.underruns++;
+        _pattern.underrun_halves = msg->halves;
+        return;
+    }
+    _pattern.refill_events++;
+    if (_pattern.refills_sent < SIM_PATTERN_REFILLS) {
+        _pattern.refills_sent++;
+        _hostSendStreamHalf(msg->first, PATTERN_LOAD,
+                            time_ns + SIM_PATTERN_HOST_LATENCY_NS);
+    }
+}
+
+static void _scenarioPattern() {
+    // Looped from 200 ms to 250 ms, the stream starts at 310 ms with both
+    // halves loaded: the second half first, then the first half with the
+    // start. Each half lasts 56 ms, longer than a refill takes at 115200
+    // baud.
+    uint64_t ms = SIM_NS_PER_S / 1000;
+    _pattern.active = true;
+    simSetStreamRecorder(&_recordPattern);
+    _hostSendPattern(PATTERN_START, 0, 0, _pattern_loop,
+                     SIM_PATTERN_LOOP_LENGTH, SIM_PATTERN_LOOP_LENGTH,
+                     SIM_PATTERN_LOOP_TICK_NS, 200 * ms);
+    _hostSendPattern(PATTERN_STOP, 0, 0, nullptr, 0, 0, 0, 250 * ms);
+    _pattern.stream_from_ns = 280 * ms;
+    _pattern.next_step = SIM_PATTERN_STREAM_LENGTH / 2;
+    _hostSendStreamHalf(SIM_PATTERN_STREAM_LENGTH / 2, PATTERN_LOAD,
+                        280 * ms);
+    _pattern.next_step = 0;
+    _hostSendStreamHalf(0, PATTERN_START, 310 * ms);
+    _pattern.next_step = SIM_PATTERN_STREAM_LENGTH;
+    _run.duration_ns = 2 * SIM_NS_PER_S;
+}
+
+/// @brief Check the recorded changes against the steps on the tick grid,
+/// the first change is step 0 one tick after the start
+/// @return steps checked
+static uint32_t _checkPattern(size_t from, size_t to, uint32_t tick_ns,
+                              uint16_t (*step)(uint32_t), uint32_t *wrong) {
+    *wrong = 0;
+    if (from >= to) {
+        return 0;
+    }
+    uint64_t start_ns = _pattern.changes[from].first - tick_ns;
+    uint64_t last_ns = _pattern.changes[to - 1].first;
+    size_t change = from;
+    uint16_t levels = step(0);
+    uint32_t k = 0;
+    for (; start_ns + (k + 1) * (uint64_t)tick_ns <= last_ns; k++) {
+        uint64_t due_ns = start_ns + (k + 1) * (uint64_t)tick_ns;
+        uint16_t expected = step(k);
+        if (k && expected == levels) {
+            continue;
+        }
+        // Any change before the due time is one too many
+        while (change < to && _pattern.changes[change].first < due_ns) {
+            (*wrong)++;
+            change++;
+        }
+        if (change < to && _pattern.changes[change].first == due_ns &&
+            (_pattern.changes[change].second & SIM_PATTERN_OUTPUTS) ==
+                expected) {
+            change++;
+        } else {
+            (*wrong)++;
+        }
+        levels = expected;
+    }
+    *wrong += to - change;
+    return k;
+}
+
+static uint16_t _patternLoopStep(uint32_t k) {
+    return _pattern_loop[k % SIM_PATTERN_LOOP_LENGTH];
+}
+
+static void _printPatternReport() {
+    size_t split = 0;
+    while (split < _pattern.changes.size() &&
+           _pattern.changes[split].first < _pattern.stream_from_ns) {
+        split++;
+    }
+    uint32_t wrong;
+    uint32_t steps = _checkPattern(0, split, SIM_PATTERN_LOOP_TICK_NS,
+                                   &_patternLoopStep, &wrong);
+    printf("pattern loop          %u steps of %u ns, %u wrong\n", steps,
+           SIM_PATTERN_LOOP_TICK_NS, wrong);
+    _check(steps && !wrong, "pattern loop steps");
+    steps = _checkPattern(split, _pattern.changes.size(),
+                          SIM_PATTERN_STREAM_TICK_NS, &_patternStreamStep,
+                          &wrong);
+    printf("pattern stream        %u steps of %u ns, %u wrong, %u refills "
+           "of %u events, %u underrun after %u halves\n",
+           steps, SIM_PATTERN_STREAM_TICK_NS, wrong, _pattern.refills_sent,
+           _pattern.refill_events, _pattern.underruns,
+           _pattern.underrun_halves);
+    // The stream runs dry once the refills are used up
+    _check(steps && !wrong, "pattern stream steps");
+    _check(_pattern.refills_sent == SIM_PATTERN_REFILLS &&
+               _pattern.underruns == 1,
+           "pattern stream refills");
+}
+
+// External trigger scenario: channel 0 pulses at 100 Hz while bursts are
+// triggered on channel 1 by rising edges of the capture input IN0 and on
+// channel 2 by falling edges of IN1. Some IN0 edges come during a burst.
+#define SIM_BURST_CHANNELS 2
+// Edges closer together than the timer resolves are written together
+#define SIM_BURST_TOLERANCE_NS                                                 \
+    (PULSE_TIMER_MIN_TICKS * SIM_NS_PER_US / PULSE_TIMER_TICKS_PER_US)
+struct sim_burst_channel_t {
+    uint8_t input;
+    uint8_t flags;
+    uint16_t outputs;
+    uint32_t pulse_count;
+    uint32_t pulse_millihz;
+    uint32_t high_us;
+    std::vector<uint64_t> triggers_ns; // edges that start a burst
+    uint32_t busy_triggers;            // edges during a burst
+    // First output of the channel, write and due times of its edges
+    std::vector<uint64_t> rises_ns;
+    std::vector<uint64_t> rises_due_ns;
+    std::vector<uint64_t> falls_due_ns;
+};
+struct sim_burst_t {
+    uint8_t active;
+    uint32_t levels;
+    struct sim_burst_channel_t channels[SIM_BURST_CHANNELS];
+};
+static struct sim_burst_t _burst;
+
+static void _recordBurst(uint64_t time_ns, uint64_t due_ns,
+                         uint32_t high_mask) {
+    if (!_burst.active) {
+        return;
+    }
+    for (uint8_t i = 0; i < SIM_BURST_CHANNELS; i++) {
+        struct sim_burst_channel_t *channel = &_burst.channels[i];
+        uint32_t pin = 1UL << OUTPUT_PINS[__builtin_ctz(channel->outputs)];
+        if (!((high_mask ^ _burst.levels) & pin)) {
+            continue;
+        }
+        if (high_mask & pin) {
+            channel->rises_ns.push_back(time_ns);
+            channel->rises_due_ns.push_back(due_ns);
+        } else {
+            channel->falls_due_ns.push_back(due_ns);
+        }
+    }
+    _burst.levels = high_mask;
+}
+
+static void _hostSendBurst(uint8_t channel, uint64_t at_ns) {
+    const struct sim_burst_channel_t *setup = &_burst.channels[channel - 1];
+    burst_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_BURST;
+    msg.channel = channel;
+    msg.input = setup->input;
+    msg.flags = setup->flags;
+    msg.pulse_count = setup->pulse_count;
+    msg.pulse_millihz = setup->pulse_millihz;
+    msg.high_us = setup->high_us;
+    _hostSend(&msg, LENGTH_BURST_MESSAGE, at_ns);
+}
+
+/// @brief Pulse an input away from its idle high level and back
+static void _injectInputPulse(uint8_t input, uint64_t low_ns,
+                              uint64_t high_ns) {
+    simScheduleInput(_input_pins[input], LOW, low_ns);
+    simScheduleInput(_input_pins[input], HIGH, high_ns);
+    _timing[input].injected_ns.push_back(low_ns);
+    _timing[input].injected_ns.push_back(high_ns);
+    _run.injected_edges += 2;
+}
+
+static void _scenarioBurst() {
+    uint64_t ms = SIM_NS_PER_S / 1000;
+    _burst.active = true;
+    struct sim_burst_channel_t *capture = &_burst.channels[0];
+    capture->input = 0;
+    capture->flags = 0;
+    capture->outputs = 0x00F0;
+    capture->pulse_count = 5;
+    capture->pulse_millihz = 1000000;
+    capture->high_us = 300;
+    struct sim_burst_channel_t *port = &_burst.channels[1];
+    port->input = 1;
+    port->flags = BURST_FALLING_EDGE;
+    port->outputs = 0x0F00;
+    port->pulse_count = 3;
+    port->pulse_millihz = 1000000;
+    port->high_us = 0;
+    _hostSendChannelSetup(0, 0x000F, 0, 100000, 0, SYNC_RISING_EDGE,
+                          200 * ms);
+    for (uint8_t channel = 1; channel <= SIM_BURST_CHANNELS; channel++) {
+        _hostSendChannelSetup(channel, _burst.channels[channel - 1].outputs,
+                              0, 0, 0, SYNC_RISING_EDGE, 200 * ms);
+        _hostSendBurst(channel, 200 * ms);
+    }
+
+    // Rising edges of IN0 every 20 ms, every 8th followed by a second one
+    // while its burst of 5 ms plays
+    for (uint32_t k = 0; k < 40; k++) {
+        uint64_t rise_ns = 300 * ms + k * 20 * ms + _random() % (5 * ms);
+        _injectInputPulse(capture->input, rise_ns - ms, rise_ns);
+        capture->triggers_ns.push_back(rise_ns);
+        if (k % 8 == 7) {
+            _injectInputPulse(capture->input, rise_ns + ms, rise_ns + 2 * ms);
+            capture->busy_triggers++;
+        }
+    }
+    // Falling edges of IN1 every 25 ms
+    for (uint32_t k = 0; k < 30; k++) {
+        uint64_t fall_ns = 305 * ms + k * 25 * ms + _random() % (5 * ms);
+        _injectInputPulse(port->input, fall_ns, fall_ns + ms);
+        port->triggers_ns.push_back(fall_ns);
+    }
+    _run.duration_ns = 2 * SIM_NS_PER_S;
+}
+
+/// @brief Check the bursts of a channel against its triggers: latency of
+/// the first rise, pulse count, period and high time of every pulse and the
+/// TYPE_BURST reports
+static void _printBurstReport(uint8_t channel) {
+    const struct sim_burst_channel_t *burst = &_burst.channels[channel - 1];
+    uint64_t period_ns = 1000000000000ULL / burst->pulse_millihz;
+    uint64_t high_ns =
+        burst->high_us ? burst->high_us * SIM_NS_PER_US : period_ns / 2;
+    uint32_t wrong = 0;
+    uint64_t latency_sum_ns = 0;
+    uint64_t latency_max_ns = 0;
+    int64_t error_max_ns = 0;
+    size_t rise = 0;
+    for (size_t k = 0; k < burst->triggers_ns.size(); k++) {
+        uint64_t trigger_ns = burst->triggers_ns[k];
+        uint64_t end_ns = k + 1 < burst->triggers_ns.size()
+                              ? burst->triggers_ns[k + 1]
+                              : UINT64_MAX;
+        uint32_t pulses = 0;
+        uint64_t first_ns = 0;
+        for (; rise < burst->rises_ns.size() && burst->rises_ns[rise] < end_ns;
+             rise++, pulses++) {
+            if (burst->rises_ns[rise] < trigger_ns) {
+                wrong++;
+                continue;
+            }
+            int64_t error_ns = 0;
+            if (!pulses) {
+                first_ns = burst->rises_ns[rise];
+                uint64_t latency_ns = first_ns - trigger_ns;
+                latency_sum_ns += latency_ns;
+                if (latency_ns > latency_max_ns) {
+                    latency_max_ns = latency_ns;
+                }
+            } else {
+                error_ns = (int64_t)(burst->rises_due_ns[rise] -
+                                     (first_ns + pulses * period_ns));
+            }
+            // The first rise has no due time on the timer, it is written
+            // from the input interrupt
+            uint64_t rise_ns = pulses ? burst->rises_due_ns[rise] : first_ns;
+            int64_t high_error_ns =
+                rise < burst->falls_due_ns.size()
+                    ? (int64_t)(burst->falls_due_ns[rise] - rise_ns - high_ns)
+                    : INT64_MAX;
+            if (llabs(high_error_ns) > llabs(error_ns)) {
+                error_ns = high_error_ns;
+            }
+            if (llabs(error_ns) > llabs(error_max_ns)) {
+                error_max_ns = error_ns;
+            }
+            wrong += llabs(error_ns) > SIM_BURST_TOLERANCE_NS;
+        }
+        wrong += pulses != burst->pulse_count;
+    }
+
+    uint32_t started = 0;
+    uint32_t late = 0;
+    uint32_t busy = 0;
+    uint32_t report_errors = 0;
+    uint64_t reported_max_ns = 0;
+    for (size_t i = 0; i < _host.bursts.size(); i++) {
+        const burst_reply_message *reply = &_host.bursts[i];
+        if (reply->channel != channel) {
+            continue;
+        }
+        if (reply->status == BURST_BUSY) {
+            busy++;
+            continue;
+        }
+        report_errors += reply->pulse_id != started * burst->pulse_count;
+        late += reply->status == BURST_LATE;
+        started++;
+        if (reply->latency_ns != BURST_NO_LATENCY &&
+            reply->latency_ns > reported_max_ns) {
+            reported_max_ns = reply->latency_ns;
+        }
+    }
+    report_errors += started != burst->triggers_ns.size();
+    report_errors += busy != burst->busy_triggers;
+
+    uint8_t captured = (IN_CAPTURE_INPUTS >> burst->input) & 1;
+    printf("burst IN%u %s    %u started, %u late, %u busy, %u pulses, "
+           "%u wrong, max error %lld ns\n",
+           burst->input, captured ? "capture" : "port   ", started, late, busy,
+           (unsigned)burst->rises_ns.size(), wrong, (long long)error_max_ns);
+    printf("  trigger latency     mean %.2f us, max %.2f us, ",
+           latency_sum_ns / 1e3 /
+               (burst->triggers_ns.empty() ? 1 : burst->triggers_ns.size()),
+           latency_max_ns / 1e3);
+    if (captured) {
+        printf("device reported max %.2f us", reported_max_ns / 1e3);
+    } else {
+        printf("not measured by the device");
+    }
+    printf(", %u report errors\n", report_errors);
+    _check(!wrong, "burst pulses");
+    _check(!report_errors, "burst reports");
+}
+
+// Analog scenario: AIN0 and AIN1 sampled four times per pulse of a 500 Hz
+// channel, then four inputs at 64 times the rate, more than the ADC and the
+// link carry. Every input reads the time it was sampled at in us, modulo
+// 1024 and 256 us apart from input to input, so the host can tell when each
+// value was converted.
+#define SIM_ANALOG_PHASES 2
+#define SIM_ANALOG_INPUT_US 256
+struct sim_analog_phase_t {
+    uint8_t pins;
+    uint8_t divider;
+    uint32_t frames;
+    uint32_t sets;        // received
+    uint32_t gaps;        // sets missing between frames
+    uint32_t sets_device; // last report of the device
+    uint32_t dropped;
+    uint32_t wrong; // values not sampled after their due time
+    uint32_t checked;
+    uint64_t first_sum_us; // due time to the first and last conversion
+    uint32_t first_max_us;
+    uint64_t last_sum_us;
+    uint32_t last_max_us;
+    uint32_t next_pulse_id; // of the set after the last frame
+    uint8_t next_index;
+};
+struct sim_analog_t {
+    uint8_t active;
+    uint32_t period_ns;
+    uint8_t have_offset;
+    int64_t rise_offset; // index into _edges.rises minus pulse_id
+    uint8_t phase;
+    struct sim_analog_phase_t phases[SIM_ANALOG_PHASES];
+};
+static struct sim_analog_t _analog;
+
+static uint16_t _analogSignal(uint8_t pin, uint64_t time_ns) {
+    for (uint8_t i = 0; i < NUM_ANALOG_PINS; i++) {
+        if (ANALOG_PINS[i] == pin) {
+            return (time_ns / SIM_NS_PER_US + i * SIM_ANALOG_INPUT_US) & 1023;
+        }
+    }
+    return 0;
+}
+
+/// @brief Delay from the due time of a set to the sampling of input i
+static uint32_t _analogDelayUs(uint16_t value, uint8_t input,
+                               uint64_t due_ns) {
+    uint32_t sampled_us = value - input * SIM_ANALOG_INPUT_US;
+    return (sampled_us - due_ns / SIM_NS_PER_US) & 1023;
+}
+
+static void _hostAnalogSamples(const analog_samples_message *msg,
+                               size_t len) {
+    uint8_t num_pins = __builtin_popcount(msg->pins);
+    if (len != MIN_LENGTH_ANALOG_SAMPLES_MESSAGE +
+                   msg->count * num_pins * sizeof(uint16_t) ||
+        !msg->divider) {
+        _host.errors++;
+        return;
+    }
+    struct sim_analog_phase_t *phase = &_analog.phases[_analog.phase];
+    if (phase->frames &&
+        (msg->pins != phase->pins || msg->divider != phase->divider)) {
+        if (_analog.phase + 1 >= SIM_ANALOG_PHASES) {
+            _host.errors++;
+            return;
+        }
+        phase = &_analog.phases[++_analog.phase];
+    }
+    uint64_t step_ns = _analog.period_ns / msg->divider;
+    if (!_analog.have_offset) {
+        // The rise of the first set is the last one before it was sampled
+        uint64_t start_ns = (uint64_t)msg->uptime_us * SIM_NS_PER_US;
+        size_t rise = 0;
+        while (rise + 1 < _edges.rises.size() &&
+               _edges.rises[rise + 1] + msg->index * step_ns <= start_ns) {
+            rise++;
+        }
+        _analog.rise_offset = (int64_t)rise - msg->pulse_id;
+        _analog.have_offset = true;
+    }
+    if (phase->frames && (msg->pulse_id != phase->next_pulse_id ||
+                          msg->index != phase->next_index)) {
+        phase->gaps += (msg->pulse_id - phase->next_pulse_id) * msg->divider +
+                       msg->index - phase->next_index;
+    }
+    phase->pins = msg->pins;
+    phase->divider = msg->divider;
+    phase->frames++;
+    phase->sets += msg->count;
+    phase->sets_device = msg->sets;
+    phase->dropped = msg->dropped;
+
+    uint8_t first_input = __builtin_ctz(msg->pins);
+    uint8_t last_input = 31 - __builtin_clz(msg->pins);
+    uint32_t pulse_id = msg->pulse_id;
+    uint8_t index = msg->index;
+    for (uint8_t i = 0; i < msg->count; i++) {
+        const uint16_t *values = msg->values + i * num_pins;
+        int64_t rise = pulse_id + _analog.rise_offset;
+        if (rise >= 0 && (size_t)rise < _edges.rises.size()) {
+            uint64_t due_ns = _edges.rises[rise] + index * step_ns;
+            uint32_t first_us = _analogDelayUs(values[0], first_input, due_ns);
+            uint32_t last_us =
+                _analogDelayUs(values[num_pins - 1], last_input, due_ns);
+            phase->first_sum_us += first_us;
+            phase->last_sum_us += last_us;
+            if (first_us > phase->first_max_us) {
+                phase->first_max_us = first_us;
+            }
+            if (last_us > phase->last_max_us) {
+                phase->last_max_us = last_us;
+            }
+            // Half the range, later means before the due time
+            phase->wrong += last_us >= 512;
+            phase->checked++;
+        }
+        if (++index >= msg->divider) {
+            index = 0;
+            pulse_id++;
+        }
+    }
+    phase->next_pulse_id = pulse_id;
+    phase->next_index = index;
+}
+
+static void _hostSendAnalog(uint8_t pins, uint8_t divider,
+                            uint32_t max_latency_us, uint64_t at_ns) {
+    analog_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_ANALOG;
+    msg.channel = 0;
+    msg.pins = pins;
+    msg.divider = divider;
+    msg.max_latency_us = max_latency_us;
+    _hostSend(&msg, LENGTH_ANALOG_MESSAGE, at_ns);
+}
+
+static void _scenarioAnalog() {
+    uint64_t ms = SIM_NS_PER_S / 1000;
+    _analog.active = true;
+    _edges.pulse_millihz = 500 * MILLIHZ_PER_HZ;
+    _analog.period_ns = 1000000000000ULL / _edges.pulse_millihz;
+    simSetAnalogSignal(&_analogSignal);
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, 100 * ms);
+    _hostSendAnalog(0x03, 4, 5000, 200 * ms);
+    _hostSendAnalog(0x0F, 64, 5000, 1200 * ms);
+    _hostSendAnalog(0, 1, 0, 1500 * ms);
+    _run.duration_ns = 2 * SIM_NS_PER_S;
+}
+
+static void _printAnalogReport() {
+    for (uint8_t i = 0; i <= _analog.phase; i++) {
+        const struct sim_analog_phase_t *phase = &_analog.phases[i];
+        uint32_t checked = phase->checked ? phase->checked : 1;
+        printf("analog pins %02x / %-3u  %u frames, %u sets, %u gaps, "
+               "device %u sets, %u dropped\n",
+               phase->pins, phase->divider, phase->frames, phase->sets,
+               phase->gaps, phase->sets_device, phase->dropped);
+        printf("  sampled after due   first mean %.2f us, max %u us, last "
+               "mean %.2f us, max %u us, %u of %u wrong\n",
+               (double)phase->first_sum_us / checked, phase->first_max_us,
+               (double)phase->last_sum_us / checked, phase->last_max_us,
+               phase->wrong, phase->checked);
+        _check(!phase->wrong && phase->sets <= phase->sets_device,
+               "analog sets");
+    }
+    // The first phase is well within what the ADC and the link carry
+    const struct sim_analog_phase_t *first = &_analog.phases[0];
+    _check(_analog.phase + 1 == SIM_ANALOG_PHASES && first->frames &&
+               !first->gaps && !first->dropped &&
+               first->sets == first->sets_device,
+           "analog sets of the first phase");
+}
+
+// Resend scenario: the event stream is sequenced and the line to the host
+// flips a bit in every SIM_LINE_ERROR_BYTES-th byte. The host asks for the
+// frames it misses and holds back the ones after a gap, so the input edges
+// arrive complete and in order.
+#define SIM_LINE_ERROR_BYTES 1000
+#define SIM_RESEND_RETRY_NS (50 * SIM_NS_PER_S / 1000)
+struct sim_sequence_t {
+    uint8_t active;
+    uint64_t errors_from_ns; // clean line before
+    uint32_t line_bytes;
+    uint32_t line_errors;
+    uint16_t next; // expected sequence number
+    std::map<uint16_t, std::vector<uint8_t>> held; // frames after a gap
+    uint64_t gap_ns;       // first frame held back, 0 -> no gap
+    uint64_t requested_ns; // last TYPE_RESEND, 0 -> none outstanding
+    uint16_t requested_end; // end of the gap it asked for
+    uint32_t frames;
+    uint32_t requests;
+    uint32_t recovered; // frames that closed a gap
+    uint32_t duplicates;
+    uint32_t lost; // reported by the device
+    size_t held_max;
+    uint64_t gap_max_ns;
+};
+static struct sim_sequence_t _sequence;
+
+/// @brief Flip a bit of every SIM_LINE_ERROR_BYTES-th byte, markers excluded
+static uint8_t _lineByte(uint8_t byte) {
+    if (!_sequence.active || simNowNs() < _sequence.errors_from_ns ||
+        !byte || ++_sequence.line_bytes % SIM_LINE_ERROR_BYTES) {
+        return byte;
+    }
+    _sequence.line_errors++;
+    return byte ^ 0x10 ? byte ^ 0x10 : byte ^ 0x20;
+}
+
+/// @brief Ask for the frames of the first gap, again if the last request
+/// was not served in time. Later gaps follow once it is closed.
+static void _hostRequestResend(uint64_t time_ns) {
+    if (_sequence.held.empty() ||
+        (_sequence.requested_ns &&
+         time_ns - _sequence.requested_ns < SIM_RESEND_RETRY_NS)) {
+        return;
+    }
+    resend_message msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.header.type = TYPE_RESEND;
+    msg.first = _sequence.next;
+    msg.count = _sequence.held.begin()->first - _sequence.next;
+    _hostSend(&msg, LENGTH_RESEND_MESSAGE, time_ns);
+    _sequence.requested_ns = time_ns;
+    _sequence.requested_end = _sequence.held.begin()->first;
+    _sequence.requests++;
+}
+
+/// @brief Hand on the held frames that follow without a gap
+static void _hostDrainSequenced(uint64_t time_ns) {
+    for (auto it = _sequence.held.find(_sequence.next);
+         it != _sequence.held.end();
+         it = _sequence.held.find(_sequence.next)) {
+        _hostHandleFrame(time_ns, it->second.data(), it->second.size());
+        _sequence.held.erase(it);
+        _sequence.next++;
+    }
+    if ((int16_t)(_sequence.next - _sequence.requested_end) >= 0) {
+        _sequence.requested_ns = 0; // the gap asked for is closed
+    }
+    if (!_sequence.held.empty()) {
+        _hostRequestResend(time_ns);
+        return;
+    }
+    if (_sequence.gap_ns && time_ns - _sequence.gap_ns > _sequence.gap_max_ns) {
+        _sequence.gap_max_ns = time_ns - _sequence.gap_ns;
+    }
+    _sequence.gap_ns = 0;
+}
+
+static void _hostSequenced(uint64_t time_ns, const sequenced_message *msg,
+                           size_t len) {
+    _sequence.frames++;
+    int16_t ahead = msg->sequence - _sequence.next;
+    if (ahead < 0 || _sequence.held.count(msg->sequence)) {
+        _sequence.duplicates++;
+        return;
+    }
+    const uint8_t *frame = msg->frame;
+    size_t frame_len = len - MIN_LENGTH_SEQUENCED_MESSAGE;
+    if (ahead > 0) {
+        if (_sequence.held.empty()) {
+            _sequence.gap_ns = time_ns;
+        }
+        _sequence.held[msg->sequence].assign(frame, frame + frame_len);
+        if (_sequence.held.size() > _sequence.held_max) {
+            _sequence.held_max = _sequence.held.size();
+        }
+        _hostRequestResend(time_ns);
+        return;
+    }
+    _sequence.recovered += !_sequence.held.empty();
+    _hostHandleFrame(time_ns, frame, frame_len);
+    _sequence.next++;
+    _hostDrainSequenced(time_ns);
+}
+
+static void _hostResendLost(uint64_t time_ns, const resend_message *msg) {
+    uint16_t end = msg->first + msg->count;
+    if ((int16_t)(msg->first - _sequence.next) > 0 ||
+        (int16_t)(end - _sequence.next) <= 0) {
+        return;
+    }
+    _sequence.lost += (uint16_t)(end - _sequence.next);
+    _sequence.next = end;
+    _hostDrainSequenced(time_ns);
+}
+
+static void _scenarioResend() {
+    uint64_t ms = SIM_NS_PER_S / 1000;
+    _sequence.active = true;
+    _sequence.errors_from_ns = 300 * ms;
+    batch_config_message config;
+    config.header.type = TYPE_BATCH_CONFIG;
+    config.max_bytes = 0xFF;
+    config.max_latency_us = 5000;
+    _hostSend(&config, LENGTH_BATCH_CONFIG_MESSAGE, 50 * ms);
+    sequence_message sequence;
+    sequence.header.type = TYPE_SEQUENCE;
+    sequence.flags = SEQUENCE_ON;
+    _hostSend(&sequence, LENGTH_SEQUENCE_MESSAGE, 50 * ms);
+    _edges.pulse_millihz = 30 * MILLIHZ_PER_HZ;
+    _hostSendSetup(_edges.pulse_millihz, 0, 0, 0,
+                   RESET_COUNTER | SYNC_RISING_EDGE, 100 * ms);
+    _injectInputs(portInputs(), 100, 200 * ms, 2800 * ms);
+    _run.duration_ns = 3 * SIM_NS_PER_S;
+}
+
+static void _printSequenceReport() {
+    printf("sequence              %u frames, %u line errors, %u requests, "
+           "%u recovered, %u duplicates, %u lost\n",
+           _sequence.frames, _sequence.line_errors, _sequence.requests,
+           _sequence.recovered, _sequence.duplicates, _sequence.lost);
+    printf("  held back           max %u frames, max %.2f ms, %u still "
+           "held\n",
+           (unsigned)_sequence.held_max, _sequence.gap_max_ns / 1e6,
+           (unsigned)_sequence.held.size());
+    _check(_sequence.line_errors && !_sequence.lost &&
+               _sequence.held.empty(),
+           "sequenced frames");
+}
+
+struct sim_scenario_t {
+    const char *name;
+    const char *description;
+    void (*start)();
+    void (*check)(); // expectations beyond the common ones, may be nullptr
+};
+
+static const struct sim_scenario_t _scenarios[] = {
+    {"pulses", "1000 pulses at 100 Hz on an idle link", &_scenarioPulses,
+     &_checkPulses},
+    {"fractional", "29.97 Hz for 10 minutes, drift", &_scenarioFractional,
+     &_checkFractional},
+    {"inputs", "30 Hz, 8 inputs at 500 Hz each, TYPE_INPUTS",
+     &_scenarioInputs, &_checkInputs},
+    {"inputs_batched", "as inputs, with TYPE_INPUTS_BATCH",
+     &_scenarioInputsBatched, &_checkInputs},
+    {"inputs_link", "30 Hz, 8 inputs at 120 Hz each, TYPE_INPUTS",
+     &_scenarioInputsLink, &_checkInputs},
+    {"inputs_link_batched", "as inputs_link, with TYPE_INPUTS_BATCH",
+     &_scenarioInputsLinkBatched, &_checkInputsLinkBatched},
+    {"serial_load", "100 Hz while the host floods echo frames",
+     &_scenarioSerialLoad, &_checkSerialLoad},
+    {"channels", "200 Hz, 25 Hz and a phase shifted 200 Hz channel",
+     &_scenarioChannels, &_checkChannels},
+    {"stagger", "strobe channel 5 us after a 100 Hz camera channel",
+     &_scenarioStagger, &_checkStagger},
+    {"duty", "1 ms pulses at 100 Hz, then 200 us at 50 Hz", &_scenarioDuty,
+     &_checkDuty},
+    {"capture", "input capture against micros() on coincident edges",
+     &_scenarioCapture, &_checkCapture},
+    {"baud", "inputs at 1 Mbaud, then a failed switch to 2 Mbaud",
+     &_scenarioBaud, &_checkBaud},
+    {"schedule", "three segment schedule, three passes",
+     &_scenarioSchedule, nullptr},
+    {"cascade", "follower of an injected 100 Hz leader with sync resets",
+     &_scenarioCascade, nullptr},
+    {"timed", "setup, reset and stop at device times and pulse_ids",
+     &_scenarioTimed, nullptr},
+    {"pattern", "looped output pattern, then a streamed one that runs dry",
+     &_scenarioPattern, nullptr},
+    {"burst", "output bursts triggered by input edges next to a channel",
+     &_scenarioBurst, nullptr},
+    {"analog", "two inputs at 4x a 500 Hz channel, then four at 64x",
+     &_scenarioAnalog, nullptr},
+    {"resend", "sequenced inputs over a line with bit errors",
+     &_scenarioResend, nullptr},
+};
+#define NUM_SCENARIOS (sizeof(_scenarios) / sizeof(_scenarios[0]))
+
+static void _printStatsHistogram(const char *name,
+                                 const uint16_t *histogram) {
+    printf("%-22s", name);
+    for (uint8_t i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        if (histogram[i]) {
+            printf(" %s%u:%u", i + 1 < STATS_HISTOGRAM_BUCKETS ? "<" : ">=",
+                   i + 1 < STATS_HISTOGRAM_BUCKETS ? 1u << i : 1u << (i - 1),
+                   histogram[i]);
+        }
+    }
+    printf("\n");
+}
+
+static void _printDeviceStats(const stats_message *stats) {
+    printf("device stats          %u ms, %u loop passes, max %u us, "
+           "%u edges, late max %u us\n",
+           stats->elapsed_ms, stats->loop_count, stats->loop_max_us,
+           stats->edge_count, stats->edge_late_max_us);
+    _printStatsHistogram("  loop us", stats->loop_histogram);
+    _printStatsHistogram("  edge late us", stats->edge_late_histogram);
+    printf("  inputs              %u interrupts, %u edges, %u events, "
+           "%u lost, high water %u/%u\n",
+           stats->input_captures, stats->input_edges, stats->input_events,
+           stats->input_lost, stats->input_high_water,
+           stats->capture_high_water);
+    uint32_t rx_errors = 0;
+    for (uint8_t i = 0; i < STATS_RX_ERROR_BITS; i++) {
+        rx_errors += stats->rx_errors[i];
+    }
+    printf("  serial              tx %u frames, %u bytes, %u dropped, "
+           "min free %u, rx %u frames, %u errors\n",
+           stats->tx_frames, stats->tx_bytes, stats->tx_dropped,
+           stats->tx_free_min, stats->rx_frames, rx_errors);
+}
+
+static void _printReport(const struct sim_scenario_t &scenario) {
+    printf("## %s: %s\n", scenario.name, scenario.description);
+    printf("virtual time          %.3f s\n", simNowNs() / 1e9);
+    printf("loop passes           %llu, mean %.2f us, max %.2f us\n",
+           (unsigned long long)_run.loop_passes,
+           _run.loop_sum_ns / 1e3 / (_run.loop_passes ? _run.loop_passes : 1),
+           _run.loop_max_ns / 1e3);
+    printf("interrupts            %u\n", simInterruptCount());
+    printf("edges                 %llu\n", (unsigned long long)_edges.count);
+    if (_edges.count) {
+        printf("edge latency          mean %.2f us, max %.2f us\n",
+               _edges.latency_sum_ns / 1e3 / _edges.count,
+               _edges.latency_max_ns / 1e3);
+        printf("edge schedule drift   %lld ns\n",
+               (long long)_edges.max_drift_ns);
+        printf("output edges         ");
+        for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+            printf(" %u", _edges.toggles[i]);
+        }
+        printf("\n");
+        printf("OUT00 high time       %u pulses, min %.3f us, max %.3f us\n",
+               _edges.high_pulses, _edges.high_min_ns / 1e3,
+               _edges.high_max_ns / 1e3);
+        printf("edge latency histogram\n");
+        for (uint8_t i = 0; i < SIM_HISTOGRAM_BUCKETS; i++) {
+            if (_edges.latency_histogram[i]) {
+                printf("  < %8llu ns  %llu\n", 2ULL << i,
+                       (unsigned long long)_edges.latency_histogram[i]);
+            }
+        }
+    }
+    uint32_t expected_edges = _run.injected_edges;
+    if (expected_edges) {
+        printf("input edges           injected %u, reported %u in %u events, "
+               "lost %d, device overflows %u\n",
+               _run.injected_edges, _host.input_edges, _host.input_events,
+               (int)(expected_edges - _host.input_edges), _host.lost_events);
+        // Edges go missing only with the events the device reports lost
+        _check(_host.input_edges <= expected_edges &&
+                   (_host.input_edges == expected_edges || _host.lost_events),
+               "input edges");
+    }
+    for (uint8_t i = 0; i < SIM_INPUT_PINS; i++) {
+        const struct sim_input_timing_t *timing = &_timing[i];
+        // Edges match up only if none was lost
+        if (!timing->reported ||
+            timing->reported != timing->injected_ns.size()) {
+            continue;
+        }
+        printf("IN%u timestamp error    %s, min %lld ns, mean %lld ns, "
+               "max %lld ns\n",
+               i, (IN_CAPTURE_INPUTS >> i) & 1 ? "capture" : "micros ",
+               (long long)timing->error_min_ns,
+               (long long)(timing->error_sum_ns / (int64_t)timing->reported),
+               (long long)timing->error_max_ns);
+    }
+    if (_host.have_stats) {
+        _printDeviceStats(&_host.stats);
+    }
+    _check(_host.have_stats, "stats response");
+    if (_edges.pulse_millihz) {
+        _check(llabs(_edges.max_drift_ns) <= SIM_TICK_NS,
+               "edge schedule drift");
+    }
+    if (!_schedule.empty()) {
+        _printScheduleReport();
+    }
+    if (!_timed_expected.empty()) {
+        _printTimedReport();
+    }
+    if (_pattern.active) {
+        _printPatternReport();
+    }
+    if (_burst.active) {
+        for (uint8_t i = 1; i <= SIM_BURST_CHANNELS; i++) {
+            _printBurstReport(i);
+        }
+    }
+    if (_analog.active) {
+        _printAnalogReport();
+    }
+    if (_sequence.active) {
+        _printSequenceReport();
+    }
+    if (!_cascade.expected_ids.empty()) {
+        printf("follower pulse_id      %u of %u camera pulses checked, %u "
+               "wrong\n",
+               _cascade.checked, (unsigned)_cascade.expected_ids.size(),
+               _cascade.wrong);
+        _check(_cascade.checked == _cascade.expected_ids.size() &&
+                   !_cascade.wrong,
+               "follower pulse_ids");
+    }
+    if (_num_baud_proposals) {
+        printf("baudrate              verified %u, device at %u\n",
+               _host.baud_verified, serialLinkBaudrate());
+    }
+    printf("host rx               %u frames, %u bytes, %u acks, %u errors, "
+           "%u crc errors\n",
+           _host.frames, _host.bytes, _host.acks, _host.errors,
+           _host.crc_errors);
+    printf("device rx dropped     %u bytes\n", simSerialRxDropped());
+    // Only the resend scenario garbles the line
+    _check(_host.errors + _host.crc_errors <= _sequence.line_errors,
+           "host rx errors");
+    _check(!simSerialRxDropped(), "device rx");
+}
+
+/// @brief Run a scenario and check its results
+/// @return checks that failed
+static uint32_t _runScenario(const struct sim_scenario_t &scenario,
+                             const SimCosts &costs) {
+    simReset(costs);
+    _run.serial_tx_fifo = costs.serial_tx_fifo;
+    simSetHostReceiver(&_hostReceive);
+    simSetOutputRecorder(&_recordOutputs);
+
+    // The inputs start high (pull ups), setup() reports that without edges
+    _host.inputs_state = portInputs();
+    _host.capture_state = IN_CAPTURE_INPUTS;
+    setup();
+    scenario.start();
+    // Counters of the whole run, the response has time to arrive. Sent when
+    // it is due, the host line carries writes in the order they are made
+    // and replies of the host to events must not wait behind it.
+    uint64_t stats_at_ns = _run.duration_ns - SIM_NS_PER_S / 2;
+    uint8_t stats_sent = false;
+    while (simNowNs() < _run.duration_ns) {
+        uint64_t start_ns = simNowNs();
+        if (!stats_sent && start_ns >= stats_at_ns) {
+            stats_request_message stats_request;
+            stats_request.header.type = TYPE_STATS;
+            stats_request.flags = 0;
+            _hostSend(&stats_request, LENGTH_STATS_REQUEST_MESSAGE,
+                      start_ns);
+            stats_sent = true;
+        }
+        loop();
+        simConsume(costs.loop_ns);
+        uint64_t pass_ns = simNowNs() - start_ns;
+        _run.loop_passes++;
+        _run.loop_sum_ns += pass_ns;
+        if (pass_ns > _run.loop_max_ns) {
+            _run.loop_max_ns = pass_ns;
+        }
+    }
+    _printReport(scenario);
+    if (scenario.check) {
+        scenario.check();
+    }
+    printf("checks                %s\n\n", _run.failed ? "FAILED" : "passed");
+    return _run.failed;
+}
+
+// Batched inputs never lose more edges than the same inputs sent as
+// TYPE_INPUTS frames. Every scenario has its own process, main() compares
+// the edges they lost.
+static const struct sim_comparison_t {
+    const char *batched;
+    const char *legacy;
+} _comparisons[] = {
+    {"inputs_batched", "inputs"},
+    {"inputs_link_batched", "inputs_link"},
+};
+#define NUM_COMPARISONS (sizeof(_comparisons) / sizeof(_comparisons[0]))
+
+static uint8_t _scenarioIndex(const char *name) {
+    uint8_t i = 0;
+    while (i < NUM_SCENARIOS && strcmp(name, _scenarios[i].name)) {
+        i++;
+    }
+    return i;
+}
+
+/// @brief Run a scenario in a fresh process, the firmware keeps its state
+/// in globals and function statics
+/// @param lost_edges input edges the host did not see
+/// @return false if the scenario failed
+static uint8_t _forkScenario(const struct sim_scenario_t &scenario,
+                             const SimCosts &costs, int64_t *lost_edges) {
+    int fds[2];
+    if (pipe(fds)) {
+        return false;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        uint32_t failed_checks = _runScenario(scenario, costs);
+        fflush(stdout);
+        int64_t lost = (int64_t)_run.injected_edges - _host.input_edges;
+        uint8_t sent = write(fds[1], &lost, sizeof(lost)) == sizeof(lost);
+        _exit(failed_checks || !sent ? 1 : 0);
+    }
+    close(fds[1]);
+    uint8_t received =
+        pid > 0 && read(fds[0], lost_edges, sizeof(*lost_edges)) ==
+                       sizeof(*lost_edges);
+    close(fds[0]);
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) || !received) {
+        printf("## %s FAILED\n\n", scenario.name);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *name = "all";
+    SimCosts costs = SIM_COSTS_AVR;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--teensy")) {
+            costs = SIM_COSTS_TEENSY4;
+        } else {
+            name = argv[i];
+        }
+    }
+
+    uint8_t found = false;
+    uint8_t failed = 0;
+    uint8_t ran[NUM_SCENARIOS] = {};
+    int64_t lost_edges[NUM_SCENARIOS] = {};
+    for (uint8_t i = 0; i < NUM_SCENARIOS; i++) {
+        if (strcmp(name, "all") && strcmp(name, _scenarios[i].name)) {
+            continue;
+        }
+        found = true;
+        // A batched scenario is compared to its legacy one, run that first
+        for (uint8_t c = 0; c < NUM_COMPARISONS; c++) {
+            uint8_t legacy = _scenarioIndex(_comparisons[c].legacy);
+            if (!strcmp(_comparisons[c].batched, _scenarios[i].name) &&
+                legacy < NUM_SCENARIOS && !ran[legacy]) {
+                ran[legacy] = true;
+                if (!_forkScenario(_scenarios[legacy], costs,
+                                   &lost_edges[legacy])) {
+                    failed++;
+                }
+            }
+        }
+        if (ran[i]) {
+            continue;
+        }
+        ran[i] = true;
+        if (!_forkScenario(_scenarios[i], costs, &lost_edges[i])) {
+            failed++;
+        }
+    }
+    if (!found) {
+        printf("unknown scenario %s, available:\n", name);
+        for (uint8_t i = 0; i < NUM_SCENARIOS; i++) {
+            printf("  %-20s %s\n", _scenarios[i].name,
+                   _scenarios[i].description);
+        }
+        return 1;
+    }
+    for (uint8_t c = 0; c < NUM_COMPARISONS; c++) {
+        uint8_t batched = _scenarioIndex(_comparisons[c].batched);
+        uint8_t legacy = _scenarioIndex(_comparisons[c].legacy);
+        if (batched < NUM_SCENARIOS && legacy < NUM_SCENARIOS &&
+            ran[batched] && ran[legacy] &&
+            lost_edges[batched] > lost_edges[legacy]) {
+            printf("FAILED                %s lost %lld input edges, %s %lld\n",
+                   _comparisons[c].batched, (long long)lost_edges[batched],
+                   _comparisons[c].legacy, (long long)lost_edges[legacy]);
+            failed++;
+        }
+    }
+    if (failed) {
+        printf("%u scenarios failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
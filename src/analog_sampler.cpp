@@ -0,0 +1,157 @@
+/*******************************************************************************
+ * File:        analog_sampler.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "analog_sampler.h"
+
+#if ANALOG_SAMPLING
+#include "critical_section.h"
+
+static uint8_t _channels[ANALOG_MAX_PINS]; // ADC channels of the set
+static uint8_t _count = 0;
+static volatile uint8_t _next = 0; // value being converted
+static volatile uint8_t _busy = false;
+static uint16_t _values[ANALOG_MAX_PINS];
+static AnalogSetHandler _handler = nullptr;
+
+static void _adcStart(uint8_t channel);
+
+/// @brief Conversion complete, called from the ADC interrupt
+static void _converted(uint16_t value) {
+    uint8_t next = _next;
+    _values[next++] = value;
+    if (next < _count) {
+        _next = next;
+        _adcStart(_channels[next]);
+        return;
+    }
+    _busy = false;
+    _handler(_values, _count);
+}
+
+#if defined(__AVR_ATmega328P__)
+// ############################################## ATmega328P, interrupt chain
+//
+// Single conversions against AVcc, the complete interrupt switches the
+// multiplexer and starts the next one. The ADC clock of 500 kHz (prescaler
+// 32) is above the 200 kHz of full resolution, the datasheet allows up to 1
+// MHz at less than 10 bits.
+#define ANALOG_ADCSRA ((1 << ADEN) | (1 << ADIE) | (1 << ADPS2) | (1 << ADPS0))
+
+/// @brief ADC channel of an analog pin, A0 is pin 14
+static uint8_t _adcChannel(int16_t pin) { return pin - 14; }
+
+static uint8_t _adcSupported(int16_t pin) { return pin >= 14 && pin <= 21; }
+
+static void _adcBegin() { ADCSRA = ANALOG_ADCSRA; }
+
+static void _adcStart(uint8_t channel) {
+    ADMUX = (1 << REFS0) | channel;
+    ADCSRA = ANALOG_ADCSRA | (1 << ADSC);
+}
+
+ISR(ADC_vect) { _converted(ADC); }
+
+#elif defined(__IMXRT1062__)
+// ################################################# Teensy 4.x, ADC1 chain
+//
+// The core configures ADC1 for analogRead(): 10 bit, high speed, no
+// averaging. A write of HC0 starts a conversion, with AIEN its end raises
+// the interrupt and reading R0 clears it.
+
+// ADC1 channels of pins 14 to 25, A0 to A11
+static const uint8_t _adc1_channels[] = {7,  8,  12, 11, 6, 5,
+                                         15, 0,  13, 14, 1, 2};
+
+/// @brief ADC1 channel of an analog pin, 0xFF if it does not reach ADC1
+static uint8_t _adcChannel(int16_t pin) {
+    if (pin >= 14 && pin <= 25) {
+        return _adc1_channels[pin - 14];
+    }
+    if (pin == 40 || pin == 41) {
+        return pin - 31; // A16, A17
+    }
+    return 0xFF;
+}
+
+static uint8_t _adcSupported(int16_t pin) { return _adcChannel(pin) != 0xFF; }
+
+static void _adcIsr() {
+    _converted(ADC1_R0);
+    asm volatile("dsb");
+}
+
+static void _adcBegin() {
+    attachInterruptVector(IRQ_ADC1, &_adcIsr);
+    NVIC_ENABLE_IRQ(IRQ_ADC1);
+}
+
+static void _adcStart(uint8_t channel) { ADC1_HC0 = ADC_HC_AIEN | channel; }
+
+#elif defined(TRIGGER_SIM)
+// ################################################################ Simulator
+#include "sim.h"
+
+static uint8_t _adcChannel(int16_t pin) { return pin; }
+
+static uint8_t _adcSupported(int16_t pin) { return pin >= 0; }
+
+static void _adcIsr() { _converted(simAdcRead()); }
+
+static void _adcBegin() { simAttachAdcInterrupt(&_adcIsr); }
+
+static void _adcStart(uint8_t channel) { simAdcStart(channel); }
+
+#endif
+
+// ###################################################################### API
+void analogSamplerBegin(AnalogSetHandler handler) {
+    _handler = handler;
+    _adcBegin();
+}
+
+uint8_t analogSamplerSelect(uint8_t pins) {
+    if ((pins & ~validAnalogInputs()) ||
+        __builtin_popcount(pins) > ANALOG_MAX_PINS) {
+        return false;
+    }
+    for (uint8_t i = 0; i < NUM_ANALOG_PINS; i++) {
+        if ((pins & (1 << i)) && !_adcSupported(ANALOG_PINS[i])) {
+            return false;
+        }
+    }
+    // A set converts for a few conversion times at most
+    for (;;) {
+        {
+            CriticalSection critical_section;
+            if (!_busy) {
+                _count = 0;
+                for (uint8_t i = 0; i < NUM_ANALOG_PINS; i++) {
+                    if (pins & (1 << i)) {
+                        _channels[_count++] = _adcChannel(ANALOG_PINS[i]);
+                    }
+                }
+                return true;
+            }
+        }
+        delayMicroseconds(1);
+    }
+}
+
+uint8_t analogSamplerStart() {
+    CriticalSection critical_section;
+    if (_busy || !_count) {
+        return false;
+    }
+    _busy = true;
+    _next = 0;
+    _adcStart(_channels[0]);
+    return true;
+}
+
+#endif
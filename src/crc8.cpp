@@ -0,0 +1,32 @@
+/*******************************************************************************
+ * File:        crc8.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "crc8.h"
+
+#define CRC8_ENTRIES_4(i)                                                      \
+    crc8Shift((i), 8), crc8Shift((i) + 1, 8), crc8Shift((i) + 2, 8),           \
+        crc8Shift((i) + 3, 8)
+#define CRC8_ENTRIES_16(i)                                                     \
+    CRC8_ENTRIES_4(i), CRC8_ENTRIES_4((i) + 4), CRC8_ENTRIES_4((i) + 8),       \
+        CRC8_ENTRIES_4((i) + 12)
+#define CRC8_ENTRIES_64(i)                                                     \
+    CRC8_ENTRIES_16(i), CRC8_ENTRIES_16((i) + 16),                             \
+        CRC8_ENTRIES_16((i) + 32), CRC8_ENTRIES_16((i) + 48)
+
+// Generated by the compiler, nothing is computed at runtime
+#if defined(__AVR__)
+const uint8_t crc8_table[256] PROGMEM = {
+#else
+const uint8_t crc8_table[256] = {
+#endif
+    CRC8_ENTRIES_64(0),
+    CRC8_ENTRIES_64(64),
+    CRC8_ENTRIES_64(128),
+    CRC8_ENTRIES_64(192),
+};
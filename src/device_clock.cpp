@@ -0,0 +1,24 @@
+/*******************************************************************************
+ * File:        device_clock.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "device_clock.h"
+#include "critical_section.h"
+
+static uint32_t _last_us = 0;
+static uint32_t _wraps = 0;
+
+uint64_t deviceClockUs() {
+    CriticalSection critical_section;
+    uint32_t current_us = micros();
+    if (current_us < _last_us) {
+        _wraps++;
+    }
+    _last_us = current_us;
+    return ((uint64_t)_wraps << 32) | current_us;
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * File:        device_stats.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "device_stats.h"
+#include "critical_section.h"
+
+// Every counter is only written from one context (loop, pulse timer
+// interrupt or input interrupt), read and reset copy them with interrupts off
+static DeviceStats _stats;
+static uint32_t _reset_ms = 0;
+
+/// @brief Histogram bucket of a duration, log2 of the microseconds
+static inline uint8_t _bucket(uint32_t us) {
+    uint8_t bucket = us ? sizeof(long) * 8 - __builtin_clzl(us) : 0;
+    return bucket < STATS_HISTOGRAM_BUCKETS ? bucket
+                                            : STATS_HISTOGRAM_BUCKETS - 1;
+}
+
+static inline void _count(uint16_t *histogram, uint32_t us) {
+    uint16_t *counter = &histogram[_bucket(us)];
+    if (*counter != UINT16_MAX) {
+        (*counter)++;
+    }
+}
+
+void deviceStatsLoop(uint32_t loop_us) {
+    _stats.loop_count++;
+    if (loop_us > _stats.loop_max_us) {
+        _stats.loop_max_us = loop_us;
+    }
+    _count(_stats.loop_histogram, loop_us);
+}
+
+void deviceStatsEdge(uint32_t late_us) {
+    _stats.edge_count++;
+    if (late_us > _stats.edge_late_max_us) {
+        _stats.edge_late_max_us = late_us;
+    }
+    _count(_stats.edge_late_histogram, late_us);
+}
+
+void deviceStatsInputs(uint8_t edges, uint8_t events) {
+    _stats.input_captures++;
+    _stats.input_edges += edges;
+    _stats.input_events += events;
+}
+
+void deviceStatsTx(size_t bytes, int tx_free, uint8_t queued) {
+    if (!queued) {
+        _stats.tx_dropped++;
+        return;
+    }
+    _stats.tx_frames++;
+    _stats.tx_bytes += bytes;
+    if (tx_free >= 0 && (uint32_t)tx_free < _stats.tx_free_min) {
+        _stats.tx_free_min = tx_free;
+    }
+}
+
+void deviceStatsRx(uint8_t error_flags) {
+    _stats.rx_frames++;
+    for (uint8_t bit = 0; bit < STATS_RX_ERROR_BITS; bit++) {
+        if ((error_flags & (1 << bit)) &&
+            _stats.rx_errors[bit] != UINT16_MAX) {
+            _stats.rx_errors[bit]++;
+        }
+    }
+}
+
+void deviceStatsRead(DeviceStats *stats) {
+    CriticalSection critical_section;
+    memcpy(stats, &_stats, sizeof(DeviceStats));
+    stats->elapsed_ms = millis() - _reset_ms;
+}
+
+void deviceStatsReset() {
+    CriticalSection critical_section;
+    memset(&_stats, 0, sizeof(DeviceStats));
+    _stats.tx_free_min = UINT16_MAX;
+    _reset_ms = millis();
+}
@@ -0,0 +1,250 @@
+/*******************************************************************************
+ * File:        input_capture.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "input_capture.h"
+#include "critical_section.h"
+
+#if IN_CAPTURE_INPUTS
+static InputCaptureHandler _handler = nullptr;
+
+#if !defined(TRIGGER_SIM)
+// Upper 32 bits of the 48 bit ticks
+static volatile uint32_t _overflows = 0;
+
+/// @brief Extend a 16 bit count latched in the current interrupt
+/// @param overflow_pending overflow flag not counted yet
+static inline uint64_t _extendCount(uint16_t count,
+                                    uint8_t overflow_pending) {
+    uint32_t overflows = _overflows;
+    // A small count with a pending overflow was latched after the wrap
+    if (overflow_pending && count < 0x8000) {
+        overflows++;
+    }
+    return ((uint64_t)overflows << 16) | count;
+}
+#endif
+
+#if defined(__AVR__)
+// ############################################ AVR, Timer1 input capture ICP1
+//
+// Timer1 runs free at prescaler 8 from begin on and the pulse timer only
+// moves OCR1A (pulse_timer.cpp). ICP1 captures one edge direction, ICES1 is
+// flipped after every capture. An edge back that arrives before the flip is
+// not latched; it is reported with the count at the time it was noticed so
+// that the level stays right.
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#define CAPTURE_INPUT __builtin_ctz(IN_CAPTURE_INPUTS)
+
+static inline uint8_t _pinLevel() { return PINB & _BV(PINB0) ? HIGH : LOW; }
+
+/// @brief Capture the next edge away from level
+static inline void _armEdge(uint8_t level) {
+    if (level) {
+        TCCR1B &= ~_BV(ICES1);
+    } else {
+        TCCR1B |= _BV(ICES1);
+    }
+    // Switching the edge may set a stale capture flag
+    TIFR1 = _BV(ICF1);
+}
+
+ISR(TIMER1_OVF_vect) { _overflows++; }
+
+ISR(TIMER1_CAPT_vect) {
+    uint16_t count = ICR1;
+    uint8_t level = TCCR1B & _BV(ICES1) ? HIGH : LOW;
+    _handler(_extendCount(count, TIFR1 & _BV(TOV1)), CAPTURE_INPUT, level);
+    _armEdge(level);
+    uint8_t pin_level = _pinLevel();
+    if (pin_level != level) {
+        count = TCNT1;
+        _handler(_extendCount(count, TIFR1 & _BV(TOV1)), CAPTURE_INPUT,
+                 pin_level);
+        _armEdge(pin_level);
+    }
+}
+
+void inputCaptureBegin(InputCaptureHandler handler) {
+    CriticalSection critical_section;
+    _handler = handler;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS11); // normal mode, prescaler 8
+    _armEdge(_pinLevel());
+    TIFR1 = _BV(TOV1);
+    TIMSK1 |= _BV(ICIE1) | _BV(TOIE1);
+}
+
+uint32_t inputCaptureHz() { return F_CPU / 8; }
+
+uint16_t inputCaptureCount() { return TCNT1; }
+
+#elif defined(__IMXRT1062__)
+// ############################################ Teensy 4.x, QTIMER3 capture
+//
+// Every capture input has its own timer of QTIMER3. The timers run with the
+// same clock and are started together, so their counts are equal and the
+// overflows of the first one extend all of them. Pads stay readable through
+// GPIO (SION) for trigger_inputs.
+#define CAPTURE_PCS 11 // IP bus clock / 8
+#define CAPTURE_PRESCALER 8
+#define CAPTURE_PAD_SION 0x10 // keep the pad input path to GPIO
+
+struct CapturePin {
+    int16_t pin;
+    volatile uint32_t *mux;
+    volatile uint32_t *select_input;
+};
+static const CapturePin _capture_pins[INPUT_CAPTURE_MAX_INPUTS] = {
+    {19, &IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_00,
+     &IOMUXC_QTIMER3_TIMER0_SELECT_INPUT},
+    {18, &IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_01,
+     &IOMUXC_QTIMER3_TIMER1_SELECT_INPUT},
+    {14, &IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_02,
+     &IOMUXC_QTIMER3_TIMER2_SELECT_INPUT},
+    {15, &IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_03,
+     &IOMUXC_QTIMER3_TIMER3_SELECT_INPUT},
+};
+
+struct CaptureChannel {
+    uint8_t input;
+    uint8_t timer;
+    uint8_t level; // level after the last reported edge
+};
+static CaptureChannel _channels[INPUT_CAPTURE_MAX_INPUTS];
+static uint8_t _num_channels = 0;
+
+#define CAPTURE_TIMER(timer) IMXRT_TMR3.CH[timer]
+
+static void _qtimerIsr() {
+    uint8_t overflow_timer = _channels[0].timer;
+    uint16_t overflow_sctrl = CAPTURE_TIMER(overflow_timer).SCTRL;
+    uint8_t overflow_pending = overflow_sctrl & TMR_SCTRL_TOF;
+
+    for (uint8_t i = 0; i < _num_channels; i++) {
+        CaptureChannel *channel = &_channels[i];
+        uint16_t sctrl = CAPTURE_TIMER(channel->timer).SCTRL;
+        if (!(sctrl & TMR_SCTRL_IEF)) {
+            continue;
+        }
+        // Both edges are captured, the level follows from the last one
+        uint16_t count = CAPTURE_TIMER(channel->timer).CAPT;
+        channel->level = !channel->level;
+        _handler(_extendCount(count, overflow_pending), channel->input,
+                 channel->level);
+        // Flags clear on writing 0, the 1 keeps TOF
+        CAPTURE_TIMER(channel->timer).SCTRL =
+            (sctrl | TMR_SCTRL_TOF) & ~TMR_SCTRL_IEF;
+        uint8_t pin_level =
+            CAPTURE_TIMER(channel->timer).SCTRL & TMR_SCTRL_INPUT ? HIGH : LOW;
+        if (pin_level != channel->level) {
+            count = CAPTURE_TIMER(channel->timer).CNTR;
+            channel->level = pin_level;
+            _handler(_extendCount(count, overflow_pending), channel->input,
+                     channel->level);
+        }
+    }
+
+    if (overflow_pending) {
+        _overflows++;
+        CAPTURE_TIMER(overflow_timer).SCTRL =
+            (CAPTURE_TIMER(overflow_timer).SCTRL | TMR_SCTRL_IEF) &
+            ~TMR_SCTRL_TOF;
+    }
+    asm volatile("dsb");
+}
+
+void inputCaptureBegin(InputCaptureHandler handler) {
+    CriticalSection critical_section;
+    _handler = handler;
+    CCM_CCGR6 |= CCM_CCGR6_QTIMER3(CCM_CCGR_ON);
+
+    uint16_t enable = 0;
+    _num_channels = 0;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if (!(captureInputs() & (1 << i))) {
+            continue;
+        }
+        uint8_t timer = teensy4CaptureTimer(INPUT_PINS[i]);
+        const CapturePin *pin = &_capture_pins[timer];
+        CaptureChannel *channel = &_channels[_num_channels];
+        channel->input = i;
+        channel->timer = timer;
+        channel->level = digitalRead(pin->pin);
+
+        IMXRT_TMR3.CH[0].ENBL &= ~(1 << timer);
+        CAPTURE_TIMER(timer).CTRL = 0;
+        CAPTURE_TIMER(timer).CNTR = 0;
+        CAPTURE_TIMER(timer).LOAD = 0;
+        CAPTURE_TIMER(timer).COMP1 = 0xFFFF;
+        CAPTURE_TIMER(timer).CMPLD1 = 0xFFFF;
+        CAPTURE_TIMER(timer).CSCTRL = 0;
+        CAPTURE_TIMER(timer).FILT = 0;
+        CAPTURE_TIMER(timer).SCTRL =
+            TMR_SCTRL_CAPTURE_MODE(3) | TMR_SCTRL_IEFIE |
+            (_num_channels == 0 ? TMR_SCTRL_TOFIE : 0);
+        CAPTURE_TIMER(timer).CTRL = TMR_CTRL_CM(1) |
+                                    TMR_CTRL_PCS(CAPTURE_PCS) |
+                                    TMR_CTRL_SCS(timer);
+        enable |= 1 << timer;
+
+        *pin->mux = 1 | CAPTURE_PAD_SION; // QTIMER3 is ALT1
+        *pin->select_input = 1;
+        _num_channels++;
+    }
+
+    attachInterruptVector(IRQ_QTIMER3, &_qtimerIsr);
+    NVIC_ENABLE_IRQ(IRQ_QTIMER3);
+    // Start together, the counts stay equal
+    IMXRT_TMR3.CH[0].ENBL |= enable;
+}
+
+uint32_t inputCaptureHz() { return F_BUS_ACTUAL / CAPTURE_PRESCALER; }
+
+uint16_t inputCaptureCount() { return CAPTURE_TIMER(_channels[0].timer).CNTR; }
+
+#elif defined(TRIGGER_SIM)
+// ################################################# Simulator, one capture pin
+#include "sim.h"
+
+#define SIM_CAPTURE_HZ 16000000UL
+#define CAPTURE_INPUT __builtin_ctz(IN_CAPTURE_INPUTS)
+
+static void _captureIsr() {
+    uint8_t level;
+    uint64_t ticks = simCaptureRead(&level);
+    _handler(ticks, CAPTURE_INPUT, level);
+    // Edges while the capture was pending are not latched
+    uint8_t pin_level = (simPortRead() >> INPUT_PINS[CAPTURE_INPUT]) & 1;
+    if (pin_level != level) {
+        _handler(simCaptureCount(), CAPTURE_INPUT, pin_level);
+    }
+}
+
+void inputCaptureBegin(InputCaptureHandler handler) {
+    CriticalSection critical_section;
+    _handler = handler;
+    simAttachCaptureInterrupt(INPUT_PINS[CAPTURE_INPUT], SIM_CAPTURE_HZ,
+                              &_captureIsr);
+}
+
+uint32_t inputCaptureHz() { return SIM_CAPTURE_HZ; }
+
+uint16_t inputCaptureCount() { return (uint16_t)simCaptureCount(); }
+
+#endif
+
+#else
+void inputCaptureBegin(InputCaptureHandler) {}
+
+uint32_t inputCaptureHz() { return 0; }
+
+uint16_t inputCaptureCount() { return 0; }
+#endif
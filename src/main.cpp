@@ -42,70 +42,377 @@
   https://flir.app.boxcn.net/s/xobncd08w5w3oc72tmvs33dnttqfpjw9/file/416905133542
 */
 
+#include "analog_sampler.h"
+#include "critical_section.h"
+#include "device_clock.h"
+#include "device_stats.h"
+#include "input_capture.h"
+#include "input_events.h"
+#include "pattern_output.h"
+#include "pulse_engine.h"
+#include "serial_link.h"
 #include "serial_peer.h"
+#include "timed_queue.h"
+#include "trigger_inputs.h"
+#include "trigger_outputs.h"
 #include "triggerpins_selector.h"
+#include "tx_queue.h"
 #include <Arduino.h>
 #include <PacketSerial.h>
 #include <stdint.h>
 
-#define BAUDRATE 115200
 #define SERIAL_START_DELAY 100
+#define EVENT_OVERFLOW_HOLDOFF_MS 100
+
+InputEventRing input_events;
+/// @brief input capture handler, called from the capture interrupt
+/// @param uptime_us
+/// @param state
+/// @param changed
+void handleInputs(uint32_t uptime_us, uint8_t state, uint8_t changed) {
+    // One event per channel the changed inputs are assigned to, all with
+    // the timestamp of the capture
+    uint8_t edges = __builtin_popcount(changed);
+    uint8_t events = 0;
+    while (changed) {
+        uint8_t channel = pulse_engine.getInputChannel(__builtin_ctz(changed));
+        for (uint8_t i = 0; i < NUM_INPUTS; i++) {
+            if (pulse_engine.getInputChannel(i) == channel) {
+                changed &= ~(1 << i);
+            }
+        }
+        input_events.push(
+            {uptime_us, pulse_engine.getPulseCount(channel), state});
+        events++;
+    }
+    deviceStatsInputs(edges, events);
+}
 
-// Delays
-#define SECOUND 1e6
-
-enum INPUT_MASK {
-    IN0_MASK = 1 << 0,
-    IN1_MASK = 1 << 1,
-    IN2_MASK = 1 << 2,
-    IN3_MASK = 1 << 3,
-    IN4_MASK = 1 << 4,
-    IN5_MASK = 1 << 5,
-    IN6_MASK = 1 << 6,
-    IN7_MASK = 1 << 7,
-};
-
-#define RESET_PULSE_COUNT UINT32_MAX
-uint32_t pulse_count = RESET_PULSE_COUNT;
-
-// Input interrupt macro
-#define makeInputInterrupt(pin, pullup, mask)                                  \
-    {                                                                          \
-        if (digitalPinToPort(pin) != 0) {                                      \
-            pinMode(pin, pullup);                                              \
-            attachInterrupt(                                                   \
-                digitalPinToInterrupt(pin), [] { handleInput(pin, mask); },    \
-                CHANGE);                                                       \
-            handleInput(pin, mask);                                            \
-        }                                                                      \
+#if IN_CAPTURE_INPUTS
+CaptureEventRing capture_events;
+/// @brief timer input capture handler, called from the capture interrupt
+/// @param uptime_us
+/// @param ticks
+/// @param state
+/// @param input
+void handleCapture(uint32_t uptime_us, uint64_t ticks, uint8_t state,
+                   uint8_t input) {
+    deviceStatsInputs(1, 1);
+    capture_events.push({ticks, uptime_us,
+                         pulse_engine.getInputPulseCount(input), state,
+                         input});
+}
+#endif
+
+/// @brief follower, called from the input interrupts before the inputs are
+/// timestamped
+/// @param state
+/// @param changed
+/// @param capture_count
+uint8_t followInputs(uint8_t state, uint8_t changed, uint16_t capture_count) {
+    return pulse_engine.followInputs(state, changed, capture_count);
+}
+
+BurstEventRing burst_events;
+/// @brief burst trigger handler, called from the input interrupt
+/// @param channel
+/// @param input
+/// @param status
+/// @param latency_ticks
+void handleBurst(uint8_t channel, uint8_t input, uint8_t status,
+                 uint32_t latency_ticks) {
+    burst_events.push({micros(), pulse_engine.getPulseCount(channel),
+                       latency_ticks, channel, input, status});
+}
+
+/// @brief sync edge handler, called from the pulse timer interrupt or for
+/// followers from the input interrupt
+/// @param channel
+void handleSync(uint8_t channel) {
+    input_events.push({micros(), pulse_engine.getPulseCount(channel),
+                       triggerInputsState()});
+}
+
+SegmentEventRing segment_events;
+/// @brief schedule segment handler, called from the pulse timer interrupt
+/// @param channel
+/// @param segment
+/// @param pass
+void handleSegment(uint8_t channel, uint8_t segment, uint16_t pass) {
+    segment_events.push({micros(), pulse_engine.getPulseCount(channel),
+                         channel, segment, pass});
+}
+
+/// @brief ScheduleLoader, hands a TYPE_SCHEDULE piece to the pulse engine
+/// @param msg
+uint8_t loadSchedule(const schedule_message *msg) {
+    return pulse_engine.loadSchedule(msg->channel, msg->flags, msg->repeat,
+                                     msg->first, msg->total, msg->segments,
+                                     msg->count);
+}
+
+TimedQueue timed_queue;
+TimedEventRing timed_events;
+static_assert(TIMED_EVENT_BUFFER_SIZE >= TIMED_QUEUE_SIZE,
+              "every queued timed command needs room for its event");
+/// @brief timed command handler, called from the pulse timer interrupt or
+/// from PulseEngine::armTimed()
+/// @param channel
+/// @param id
+/// @param status
+/// @param applied_us
+void handleTimed(uint8_t channel, uint8_t id, uint8_t status,
+                 uint64_t applied_us) {
+    timed_events.push(
+        {applied_us, pulse_engine.getPulseCount(channel), id, channel, status});
+}
+
+/// @brief TimedQueue, queues a TYPE_TIMED command until its time
+/// @param msg
+uint8_t queueTimed(const timed_message *msg) {
+    PulseTimedCommand command;
+    command.at = msg->at;
+    command.pulse_millihz = msg->pulse_millihz;
+    command.pulse_limit = msg->pulse_limit;
+    command.high_us = msg->high_us;
+    command.id = msg->id;
+    command.channel = msg->channel;
+    command.action = msg->action;
+    command.trigger = msg->trigger;
+    command.flags = msg->flags;
+    return timed_queue.push(&command);
+}
+
+#if PATTERN_OUTPUT
+PatternEventRing pattern_events;
+/// @brief played half handler, called from the DMA interrupt
+/// @param status
+/// @param first
+/// @param halves
+void handlePattern(uint8_t status, uint16_t first, uint32_t halves) {
+    pattern_events.push({micros(), halves, first, status});
+}
+
+/// @brief PatternLoader, hands TYPE_PATTERN to the pattern output
+/// @param msg
+uint8_t loadPattern(const pattern_message *msg) {
+    switch (msg->action) {
+    case PATTERN_LOAD:
+        return patternOutputLoad(msg->first, msg->steps, msg->count);
+    case PATTERN_START:
+        // A new pattern may overwrite the steps of the running one
+        patternOutputStop();
+        return patternOutputLoad(msg->first, msg->steps, msg->count) &&
+               patternOutputStart(msg->length, msg->outputs, msg->tick_ns,
+                                  msg->flags);
+    default:
+        patternOutputStop();
+        return true;
     }
+}
+#endif
 
-uint8_t inputs_state = 0;
-uint32_t inputs_changetime_us = 0;
-/// @brief input handler
-/// @param pin
-/// @param mask
-void handleInput(uint16_t pin, INPUT_MASK mask) {
-    if (digitalRead(pin)) {
-        inputs_state |= mask; // setting bit
-    } else {
-        inputs_state &= ~(mask); // clearing bit
+#if ANALOG_SAMPLING
+AnalogSetRing analog_sets;
+AnalogSet analog_set; // being converted
+volatile uint32_t analog_converted = 0; // sets since the setup
+volatile uint32_t analog_busy = 0;      // sets dropped, ADC still busy
+analog_message analog_setup;            // pins 0 -> off
+uint8_t analog_frame_sets = 1;          // sets that fill a frame
+uint32_t analog_overflows_before = 0;   // of analog_sets at the setup
+uint32_t analog_skipped = 0;            // sets the pulse engine skipped
+
+/// @brief analog set handler, called from the pulse timer interrupt or for
+/// bursts and followers from the input interrupt
+/// @param channel
+/// @param index
+void handleSample(uint8_t channel, uint8_t index) {
+    // The set completes in another interrupt, not before it has its key
+    CriticalSection critical_section;
+    if (!analogSamplerStart()) {
+        analog_busy++;
+        return;
     }
-    inputs_changetime_us = micros();
+    analog_set.uptime_us = micros();
+    analog_set.pulse_id = pulse_engine.getPulseCount(channel);
+    analog_set.index = index;
+}
+
+/// @brief finished set handler, called from the ADC interrupt
+/// @param values
+/// @param count
+void handleAnalogSet(const uint16_t *values, uint8_t count) {
+    memcpy(analog_set.values, values, count * sizeof(uint16_t));
+    analog_sets.push(analog_set);
+    analog_converted++;
 }
+#endif
 
 // Communication
+#if defined(__AVR__)
+// The largest host message the Uno/Nano take is a full schedule. PacketSerial
+// decodes a frame into a buffer of its length on the stack.
+#define RECEIVE_BUFFER_SIZE 64
+static_assert(MIN_LENGTH_SCHEDULE_MESSAGE +
+                      SCHEDULE_MAX_SEGMENTS * LENGTH_SCHEDULE_SEGMENT <
+                  RECEIVE_BUFFER_SIZE - 1,
+              "RECEIVE_BUFFER_SIZE can not take a full schedule");
+static_assert(LENGTH_TIMED_MESSAGE < RECEIVE_BUFFER_SIZE - 1,
+              "RECEIVE_BUFFER_SIZE can not take a timed command");
+PacketSerial_<COBS, 0, RECEIVE_BUFFER_SIZE> packet_serial;
+#else
 PacketSerial packet_serial;
+#endif
+TxQueue tx_queue;
 SerialPeer serial_peer;
 SetupStruct setup_struct;
 
-/// @brief PacketSender
+// Room for the largest input frame, a full batch wrapped with its sequence
+// number where the board has sequencing.
+// Events wait in their buffers until the transmit queue has it, input
+// events only until it has room for the frame they may close
+// (SerialPeer::inputsFrameLength()).
+#define INPUT_FRAME_SPACE TX_QUEUE_FRAME_SPACE(SERIAL_PEER_MAX_SEQUENCED_SIZE)
+static_assert(SERIAL_PEER_MAX_BATCH_SIZE >= LENGTH_INPUT_CAPTURE_MESSAGE,
+              "a capture message has to fit into INPUT_FRAME_SPACE");
+static_assert(SERIAL_PEER_MAX_BATCH_SIZE >= LENGTH_SEGMENT_MESSAGE,
+              "a segment message has to fit into INPUT_FRAME_SPACE");
+static_assert(SERIAL_PEER_MAX_BATCH_SIZE >= LENGTH_TIMED_REPLY_MESSAGE,
+              "a timed reply has to fit into INPUT_FRAME_SPACE");
+static_assert(SERIAL_PEER_MAX_BATCH_SIZE >= LENGTH_PATTERN_STATUS_MESSAGE,
+              "a pattern status has to fit into INPUT_FRAME_SPACE");
+static_assert(SERIAL_PEER_MAX_BATCH_SIZE >= LENGTH_BURST_REPLY_MESSAGE,
+              "a burst reply has to fit into INPUT_FRAME_SPACE");
+static_assert(SERIAL_PEER_MAX_BATCH_SIZE >=
+                  MIN_LENGTH_ANALOG_SAMPLES_MESSAGE +
+                      NUM_ANALOG_PINS * sizeof(uint16_t),
+              "a set of every analog input has to fit into INPUT_FRAME_SPACE");
+static_assert(INPUT_FRAME_SPACE <= TX_QUEUE_INPUTS_SIZE,
+              "TX_QUEUE_INPUTS_SIZE can not take a full batch");
+
+#if defined(__AVR_ATmega328P__)
+// The ATmega328P has 2 kB of RAM. Next to these buffers come the Serial
+// buffers, the Arduino core, the smaller globals and the stack, which takes
+// the PacketSerial decode buffer on top of the deepest loop() call.
+#define AVR_BUFFER_RAM 1408
+static_assert(sizeof(pulse_engine) + sizeof(serial_peer) + sizeof(tx_queue) +
+                      sizeof(packet_serial) + sizeof(input_events) +
+                      sizeof(segment_events) + sizeof(timed_queue) +
+                      sizeof(timed_events) + sizeof(burst_events) +
+                      sizeof(analog_sets) <=
+                  AVR_BUFFER_RAM,
+              "the buffers do not fit the RAM of the ATmega328P");
+#endif
+
+/// @brief PacketSender, queues the frame, it is written by tx_queue.update()
 /// @param send_buffer
 /// @param size
-void sendCOM(const uint8_t *send_buffer, size_t size) {
-    packet_serial.send(send_buffer, size);
+/// @param priority
+void sendCOM(const uint8_t *send_buffer, size_t size, uint8_t priority) {
+    uint8_t queued = tx_queue.push(priority, send_buffer, size);
+    deviceStatsTx(size, Serial.availableForWrite(), queued);
 }
 
+/// @brief FrameStart of the transmit queue, stamps a held time sync reply
+/// right before it goes out
+void startTxFrame() { serial_peer.sendTimeSync(); }
+
+#if ANALOG_SAMPLING
+/// @brief Send the converted sets in frames of consecutive sets, a frame
+/// goes out once it is full or its first set is max_latency_us old
+/// @param current_us
+/// @param force send what there is, full or not
+void sendAnalogSets(uint32_t current_us, uint8_t force) {
+    uint8_t num_pins = __builtin_popcount(analog_setup.pins);
+    AnalogSet set;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           analog_sets.peek(&set)) {
+        if (!force && analog_sets.size() < analog_frame_sets &&
+            current_us - set.uptime_us < analog_setup.max_latency_us) {
+            return;
+        }
+        uint32_t first_pulse_id = set.pulse_id;
+        uint8_t first_index = set.index;
+        uint32_t uptime_us = set.uptime_us;
+        uint32_t pulse_id = set.pulse_id;
+        uint8_t index = set.index;
+        uint16_t *values = serial_peer.analogSampleValues();
+        uint8_t count = 0;
+        do {
+            analog_sets.pop(&set);
+            memcpy(values, set.values, num_pins * sizeof(uint16_t));
+            values += num_pins;
+            count++;
+            if (++index >= analog_setup.divider) {
+                index = 0;
+                pulse_id++;
+            }
+        } while (count < analog_frame_sets && analog_sets.peek(&set) &&
+                 set.pulse_id == pulse_id && set.index == index);
+
+        analog_skipped += pulse_engine.takeSamplesSkipped();
+        uint32_t sets;
+        uint32_t dropped;
+        {
+            CriticalSection critical_section;
+            sets = analog_converted;
+            dropped = analog_busy;
+        }
+        dropped += analog_sets.getOverflows() - analog_overflows_before +
+                   analog_skipped;
+        serial_peer.sendAnalogSamples(
+            analog_setup.channel, analog_setup.pins, analog_setup.divider,
+            first_index, count, first_pulse_id, uptime_us, sets, dropped);
+    }
+}
+
+/// @brief AnalogSetup, applies TYPE_ANALOG. The sets of the old setup are
+/// sent as far as the transmit queue takes them, the counters restart.
+/// @param msg
+uint8_t setupAnalog(const analog_message *msg) {
+    uint8_t num_pins = __builtin_popcount(msg->pins);
+    uint8_t divider = msg->divider;
+    if (msg->pins &&
+        (msg->channel >= PULSE_CHANNELS || !divider ||
+         divider > ANALOG_MAX_DIVIDER || (divider & (divider - 1)) ||
+         (msg->pins & ~validAnalogInputs()) || num_pins > ANALOG_MAX_PINS)) {
+        return false;
+    }
+    pulse_engine.setupSampling(msg->channel, 0);
+    if (!analogSamplerSelect(msg->pins)) {
+        // Input without an ADC channel, the old setup goes on
+        pulse_engine.setupSampling(analog_setup.channel,
+                                   analog_setup.pins ? analog_setup.divider
+                                                     : 0);
+        return false;
+    }
+    sendAnalogSets(micros(), true);
+    AnalogSet set;
+    while (analog_sets.pop(&set)) {
+    }
+
+    analog_setup = *msg;
+    if (!num_pins) {
+        return true;
+    }
+    uint8_t frame_sets =
+        (SERIAL_PEER_MAX_BATCH_SIZE - MIN_LENGTH_ANALOG_SAMPLES_MESSAGE) /
+        (num_pins * sizeof(uint16_t));
+    analog_frame_sets = frame_sets < ANALOG_SET_BUFFER_SIZE / 2
+                            ? frame_sets
+                            : ANALOG_SET_BUFFER_SIZE / 2;
+    {
+        CriticalSection critical_section;
+        analog_converted = 0;
+        analog_busy = 0;
+    }
+    analog_overflows_before = analog_sets.getOverflows();
+    pulse_engine.takeSamplesSkipped();
+    analog_skipped = 0;
+    return pulse_engine.setupSampling(msg->channel, divider);
+}
+#endif
+
 // Serial echo
 #define DEBUG_COM false
 // DEBUG_COM needs 323 bytes of RAM and 204 bytes of Flash
@@ -126,7 +433,7 @@ void handleCOM(const uint8_t *incoming, size_t size) {
     memcpy(echo_buffer, incoming, size);
     echo_buffer_len = size;
 
-    sendCOM(echo_buffer, echo_buffer_len);
+    sendCOM(echo_buffer, echo_buffer_len, TX_PRIORITY_TEXT);
 #endif
 
     // Call handler
@@ -134,143 +441,165 @@ void handleCOM(const uint8_t *incoming, size_t size) {
         serial_peer.handleMessage((uint8_t *)incoming, size);
 }
 
-void triggerDigitalWrite(uint8_t state) {
-    // note: digitalWrite does not generate an error for invalid pins
-    digitalWrite(OUT00_PIN, state);
-    digitalWrite(OUT01_PIN, state);
-    digitalWrite(OUT02_PIN, state);
-    digitalWrite(OUT03_PIN, state);
-    digitalWrite(OUT04_PIN, state);
-    digitalWrite(OUT05_PIN, state);
-    digitalWrite(OUT06_PIN, state);
-    digitalWrite(OUT07_PIN, state);
-    digitalWrite(OUT08_PIN, state);
-    digitalWrite(OUT09_PIN, state);
-    digitalWrite(OUT10_PIN, state);
-    digitalWrite(OUT11_PIN, state);
-    digitalWrite(OUT12_PIN, state);
-    digitalWrite(OUT13_PIN, state);
-    digitalWrite(OUT14_PIN, state);
-    digitalWrite(OUT15_PIN, state);
-}
-
 void setup() {
     // Serial
-    Serial.begin(BAUDRATE);    // USB is always 12 or 480 Mbit/sec
+    // USB is always 12 or 480 Mbit/sec, the UART rate can change with
+    // TYPE_BAUD
+    serialLinkBegin(SERIAL_LINK_DEFAULT_BAUDRATE);
     delay(SERIAL_START_DELAY); // Time for USB Terminal to start
+    deviceStatsReset();
 
     // Outputs
-    // note: pinmode does not generate an error for invalid pins
-    pinMode(OUT00_PIN, OUTPUT);
-    pinMode(OUT01_PIN, OUTPUT);
-    pinMode(OUT02_PIN, OUTPUT);
-    pinMode(OUT03_PIN, OUTPUT);
-    pinMode(OUT04_PIN, OUTPUT);
-    pinMode(OUT05_PIN, OUTPUT);
-    pinMode(OUT06_PIN, OUTPUT);
-    pinMode(OUT07_PIN, OUTPUT);
-    pinMode(OUT08_PIN, OUTPUT);
-    pinMode(OUT09_PIN, OUTPUT);
-    pinMode(OUT10_PIN, OUTPUT);
-    pinMode(OUT11_PIN, OUTPUT);
-    pinMode(OUT12_PIN, OUTPUT);
-    pinMode(OUT13_PIN, OUTPUT);
-    pinMode(OUT14_PIN, OUTPUT);
-    pinMode(OUT15_PIN, OUTPUT);
+    // note: pins that do not exist on the board are skipped at compile time
+    triggerOutputsBegin();
+#if PATTERN_OUTPUT
+    patternOutputBegin(&handlePattern);
+#endif
+#if ANALOG_SAMPLING
+    analogSamplerBegin(&handleAnalogSet);
+#endif
 
     // Inputs
-    // note: makeInputInterrupt does not generate an error for invalid pins
-    makeInputInterrupt(IN00_PIN, INPUT_PULLUP, IN0_MASK);
-    makeInputInterrupt(IN01_PIN, INPUT_PULLUP, IN1_MASK);
-    makeInputInterrupt(IN02_PIN, INPUT_PULLUP, IN2_MASK);
-    makeInputInterrupt(IN03_PIN, INPUT_PULLUP, IN3_MASK);
-    makeInputInterrupt(IN04_PIN, INPUT_PULLUP, IN4_MASK);
-    makeInputInterrupt(IN05_PIN, INPUT_PULLUP, IN5_MASK);
-    makeInputInterrupt(IN06_PIN, INPUT_PULLUP, IN6_MASK);
-    makeInputInterrupt(IN07_PIN, INPUT_PULLUP, IN7_MASK);
+    // note: pins that do not exist on the board are skipped at compile time
+    triggerInputsSetFollower(&followInputs);
+#if IN_CAPTURE_INPUTS
+    triggerInputsBegin(&handleInputs, &handleCapture);
+#else
+    triggerInputsBegin(&handleInputs);
+#endif
 
     // Communication
     packet_serial.setStream(&Serial);
     packet_serial.setPacketHandler(&handleCOM);
+    tx_queue.setStream(&Serial);
+    tx_queue.setFrameStart(&startTxFrame);
 
     serial_peer.setPacketSender(&sendCOM);
+    serial_peer.setClock(&deviceClockUs);
+    serial_peer.setScheduleLoader(&loadSchedule);
+    serial_peer.setTimedQueue(&queueTimed);
+#if PATTERN_OUTPUT
+    serial_peer.setPatternLoader(&loadPattern);
+#endif
+#if ANALOG_SAMPLING
+    serial_peer.setAnalogSetup(&setupAnalog);
+#endif
+
+    // Pulses
+    pulse_engine.begin();
+    pulse_engine.setOutputWriter(&triggerOutputsWriteMasks);
+    pulse_engine.setSyncHandler(&handleSync);
+    pulse_engine.setSegmentHandler(&handleSegment);
+    pulse_engine.setTimedHandler(&handleTimed);
+    pulse_engine.setBurstHandler(&handleBurst);
+#if ANALOG_SAMPLING
+    pulse_engine.setSampleHandler(&handleSample);
+#endif
 }
 
 void loop() {
-    static uint32_t square_wave_timer_last_time_us = micros();
-    static uint8_t wave_state = LOW;
-    static uint8_t sync_rising_edge = true;
     static uint32_t setup_start_timer_last_time_us = micros();
     static uint32_t setup_start_timer_delay_us = 0;
     static uint8_t setup_start_timer_enable = false;
 
-    static uint8_t pulse_hz = 0;
-    static uint8_t req_pulse_hz = 0;
-    static uint32_t pulse_limit = 0;
-
-    // ######################################################### Generate pulses
-    //
-    //                            ┌─────┐     ┌─────┐     ┌─       ─┐
-    //          ...               │     │     │     │     │   ...   │ ...
-    //               ─────────────┘     └─────┘     └─────┘         └───────────
-    // wavestate           0      │  1  │  0  │  1  │  0  │ 1     n │     0
-    // pulse_count     UINT32_MAX │  0  │  0  │  1  │  1  │ 2     n │ UINT32_MAX
-    // pulse_count (cont.) n      │ n+1 │ n+1 │ n+2 │ n+2 │n+3   n+m│    n+m
-    // sync_rising_edge == true   ┴     │     ┴     │     ┴         │
-    // sync_rising_edge == false        ┴           ┴               ┴
-    //
+    // Pulses are generated by the pulse timer interrupt, see
+    // PulseEngine::handleEdge
     uint32_t current_us = micros();
+    deviceClockUs(); // track micros() wraps
+    static uint32_t last_loop_us = current_us;
+    deviceStatsLoop(current_us - last_loop_us);
+    last_loop_us = current_us;
 
-    if ((current_us - square_wave_timer_last_time_us) >
-            SECOUND / (pulse_hz *
-                       2) && // twice the frequency of the request framerate
-        pulse_hz             // Request framerate > 0
-    ) {
-        // Save last wave_state toggle time
-        square_wave_timer_last_time_us = current_us;
-
-        // Toggle wave_state
-        wave_state = !wave_state;
-
-        uint8_t square_wave_rising_edge = wave_state == HIGH;
-        uint8_t square_wave_falling_edge = wave_state == LOW;
-
-        // increment on wave_state rising edge
-        pulse_count += square_wave_rising_edge && req_pulse_hz;
-
-        // # square_wave_timer code:
-        triggerDigitalWrite(wave_state); // set pins
-
-        if (pulse_count == 0 &&
-            ((sync_rising_edge && square_wave_rising_edge) ||
-             (!sync_rising_edge && square_wave_falling_edge))) {
-            // Send first input on rising edge/falling edge (bool
-            // sync_rising_edge) to enable triggerdata/camera-metadata
-            // synchronisation
-            inputs_changetime_us = current_us;
-        }
-
-        // Request stop pulsing only after pulse_limit is reached
-        if (pulse_limit && pulse_count >= pulse_limit) {
-            req_pulse_hz = 0;
-        }
-
-        // Stop pulsing only after falling edge
-        if (wave_state == LOW) {
-            pulse_hz = req_pulse_hz;
+    // ################################################## Send inputs on changes
+    // Events stay in their buffers while the transmit queue is backed up.
+    // A segment start, timed command or burst goes before the inputs of its
+    // pulses. Frames the host asked for again go first, it holds back the
+    // ones after them.
+#if SERIAL_PEER_SEQUENCING
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           serial_peer.resendNext()) {
+    }
+#endif
+#if PATTERN_OUTPUT
+    PatternEvent pattern_event;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           pattern_events.pop(&pattern_event)) {
+        serial_peer.sendPattern(pattern_event.status, pattern_event.first,
+                                pattern_event.uptime_us, pattern_event.halves);
+    }
+#endif
+    BurstEvent burst_event;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           burst_events.pop(&burst_event)) {
+        uint32_t latency_ns = BURST_NO_LATENCY;
+        if (burst_event.latency_ticks != BURST_NO_LATENCY) {
+            latency_ns = (uint64_t)burst_event.latency_ticks * 1000000000UL /
+                         inputCaptureHz();
         }
+        serial_peer.sendBurst(burst_event.channel, burst_event.input,
+                              burst_event.status, burst_event.uptime_us,
+                              burst_event.pulse_id, latency_ns);
+    }
+    TimedEvent timed_event;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           timed_events.pop(&timed_event)) {
+        serial_peer.sendTimed(timed_event.id, timed_event.channel,
+                              timed_event.status, timed_event.applied_us,
+                              timed_event.pulse_id);
+        timed_queue.remove(timed_queue.first(timed_event.channel));
+    }
+    SegmentEvent segment_event;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           segment_events.pop(&segment_event)) {
+        serial_peer.sendSegment(segment_event.channel, segment_event.uptime_us,
+                                segment_event.pulse_id, segment_event.segment,
+                                segment_event.pass);
+    }
+    InputEvent input_event;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >=
+               TX_QUEUE_FRAME_SPACE(serial_peer.inputsFrameLength()) &&
+           input_events.pop(&input_event)) {
+        serial_peer.queueInputs(input_event.uptime_us, input_event.pulse_id,
+                                input_event.inputs_state);
+    }
+#if IN_CAPTURE_INPUTS
+    CaptureEvent capture_event;
+    while (tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE &&
+           capture_events.pop(&capture_event)) {
+        serial_peer.sendInputCapture(
+            capture_event.uptime_us, capture_event.pulse_id,
+            capture_event.inputs_state, capture_event.input,
+            capture_event.ticks);
+    }
+#endif
+#if ANALOG_SAMPLING
+    sendAnalogSets(current_us, false);
+#endif
+    if (tx_queue.space(TX_PRIORITY_INPUTS) >=
+        TX_QUEUE_FRAME_SPACE(serial_peer.inputsFrameLength())) {
+        serial_peer.updateBatch(current_us);
     }
 
-    // ################################################## Send inputs on changes
-    static uint32_t inputs_changetime_us_before = 0;
-    if (inputs_changetime_us_before != inputs_changetime_us) {
-        noInterrupts();
-        inputs_changetime_us_before = inputs_changetime_us;
-        uint8_t temp_inputs_state = inputs_state;
-        interrupts();
-
-        serial_peer.sendInputs(inputs_changetime_us_before, pulse_count,
-                               temp_inputs_state);
+    // Report events dropped because the event buffer was full. The count is
+    // cumulative, under sustained overflow one report per holdoff is enough.
+    static uint32_t input_overflows_before = 0;
+    static uint32_t input_overflows_ms = 0;
+    uint32_t input_overflows =
+        input_events.getOverflows() + segment_events.getOverflows() +
+        burst_events.getOverflows();
+#if IN_CAPTURE_INPUTS
+    input_overflows += capture_events.getOverflows();
+#endif
+#if PATTERN_OUTPUT
+    input_overflows += pattern_events.getOverflows();
+#endif
+    uint32_t now_ms = millis();
+    if (input_overflows_before != input_overflows &&
+        now_ms - input_overflows_ms >= EVENT_OVERFLOW_HOLDOFF_MS &&
+        tx_queue.space(TX_PRIORITY_INPUTS) >= INPUT_FRAME_SPACE) {
+        input_overflows_before = input_overflows;
+        input_overflows_ms = now_ms;
+        serial_peer.sendEventOverflow(input_overflows);
     }
 
     // Communication
@@ -282,7 +611,91 @@ void loop() {
         //
         // Ultimately you may need to just increase your recieve buffer via the
         // template parameters.
-        serial_peer.sendError((uint8_t *)"PacketSerial overflow error", 28);
+        deviceStatsRx(SERIAL_PEER_ERROR_RX_OVERFLOW);
+        serial_peer.sendError(SERIAL_PEER_ERROR_RX_OVERFLOW);
+    }
+
+    // #################################################### Handle info requests
+    if (serial_peer.getInfoRequest()) {
+        serial_peer.sendInfo(F_CPU, triggerOutputsSkewCycles(),
+                             triggerOutputsPorts(), inputCaptureHz(),
+                             captureInputs());
+    }
+
+    // ################################################### Handle stats requests
+    static uint32_t stats_overflows_before = 0;
+    uint8_t stats_reset;
+    if (serial_peer.getStatsRequest(&stats_reset)) {
+        DeviceStats stats;
+        deviceStatsRead(&stats);
+        stats.input_lost = input_overflows - stats_overflows_before;
+        stats.input_high_water = input_events.getHighWater();
+#if IN_CAPTURE_INPUTS
+        stats.capture_high_water = capture_events.getHighWater();
+#else
+        stats.capture_high_water = 0;
+#endif
+        serial_peer.sendStats(&stats);
+        if (stats_reset) {
+            deviceStatsReset();
+            stats_overflows_before = input_overflows;
+            input_events.resetHighWater();
+#if IN_CAPTURE_INPUTS
+            capture_events.resetHighWater();
+#endif
+        }
+    }
+
+    // ####################################################### Link speed change
+    uint32_t baudrate;
+    if (serial_peer.getBaudRequest(&baudrate)) {
+        serialLinkPropose(baudrate);
+    }
+    if (serial_peer.getBaudVerify()) {
+        serialLinkVerified();
+        serial_peer.sendBaud(serialLinkBaudrate(), BAUD_VERIFY);
+    }
+    serialLinkUpdate(tx_queue.empty());
+
+    // ############################################ Handle channel setup packets
+    PulseChannelSetup channel_setup;
+    for (uint8_t channel = 0; channel < PULSE_CHANNELS; channel++) {
+        if (serial_peer.getChannelSetup(channel, &channel_setup)) {
+            pulse_engine.setupChannel(channel, &channel_setup);
+        }
+    }
+    PulseCascadeSetup cascade_setup;
+    for (uint8_t channel = 0; channel < PULSE_CHANNELS; channel++) {
+        if (serial_peer.getCascadeSetup(channel, &cascade_setup)) {
+            pulse_engine.setupCascade(channel, &cascade_setup);
+        }
+    }
+    PulseBurstSetup burst_setup;
+    for (uint8_t channel = 0; channel < PULSE_CHANNELS; channel++) {
+        if (serial_peer.getBurstSetup(channel, &burst_setup)) {
+            pulse_engine.setupBurst(channel, &burst_setup);
+        }
+    }
+
+    // ################################################### Arm timed commands
+    // The oldest command of every channel goes to the pulse engine shortly
+    // before its time. A channel that stopped before the trigger dropped it,
+    // it is armed again for the stopped channel.
+    uint8_t timed_dropped = pulse_engine.takeTimedDropped();
+    uint64_t now_us = deviceClockUs();
+    for (uint8_t channel = 0; channel < PULSE_CHANNELS; channel++) {
+        PulseTimedCommand *command = timed_queue.first(channel);
+        if (!command) {
+            continue;
+        }
+        if (timed_dropped & (1 << channel)) {
+            command->armed = false;
+        }
+        if (command->armed || (command->trigger == TIMED_AT_US &&
+                               command->at > now_us + TIMED_ARM_US)) {
+            continue;
+        }
+        command->armed = pulse_engine.armTimed(command);
     }
 
     // #################################################### Handle setup packets
@@ -290,9 +703,9 @@ void loop() {
 #if DEBUG_COM
         echo_buffer_len =
             snprintf((char *)echo_buffer, MAX_MAIN_BUFFER_SIZE,
-                     "getSetup, pulse_hz: %d, pulse_limit: %lu, "
+                     "getSetup, pulse_millihz: %lu, pulse_limit: %lu, "
                      "setup_struct.delay_us: %lu",
-                     setup_struct.pulse_hz, setup_struct.pulse_limit,
+                     setup_struct.pulse_millihz, setup_struct.pulse_limit,
                      setup_struct.delay_us);
         serial_peer.sendTxt(echo_buffer, echo_buffer_len);
 #endif
@@ -309,15 +722,12 @@ void loop() {
         // # setup_start_timer code:
 
         // ######################################################### Apply setup
-        req_pulse_hz = setup_struct.pulse_hz;
-        pulse_limit = setup_struct.pulse_limit;
-        sync_rising_edge = setup_struct.flags & SYNC_RISING_EDGE;
-
-        if (setup_struct.flags & RESET_COUNTER) {
-            pulse_count = RESET_PULSE_COUNT;
-        }
-    }
-    if (pulse_hz == 0) {
-        pulse_hz = req_pulse_hz;
+        pulse_engine.setup(setup_struct.pulse_millihz,
+                           setup_struct.pulse_limit, setup_struct.high_us,
+                           setup_struct.flags & SYNC_RISING_EDGE,
+                           setup_struct.flags & RESET_COUNTER);
     }
+
+    // Communication
+    tx_queue.update();
 }
@@ -0,0 +1,258 @@
+/*******************************************************************************
+ * File:        pattern_output.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "pattern_output.h"
+
+#if PATTERN_OUTPUT
+#include "critical_section.h"
+
+#if defined(__IMXRT1062__)
+#define PATTERN_PORTS 4 // GPIO6..9
+#else
+#define PATTERN_PORTS 1
+#endif
+
+static uint16_t _steps[PATTERN_MAX_STEPS]; // OUT00..OUT15 levels
+// Toggle masks per port, read by the DMA
+static volatile uint32_t _words[PATTERN_PORTS][PATTERN_MAX_STEPS];
+static uint8_t _num_ports = 0;
+static uint16_t _length = 0;
+static uint16_t _outputs = 0;
+static uint8_t _flags = 0;
+static TriggerOutputMask _output_mask; // outputs of the running pattern
+static const TriggerOutputMask _no_outputs = {};
+static volatile uint8_t _running = false;
+// Streaming: halves loaded again since they were played, bit per half
+static volatile uint8_t _loaded = 0;
+static volatile uint32_t _halves = 0;
+static PatternHandler _handler = nullptr;
+
+/// @brief End of a half, called from the DMA interrupt
+/// @param position steps of the current pass through the buffer played
+static void _halfPlayed(uint16_t position) {
+    uint16_t half = _length / 2;
+    // The other half started a moment ago
+    uint8_t played = position >= half ? 0 : 1;
+    _halves++;
+    if (!(_flags & PATTERN_STREAM)) {
+        return;
+    }
+    _loaded &= ~(1 << played);
+    if (!(_loaded & (1 << !played))) {
+        // Its first step is due at the next tick
+        patternOutputStop();
+        _handler(PATTERN_UNDERRUN, !played * half, _halves);
+        return;
+    }
+    _handler(PATTERN_REFILL, played * half, _halves);
+}
+
+#if defined(__IMXRT1062__)
+// ######################################## Teensy 4.x, QTIMER4 paced DMA chain
+//
+// QTIMER4 timer 0 counts the bus clock up to COMP1 and starts over. Every
+// compare loads COMP1 from CMPLD1 and requests the pacer channel, which
+// writes CMPLD1 again to acknowledge the request. The pacer links to the
+// channel of the first port, every port channel writes the toggle mask of
+// its port and links to the next one, so the ports change a few bus cycles
+// apart. All channels take one transfer per step and stay in step. The last
+// one interrupts at the half and at the end of the buffer.
+#include <DMAChannel.h>
+
+#define PATTERN_TIMER IMXRT_TMR4.CH[0]
+#define PATTERN_PCS 8 // IP bus clock, + log2 of the prescaler
+
+static DMAChannel _pacer;
+static DMAChannel _port_dma[PATTERN_PORTS];
+static volatile uint16_t _compare = 0; // rewritten to CMPLD1 by the pacer
+
+static void _dmaIsr() {
+    DMAChannel *last = &_port_dma[_num_ports - 1];
+    last->clearInterrupt();
+    // CITER counts down the transfers left in the pass
+    _halfPlayed(_length - last->TCD->CITER);
+    asm volatile("dsb");
+}
+
+static void _portMasks(uint16_t outputs, uint32_t *masks) {
+    TriggerOutputMask mask;
+    triggerOutputsMask(outputs, &mask);
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        masks[i] = mask.port[i];
+    }
+}
+
+static void _dmaStart(uint32_t tick_ns) {
+    // Bus cycles per tick, prescaled into the 16 bit compare. Ticks up to
+    // 436 us at 150 MHz need no prescaler and are exact to the bus cycle.
+    uint64_t cycles =
+        ((uint64_t)tick_ns * F_BUS_ACTUAL + 500000000UL) / 1000000000UL;
+    uint8_t prescale = 0;
+    while ((cycles >> prescale) > 0x10000) {
+        prescale++;
+    }
+    _compare = (cycles >> prescale) - 1;
+
+    CCM_CCGR6 |= CCM_CCGR6_QTIMER4(CCM_CCGR_ON);
+    PATTERN_TIMER.CTRL = 0;
+    PATTERN_TIMER.SCTRL = 0;
+    PATTERN_TIMER.CNTR = 0;
+    PATTERN_TIMER.LOAD = 0;
+    PATTERN_TIMER.COMP1 = _compare;
+    PATTERN_TIMER.CMPLD1 = _compare;
+    PATTERN_TIMER.CSCTRL = TMR_CSCTRL_CL1(1); // COMP1 from CMPLD1 at compare
+    PATTERN_TIMER.DMA = TMR_DMA_CMPLD1DE;
+
+    _pacer.source(_compare);
+    _pacer.destination(PATTERN_TIMER.CMPLD1);
+    _pacer.transferCount(_length);
+    _pacer.triggerAtHardwareEvent(DMAMUX_SOURCE_QTIMER4_WRITE0_CMPLD1);
+    DMAChannel *previous = &_pacer;
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        DMAChannel *dma = &_port_dma[i];
+        dma->sourceBuffer(_words[i], _length * sizeof(uint32_t));
+        dma->destination(*triggerOutputsToggleRegister(i));
+        // Minor links skip the last transfer of a pass, the major link
+        // covers it
+        dma->triggerAtTransfersOf(*previous);
+        dma->triggerAtCompletionOf(*previous);
+        previous = dma;
+    }
+    previous->interruptAtHalf();
+    previous->interruptAtCompletion();
+    previous->attachInterrupt(&_dmaIsr);
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        _port_dma[i].enable();
+    }
+    _pacer.enable();
+
+    // The first compare plays step 0
+    PATTERN_TIMER.CTRL = TMR_CTRL_CM(1) |
+                         TMR_CTRL_PCS(PATTERN_PCS + prescale) | TMR_CTRL_LENGTH;
+}
+
+static void _dmaStop() {
+    PATTERN_TIMER.CTRL = 0;
+    PATTERN_TIMER.DMA = 0;
+    _pacer.disable();
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        _port_dma[i].disable();
+        _port_dma[i].clearInterrupt();
+    }
+}
+
+#elif defined(TRIGGER_SIM)
+// ######################################## Simulator, the HAL stream is the DMA
+#include "sim.h"
+
+static void _streamIsr() { _halfPlayed(simStreamPosition()); }
+
+static void _portMasks(uint16_t outputs, uint32_t *masks) {
+    TriggerOutputMask mask;
+    triggerOutputsMask(outputs, &mask);
+    masks[0] = mask.pins;
+}
+
+static void _dmaStart(uint32_t tick_ns) {
+    simStartStream(_words[0], _length, tick_ns, &_streamIsr);
+}
+
+static void _dmaStop() { simStopStream(); }
+
+#endif
+
+/// @brief Toggle masks of step i from the one before it in the loop
+static void _updateWords(uint16_t i) {
+    uint16_t previous = _steps[i ? i - 1 : _length - 1];
+    uint32_t masks[PATTERN_PORTS];
+    _portMasks((_steps[i] ^ previous) & _outputs, masks);
+    for (uint8_t port = 0; port < _num_ports; port++) {
+        _words[port][i] = masks[port];
+    }
+}
+
+void patternOutputBegin(PatternHandler handler) { _handler = handler; }
+
+uint8_t patternOutputLoad(uint16_t first, const void *steps, uint8_t count) {
+    if (first + count > PATTERN_MAX_STEPS) {
+        return false;
+    }
+    uint16_t half = _length / 2;
+    uint8_t target = 0;
+    if (_running) {
+        // Only the half of a stream that was played and not loaded since
+        if (!(_flags & PATTERN_STREAM) || first >= _length) {
+            return false;
+        }
+        target = first / half;
+        if ((_loaded & (1 << target)) || first + count > (target + 1) * half) {
+            return false;
+        }
+    }
+    memcpy(&_steps[first], steps, count * sizeof(uint16_t));
+    if (!_running) {
+        return true;
+    }
+    // The step after the piece toggles against its new predecessor. It is
+    // the first of the playing half or of the rest of this one, both not
+    // due before the next pass.
+    for (uint16_t i = first; i <= first + count; i++) {
+        _updateWords(i % _length);
+    }
+    if (first + count == (target + 1) * half) {
+        CriticalSection critical_section;
+        _loaded |= 1 << target;
+    }
+    return true;
+}
+
+uint8_t patternOutputStart(uint16_t length, uint16_t outputs, uint32_t tick_ns,
+                           uint8_t flags) {
+    if (length < 2 || length % 2 || length > PATTERN_MAX_STEPS ||
+        tick_ns < PATTERN_MIN_TICK_NS || tick_ns > PATTERN_MAX_TICK_NS ||
+        triggerOutputsPorts() > PATTERN_PORTS) {
+        return false;
+    }
+    patternOutputStop();
+    _num_ports = triggerOutputsPorts();
+    _length = length;
+    _outputs = outputs;
+    _flags = flags;
+    for (uint16_t i = 0; i < length; i++) {
+        _updateWords(i);
+    }
+    triggerOutputsMask(outputs, &_output_mask);
+
+    // Step 0 toggles away from the last step
+    TriggerOutputMask set;
+    TriggerOutputMask clear;
+    triggerOutputsMask(_steps[length - 1] & outputs, &set);
+    triggerOutputsMask(~_steps[length - 1] & outputs, &clear);
+    CriticalSection critical_section;
+    _halves = 0;
+    _loaded = 0x3;
+    _running = true;
+    triggerOutputsWriteMasks(&set, &clear);
+    _dmaStart(tick_ns);
+    return true;
+}
+
+void patternOutputStop() {
+    CriticalSection critical_section;
+    if (!_running) {
+        return;
+    }
+    _dmaStop();
+    _running = false;
+    triggerOutputsWriteMasks(&_no_outputs, &_output_mask);
+}
+
+uint8_t patternOutputRunning() { return _running; }
+
+#endif
@@ -0,0 +1,1249 @@
+/*******************************************************************************
+ * File:        pulse_engine.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "pulse_engine.h"
+#include "critical_section.h"
+#include "device_clock.h"
+#include "device_stats.h"
+#include "input_capture.h"
+
+PulseEngine pulse_engine;
+
+static uint32_t _pulseTimerCallback() {
+    deviceStatsEdge(pulseTimerLateTicks() / PULSE_TIMER_TICKS_PER_US);
+    return pulse_engine.handleEdge();
+}
+
+/// @brief a before b on the modulo 2^32 tick timeline
+static inline uint8_t _ticksBefore(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+PulseEngine::PulseEngine() {
+    memset(_channels, 0, sizeof(_channels));
+    memset(_channel_outputs, 0, sizeof(_channel_outputs));
+    memset(_sync_outputs, 0, sizeof(_sync_outputs));
+    memset(_input_channels, 0, sizeof(_input_channels));
+    memset(_timed, 0, sizeof(_timed));
+    memset(_bursts, 0, sizeof(_bursts));
+    for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+        _channels[i].pulse_count = RESET_PULSE_COUNT;
+        _channels[i].gen_pulse_count = RESET_PULSE_COUNT;
+        _channels[i].sync_rising_edge = true;
+        _channels[i].segment = PULSE_NO_SEGMENT;
+        _channels[i].clock_input = CASCADE_NO_INPUT;
+        _channels[i].sync_input = CASCADE_NO_INPUT;
+    }
+}
+
+void PulseEngine::begin() {
+    _channel_outputs[0] = ALL_OUTPUTS;
+    for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+        triggerOutputsMask(_channel_outputs[i], &_channels[i].outputs);
+    }
+}
+
+/// @brief Period for a rate, only called from loop(), the 64 bit division is
+/// too slow for the timer interrupt on AVR
+FixedTicks PulseEngine::period(uint32_t pulse_millihz) {
+    uint64_t ticks =
+        ((uint64_t)PULSE_TIMER_HZ * MILLIHZ_PER_HZ << 32) / pulse_millihz;
+    FixedTicks period = {(uint32_t)(ticks >> 32), (uint32_t)ticks};
+
+    // Both the high and the low time have to fit one timer interval
+    if (period.ticks < 2 * PULSE_TIMER_MIN_TICKS) {
+        period.ticks = 2 * PULSE_TIMER_MIN_TICKS;
+        period.frac = 0;
+    } else if (period.ticks >= 2 * PULSE_TIMER_MAX_TICKS) {
+        period.ticks = 2 * PULSE_TIMER_MAX_TICKS;
+        period.frac = 0;
+    }
+    return period;
+}
+
+/// @brief High time of every pulse, only called from loop()
+/// @param high_us 0 -> half the period
+FixedTicks PulseEngine::highTime(const FixedTicks *period, uint32_t high_us) {
+    FixedTicks high;
+    if (!high_us) {
+        high.ticks = period->ticks >> 1;
+        high.frac = (period->frac >> 1) | (period->ticks << 31);
+        return high;
+    }
+
+    // Neither edge may come closer than the timer resolves and neither the
+    // high nor the low time may be longer than one timer interval
+    uint64_t ticks = (uint64_t)high_us * PULSE_TIMER_TICKS_PER_US;
+    uint32_t min_ticks = PULSE_TIMER_MIN_TICKS;
+    uint32_t max_ticks = period->ticks - PULSE_TIMER_MIN_TICKS;
+    if (period->ticks > PULSE_TIMER_MAX_TICKS + PULSE_TIMER_MIN_TICKS) {
+        min_ticks = period->ticks - PULSE_TIMER_MAX_TICKS;
+    }
+    if (max_ticks > PULSE_TIMER_MAX_TICKS) {
+        max_ticks = PULSE_TIMER_MAX_TICKS;
+    }
+    if (ticks < min_ticks) {
+        ticks = min_ticks;
+    } else if (ticks > max_ticks) {
+        ticks = max_ticks;
+    }
+    high.ticks = ticks;
+    high.frac = 0;
+    return high;
+}
+
+/// @brief Apply a setup to channel 0, called from loop()
+/// @param pulse_millihz 0 -> stop after the next falling edge
+/// @param pulse_limit 0 -> unlimited pulses
+/// @param high_us 0 -> half the period
+/// @param sync_rising_edge
+/// @param reset_counter
+void PulseEngine::setup(uint32_t pulse_millihz, uint32_t pulse_limit,
+                        uint32_t high_us, uint8_t sync_rising_edge,
+                        uint8_t reset_counter) {
+    configure(0, pulse_millihz, high_us, 0, pulse_limit, sync_rising_edge,
+              reset_counter);
+}
+
+/// @brief Assign outputs and inputs to a channel and apply its setup, called
+/// from loop()
+/// @return false if the channel does not exist
+uint8_t PulseEngine::setupChannel(uint8_t channel,
+                                  const PulseChannelSetup *setup) {
+    if (channel >= PULSE_CHANNELS) {
+        return false;
+    }
+
+    assignOutputs(channel, setup->outputs,
+                  _sync_outputs[channel] & ~setup->outputs);
+    for (uint8_t i = 0; i < NUM_INPUTS; i++) {
+        if (setup->inputs & (1 << i)) {
+            _input_channels[i] = channel;
+        } else if (_input_channels[i] == channel) {
+            _input_channels[i] = 0;
+        }
+    }
+
+    uint64_t phase_ticks = (uint64_t)setup->phase_us * PULSE_TIMER_TICKS_PER_US;
+    if (phase_ticks > PULSE_TIMER_MAX_TICKS) {
+        phase_ticks = PULSE_TIMER_MAX_TICKS;
+    }
+    configure(channel, setup->pulse_millihz, setup->high_us, phase_ticks,
+              setup->pulse_limit, setup->flags & SYNC_RISING_EDGE,
+              setup->flags & RESET_COUNTER);
+    return true;
+}
+
+/// @brief Make a channel a follower of the clock input or give it back its
+/// generator, and set its sync outputs, called from loop()
+/// @return false if the channel does not exist
+uint8_t PulseEngine::setupCascade(uint8_t channel,
+                                  const PulseCascadeSetup *setup) {
+    if (channel >= PULSE_CHANNELS) {
+        return false;
+    }
+    PulseChannel *ch = &_channels[channel];
+    if (setup->clock_input != CASCADE_NO_INPUT) {
+        // A follower has no generator of its own
+        configure(channel, 0, 0, 0, 0, ch->sync_rising_edge, false);
+    }
+    assignOutputs(channel, _channel_outputs[channel] & ~setup->sync_outputs,
+                  setup->sync_outputs);
+
+    CriticalSection critical_section;
+    ch->clock_input = setup->clock_input;
+    ch->sync_input = setup->sync_input;
+    updateFollowers();
+    if (setup->clock_input != CASCADE_NO_INPUT) {
+        _bursts[channel].pulse_millihz = 0;
+        updateBursts();
+    }
+    return true;
+}
+
+/// @brief Arm or disarm the external trigger of a channel, called from
+/// loop()
+///
+/// Arming stops the generator of the channel and ends a cascade, the channel
+/// keeps its outputs and pulse_id. A burst that is playing finishes.
+/// @return false if the channel does not exist or the burst has no pulses
+uint8_t PulseEngine::setupBurst(uint8_t channel,
+                                const PulseBurstSetup *setup) {
+    uint8_t arm = setup->input != BURST_NO_INPUT;
+    if (channel >= PULSE_CHANNELS ||
+        (arm && (setup->input >= NUM_INPUTS || !setup->pulse_count ||
+                 !setup->pulse_millihz))) {
+        return false;
+    }
+    PulseChannel *ch = &_channels[channel];
+    BurstTrigger burst = {0, {0, 0}, {0, 0}, 0, 0, false};
+    if (arm) {
+        configure(channel, 0, 0, 0, 0, ch->sync_rising_edge, false);
+        burst.pulse_millihz = setup->pulse_millihz;
+        burst.period = period(setup->pulse_millihz);
+        burst.high = highTime(&burst.period, setup->high_us);
+        burst.pulse_count = setup->pulse_count;
+        burst.input = setup->input;
+        burst.falling_edge = setup->flags & BURST_FALLING_EDGE;
+    }
+
+    CriticalSection critical_section;
+    if (arm && ch->clock_input != CASCADE_NO_INPUT) {
+        ch->clock_input = CASCADE_NO_INPUT;
+        updateFollowers();
+    }
+    _bursts[channel] = burst;
+    updateBursts();
+    return true;
+}
+
+/// @brief Sample the analog inputs in step with a channel, called from
+/// loop()
+///
+/// Every rising edge of the channel starts a set, divider > 1 adds the sets
+/// between its edges. A new setup applies from the next rising edge on.
+/// @param divider sets per pulse, a power of two; 0 -> off
+/// @return false if the channel does not exist or the divider is invalid
+uint8_t PulseEngine::setupSampling(uint8_t channel, uint8_t divider) {
+    if (divider && (channel >= PULSE_CHANNELS ||
+                    divider > ANALOG_MAX_DIVIDER ||
+                    (divider & (divider - 1)))) {
+        return false;
+    }
+    uint8_t sample_channel = divider ? channel : PULSE_NO_SAMPLE;
+
+    CriticalSection critical_section;
+    // Sets between the edges are of the old divider, the ones of another
+    // channel are gone
+    for (uint8_t i = 0; i < 2; i++) {
+        if (_batches[i].sample != 0 || sample_channel != _sample_channel) {
+            _batches[i].sample = PULSE_NO_SAMPLE;
+        }
+    }
+    _sample_channel = sample_channel;
+    _sample_shift = divider ? __builtin_ctz(divider) : 0;
+    _sample_index = 0;
+    return true;
+}
+
+/// @brief Sets between the edges the sampled channel did not get to
+/// @return count since the last call
+uint32_t PulseEngine::takeSamplesSkipped() {
+    CriticalSection critical_section;
+    uint32_t skipped = _samples_skipped;
+    _samples_skipped = 0;
+    return skipped;
+}
+
+/// @brief Outputs and sync outputs belong to one channel, the ones given to
+/// the channel are taken from all others. Outputs that lose their channel go
+/// low.
+void PulseEngine::assignOutputs(uint8_t channel, uint16_t outputs,
+                                uint16_t sync_outputs) {
+    uint16_t taken = outputs | sync_outputs;
+    uint16_t released =
+        (_channel_outputs[channel] | _sync_outputs[channel]) & ~taken;
+    for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+        uint16_t channel_outputs =
+            i == channel ? outputs : _channel_outputs[i] & ~taken;
+        uint16_t channel_sync_outputs =
+            i == channel ? sync_outputs : _sync_outputs[i] & ~taken;
+        if (channel_outputs != _channel_outputs[i]) {
+            _channel_outputs[i] = channel_outputs;
+            TriggerOutputMask mask;
+            triggerOutputsMask(channel_outputs, &mask);
+            CriticalSection critical_section;
+            _channels[i].outputs = mask;
+        }
+        if (channel_sync_outputs != _sync_outputs[i]) {
+            _sync_outputs[i] = channel_sync_outputs;
+            TriggerOutputMask mask;
+            triggerOutputsMask(channel_sync_outputs, &mask);
+            CriticalSection critical_section;
+            _channels[i].sync_outputs = mask;
+            if (channel_sync_outputs) {
+                _sync_channels |= 1 << i;
+            } else {
+                _sync_channels &= ~(1 << i);
+            }
+        }
+    }
+    if (released) {
+        TriggerOutputMask none;
+        TriggerOutputMask clear;
+        triggerOutputsMask(0, &none);
+        triggerOutputsMask(released, &clear);
+        CriticalSection critical_section;
+        _outputWriterFunction(&none, &clear);
+    }
+}
+
+/// @brief Collect the inputs the followers listen to, interrupts off
+void PulseEngine::updateFollowers() {
+    _followers = 0;
+    _clock_inputs = 0;
+    _sync_inputs = 0;
+    for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+        PulseChannel *ch = &_channels[i];
+        if (ch->clock_input == CASCADE_NO_INPUT) {
+            continue;
+        }
+        _followers |= 1 << i;
+        _clock_inputs |= 1 << ch->clock_input;
+        if (ch->sync_input != CASCADE_NO_INPUT) {
+            _sync_inputs |= 1 << ch->sync_input;
+        }
+    }
+}
+
+/// @brief Collect the inputs the armed bursts trigger on, interrupts off
+void PulseEngine::updateBursts() {
+    _burst_channels = 0;
+    _burst_rising = 0;
+    _burst_falling = 0;
+    for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+        BurstTrigger *burst = &_bursts[i];
+        if (!burst->pulse_millihz) {
+            continue;
+        }
+        _burst_channels |= 1 << i;
+        if (burst->falling_edge) {
+            _burst_falling |= 1 << burst->input;
+        } else {
+            _burst_rising |= 1 << burst->input;
+        }
+    }
+}
+
+/// @brief Load a piece of the schedule table, called from loop()
+///
+/// The first piece of a table empties the table, a channel still following
+/// the old one stops at the end of its segment. The last piece starts the
+/// schedule on the channel.
+/// @return false if the piece is out of order or a segment is invalid
+uint8_t PulseEngine::loadSchedule(uint8_t channel, uint8_t flags,
+                                  uint16_t repeat, uint8_t first,
+                                  uint8_t total,
+                                  const schedule_segment *segments,
+                                  uint8_t count) {
+    if (channel >= PULSE_CHANNELS || !count || total > SCHEDULE_MAX_SEGMENTS ||
+        first + count > total) {
+        return false;
+    }
+    if (!first) {
+        CriticalSection critical_section;
+        _schedule_size = 0;
+        _schedule_loaded = 0;
+    } else if (first != _schedule_loaded) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        const schedule_segment *segment = &segments[i];
+        if (!segment->pulse_millihz || !segment->pulse_count) {
+            return false;
+        }
+        ScheduleSegment *entry = &_schedule[first + i];
+        entry->pulse_millihz = segment->pulse_millihz;
+        entry->period = period(segment->pulse_millihz);
+        entry->high = highTime(&entry->period, segment->high_us);
+        entry->pulse_count = segment->pulse_count;
+        entry->flags = segment->flags;
+        // The low time of the last pulse and the gap are one timer interval
+        uint32_t max_gap_ticks = PULSE_TIMER_MAX_TICKS -
+                                 (entry->period.ticks - entry->high.ticks + 1);
+        uint64_t gap_ticks =
+            (uint64_t)segment->gap_us * PULSE_TIMER_TICKS_PER_US;
+        entry->gap_ticks =
+            gap_ticks > max_gap_ticks ? max_gap_ticks : (uint32_t)gap_ticks;
+    }
+    _schedule_loaded = first + count;
+    if (_schedule_loaded < total) {
+        return true;
+    }
+
+    {
+        CriticalSection critical_section;
+        if (_schedule_channel != PULSE_NO_SEGMENT &&
+            _schedule_channel != channel &&
+            _channels[_schedule_channel].segment != PULSE_NO_SEGMENT) {
+            // One channel at a time, the previous one stops after its pulse
+            _channels[_schedule_channel].req_pulse_millihz = 0;
+            _channels[_schedule_channel].req_changed = true;
+        }
+        _schedule_size = total;
+        _schedule_repeat = repeat;
+        _schedule_channel = channel;
+    }
+    request(channel, _schedule[0].pulse_millihz, &_schedule[0].period,
+            &_schedule[0].high, 0, 0, flags & SYNC_RISING_EDGE,
+            flags & RESET_COUNTER, true);
+    return true;
+}
+
+/// @brief Hand a timed command to the generator, called from loop()
+///
+/// A running channel applies it at the falling edge before its trigger. A
+/// stopped channel has no edges to wait for: a setup starts it at the time,
+/// a stop or reset is applied once the time has come.
+/// @return false if the command has to wait and be armed again
+uint8_t PulseEngine::armTimed(const PulseTimedCommand *command) {
+    uint8_t channel = command->channel;
+    PulseChannel *ch = &_channels[channel];
+    uint8_t action = command->action;
+    FixedTicks period_ticks = {0, 0};
+    FixedTicks high_ticks = {0, 0};
+    if (action == TIMED_SETUP && !command->pulse_millihz) {
+        action = TIMED_STOP;
+    } else if (action == TIMED_SETUP) {
+        period_ticks = period(command->pulse_millihz);
+        high_ticks = highTime(&period_ticks, command->high_us);
+    }
+    uint8_t at_us = command->trigger == TIMED_AT_US;
+
+    CriticalSection critical_section;
+    uint64_t now_us = deviceClockUs();
+    TimedAction *timed = &_timed[channel];
+    timed->id = command->id;
+    timed->status = TIMED_APPLIED;
+    // First tick the generator has not passed, or the target on its timeline
+    uint64_t earliest = _horizon_ticks64 + PULSE_TIMER_MIN_TICKS;
+    uint64_t due = earliest;
+    if (at_us && _running) {
+        due = command->at > _start_us
+                  ? (command->at - _start_us) * PULSE_TIMER_TICKS_PER_US
+                  : 0;
+    }
+    if (due < earliest) {
+        due = earliest;
+        timed->status = TIMED_LATE;
+    }
+
+    if (ch->pulse_millihz) {
+        timed->trigger = command->trigger;
+        timed->target = at_us ? (uint32_t)due : (uint32_t)command->at;
+        timed->pulse_millihz = command->pulse_millihz;
+        timed->period = period_ticks;
+        timed->high = high_ticks;
+        timed->pulse_limit = command->pulse_limit;
+        timed->flags = command->flags;
+        timed->action = action;
+        return true;
+    }
+
+    if (action != TIMED_SETUP) {
+        if (at_us && command->at > now_us) {
+            return false;
+        }
+        timed->status = TIMED_APPLIED;
+        if (action == TIMED_RESET) {
+            // Edges the generator already produced are still to be counted
+            ch->pulse_count = RESET_PULSE_COUNT;
+            ch->gen_pulse_count =
+                RESET_PULSE_COUNT + pendingRisingEdges(channel);
+        }
+        _timedHandlerFunction(channel, timed->id, timed->status, now_us);
+        return true;
+    }
+
+    uint64_t phase_ticks = 0;
+    if (_running) {
+        phase_ticks = due - PULSE_TIMER_MIN_TICKS;
+    } else if (at_us) {
+        // The engine starts with this channel, tick 0 is now
+        uint64_t first_us =
+            now_us + PULSE_TIMER_MIN_TICKS / PULSE_TIMER_TICKS_PER_US;
+        if (command->at >= first_us) {
+            phase_ticks = (command->at - first_us) * PULSE_TIMER_TICKS_PER_US;
+        } else {
+            timed->status = TIMED_LATE;
+        }
+    }
+    if (!at_us) {
+        // Nothing pulses towards the pulse_id, it starts right away
+        uint32_t first = command->flags & RESET_COUNTER
+                             ? 0
+                             : ch->gen_pulse_count + 1;
+        if (first != (uint32_t)command->at) {
+            timed->status = TIMED_LATE;
+        }
+    }
+    // Before the channel starts, an idle engine generates its first edges
+    // right away
+    ch->timed_report = TIMED_REPORT_RISE;
+    request(channel, command->pulse_millihz, &period_ticks, &high_ticks,
+            phase_ticks, command->pulse_limit,
+            command->flags & SYNC_RISING_EDGE, command->flags & RESET_COUNTER,
+            false);
+    return true;
+}
+
+/// @brief Channels whose armed timed command was dropped because they
+/// stopped before its trigger, called from loop()
+/// @return channel bits, cleared by the call
+uint8_t PulseEngine::takeTimedDropped() {
+    CriticalSection critical_section;
+    uint8_t dropped = _timed_dropped;
+    _timed_dropped = 0;
+    return dropped;
+}
+
+void PulseEngine::configure(uint8_t channel, uint32_t pulse_millihz,
+                            uint32_t high_us, uint32_t phase_ticks,
+                            uint32_t pulse_limit, uint8_t sync_rising_edge,
+                            uint8_t reset_counter) {
+    FixedTicks period_ticks = {0, 0};
+    FixedTicks high_ticks = {0, 0};
+    if (pulse_millihz) {
+        period_ticks = period(pulse_millihz);
+        high_ticks = highTime(&period_ticks, high_us);
+    }
+    request(channel, pulse_millihz, &period_ticks, &high_ticks, phase_ticks,
+            pulse_limit, sync_rising_edge, reset_counter, false);
+}
+
+/// @brief Hand a new rate to the generator, applied at the next falling edge
+/// or right away if the channel is stopped
+/// @param start_schedule follow the schedule table from its first segment
+void PulseEngine::request(uint8_t channel, uint32_t pulse_millihz,
+                          const FixedTicks *period_ticks,
+                          const FixedTicks *high_ticks, uint64_t phase_ticks,
+                          uint32_t pulse_limit, uint8_t sync_rising_edge,
+                          uint8_t reset_counter, uint8_t start_schedule) {
+    PulseChannel *ch = &_channels[channel];
+    CriticalSection critical_section;
+    ch->req_pulse_millihz = pulse_millihz;
+    ch->req_period = *period_ticks;
+    ch->req_high = *high_ticks;
+    ch->req_schedule = start_schedule;
+    ch->req_changed = true;
+    if (pulse_millihz && ch->clock_input != CASCADE_NO_INPUT) {
+        // Back to its own generator
+        ch->clock_input = CASCADE_NO_INPUT;
+        updateFollowers();
+    }
+    if (pulse_millihz && _bursts[channel].pulse_millihz) {
+        // Pulses on its own, no longer triggered
+        _bursts[channel].pulse_millihz = 0;
+        updateBursts();
+    }
+    ch->pulse_limit = pulse_limit;
+    ch->sync_rising_edge = sync_rising_edge;
+    if (reset_counter) {
+        // Edges the generator already produced are still to be counted
+        ch->pulse_count = RESET_PULSE_COUNT;
+        ch->gen_pulse_count = RESET_PULSE_COUNT + pendingRisingEdges(channel);
+    }
+    if (ch->pulse_millihz == 0 && ch->req_pulse_millihz) {
+        schedule(channel, phase_ticks);
+    }
+}
+
+/// @brief Current pulse count of a channel, safe to call from interrupts
+uint32_t PulseEngine::getPulseCount(uint8_t channel) {
+    CriticalSection critical_section;
+    return _channels[channel].pulse_count;
+}
+
+/// @brief Pulse count of the channel an input is assigned to, safe to call
+/// from interrupts
+uint32_t PulseEngine::getInputPulseCount(uint8_t input) {
+    return getPulseCount(_input_channels[input]);
+}
+
+uint8_t PulseEngine::isRunning() { return _running; }
+
+/// @brief Put a channel into the edge scheduler, interrupts off
+///
+/// The first channel starts the timer and the time grid. Channels joining
+/// later keep their phase to that grid: their first rising edge is the first
+/// one of phase + n periods that the generator has not passed yet.
+void PulseEngine::schedule(uint8_t channel, uint64_t phase_ticks) {
+    PulseChannel *ch = &_channels[channel];
+    ch->pulse_millihz = ch->req_pulse_millihz;
+    ch->period = ch->req_period;
+    ch->high = ch->req_high;
+    ch->req_changed = false;
+    ch->phase = 0;
+    ch->gen_wave_state = LOW;
+    enterSegment(ch, ch->req_schedule ? 0 : PULSE_NO_SEGMENT);
+    ch->pass = 0;
+    ch->burst_pulses = 0;
+
+    if (!_running) {
+        // First edge right away, the setup delay has already elapsed
+        _horizon_ticks = 0;
+        _horizon_ticks64 = 0;
+        ch->rise_ticks = PULSE_TIMER_MIN_TICKS + phase_ticks;
+        ch->due_ticks = ch->rise_ticks;
+        heapPush(channel);
+        startTimer();
+        return;
+    }
+
+    uint64_t due = PULSE_TIMER_MIN_TICKS + phase_ticks;
+    uint64_t earliest = _horizon_ticks64 + PULSE_TIMER_MIN_TICKS;
+    if (due < earliest) {
+        // Whole periods, counted with the integer part of the period so that
+        // the exact offset is never short of earliest
+        uint64_t periods =
+            (earliest - due + ch->period.ticks - 1) / ch->period.ticks;
+        // periods * (ticks + frac / 2^32), fraction split in 32 bit halves
+        // so nothing overflows
+        uint64_t frac_low = (uint64_t)(uint32_t)periods * ch->period.frac;
+        uint64_t frac_high = (periods >> 32) * ch->period.frac;
+        due += periods * ch->period.ticks + frac_high + (frac_low >> 32);
+        ch->phase = (uint32_t)frac_low;
+    }
+    ch->rise_ticks = (uint32_t)due;
+    ch->due_ticks = ch->rise_ticks;
+    heapPush(channel);
+}
+
+/// @brief Generate the first two batches and start the timer at tick 0 with
+/// the channels in the heap, interrupts off
+void PulseEngine::startTimer() {
+    generateBatch(&_batches[0]);
+    generateBatch(&_batches[1]);
+    _batch_next = 0;
+    _running = true;
+    _start_us = deviceClockUs();
+    pulseTimerStart(&_pulseTimerCallback, _batches[0].at_ticks,
+                    _batches[1].at_ticks - _batches[0].at_ticks);
+}
+
+// ############################################################# Edge scheduler
+void PulseEngine::heapPush(uint8_t channel) {
+    uint8_t index = _heap_size++;
+    uint32_t due_ticks = _channels[channel].due_ticks;
+    while (index) {
+        uint8_t parent = (index - 1) / 2;
+        if (!_ticksBefore(due_ticks, _channels[_heap[parent]].due_ticks)) {
+            break;
+        }
+        _heap[index] = _heap[parent];
+        index = parent;
+    }
+    _heap[index] = channel;
+}
+
+void PulseEngine::heapSiftDown(uint8_t index) {
+    uint8_t channel = _heap[index];
+    uint32_t due_ticks = _channels[channel].due_ticks;
+    for (;;) {
+        uint8_t child = 2 * index + 1;
+        if (child >= _heap_size) {
+            break;
+        }
+        if (child + 1 < _heap_size &&
+            _ticksBefore(_channels[_heap[child + 1]].due_ticks,
+                         _channels[_heap[child]].due_ticks)) {
+            child++;
+        }
+        if (!_ticksBefore(_channels[_heap[child]].due_ticks, due_ticks)) {
+            break;
+        }
+        _heap[index] = _heap[child];
+        index = child;
+    }
+    _heap[index] = channel;
+}
+
+void PulseEngine::heapRemoveTop() {
+    _heap[0] = _heap[--_heap_size];
+    if (_heap_size) {
+        heapSiftDown(0);
+    }
+}
+
+// ################################################################# Schedule
+/// @brief Start a segment of the schedule table on a channel, interrupts off
+/// @param segment PULSE_NO_SEGMENT -> leave the schedule
+void PulseEngine::enterSegment(PulseChannel *ch, uint8_t segment) {
+    ch->segment = segment;
+    if (segment == PULSE_NO_SEGMENT) {
+        ch->segment_report = false;
+        return;
+    }
+    ch->segment_pulses = _schedule[segment].pulse_count;
+    ch->segment_report = !(_schedule[segment].flags & SEGMENT_SILENT);
+}
+
+/// @brief Move on to the next segment after the falling edge of the last
+/// pulse of a segment, interrupts off
+///
+/// The segment ends where its next pulse would rise, the next one starts
+/// gap_ticks later. Sets the first rising edge of the next segment.
+/// @return false at the end of the schedule or if the table is replaced
+uint8_t PulseEngine::nextSegment(PulseChannel *ch) {
+    uint8_t segment = ch->segment + 1;
+    if (segment >= _schedule_size) {
+        if (!_schedule_size ||
+            (_schedule_repeat && ch->pass + 1 >= _schedule_repeat)) {
+            return false;
+        }
+        segment = 0;
+        ch->pass++;
+    }
+    uint32_t phase = ch->phase + ch->period.frac;
+    ch->rise_ticks += ch->period.ticks + (phase < ch->phase) +
+                      _schedule[ch->segment].gap_ticks;
+    ch->pulse_millihz = _schedule[segment].pulse_millihz;
+    ch->period = _schedule[segment].period;
+    ch->high = _schedule[segment].high;
+    ch->phase = 0;
+    ch->due_ticks = ch->rise_ticks;
+    enterSegment(ch, segment);
+    return true;
+}
+
+// ############################################################ Timed commands
+/// @brief Apply the timed command of a channel if the next rising edge is
+/// at or after its trigger, at a falling edge, interrupts off
+/// @return false if the command stopped the channel
+uint8_t PulseEngine::applyTimed(EdgeBatch *batch, uint8_t channel) {
+    PulseChannel *ch = &_channels[channel];
+    TimedAction *timed = &_timed[channel];
+    if (timed->trigger == TIMED_AT_PULSE) {
+        uint32_t next_pulse = ch->gen_pulse_count + 1;
+        if ((int32_t)(next_pulse - timed->target) < 0) {
+            return true;
+        }
+        if (next_pulse != timed->target) {
+            timed->status = TIMED_LATE;
+        }
+    } else if (_ticksBefore(ch->rise_ticks, timed->target)) {
+        return true;
+    }
+
+    uint8_t bit = 1 << channel;
+    uint8_t action = timed->action;
+    timed->action = 0;
+    if (action == TIMED_STOP) {
+        ch->pulse_millihz = 0;
+        ch->req_changed = false;
+        ch->segment = PULSE_NO_SEGMENT;
+        ch->timed_report = TIMED_REPORT_BATCH;
+        batch->timed |= bit;
+        return false;
+    }
+    if (action == TIMED_SETUP) {
+        if (timed->trigger == TIMED_AT_US) {
+            // The last pulse of the old setup may still be high then
+            uint32_t earliest = batch->at_ticks + PULSE_TIMER_MIN_TICKS;
+            ch->rise_ticks = timed->target;
+            if (_ticksBefore(timed->target, earliest)) {
+                ch->rise_ticks = earliest;
+                timed->status = TIMED_LATE;
+            }
+        }
+        ch->pulse_millihz = timed->pulse_millihz;
+        ch->period = timed->period;
+        ch->high = timed->high;
+        ch->phase = 0;
+        ch->due_ticks = ch->rise_ticks;
+        ch->pulse_limit = timed->pulse_limit;
+        ch->sync_rising_edge = timed->flags & SYNC_RISING_EDGE;
+        ch->req_changed = false;
+        enterSegment(ch, PULSE_NO_SEGMENT);
+    }
+    if (action == TIMED_RESET || (timed->flags & RESET_COUNTER)) {
+        ch->gen_pulse_count = RESET_PULSE_COUNT;
+        batch->reset |= bit;
+    }
+    ch->timed_report = TIMED_REPORT_RISE;
+    return true;
+}
+
+/// @brief The channel stopped before the trigger of its timed command,
+/// loop() arms it again for the stopped channel, interrupts off
+void PulseEngine::dropTimed(uint8_t channel) {
+    if (_timed[channel].action) {
+        _timed[channel].action = 0;
+        _timed_dropped |= 1 << channel;
+    }
+}
+
+uint8_t PulseEngine::pendingRisingEdges(uint8_t channel) {
+    uint8_t bit = 1 << channel;
+    return !!(_batches[0].rising & bit) + !!(_batches[1].rising & bit);
+}
+
+/// @brief Plan the sets between the rising edge just generated and the next
+/// one, interrupts off
+void PulseEngine::startSamples(const PulseChannel *ch) {
+    if (!_sample_shift) {
+        return;
+    }
+    // One period / divider, shifted across the fraction
+    _sample_step.ticks = ch->period.ticks >> _sample_shift;
+    _sample_step.frac = (ch->period.frac >> _sample_shift) |
+                        (ch->period.ticks << (32 - _sample_shift));
+    _sample_due_ticks = ch->rise_ticks;
+    _sample_phase = ch->phase;
+    _sample_index = 0;
+    nextSample();
+}
+
+/// @brief Advance to the next set between the edges, interrupts off
+void PulseEngine::nextSample() {
+    if (++_sample_index >> _sample_shift) {
+        _sample_index = 0;
+        return;
+    }
+    uint32_t phase = _sample_phase + _sample_step.frac;
+    _sample_due_ticks += _sample_step.ticks + (phase < _sample_phase);
+    _sample_phase = phase;
+}
+
+/// @brief Take the next edges off the heap, runs ahead of the outputs
+void PulseEngine::generateBatch(EdgeBatch *batch) {
+    batch->rising = 0;
+    batch->falling = 0;
+    batch->segment = PULSE_NO_SEGMENT;
+    batch->reset = 0;
+    batch->timed = 0;
+    batch->sample = PULSE_NO_SAMPLE;
+    if (!_heap_size) {
+        // Idle compare match, keeps the timer running for channels to join
+        batch->at_ticks = _horizon_ticks + PULSE_TIMER_MIN_TICKS;
+    } else {
+        batch->at_ticks = _channels[_heap[0]].due_ticks;
+        // The last batch may have gone out after its first edge
+        if (_ticksBefore(batch->at_ticks,
+                         _horizon_ticks + PULSE_TIMER_MIN_TICKS)) {
+            batch->at_ticks = _horizon_ticks + PULSE_TIMER_MIN_TICKS;
+        }
+    }
+    if (_sample_index) {
+        // A set between the edges gets a compare match of its own unless it
+        // is too close to the next edge, then it goes with that
+        uint32_t sample_ticks = _sample_due_ticks;
+        if (_ticksBefore(sample_ticks,
+                         _horizon_ticks + PULSE_TIMER_MIN_TICKS)) {
+            sample_ticks = _horizon_ticks + PULSE_TIMER_MIN_TICKS;
+        }
+        if (!_heap_size || (int32_t)(batch->at_ticks - sample_ticks) >=
+                               (int32_t)PULSE_TIMER_MIN_TICKS) {
+            batch->at_ticks = sample_ticks;
+        }
+    }
+    if (_burst_channels &&
+        (int32_t)(batch->at_ticks - _horizon_ticks) >
+            (int32_t)(BURST_LOOKAHEAD_TICKS + PULSE_TIMER_MIN_TICKS)) {
+        // Idle compare match instead, a burst may start before the next edge
+        batch->at_ticks = _horizon_ticks + BURST_LOOKAHEAD_TICKS;
+    }
+    if (_sample_index && (int32_t)(_sample_due_ticks - batch->at_ticks) <
+                             (int32_t)PULSE_TIMER_MIN_TICKS) {
+        batch->sample = _sample_index;
+        nextSample();
+    }
+
+    // Edges closer together than the timer resolves are written together,
+    // at the last of them: an edge may be late by up to the resolution but
+    // never early
+    uint32_t window_ticks = batch->at_ticks;
+    for (uint8_t i = 0; i < _heap_size; i++) {
+        uint32_t due_ticks = _channels[_heap[i]].due_ticks;
+        if ((int32_t)(due_ticks - window_ticks) <
+                (int32_t)PULSE_TIMER_MIN_TICKS &&
+            _ticksBefore(batch->at_ticks, due_ticks)) {
+            batch->at_ticks = due_ticks;
+        }
+    }
+    while (_heap_size &&
+           (int32_t)(_channels[_heap[0]].due_ticks - window_ticks) <
+               (int32_t)PULSE_TIMER_MIN_TICKS) {
+        uint8_t channel = _heap[0];
+        uint8_t bit = 1 << channel;
+        PulseChannel *ch = &_channels[channel];
+
+        ch->gen_wave_state = !ch->gen_wave_state;
+        if (ch->gen_wave_state == HIGH) {
+            batch->rising |= bit;
+            ch->gen_pulse_count++;
+            if (ch->segment != PULSE_NO_SEGMENT) {
+                ch->segment_pulses--;
+                if (ch->segment_report) {
+                    ch->segment_report = false;
+                    batch->segment = ch->segment;
+                    batch->segment_channel = channel;
+                    batch->pass = ch->pass;
+                }
+            }
+            if (ch->timed_report == TIMED_REPORT_RISE) {
+                ch->timed_report = TIMED_REPORT_BATCH;
+                batch->timed |= bit;
+            }
+            if (channel == _sample_channel) {
+                // Sets of the pulse before that are still due are lost
+                _samples_skipped +=
+                    (batch->sample != PULSE_NO_SAMPLE) +
+                    (_sample_index ? (1 << _sample_shift) - _sample_index : 0);
+                batch->sample = 0;
+                startSamples(ch);
+            }
+            // The last pulse of a burst stops the channel
+            if (ch->burst_pulses && !--ch->burst_pulses) {
+                ch->req_pulse_millihz = 0;
+                ch->req_changed = true;
+            }
+            // Request stop pulsing only after pulse_limit is reached
+            if (ch->pulse_limit && ch->gen_pulse_count >= ch->pulse_limit) {
+                ch->req_pulse_millihz = 0;
+                ch->req_changed = true;
+            }
+            // Falling edge after the high time
+            uint32_t phase = ch->phase + ch->high.frac;
+            ch->due_ticks =
+                ch->rise_ticks + ch->high.ticks + (phase < ch->phase);
+        } else {
+            batch->falling |= bit;
+            // Stop or change the rate and width only after falling edges
+            uint8_t segment_end = !ch->req_changed &&
+                                  ch->segment != PULSE_NO_SEGMENT &&
+                                  !ch->segment_pulses;
+            if (ch->req_changed) {
+                ch->req_changed = false;
+                ch->pulse_millihz = ch->req_pulse_millihz;
+                if (!ch->pulse_millihz) {
+                    ch->segment = PULSE_NO_SEGMENT;
+                    dropTimed(channel);
+                    heapRemoveTop();
+                    continue;
+                }
+                // The new pulse starts as if its rising edge had been one
+                // high time before this falling edge
+                ch->rise_ticks = ch->due_ticks - ch->req_high.ticks;
+                ch->period = ch->req_period;
+                ch->high = ch->req_high;
+                ch->phase = 0;
+                enterSegment(ch, ch->req_schedule ? 0 : PULSE_NO_SEGMENT);
+                ch->pass = 0;
+            } else if (segment_end && !nextSegment(ch)) {
+                ch->pulse_millihz = 0;
+                ch->segment = PULSE_NO_SEGMENT;
+                dropTimed(channel);
+                heapRemoveTop();
+                continue;
+            }
+            if (!segment_end) {
+                // Next rising edge one period after the last one
+                uint32_t phase = ch->phase + ch->period.frac;
+                ch->rise_ticks += ch->period.ticks + (phase < ch->phase);
+                ch->phase = phase;
+                ch->due_ticks = ch->rise_ticks;
+            }
+            if (_timed[channel].action && !applyTimed(batch, channel)) {
+                heapRemoveTop();
+                continue;
+            }
+        }
+        heapSiftDown(0);
+    }
+
+    _horizon_ticks64 += (uint32_t)(batch->at_ticks - _horizon_ticks);
+    _horizon_ticks = batch->at_ticks;
+}
+
+/// @brief Start the bursts of the triggered inputs, interrupts off
+///
+/// The first rising edges are written right here, the generator takes over
+/// from their falling edges. Those can not come before the batches it has
+/// already generated, a high time shorter than that makes the first pulse
+/// longer (BURST_LATE). Armed bursts keep the lookahead short, see
+/// BURST_LOOKAHEAD_TICKS.
+void PulseEngine::triggerBursts(uint8_t triggered, uint16_t capture_count) {
+    uint8_t started = 0;
+    uint8_t busy = 0;
+    TriggerOutputMask set;
+    TriggerOutputMask clear;
+    memset(&set, 0, sizeof(set));
+    memset(&clear, 0, sizeof(clear));
+    uint8_t pending = _running ? _batches[0].rising | _batches[0].falling |
+                                     _batches[1].rising | _batches[1].falling
+                               : 0;
+    uint8_t channels = _burst_channels;
+    while (channels) {
+        uint8_t i = __builtin_ctz(channels);
+        channels &= channels - 1;
+        uint8_t bit = 1 << i;
+        PulseChannel *ch = &_channels[i];
+        if (!(triggered & (1 << _bursts[i].input))) {
+            continue;
+        }
+        if (ch->pulse_millihz || (pending & bit)) {
+            busy |= bit;
+            continue;
+        }
+        started |= bit;
+        triggerOutputsMaskAdd(&set, &ch->outputs);
+        if ((_sync_channels & bit) && ch->pulse_count == RESET_PULSE_COUNT) {
+            triggerOutputsMaskAdd(&set, &ch->sync_outputs);
+        }
+    }
+    uint32_t latency_ticks = BURST_NO_LATENCY;
+    uint8_t late = 0;
+    if (started) {
+        _outputWriterFunction(&set, &clear);
+        if (triggered & captureInputs()) {
+            latency_ticks = (uint16_t)(inputCaptureCount() - capture_count);
+        }
+        startBursts(started, &late);
+    }
+
+    channels = started | busy;
+    while (channels) {
+        uint8_t i = __builtin_ctz(channels);
+        channels &= channels - 1;
+        uint8_t bit = 1 << i;
+        uint8_t status = busy & bit   ? BURST_BUSY
+                         : late & bit ? BURST_LATE
+                                      : BURST_STARTED;
+        _burstHandlerFunction(i, _bursts[i].input, status,
+                              busy & bit ? BURST_NO_LATENCY : latency_ticks);
+    }
+}
+
+/// @brief Hand the bursts whose first rising edge was just written to the
+/// generator, interrupts off
+/// @param late channel bits, set for bursts with a longer first pulse
+void PulseEngine::startBursts(uint8_t started, uint8_t *late) {
+    uint32_t now_ticks = 0;
+    if (_running) {
+        now_ticks = _batches[_batch_next].at_ticks - pulseTimerTicksToMatch();
+    } else {
+        _horizon_ticks = 0;
+        _horizon_ticks64 = 0;
+    }
+    uint32_t earliest = _horizon_ticks + PULSE_TIMER_MIN_TICKS;
+    uint8_t channels = started;
+    while (channels) {
+        uint8_t i = __builtin_ctz(channels);
+        channels &= channels - 1;
+        PulseChannel *ch = &_channels[i];
+        BurstTrigger *burst = &_bursts[i];
+        ch->pulse_millihz = burst->pulse_millihz;
+        ch->period = burst->period;
+        ch->high = burst->high;
+        ch->phase = 0;
+        ch->gen_wave_state = HIGH;
+        ch->gen_pulse_count++;
+        enterSegment(ch, PULSE_NO_SEGMENT);
+        ch->burst_pulses = burst->pulse_count - 1;
+        ch->req_pulse_millihz = 0;
+        ch->req_changed = !ch->burst_pulses;
+        ch->req_schedule = false;
+        ch->rise_ticks = now_ticks;
+        ch->due_ticks = now_ticks + ch->high.ticks;
+        if (_ticksBefore(ch->due_ticks, earliest)) {
+            ch->due_ticks = earliest;
+            *late |= 1 << i;
+            if (_ticksBefore(now_ticks + ch->period.ticks,
+                             earliest + PULSE_TIMER_MIN_TICKS)) {
+                // No room for the low time, the later pulses move too
+                ch->rise_ticks = earliest - ch->high.ticks;
+            }
+        }
+        heapPush(i);
+        // Counted like the generated pulses in handleEdge()
+        ch->pulse_count++;
+        if (ch->pulse_count == 0 && ch->sync_rising_edge) {
+            _syncHandlerFunction(i);
+        }
+        if (i == _sample_channel) {
+            // Sets before the generated batches are too late
+            startSamples(ch);
+            while (_sample_index && _ticksBefore(_sample_due_ticks, earliest)) {
+                _samples_skipped++;
+                nextSample();
+            }
+            _sampleHandlerFunction(i, 0);
+        }
+    }
+    if (!_running) {
+        startTimer();
+    }
+}
+
+/// @brief Start the bursts triggered by the edges, then copy clock input
+/// edges to the outputs of follower channels and count their pulses, called
+/// from the input interrupt before the inputs are timestamped, interrupts off
+/// @param capture_count see TriggerInputsFollower
+/// @return inputs of changed that belong to followers, not to be reported
+uint8_t PulseEngine::followInputs(uint8_t state, uint8_t changed,
+                                  uint16_t capture_count) {
+    uint8_t triggered =
+        changed & ((state & _burst_rising) | (~state & _burst_falling));
+    if (triggered) {
+        triggerBursts(triggered, capture_count);
+    }
+    uint8_t consumed = changed & (_clock_inputs | _sync_inputs);
+    if (!consumed) {
+        return 0;
+    }
+    uint8_t rising = 0;
+    uint8_t falling = 0;
+    TriggerOutputMask set;
+    TriggerOutputMask clear;
+    memset(&set, 0, sizeof(set));
+    memset(&clear, 0, sizeof(clear));
+    uint8_t followers = _followers;
+    while (followers) {
+        uint8_t i = __builtin_ctz(followers);
+        followers &= followers - 1;
+        PulseChannel *ch = &_channels[i];
+        uint8_t clock = 1 << ch->clock_input;
+        if (ch->sync_input != CASCADE_NO_INPUT &&
+            (changed & state & (1 << ch->sync_input))) {
+            // The sync edge comes with the clock edge of pulse_id 0 on the
+            // leader, it may be captured with it or just after it
+            ch->pulse_count =
+                state & ~changed & clock ? 0 : RESET_PULSE_COUNT;
+        }
+        if (!(changed & clock)) {
+            continue;
+        }
+        if (state & clock) {
+            rising |= 1 << i;
+            triggerOutputsMaskAdd(&set, &ch->outputs);
+            if (ch->pulse_count == RESET_PULSE_COUNT) {
+                triggerOutputsMaskAdd(&set, &ch->sync_outputs);
+            }
+        } else {
+            falling |= 1 << i;
+            triggerOutputsMaskAdd(&clear, &ch->outputs);
+            triggerOutputsMaskAdd(&clear, &ch->sync_outputs);
+        }
+    }
+    if (!(rising | falling)) {
+        return consumed;
+    }
+    _outputWriterFunction(&set, &clear);
+
+    // Counted like the generated pulses in handleEdge()
+    for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+        uint8_t bit = 1 << i;
+        if (!((rising | falling) & bit)) {
+            continue;
+        }
+        PulseChannel *ch = &_channels[i];
+        ch->pulse_count += !!(rising & bit);
+        if (ch->pulse_count == 0 && !ch->sync_rising_edge == !(rising & bit)) {
+            _syncHandlerFunction(i);
+        }
+        if ((rising & bit) && i == _sample_channel) {
+            // No period to divide, one set per pulse
+            _sampleHandlerFunction(i, 0);
+        }
+    }
+    return consumed;
+}
+
+/// @brief Timer interrupt, writes the due batch of edges
+/// @return ticks between the next compare match and the one after it
+uint32_t PulseEngine::handleEdge() {
+    // ######################################################### Generate pulses
+    //
+    // Every channel, the high time is high_us or half the period:
+    //                            ┌─────┐     ┌─────┐     ┌─       ─┐
+    //          ...               │     │     │     │     │   ...   │ ...
+    //               ─────────────┘     └─────┘     └─────┘         └───────────
+    // wavestate           0      │  1  │  0  │  1  │  0  │ 1     n │     0
+    // pulse_count     UINT32_MAX │  0  │  0  │  1  │  1  │ 2     n │ UINT32_MAX
+    // pulse_count (cont.) n      │ n+1 │ n+1 │ n+2 │ n+2 │n+3   n+m│    n+m
+    // sync_rising_edge == true   ┴     │     ┴     │     ┴         │
+    // sync_rising_edge == false        ┴           ┴               ┴
+    //
+    EdgeBatch *batch = &_batches[_batch_next];
+    uint8_t edges = batch->rising | batch->falling;
+
+    if (edges) {
+        // pulse_id restarts at a timed reset, before the sync outputs look
+        // at it
+        uint8_t reset = batch->reset;
+        while (reset) {
+            _channels[__builtin_ctz(reset)].pulse_count = RESET_PULSE_COUNT;
+            reset &= reset - 1;
+        }
+        TriggerOutputMask set;
+        TriggerOutputMask clear;
+        memset(&set, 0, sizeof(set));
+        memset(&clear, 0, sizeof(clear));
+        for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+            uint8_t bit = 1 << i;
+            if (batch->rising & bit) {
+                triggerOutputsMaskAdd(&set, &_channels[i].outputs);
+                if ((_sync_channels & bit) &&
+                    _channels[i].pulse_count == RESET_PULSE_COUNT) {
+                    triggerOutputsMaskAdd(&set, &_channels[i].sync_outputs);
+                }
+            } else if (batch->falling & bit) {
+                triggerOutputsMaskAdd(&clear, &_channels[i].outputs);
+                if (_sync_channels & bit) {
+                    triggerOutputsMaskAdd(&clear, &_channels[i].sync_outputs);
+                }
+            }
+        }
+        _outputWriterFunction(&set, &clear); // set pins
+
+        for (uint8_t i = 0; i < PULSE_CHANNELS; i++) {
+            uint8_t bit = 1 << i;
+            if (!(edges & bit)) {
+                continue;
+            }
+            PulseChannel *ch = &_channels[i];
+            uint8_t square_wave_rising_edge = batch->rising & bit;
+            // increment on wave_state rising edge
+            ch->pulse_count += !!square_wave_rising_edge;
+            if (ch->pulse_count == 0 &&
+                !ch->sync_rising_edge == !square_wave_rising_edge) {
+                // Send first input on rising edge/falling edge (bool
+                // sync_rising_edge) to enable triggerdata/camera-metadata
+                // synchronisation
+                _syncHandlerFunction(i);
+            }
+        }
+        if (batch->segment != PULSE_NO_SEGMENT) {
+            _segmentHandlerFunction(batch->segment_channel, batch->segment,
+                                    batch->pass);
+        }
+        uint8_t timed = batch->timed;
+        if (timed) {
+            uint64_t at_ticks64 =
+                _horizon_ticks64 - (uint32_t)(_horizon_ticks - batch->at_ticks);
+            uint64_t applied_us =
+                _start_us + at_ticks64 / PULSE_TIMER_TICKS_PER_US;
+            while (timed) {
+                uint8_t i = __builtin_ctz(timed);
+                timed &= timed - 1;
+                _channels[i].timed_report = TIMED_REPORT_NONE;
+                _timedHandlerFunction(i, _timed[i].id, _timed[i].status,
+                                      applied_us);
+            }
+        }
+    } else if (!_heap_size && !_sample_index &&
+               batch->sample == PULSE_NO_SAMPLE &&
+               !(_batches[_batch_next ^ 1].rising |
+                 _batches[_batch_next ^ 1].falling) &&
+               _batches[_batch_next ^ 1].sample == PULSE_NO_SAMPLE) {
+        // All channels stopped and their last edges and sets are out
+        pulseTimerStop();
+        _running = false;
+        return 0;
+    }
+    if (batch->sample != PULSE_NO_SAMPLE) {
+        _sampleHandlerFunction(_sample_channel, batch->sample);
+    }
+
+    // The written batch makes room for the one after the next
+    generateBatch(batch);
+    _batch_next ^= 1;
+    return batch->at_ticks - _batches[_batch_next].at_ticks;
+}
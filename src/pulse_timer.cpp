@@ -0,0 +1,208 @@
+/*******************************************************************************
+ * File:        pulse_timer.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "pulse_timer.h"
+#include "input_capture.h"
+
+static volatile PulseTimerCallback _callback = nullptr;
+static uint32_t _late_ticks = 0;
+
+uint32_t pulseTimerLateTicks() { return _late_ticks; }
+
+#if defined(__AVR__)
+// ######################################################## AVR Timer1 (16 bit)
+//
+// Timer1 runs free in normal mode and OCR1A is advanced by the interval at
+// every compare match. Intervals longer than the 16 bit counter are split
+// into chunks, the callback is only called once the whole interval elapsed.
+// With input capture inputs Timer1 also latches their edges: it then counts
+// from inputCaptureBegin() on and is never stopped or reset here.
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+// Lead of a compare match that replaces one TCNT1 already passed, enough
+// for the write of OCR1A to land before the count reaches it
+#define PULSE_TIMER_CATCH_UP_TICKS 4
+
+static volatile uint32_t _pending_ticks = 0;   // interval after the next match
+static volatile uint32_t _remaining_ticks = 0; // rest of the current interval
+static volatile uint16_t _compare = 0;  // match time of the schedule
+static volatile uint8_t _behind = false; // OCR1A is a catch up match
+
+/// @brief Advance the compare match by the next chunk of the current interval
+///
+/// Long intervals are cut into 0x8000 tick chunks so that the last chunk is
+/// never shorter than half a counter period. An interrupt held off by others
+/// for longer than a short interval finds TCNT1 already past the new match:
+/// the match would then only come after a wrap of the counter (32 ms). OCR1A
+/// is set just ahead of TCNT1 instead, the match fires late, and _compare
+/// keeps the schedule so the intervals after it do not shift.
+static inline void _advanceCompare() {
+    uint16_t step =
+        _remaining_ticks > 0xFFFF ? 0x8000 : (uint16_t)_remaining_ticks;
+    _remaining_ticks -= step;
+    uint16_t elapsed = TCNT1 - _compare; // since the match being served
+    _compare += step;
+    if ((uint32_t)elapsed + PULSE_TIMER_CATCH_UP_TICKS >= step) {
+        OCR1A = TCNT1 + PULSE_TIMER_CATCH_UP_TICKS;
+        _behind = true;
+    } else {
+        OCR1A = _compare;
+        _behind = false;
+    }
+}
+
+ISR(TIMER1_COMPA_vect) {
+    if (_remaining_ticks) {
+        // Inside a chunked interval
+        _advanceCompare();
+        return;
+    }
+    _late_ticks = (uint16_t)(TCNT1 - _compare);
+    _remaining_ticks = _pending_ticks;
+    _advanceCompare();
+    _pending_ticks = _callback();
+}
+
+void pulseTimerStart(PulseTimerCallback callback, uint32_t first_ticks,
+                     uint32_t second_ticks) {
+    uint8_t sreg = SREG;
+    cli();
+    _callback = callback;
+
+#if IN_CAPTURE_INPUTS
+    // Already running at prescaler 8, the schedule starts at the count now
+    _compare = TCNT1;
+#else
+    // Normal mode, timer stopped. This overrides the PWM setup of the core,
+    // analogWrite() on pins 9 and 10 is not available while pulsing.
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    _compare = 0;
+#endif
+
+    _remaining_ticks = first_ticks;
+    _advanceCompare();
+    _pending_ticks = second_ticks;
+
+    TIFR1 = _BV(OCF1A);  // clear stale compare flag
+#if IN_CAPTURE_INPUTS
+    TIMSK1 |= _BV(OCIE1A);
+#else
+    TIMSK1 = _BV(OCIE1A);
+    TCCR1B = _BV(CS11); // start, prescaler 8
+#endif
+    SREG = sreg;
+}
+
+int32_t pulseTimerTicksToMatch() {
+    if (_behind || (TIFR1 & _BV(OCF1A))) {
+        return (int32_t)_remaining_ticks - (uint16_t)(TCNT1 - _compare);
+    }
+    return _remaining_ticks + (uint16_t)(_compare - TCNT1);
+}
+
+void pulseTimerStop() {
+    uint8_t sreg = SREG;
+    cli();
+    TIMSK1 &= ~_BV(OCIE1A);
+#if !IN_CAPTURE_INPUTS
+    TCCR1B = 0;
+#endif
+    _remaining_ticks = 0;
+    SREG = sreg;
+}
+
+#elif defined(TEENSYDUINO)
+// ############################################ Teensy PIT through IntervalTimer
+//
+// The PIT reloads LDVAL at every expiry, so a value written from the
+// interrupt applies to the interval after the one that just started. The
+// lateness is measured with the DWT cycle counter against the expiry times
+// summed up from the intervals, modulo 2^32 cycles.
+static IntervalTimer _timer;
+static volatile uint8_t _running = false;
+static uint32_t _due_cycles = 0; // cycle count of the expiry being served
+static uint32_t _next_ticks = 0; // interval that just started
+
+#define CYCLES_PER_TICK (F_CPU / PULSE_TIMER_HZ)
+
+static void _timerIsr() {
+    int32_t late_cycles = ARM_DWT_CYCCNT - _due_cycles;
+    _late_ticks = late_cycles > 0 ? late_cycles / CYCLES_PER_TICK : 0;
+    _due_cycles += _next_ticks * CYCLES_PER_TICK;
+    uint32_t ticks = _callback();
+    _next_ticks = ticks;
+    if (_running) {
+        _timer.update(ticks);
+    }
+}
+
+void pulseTimerStart(PulseTimerCallback callback, uint32_t first_ticks,
+                     uint32_t second_ticks) {
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    noInterrupts();
+    _callback = callback;
+    _running = true;
+    _due_cycles = ARM_DWT_CYCCNT + first_ticks * CYCLES_PER_TICK;
+    _next_ticks = second_ticks;
+    _timer.priority(0); // edges before serial and input interrupts
+    _timer.begin(_timerIsr, first_ticks);
+    _timer.update(second_ticks);
+    interrupts();
+}
+
+int32_t pulseTimerTicksToMatch() {
+    return (int32_t)(_due_cycles - ARM_DWT_CYCCNT) / (int32_t)CYCLES_PER_TICK;
+}
+
+void pulseTimerStop() {
+    noInterrupts();
+    _running = false;
+    _timer.end();
+    interrupts();
+}
+
+#elif defined(TRIGGER_SIM)
+// ############################################### Simulated free running timer
+//
+// Same absolute compare schedule as Timer1 without the 16 bit limit.
+#include "sim.h"
+
+static uint64_t _compare_ticks = 0;
+static uint32_t _pending_ticks = 0;
+
+#define SIM_NS_PER_TICK (SIM_NS_PER_S / PULSE_TIMER_HZ)
+
+static uint64_t _ticksToNs(uint64_t ticks) { return ticks * SIM_NS_PER_TICK; }
+
+static void _timerIsr() {
+    _late_ticks = simNowNs() / SIM_NS_PER_TICK - _compare_ticks;
+    _compare_ticks += _pending_ticks;
+    simScheduleTimer(&_timerIsr, _ticksToNs(_compare_ticks));
+    _pending_ticks = _callback();
+}
+
+void pulseTimerStart(PulseTimerCallback callback, uint32_t first_ticks,
+                     uint32_t second_ticks) {
+    _callback = callback;
+    _compare_ticks = simNowNs() / SIM_NS_PER_TICK + first_ticks;
+    _pending_ticks = second_ticks;
+    simScheduleTimer(&_timerIsr, _ticksToNs(_compare_ticks));
+}
+
+int32_t pulseTimerTicksToMatch() {
+    return (int64_t)_compare_ticks - (int64_t)(simNowNs() / SIM_NS_PER_TICK);
+}
+
+void pulseTimerStop() { simCancelTimer(); }
+
+#endif
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ * File:        replay_buffer.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "replay_buffer.h"
+#include "serial_messages.h"
+#include <stddef.h>
+
+#define REPLAY_MASK (REPLAY_BUFFER_SIZE - 1)
+
+void ReplayBuffer::clear() {
+    _head = 0;
+    _tail = 0;
+    _first = 0;
+    _count = 0;
+}
+
+/// @brief Length of the frame at a ring position, from its header
+uint16_t ReplayBuffer::_frameLength(uint16_t at) {
+    return LENGTH_MSG_HEADER +
+           _data[(uint16_t)(at + offsetof(msg_header, length)) & REPLAY_MASK];
+}
+
+void ReplayBuffer::push(const uint8_t *frame, uint16_t len) {
+    while (REPLAY_BUFFER_SIZE - (uint16_t)(_head - _tail) < len) {
+        _tail += _frameLength(_tail);
+        _first++;
+        _count--;
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        _data[_head++ & REPLAY_MASK] = frame[i];
+    }
+    _count++;
+}
+
+uint16_t ReplayBuffer::get(uint16_t sequence, uint8_t *frame) {
+    uint16_t skip = sequence - _first;
+    if (skip >= _count) {
+        return 0;
+    }
+    uint16_t at = _tail;
+    while (skip--) {
+        at += _frameLength(at);
+    }
+    uint16_t len = _frameLength(at);
+    for (uint16_t i = 0; i < len; i++) {
+        frame[i] = _data[at++ & REPLAY_MASK];
+    }
+    return len;
+}
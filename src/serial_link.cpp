@@ -0,0 +1,64 @@
+/*******************************************************************************
+ * File:        serial_link.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "serial_link.h"
+
+static uint32_t _baudrate = SERIAL_LINK_DEFAULT_BAUDRATE;
+static uint32_t _fallback_baudrate = 0; // while the new rate is unverified
+static uint32_t _proposed_baudrate = 0;
+static uint32_t _switched_ms = 0;
+
+uint8_t serialLinkSupported(uint32_t baudrate) {
+#if defined(__AVR__) || defined(TRIGGER_SIM)
+    // Double speed mode divisor as HardwareSerial::begin() picks it
+    if (baudrate < 1200 || baudrate > F_CPU / 8) {
+        return false;
+    }
+    uint32_t setting = (F_CPU / 4 / baudrate - 1) / 2;
+    uint32_t actual = F_CPU / 8 / (setting + 1);
+    uint32_t error = actual > baudrate ? actual - baudrate : baudrate - actual;
+    return error * 40 <= baudrate;
+#else
+    return baudrate > 0;
+#endif
+}
+
+void serialLinkBegin(uint32_t baudrate) {
+    _baudrate = baudrate;
+    Serial.begin(baudrate);
+}
+
+uint32_t serialLinkBaudrate() { return _baudrate; }
+
+void serialLinkPropose(uint32_t baudrate) { _proposed_baudrate = baudrate; }
+
+void serialLinkVerified() { _fallback_baudrate = 0; }
+
+/// @brief Change the rate after the bytes of the old one are out. This waits
+/// for the hardware FIFO, at most a few milliseconds, pulses keep running.
+static void _switch(uint32_t baudrate) {
+    Serial.flush();
+    serialLinkBegin(baudrate);
+}
+
+void serialLinkUpdate(uint8_t tx_idle) {
+    if (_proposed_baudrate && tx_idle) {
+        if (!_fallback_baudrate) {
+            _fallback_baudrate = _baudrate;
+        }
+        _switch(_proposed_baudrate);
+        _proposed_baudrate = 0;
+        _switched_ms = millis();
+    }
+    if (_fallback_baudrate &&
+        millis() - _switched_ms >= BAUD_VERIFY_TIMEOUT_MS) {
+        _switch(_fallback_baudrate);
+        _fallback_baudrate = 0;
+    }
+}
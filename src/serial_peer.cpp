@@ -8,15 +8,69 @@
  ******************************************************************************/
 
 #include "serial_peer.h"
+#include "crc8.h"
 #include "serial_messages.h"
+#include "trigger_inputs.h"
 
 #include <Arduino.h>
 
 SerialPeer::SerialPeer() {}
 
+/// @brief Write an unsigned LEB128 varint
+/// @return number of bytes written, 1 to 5
+static uint8_t writeVarint(uint8_t *buffer, uint32_t value) {
+    uint8_t len = 0;
+    while (value >= 0x80) {
+        buffer[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    buffer[len++] = value;
+    return len;
+}
+
+/// @brief Channel exists, inputs exist on the board and the sync input is
+/// not the clock input
+static uint8_t _validCascade(const cascade_message *msg) {
+    uint8_t clock = msg->clock_input;
+    uint8_t sync = msg->sync_input;
+    if (msg->channel >= PULSE_CHANNELS) {
+        return false;
+    }
+    if (clock != CASCADE_NO_INPUT &&
+        (clock >= NUM_INPUT_PINS || !(validInputs() & (1 << clock)))) {
+        return false;
+    }
+    if (sync != CASCADE_NO_INPUT &&
+        (sync >= NUM_INPUT_PINS || !(validInputs() & (1 << sync)) ||
+         sync == clock)) {
+        return false;
+    }
+    return true;
+}
+
+/// @brief Channel and input exist, an armed burst has pulses at a rate
+static uint8_t _validBurst(const burst_message *msg) {
+    uint8_t input = msg->input;
+    if (msg->channel >= PULSE_CHANNELS) {
+        return false;
+    }
+    if (input == BURST_NO_INPUT) {
+        return true;
+    }
+    return input < NUM_INPUT_PINS && (validInputs() & (1 << input)) &&
+           msg->pulse_count && msg->pulse_millihz;
+}
+
+/// @brief Channel, action and trigger exist
+static uint8_t _validTimed(const timed_message *msg) {
+    return msg->channel < PULSE_CHANNELS && msg->action >= TIMED_SETUP &&
+           msg->action <= TIMED_RESET &&
+           (msg->trigger == TIMED_AT_US || msg->trigger == TIMED_AT_PULSE);
+}
+
 uint8_t SerialPeer::calculateCrc(uint8_t *buffer, size_t len) {
     uint8_t crc = 0;
-    for (uint8_t i = 0; i < len; i++) {
+    for (size_t i = 0; i < len; i++) {
         crc += buffer[i];
     }
     return crc;
@@ -24,30 +78,44 @@ uint8_t SerialPeer::calculateCrc(uint8_t *buffer, size_t len) {
 
 uint8_t SerialPeer::handleMessage(uint8_t *msg, size_t len) {
     // Variables
+    uint64_t device_rx_us = _clockFunction();
     uint8_t error_flags = 0;
+    uint16_t expected_len = 0;
     message *type_message;
     type_message = (message *)msg;
 
     uint8_t length = type_message->header.length;
     if (len < MIN_LENGTH_MESSAGE || len - LENGTH_MSG_HEADER != length) {
         error_flags |= SERIAL_PEER_ERROR_LENGTH;
+        expected_len = LENGTH_MSG_HEADER + length;
     }
+    uint8_t header_v2 = type_message->header.type & HEADER_V2;
+    uint8_t type = type_message->header.type & HEADER_TYPE_MASK;
     uint8_t *payload = type_message->value;
-    uint8_t crc = this->calculateCrc(payload, length);
+    uint8_t crc;
+    if (header_v2) {
+        crc = crc8Message(&type_message->header);
+    } else {
+        crc = this->calculateCrc(payload, length);
+    }
     if (type_message->header.crc != crc) {
         error_flags |= SERIAL_PEER_ERROR_CRC;
+    } else {
+        // Answer in the header version the host speaks
+        _header_v2 = header_v2;
     }
 
-    switch (type_message->header.type) {
+    switch (type) {
     case TYPE_ECHO:
         this->_buffer[0] = TYPE_ECHO;
         memcpy(this->_buffer, type_message, len);
         sendMessage((uint8_t *)type_message, len);
         break;
     case TYPE_SETUP:
-        if (len != LENGTH_SETUP_MESSAGE) {
+        if (len != LENGTH_SETUP_MESSAGE && len != LENGTH_SETUP_MESSAGE_V2 &&
+            len != LENGTH_SETUP_MESSAGE_V1) {
             error_flags |= SERIAL_PEER_ERROR_LENGTH;
-            sendTxt((uint8_t *)" test ", 7);
+            expected_len = LENGTH_SETUP_MESSAGE;
         }
         if (!error_flags) {
             handleSetup((setup_message *)type_message, len);
@@ -59,50 +127,209 @@ uint8_t SerialPeer::handleMessage(uint8_t *msg, size_t len) {
         error_flags |= SERIAL_PEER_ERROR_NOT_IMPLEMENTED;
         break;
     case TYPE_ACK:
-        // Not implemented
-        // TODO handle acks
-        // error_flags |= SERIAL_PEER_ERROR_NOT_IMPLEMENTED;
+        // Nothing waits for acks of the host, lost event frames are asked
+        // for with TYPE_RESEND
         break;
     case TYPE_ERROR:
         // Not implemented
         error_flags |= SERIAL_PEER_ERROR_NOT_IMPLEMENTED;
         break;
+    case TYPE_BATCH_CONFIG:
+        if (len != LENGTH_BATCH_CONFIG_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_BATCH_CONFIG_MESSAGE;
+        }
+        if (!error_flags) {
+            handleBatchConfig((batch_config_message *)type_message);
+            sendAck();
+        }
+        break;
+    case TYPE_TIME_SYNC:
+        if (len != LENGTH_TIME_SYNC_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_TIME_SYNC_MESSAGE;
+        }
+        if (!error_flags) {
+            handleTimeSync((time_sync_message *)type_message, device_rx_us);
+        }
+        break;
+    case TYPE_INFO:
+        if (!error_flags) {
+            _info_requested = true;
+        }
+        break;
+    case TYPE_STATS:
+        if (len != MIN_LENGTH_MESSAGE && len != LENGTH_STATS_REQUEST_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_STATS_REQUEST_MESSAGE;
+        }
+        if (!error_flags) {
+            _stats_flags = len == LENGTH_STATS_REQUEST_MESSAGE
+                               ? ((stats_request_message *)type_message)->flags
+                               : 0;
+            _stats_requested = true;
+        }
+        break;
+    case TYPE_BAUD:
+        if (len != LENGTH_BAUD_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_BAUD_MESSAGE;
+        } else if (!(((baud_message *)type_message)->flags & BAUD_VERIFY) &&
+                   !serialLinkSupported(
+                       ((baud_message *)type_message)->baudrate)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            handleBaud((baud_message *)type_message);
+        }
+        break;
+    case TYPE_CHANNEL_SETUP:
+        if (len != LENGTH_CHANNEL_SETUP_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_CHANNEL_SETUP_MESSAGE;
+        } else if (((channel_setup_message *)type_message)->channel >=
+                   PULSE_CHANNELS) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            handleChannelSetup((channel_setup_message *)type_message);
+            sendAck();
+        }
+        break;
+    case TYPE_CASCADE:
+        if (len != LENGTH_CASCADE_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_CASCADE_MESSAGE;
+        } else if (!_validCascade((cascade_message *)type_message)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            handleCascade((cascade_message *)type_message);
+            sendAck();
+        }
+        break;
+    case TYPE_BURST:
+        if (len != LENGTH_BURST_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_BURST_MESSAGE;
+        } else if (!_validBurst((burst_message *)type_message)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            handleBurst((burst_message *)type_message);
+            sendAck();
+        }
+        break;
+    case TYPE_SCHEDULE:
+        if (len < MIN_LENGTH_SCHEDULE_MESSAGE ||
+            len != MIN_LENGTH_SCHEDULE_MESSAGE +
+                       ((schedule_message *)type_message)->count *
+                           LENGTH_SCHEDULE_SEGMENT) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len =
+                len < MIN_LENGTH_SCHEDULE_MESSAGE
+                    ? MIN_LENGTH_SCHEDULE_MESSAGE
+                    : MIN_LENGTH_SCHEDULE_MESSAGE +
+                          ((schedule_message *)type_message)->count *
+                              LENGTH_SCHEDULE_SEGMENT;
+        }
+        if (!error_flags &&
+            !_scheduleLoaderFunction((schedule_message *)type_message)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            sendAck();
+        }
+        break;
+    case TYPE_TIMED:
+        if (len != LENGTH_TIMED_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_TIMED_MESSAGE;
+        } else if (!_validTimed((timed_message *)type_message)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        // A full queue rejects the command like an invalid one
+        if (!error_flags &&
+            !_timedQueueFunction((timed_message *)type_message)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            sendAck();
+        }
+        break;
+    case TYPE_PATTERN:
+        if (len < MIN_LENGTH_PATTERN_MESSAGE ||
+            len != MIN_LENGTH_PATTERN_MESSAGE +
+                       ((pattern_message *)type_message)->count *
+                           sizeof(uint16_t)) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len =
+                len < MIN_LENGTH_PATTERN_MESSAGE
+                    ? MIN_LENGTH_PATTERN_MESSAGE
+                    : MIN_LENGTH_PATTERN_MESSAGE +
+                          ((pattern_message *)type_message)->count *
+                              sizeof(uint16_t);
+        } else if (!error_flags && !_patternLoaderFunction) {
+            error_flags |= SERIAL_PEER_ERROR_NOT_IMPLEMENTED;
+        } else if (!error_flags &&
+                   (((pattern_message *)type_message)->action >
+                        PATTERN_STOP ||
+                    !_patternLoaderFunction(
+                        (pattern_message *)type_message))) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            sendAck();
+        }
+        break;
+    case TYPE_ANALOG:
+        if (len != LENGTH_ANALOG_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_ANALOG_MESSAGE;
+        } else if (!error_flags && !_analogSetupFunction) {
+            error_flags |= SERIAL_PEER_ERROR_NOT_IMPLEMENTED;
+        } else if (!error_flags &&
+                   !_analogSetupFunction((analog_message *)type_message)) {
+            error_flags |= SERIAL_PEER_ERROR_INVALID_VALUE;
+        }
+        if (!error_flags) {
+            sendAck();
+        }
+        break;
+#if SERIAL_PEER_SEQUENCING
+    case TYPE_SEQUENCE:
+        if (len != LENGTH_SEQUENCE_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_SEQUENCE_MESSAGE;
+        }
+        if (!error_flags) {
+            handleSequence((sequence_message *)type_message);
+            sendAck();
+        }
+        break;
+    case TYPE_RESEND:
+        if (len != LENGTH_RESEND_MESSAGE) {
+            error_flags |= SERIAL_PEER_ERROR_LENGTH;
+            expected_len = LENGTH_RESEND_MESSAGE;
+        }
+        if (!error_flags) {
+            handleResend((resend_message *)type_message);
+        }
+        break;
+#else
+    case TYPE_SEQUENCE:
+    case TYPE_RESEND:
+        error_flags |= SERIAL_PEER_ERROR_NOT_IMPLEMENTED;
+        break;
+#endif
     default:
         // unknown packet type
         error_flags |= SERIAL_PEER_ERROR_UNKNOWN_PACKET;
         break;
     }
+    deviceStatsRx(error_flags);
     if (error_flags) {
-        uint8_t error_str[SERIAL_PEER_MAX_BUFFER_SIZE];
-        uint16_t error_len = 0;
-
-        if (error_flags & SERIAL_PEER_ERROR_CRC) {
-            error_len +=
-                snprintf((char *)error_str + error_len,
-                         SERIAL_PEER_MAX_BUFFER_SIZE - error_len,
-                         " # CRC ERROR / header.crc: %d / calc crc: %d",
-                         type_message->header.crc, crc);
-        }
-        if (error_flags & SERIAL_PEER_ERROR_LENGTH) {
-            error_len += snprintf((char *)error_str + error_len,
-                                  SERIAL_PEER_MAX_BUFFER_SIZE - error_len,
-                                  " # LENGHT ERROR / header.length: %d / len: "
-                                  "%d / MIN_LENGTH_MESSAGE: %d",
-                                  length, len, MIN_LENGTH_MESSAGE);
-        }
-        if (error_flags & SERIAL_PEER_ERROR_NOT_IMPLEMENTED) {
-            error_len += snprintf((char *)error_str + error_len,
-                                  SERIAL_PEER_MAX_BUFFER_SIZE - error_len,
-                                  " # NOT IMPLEMENTED ERROR ");
-        }
-        if (error_flags & SERIAL_PEER_ERROR_UNKNOWN_PACKET) {
-            error_len += snprintf((char *)error_str + error_len,
-                                  SERIAL_PEER_MAX_BUFFER_SIZE - error_len,
-                                  " # UNKNOWN PACKET ERROR / header.type: %d",
-                                  type_message->header.type);
-        }
-
-        sendError(error_str, error_len);
+        sendError(error_flags, &type_message->header, crc, len, expected_len);
     }
 
     return error_flags;
@@ -111,7 +338,12 @@ uint8_t SerialPeer::handleMessage(uint8_t *msg, size_t len) {
 void SerialPeer::handleSetup(setup_message *msg, size_t len) {
     _setup.delay_us = msg->delay_us;
     _setup.pulse_limit = msg->pulse_limit;
-    _setup.pulse_hz = msg->pulse_hz;
+    if (len >= LENGTH_SETUP_MESSAGE_V2) {
+        _setup.pulse_millihz = msg->pulse_millihz;
+    } else {
+        _setup.pulse_millihz = msg->pulse_hz * MILLIHZ_PER_HZ;
+    }
+    _setup.high_us = len == LENGTH_SETUP_MESSAGE ? msg->high_us : 0;
     _setup.flags = msg->flags;
     _setup_changed = true;
 }
@@ -125,9 +357,275 @@ uint8_t SerialPeer::getSetup(SetupStruct *setup) {
     return true;
 }
 
+void SerialPeer::handleChannelSetup(channel_setup_message *msg) {
+    PulseChannelSetup *setup = &_channel_setups[msg->channel];
+    setup->outputs = msg->outputs;
+    setup->inputs = msg->inputs;
+    setup->pulse_millihz = msg->pulse_millihz;
+    setup->phase_us = msg->phase_us;
+    setup->pulse_limit = msg->pulse_limit;
+    setup->flags = msg->flags;
+    setup->high_us = msg->high_us;
+    _channel_setups_changed |= 1 << msg->channel;
+}
+
+uint8_t SerialPeer::getChannelSetup(uint8_t channel,
+                                    PulseChannelSetup *setup) {
+    if (!(_channel_setups_changed & (1 << channel))) {
+        return false;
+    }
+    _channel_setups_changed &= ~(1 << channel);
+    memcpy(setup, &_channel_setups[channel], sizeof(PulseChannelSetup));
+    return true;
+}
+
+void SerialPeer::handleCascade(cascade_message *msg) {
+    PulseCascadeSetup *setup = &_cascade_setups[msg->channel];
+    setup->clock_input = msg->clock_input;
+    setup->sync_input = msg->sync_input;
+    setup->sync_outputs = msg->sync_outputs;
+    _cascade_setups_changed |= 1 << msg->channel;
+}
+
+uint8_t SerialPeer::getCascadeSetup(uint8_t channel,
+                                    PulseCascadeSetup *setup) {
+    if (!(_cascade_setups_changed & (1 << channel))) {
+        return false;
+    }
+    _cascade_setups_changed &= ~(1 << channel);
+    memcpy(setup, &_cascade_setups[channel], sizeof(PulseCascadeSetup));
+    return true;
+}
+
+void SerialPeer::handleBurst(burst_message *msg) {
+    PulseBurstSetup *setup = &_burst_setups[msg->channel];
+    setup->input = msg->input;
+    setup->flags = msg->flags;
+    setup->pulse_count = msg->pulse_count;
+    setup->pulse_millihz = msg->pulse_millihz;
+    setup->high_us = msg->high_us;
+    _burst_setups_changed |= 1 << msg->channel;
+}
+
+uint8_t SerialPeer::getBurstSetup(uint8_t channel, PulseBurstSetup *setup) {
+    if (!(_burst_setups_changed & (1 << channel))) {
+        return false;
+    }
+    _burst_setups_changed &= ~(1 << channel);
+    memcpy(setup, &_burst_setups[channel], sizeof(PulseBurstSetup));
+    return true;
+}
+
+void SerialPeer::handleBatchConfig(batch_config_message *msg) {
+    // Events queued with the old settings go out first
+    flushBatch();
+    _batch_max_bytes = msg->max_bytes;
+    if (_batch_max_bytes > SERIAL_PEER_MAX_BATCH_SIZE) {
+        _batch_max_bytes = SERIAL_PEER_MAX_BATCH_SIZE;
+    }
+    _batch_max_latency_us = msg->max_latency_us;
+}
+
+#if SERIAL_PEER_SEQUENCING
+void SerialPeer::handleSequence(sequence_message *msg) {
+    // The batch being collected goes out the way it was started
+    flushBatch();
+    _sequence_on = msg->flags & SEQUENCE_ON;
+    _replay.clear();
+    _resend_next = 0;
+    _resend_end = 0;
+}
+
+/// @brief Add the frames of a request to the ones still to be resent. The
+/// host asks for all it is missing, overlapping requests are merged.
+void SerialPeer::handleResend(resend_message *msg) {
+    if (!_sequence_on) {
+        return;
+    }
+    uint16_t end = msg->first + msg->count;
+    if (_resend_next == _resend_end) {
+        _resend_next = msg->first;
+        _resend_end = end;
+        return;
+    }
+    if ((int16_t)(msg->first - _resend_next) < 0) {
+        _resend_next = msg->first;
+    }
+    if ((int16_t)(end - _resend_end) > 0) {
+        _resend_end = end;
+    }
+}
+#endif
+
+/// @brief Hold the reply until the transmit queue starts its next frame,
+/// see sendTimeSync(). A reply still held goes out right away.
+void SerialPeer::handleTimeSync(time_sync_message *request,
+                                uint64_t device_rx_us) {
+    sendTimeSync();
+    _time_sync_host_tx = request->host_tx;
+    _time_sync_rx_us = device_rx_us;
+    _time_sync_pending = true;
+}
+
+/// @brief Send the held time sync reply, called by the transmit queue right
+/// before it picks its next frame. device_tx_us is taken then, so frames
+/// already on the wire do not count as link delay; the reply goes out next
+/// after the bytes the port still buffers.
+void SerialPeer::sendTimeSync() {
+    if (!_time_sync_pending) {
+        return;
+    }
+    _time_sync_pending = false;
+    time_sync_message *msg;
+    msg = (time_sync_message *)this->_buffer;
+
+    msg->host_tx = _time_sync_host_tx;
+    msg->device_rx_us = _time_sync_rx_us;
+
+    msg->header.type = TYPE_TIME_SYNC;
+    msg->header.length = LENGTH_TIME_SYNC_MESSAGE - LENGTH_MSG_HEADER;
+    // Taken as late as possible, the CRC has to cover it
+    msg->device_tx_us = _clockFunction();
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_TIME_SYNC_MESSAGE);
+}
+
+void SerialPeer::handleBaud(baud_message *msg) {
+    if (msg->flags & BAUD_VERIFY) {
+        _baud_verify_requested = true;
+        return;
+    }
+    // Acknowledged at the old rate, the switch waits until it is out
+    sendAck();
+    _baud_proposed = msg->baudrate;
+}
+
+uint8_t SerialPeer::getBaudRequest(uint32_t *baudrate) {
+    if (!_baud_proposed) {
+        return false;
+    }
+    *baudrate = _baud_proposed;
+    _baud_proposed = 0;
+    return true;
+}
+
+uint8_t SerialPeer::getBaudVerify() {
+    if (!_baud_verify_requested) {
+        return false;
+    }
+    _baud_verify_requested = false;
+    return true;
+}
+
+uint8_t SerialPeer::getInfoRequest() {
+    if (!this->_info_requested) {
+        return false;
+    }
+    this->_info_requested = false;
+    return true;
+}
+
+/// @brief Stats requested since the last call
+/// @param reset set if the counters are to be restarted after the response
+uint8_t SerialPeer::getStatsRequest(uint8_t *reset) {
+    if (!this->_stats_requested) {
+        return false;
+    }
+    this->_stats_requested = false;
+    *reset = _stats_flags & STATS_RESET;
+    return true;
+}
+
+/// @brief Transmit priority of a message type, acks and time sync replies
+/// overtake queued inputs, text and errors go last
+static uint8_t _txPriority(uint8_t type) {
+    switch (type & HEADER_TYPE_MASK) {
+    case TYPE_ACK:
+    case TYPE_TIME_SYNC:
+    case TYPE_INFO:
+    case TYPE_BAUD:
+    case TYPE_RESEND:
+        return TX_PRIORITY_CONTROL;
+    case TYPE_INPUTS:
+    case TYPE_INPUTS_BATCH:
+    case TYPE_INPUT_CAPTURE:
+    case TYPE_EVENT_OVERFLOW:
+    case TYPE_SEGMENT:
+    case TYPE_TIMED:
+    case TYPE_PATTERN:
+    case TYPE_BURST:
+    case TYPE_ANALOG_SAMPLES:
+    case TYPE_SEQUENCE:
+        return TX_PRIORITY_INPUTS;
+    case TYPE_STATS:
+        return TX_PRIORITY_STATS;
+    default:
+        return TX_PRIORITY_TEXT;
+    }
+}
+
 void SerialPeer::sendMessage(uint8_t *msg, size_t len) {
-    this->_sendPacketFunction(msg, len);
+    uint8_t priority = _txPriority(msg[0]);
+#if SERIAL_PEER_SEQUENCING
+    // The event stream is one ring of the transmit queue, its frames reach
+    // the host in the order they are numbered
+    if (_sequence_on && priority == TX_PRIORITY_INPUTS &&
+        len <= SERIAL_PEER_MAX_BATCH_SIZE) {
+        sendSequenced(msg, len);
+        return;
+    }
+#endif
+    this->_sendPacketFunction(msg, len, priority);
+}
+
+#if SERIAL_PEER_SEQUENCING
+/// @brief Wrap a frame of the event stream with the next sequence number
+/// and keep it for resends
+void SerialPeer::sendSequenced(const uint8_t *frame, size_t len) {
+    sequenced_message *msg;
+    msg = (sequenced_message *)this->_sequence_buffer;
+
+    msg->sequence = _replay.next();
+    memcpy(msg->frame, frame, len);
+
+    msg->header.type = TYPE_SEQUENCE;
+    msg->header.length =
+        MIN_LENGTH_SEQUENCED_MESSAGE - LENGTH_MSG_HEADER + len;
+    finishHeader(&msg->header);
+
+    len += MIN_LENGTH_SEQUENCED_MESSAGE;
+    _replay.push(_sequence_buffer, len);
+    this->_sendPacketFunction(_sequence_buffer, len, TX_PRIORITY_INPUTS);
+}
+
+/// @brief Send the next frame of the TYPE_RESEND requests, called from
+/// loop() while the transmit queue has room for a frame of the event stream.
+/// Frames that are no longer held are reported lost first.
+/// @return false if none is left
+uint8_t SerialPeer::resendNext() {
+    // Frames that were not sent yet can not be resent
+    uint16_t next = _replay.next();
+    if ((int16_t)(_resend_end - next) > 0) {
+        _resend_end = next;
+    }
+    if ((int16_t)(_resend_end - _resend_next) <= 0) {
+        _resend_next = _resend_end;
+        return false;
+    }
+    uint16_t first = _replay.first();
+    if ((int16_t)(first - _resend_next) > 0) {
+        uint16_t lost_end =
+            (int16_t)(_resend_end - first) < 0 ? _resend_end : first;
+        sendResendLost(_resend_next, lost_end - _resend_next);
+        _resend_next = lost_end;
+        return true;
+    }
+    uint16_t len = _replay.get(_resend_next++, _sequence_buffer);
+    this->_sendPacketFunction(_sequence_buffer, len, TX_PRIORITY_INPUTS);
+    return true;
 }
+#endif
 
 void SerialPeer::sendAck() {
     ack_message *msg;
@@ -135,13 +633,52 @@ void SerialPeer::sendAck() {
 
     msg->header.type = TYPE_ACK;
     msg->header.length = 0;
-    msg->header.crc = 0;
+    finishHeader(&msg->header);
 
     sendMessage((uint8_t *)msg, LENGTH_ACK_MESSAGE);
 }
 
-void SerialPeer::sendError(uint8_t *value, uint8_t len) {
-    _sendTypedMessage(TYPE_ERROR, value, len);
+/// @brief Report a rejected message or a link error
+/// @param error_flags SERIAL_PEER_ERROR_CODE bits
+/// @param rejected header of the rejected message, nullptr if there is none
+/// @param calc_crc crc calculated for the rejected message
+/// @param received_len bytes received
+/// @param expected_len bytes expected, 0 if the length was fine
+void SerialPeer::sendError(uint8_t error_flags, const msg_header *rejected,
+                           uint8_t calc_crc, uint16_t received_len,
+                           uint16_t expected_len) {
+    if (!rejected) {
+        uint32_t now_ms = millis();
+        if (error_flags == _link_error_flags &&
+            now_ms - _link_error_ms < SERIAL_PEER_ERROR_HOLDOFF_MS) {
+            return;
+        }
+        _link_error_flags = error_flags;
+        _link_error_ms = now_ms;
+    }
+
+    error_message *msg;
+    msg = (error_message *)this->_buffer;
+
+    msg->error_flags = error_flags;
+    if (rejected) {
+        msg->type = rejected->type;
+        msg->length = rejected->length;
+        msg->crc = rejected->crc;
+    } else {
+        msg->type = 0;
+        msg->length = 0;
+        msg->crc = 0;
+    }
+    msg->calc_crc = calc_crc;
+    msg->received_len = received_len;
+    msg->expected_len = expected_len;
+
+    msg->header.type = TYPE_ERROR;
+    msg->header.length = LENGTH_ERROR_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_ERROR_MESSAGE);
 }
 
 void SerialPeer::sendTxt(uint8_t *value, uint8_t len) {
@@ -156,11 +693,38 @@ void SerialPeer::_sendTypedMessage(uint8_t type, uint8_t *value, uint8_t len) {
 
     msg->header.type = type;
     msg->header.length = len;
-    msg->header.crc = calculateCrc(msg->value, msg->header.length);
+    finishHeader(&msg->header);
 
     sendMessage((uint8_t *)msg, MIN_LENGTH_TXT_MESSAGE + len);
 }
 
+/// @brief Set the header version and crc, type and length are set
+void SerialPeer::finishHeader(msg_header *header) {
+    if (_header_v2) {
+        header->type |= HEADER_V2;
+        header->crc = crc8Message(header);
+    } else {
+        header->crc =
+            calculateCrc((uint8_t *)header + LENGTH_MSG_HEADER, header->length);
+    }
+}
+
+#if SERIAL_PEER_SEQUENCING
+void SerialPeer::sendResendLost(uint16_t first, uint16_t count) {
+    resend_message *msg;
+    msg = (resend_message *)this->_buffer;
+
+    msg->first = first;
+    msg->count = count;
+
+    msg->header.type = TYPE_RESEND;
+    msg->header.length = LENGTH_RESEND_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_RESEND_MESSAGE);
+}
+#endif
+
 void SerialPeer::sendInputs(uint32_t uptime_us, uint32_t pulse_id,
                             uint8_t inputs_state) {
     input_state_message *msg;
@@ -172,8 +736,304 @@ void SerialPeer::sendInputs(uint32_t uptime_us, uint32_t pulse_id,
 
     msg->header.type = TYPE_INPUTS;
     msg->header.length = LENGTH_INPUT_STATE_MESSAGE - LENGTH_MSG_HEADER;
-    msg->header.crc =
-        calculateCrc((uint8_t *)msg + LENGTH_MSG_HEADER, msg->header.length);
+    finishHeader(&msg->header);
 
     sendMessage((uint8_t *)msg, LENGTH_INPUT_STATE_MESSAGE);
 }
+
+void SerialPeer::sendInfo(uint32_t cpu_hz, uint16_t output_skew_cycles,
+                          uint8_t output_ports, uint32_t capture_hz,
+                          uint8_t capture_inputs) {
+    info_message *msg;
+    msg = (info_message *)this->_buffer;
+
+    msg->cpu_hz = cpu_hz;
+    msg->output_skew_cycles = output_skew_cycles;
+    msg->output_ports = output_ports;
+    msg->capture_hz = capture_hz;
+    msg->capture_inputs = capture_inputs;
+
+    msg->header.type = TYPE_INFO;
+    msg->header.length = LENGTH_INFO_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_INFO_MESSAGE);
+}
+
+/// @brief Send an edge with its capture timestamp right away, it is never
+/// batched and may overtake batched events
+void SerialPeer::sendInputCapture(uint32_t uptime_us, uint32_t pulse_id,
+                                  uint8_t inputs_state, uint8_t input,
+                                  uint64_t ticks) {
+    input_capture_message *msg;
+    msg = (input_capture_message *)this->_buffer;
+
+    msg->inputs_state = inputs_state;
+    msg->uptime_us = uptime_us;
+    msg->pulse_id = pulse_id;
+    msg->input = input;
+    msg->ticks = ticks;
+
+    msg->header.type = TYPE_INPUT_CAPTURE;
+    msg->header.length = LENGTH_INPUT_CAPTURE_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_INPUT_CAPTURE_MESSAGE);
+}
+
+void SerialPeer::sendEventOverflow(uint32_t lost_events) {
+    event_overflow_message *msg;
+    msg = (event_overflow_message *)this->_buffer;
+
+    msg->lost_events = lost_events;
+
+    msg->header.type = TYPE_EVENT_OVERFLOW;
+    msg->header.length = LENGTH_EVENT_OVERFLOW_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_EVENT_OVERFLOW_MESSAGE);
+}
+
+void SerialPeer::sendStats(const DeviceStats *stats) {
+    stats_message *msg;
+    msg = (stats_message *)this->_buffer;
+
+    msg->elapsed_ms = stats->elapsed_ms;
+    msg->loop_count = stats->loop_count;
+    msg->loop_max_us = stats->loop_max_us;
+    msg->edge_count = stats->edge_count;
+    msg->edge_late_max_us = stats->edge_late_max_us;
+    msg->input_captures = stats->input_captures;
+    msg->input_edges = stats->input_edges;
+    msg->input_events = stats->input_events;
+    msg->input_lost = stats->input_lost;
+    msg->tx_frames = stats->tx_frames;
+    msg->tx_bytes = stats->tx_bytes;
+    msg->tx_dropped = stats->tx_dropped;
+    msg->rx_frames = stats->rx_frames;
+    memcpy(msg->rx_errors, stats->rx_errors, sizeof(msg->rx_errors));
+    msg->tx_free_min = stats->tx_free_min;
+    msg->input_high_water = stats->input_high_water;
+    msg->capture_high_water = stats->capture_high_water;
+    memcpy(msg->loop_histogram, stats->loop_histogram,
+           sizeof(msg->loop_histogram));
+    memcpy(msg->edge_late_histogram, stats->edge_late_histogram,
+           sizeof(msg->edge_late_histogram));
+
+    msg->header.type = TYPE_STATS;
+    msg->header.length = LENGTH_STATS_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_STATS_MESSAGE);
+}
+
+void SerialPeer::sendBaud(uint32_t baudrate, uint8_t flags) {
+    baud_message *msg;
+    msg = (baud_message *)this->_buffer;
+
+    msg->baudrate = baudrate;
+    msg->flags = flags;
+
+    msg->header.type = TYPE_BAUD;
+    msg->header.length = LENGTH_BAUD_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_BAUD_MESSAGE);
+}
+
+/// @brief Send the start of a schedule segment right away, it may overtake
+/// batched events like an input capture
+void SerialPeer::sendSegment(uint8_t channel, uint32_t uptime_us,
+                             uint32_t pulse_id, uint8_t segment,
+                             uint16_t pass) {
+    segment_message *msg;
+    msg = (segment_message *)this->_buffer;
+
+    msg->channel = channel;
+    msg->uptime_us = uptime_us;
+    msg->pulse_id = pulse_id;
+    msg->segment = segment;
+    msg->pass = pass;
+
+    msg->header.type = TYPE_SEGMENT;
+    msg->header.length = LENGTH_SEGMENT_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_SEGMENT_MESSAGE);
+}
+
+void SerialPeer::sendTimed(uint8_t id, uint8_t channel, uint8_t status,
+                           uint64_t applied_us, uint32_t pulse_id) {
+    timed_reply_message *msg;
+    msg = (timed_reply_message *)this->_buffer;
+
+    msg->id = id;
+    msg->channel = channel;
+    msg->status = status;
+    msg->applied_us = applied_us;
+    msg->pulse_id = pulse_id;
+
+    msg->header.type = TYPE_TIMED;
+    msg->header.length = LENGTH_TIMED_REPLY_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_TIMED_REPLY_MESSAGE);
+}
+
+void SerialPeer::sendPattern(uint8_t status, uint16_t first,
+                             uint32_t uptime_us, uint32_t halves) {
+    pattern_status_message *msg;
+    msg = (pattern_status_message *)this->_buffer;
+
+    msg->status = status;
+    msg->first = first;
+    msg->uptime_us = uptime_us;
+    msg->halves = halves;
+
+    msg->header.type = TYPE_PATTERN;
+    msg->header.length = LENGTH_PATTERN_STATUS_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_PATTERN_STATUS_MESSAGE);
+}
+
+void SerialPeer::sendBurst(uint8_t channel, uint8_t input, uint8_t status,
+                           uint32_t uptime_us, uint32_t pulse_id,
+                           uint32_t latency_ns) {
+    burst_reply_message *msg;
+    msg = (burst_reply_message *)this->_buffer;
+
+    msg->channel = channel;
+    msg->input = input;
+    msg->status = status;
+    msg->uptime_us = uptime_us;
+    msg->pulse_id = pulse_id;
+    msg->latency_ns = latency_ns;
+
+    msg->header.type = TYPE_BURST;
+    msg->header.length = LENGTH_BURST_REPLY_MESSAGE - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, LENGTH_BURST_REPLY_MESSAGE);
+}
+
+void SerialPeer::sendAnalogSamples(uint8_t channel, uint8_t pins,
+                                   uint8_t divider, uint8_t index,
+                                   uint8_t count, uint32_t pulse_id,
+                                   uint32_t uptime_us, uint32_t sets,
+                                   uint32_t dropped) {
+    analog_samples_message *msg;
+    msg = (analog_samples_message *)this->_buffer;
+
+    msg->channel = channel;
+    msg->pins = pins;
+    msg->divider = divider;
+    msg->index = index;
+    msg->count = count;
+    msg->pulse_id = pulse_id;
+    msg->uptime_us = uptime_us;
+    msg->sets = sets;
+    msg->dropped = dropped;
+
+    size_t len = MIN_LENGTH_ANALOG_SAMPLES_MESSAGE +
+                 (size_t)count * __builtin_popcount(pins) * sizeof(uint16_t);
+    msg->header.type = TYPE_ANALOG_SAMPLES;
+    msg->header.length = len - LENGTH_MSG_HEADER;
+    finishHeader(&msg->header);
+
+    sendMessage((uint8_t *)msg, len);
+}
+
+/// @brief Send inputs, batched if the host enabled batching
+void SerialPeer::queueInputs(uint32_t uptime_us, uint32_t pulse_id,
+                             uint8_t inputs_state) {
+    if (!_batch_max_bytes) {
+        sendInputs(uptime_us, pulse_id, inputs_state);
+        return;
+    }
+
+    input_batch_message *msg;
+    msg = (input_batch_message *)this->_batch_buffer;
+
+    if (!_batch_len) {
+        msg->count = 1;
+        msg->inputs_state = inputs_state;
+        msg->uptime_us = uptime_us;
+        msg->pulse_id = pulse_id;
+        _batch_len = MIN_LENGTH_INPUT_BATCH_MESSAGE;
+        // count changes with every event, it is added on flush
+        uint8_t *event = &msg->inputs_state;
+        uint8_t event_len = _batch_buffer + _batch_len - event;
+        _batch_crc8 = crc8(0, event, event_len);
+        _batch_sum = calculateCrc(event, event_len);
+    } else {
+        uint8_t *start = _batch_buffer + _batch_len;
+        uint8_t *delta = start;
+        *delta++ = inputs_state;
+        delta += writeVarint(delta, uptime_us - _batch_last_uptime_us);
+        delta += writeVarint(delta, pulse_id - _batch_last_pulse_id);
+        _batch_len = delta - _batch_buffer;
+        _batch_crc8 = crc8(_batch_crc8, start, delta - start);
+        _batch_sum += calculateCrc(start, delta - start);
+        msg->count++;
+    }
+    _batch_last_uptime_us = uptime_us;
+    _batch_last_pulse_id = pulse_id;
+
+    // Flush once the next event might not fit anymore
+    if (_batch_len + MAX_LENGTH_INPUT_BATCH_DELTA > _batch_max_bytes ||
+        msg->count == UINT8_MAX) {
+        flushBatch();
+    }
+}
+
+/// @brief Length of the frame the next queueInputs() may send: its own
+/// TYPE_INPUTS frame, or the batch once the event closes it. Batched events
+/// only need room for the batch collected so far, not for a full one.
+size_t SerialPeer::inputsFrameLength() {
+    size_t len = LENGTH_INPUT_STATE_MESSAGE;
+    if (_batch_max_bytes) {
+        len = _batch_len ? _batch_len + MAX_LENGTH_INPUT_BATCH_DELTA
+                         : MIN_LENGTH_INPUT_BATCH_MESSAGE;
+    }
+#if SERIAL_PEER_SEQUENCING
+    if (_sequence_on) {
+        len += MIN_LENGTH_SEQUENCED_MESSAGE;
+    }
+#endif
+    return len;
+}
+
+/// @brief Flush the batch when its first event is older than the latency
+/// threshold, called from loop()
+void SerialPeer::updateBatch(uint32_t current_us) {
+    if (!_batch_len) {
+        return;
+    }
+    input_batch_message *msg;
+    msg = (input_batch_message *)this->_batch_buffer;
+    if ((uint32_t)(current_us - msg->uptime_us) >= _batch_max_latency_us) {
+        flushBatch();
+    }
+}
+
+void SerialPeer::flushBatch() {
+    if (!_batch_len) {
+        return;
+    }
+    input_batch_message *msg;
+    msg = (input_batch_message *)this->_batch_buffer;
+
+    msg->header.type = TYPE_INPUTS_BATCH;
+    msg->header.length = _batch_len - LENGTH_MSG_HEADER;
+    // The crc ran while the events were appended
+    if (_header_v2) {
+        msg->header.type |= HEADER_V2;
+        msg->header.crc = crc8FinishMessage(_batch_crc8, &msg->header);
+    } else {
+        msg->header.crc = _batch_sum + msg->count;
+    }
+
+    sendMessage((uint8_t *)msg, _batch_len);
+    _batch_len = 0;
+}
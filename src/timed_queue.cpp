@@ -0,0 +1,44 @@
+/*******************************************************************************
+ * File:        timed_queue.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "timed_queue.h"
+#include <string.h>
+
+uint8_t TimedQueue::push(const PulseTimedCommand *command) {
+    if (_size >= TIMED_QUEUE_SIZE) {
+        return false;
+    }
+    _commands[_size] = *command;
+    _commands[_size].armed = false;
+    _size++;
+    return true;
+}
+
+PulseTimedCommand *TimedQueue::first(uint8_t channel) {
+    for (uint8_t i = 0; i < _size; i++) {
+        if (_commands[i].channel == channel) {
+            return &_commands[i];
+        }
+    }
+    return nullptr;
+}
+
+void TimedQueue::remove(PulseTimedCommand *command) {
+    if (!command) {
+        return;
+    }
+    uint8_t index = command - _commands;
+    if (index >= _size) {
+        return;
+    }
+    // A handful of entries, moving them keeps the arrival order
+    memmove(&_commands[index], &_commands[index + 1],
+            (_size - index - 1) * sizeof(PulseTimedCommand));
+    _size--;
+}
@@ -0,0 +1,263 @@
+/*******************************************************************************
+ * File:        trigger_inputs.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "trigger_inputs.h"
+#include "critical_section.h"
+#include "input_capture.h"
+
+static volatile uint8_t _state = 0;
+static TriggerInputsHandler _handler = nullptr;
+static TriggerCaptureHandler _capture_handler = nullptr;
+static TriggerInputsFollower _follower = nullptr;
+
+/// @brief Report the inputs that changed, interrupts off
+///
+/// Every edge of a burst may raise its own interrupt. The first one reads
+/// all of them, the later ones find nothing new and return.
+static inline void _capture(uint8_t state) {
+    uint8_t changed = (state ^ _state) & portInputs();
+    if (!changed) {
+        return;
+    }
+    _state ^= changed;
+    if (_follower) {
+        changed &= ~_follower(_state, changed, 0);
+        if (!changed) {
+            return;
+        }
+    }
+    _handler(micros(), _state, changed);
+}
+
+/// @brief Report an edge latched by the capture timer, interrupts off
+static void _captured(uint64_t ticks, uint8_t input, uint8_t level) {
+    uint8_t bit = 1 << input;
+    if (!level == !(_state & bit)) {
+        return;
+    }
+    _state ^= bit;
+    if (_follower && _follower(_state, bit, (uint16_t)ticks)) {
+        return;
+    }
+    if (_capture_handler) {
+        _capture_handler(micros(), ticks, _state, input);
+    } else {
+        _handler(micros(), _state, bit);
+    }
+}
+
+#if defined(__AVR__)
+// ####################################### AVR, pin change interrupt per port
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+// Port bit -> IN bit, the constant pin table folds this into a few shifts
+#define AVR_INPUT_BIT(port, pins, i)                                           \
+    (validInputPin(INPUT_PINS[i]) && avrPinPort(INPUT_PINS[i]) == (port)       \
+         ? (((pins) >> (avrPinBit(INPUT_PINS[i]) & 7)) & 1) << (i)            \
+         : 0)
+
+static inline uint8_t _portInputs(uint8_t port, uint8_t pins) {
+    return AVR_INPUT_BIT(port, pins, 0) | AVR_INPUT_BIT(port, pins, 1) |
+           AVR_INPUT_BIT(port, pins, 2) | AVR_INPUT_BIT(port, pins, 3) |
+           AVR_INPUT_BIT(port, pins, 4) | AVR_INPUT_BIT(port, pins, 5) |
+           AVR_INPUT_BIT(port, pins, 6) | AVR_INPUT_BIT(port, pins, 7);
+}
+
+static uint8_t _readInputs() {
+    return _portInputs(AVR_PORTB, PINB) | _portInputs(AVR_PORTC, PINC) |
+           _portInputs(AVR_PORTD, PIND);
+}
+
+// Only the inputs of the port that raised the interrupt are read
+ISR(PCINT0_vect) {
+    _capture((_state & ~avrPortInputs(AVR_PORTB)) |
+             _portInputs(AVR_PORTB, PINB));
+}
+ISR(PCINT1_vect) {
+    _capture((_state & ~avrPortInputs(AVR_PORTC)) |
+             _portInputs(AVR_PORTC, PINC));
+}
+ISR(PCINT2_vect) {
+    _capture((_state & ~avrPortInputs(AVR_PORTD)) |
+             _portInputs(AVR_PORTD, PIND));
+}
+
+static void _enableCapture() {
+    PCMSK0 = IN_PORTB_MASK;
+    PCMSK1 = IN_PORTC_MASK;
+    PCMSK2 = IN_PORTD_MASK;
+    PCIFR = _BV(PCIF0) | _BV(PCIF1) | _BV(PCIF2);
+    PCICR = (IN_PORTB_MASK ? _BV(PCIE0) : 0) |
+            (IN_PORTC_MASK ? _BV(PCIE1) : 0) |
+            (IN_PORTD_MASK ? _BV(PCIE2) : 0);
+}
+
+#elif defined(__IMXRT1062__)
+// ############################################ Teensy 4.x, one GPIO interrupt
+//
+// All fast GPIO ports (GPIO6..9) share IRQ_GPIO6789. The handler replaces the
+// one of the core, so attachInterrupt() must not be used next to it.
+
+// Registers of an IMXRT GPIO port relative to its DR
+#define GPIO_PSR_INDEX 2
+#define GPIO_IMR_INDEX 5
+#define GPIO_ISR_INDEX 6
+#define GPIO_EDGE_SEL_INDEX 7
+
+struct InputPort {
+    volatile uint32_t *gpio;
+    uint32_t mask; // pins with a pin change interrupt
+};
+static InputPort _ports[NUM_INPUT_PINS];
+static uint8_t _num_ports = 0;
+static uint8_t _input_ports[NUM_INPUT_PINS];
+static uint32_t _input_masks[NUM_INPUT_PINS];
+
+static uint8_t _readInputs() {
+    uint32_t levels[NUM_INPUT_PINS];
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        levels[i] = _ports[i].gpio[GPIO_PSR_INDEX];
+    }
+    uint8_t state = 0;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if ((validInputs() & (1 << i)) &&
+            (levels[_input_ports[i]] & _input_masks[i])) {
+            state |= 1 << i;
+        }
+    }
+    return state;
+}
+
+static void _gpioIsr() {
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        volatile uint32_t *gpio = _ports[i].gpio;
+        gpio[GPIO_ISR_INDEX] = gpio[GPIO_ISR_INDEX] & _ports[i].mask;
+    }
+    _capture(_readInputs());
+    // Make sure the flag clears reach the GPIO before the interrupt returns
+    asm volatile("dsb");
+}
+
+static void _enableCapture() {
+    _num_ports = 0;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        int16_t pin = INPUT_PINS[i];
+        if (!validInputPin(pin)) {
+            continue;
+        }
+        volatile uint32_t *gpio = portOutputRegister(pin);
+        uint8_t port = 0;
+        while (port < _num_ports && _ports[port].gpio != gpio) {
+            port++;
+        }
+        if (port == _num_ports) {
+            _ports[port].gpio = gpio;
+            _ports[port].mask = 0;
+            _num_ports++;
+        }
+        if (portInputs() & (1 << i)) {
+            _ports[port].mask |= digitalPinToBitMask(pin);
+        }
+        _input_ports[i] = port;
+        _input_masks[i] = digitalPinToBitMask(pin);
+    }
+    attachInterruptVector(IRQ_GPIO6789, &_gpioIsr);
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        volatile uint32_t *gpio = _ports[i].gpio;
+        uint32_t mask = _ports[i].mask;
+        gpio[GPIO_IMR_INDEX] &= ~mask;
+        gpio[GPIO_EDGE_SEL_INDEX] |= mask; // both edges
+        gpio[GPIO_ISR_INDEX] = mask;
+        gpio[GPIO_IMR_INDEX] |= mask;
+    }
+    NVIC_ENABLE_IRQ(IRQ_GPIO6789);
+}
+
+#elif defined(TRIGGER_SIM)
+// ################################# Simulator, pin change interrupt, one port
+#include "sim.h"
+
+static uint32_t _inputPortMask() {
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if (portInputs() & (1 << i)) {
+            mask |= 1UL << INPUT_PINS[i];
+        }
+    }
+    return mask;
+}
+
+static uint8_t _readInputs() {
+    uint32_t levels = simPortRead();
+    uint8_t state = 0;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if (validInputPin(INPUT_PINS[i]) && ((levels >> INPUT_PINS[i]) & 1)) {
+            state |= 1 << i;
+        }
+    }
+    return state;
+}
+
+static void _portIsr() { _capture(_readInputs()); }
+
+static void _enableCapture() {
+    simAttachPortInterrupt(_inputPortMask(), &_portIsr);
+}
+
+#else
+// ###################### Teensy 3.x, one interrupt per pin, shared snapshot
+static uint8_t _readInputs() {
+    uint8_t state = 0;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if (validInputPin(INPUT_PINS[i]) && digitalRead(INPUT_PINS[i])) {
+            state |= 1 << i;
+        }
+    }
+    return state;
+}
+
+static void _pinIsr() { _capture(_readInputs()); }
+
+static void _enableCapture() {
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if (portInputs() & (1 << i)) {
+            attachInterrupt(digitalPinToInterrupt(INPUT_PINS[i]), &_pinIsr,
+                            CHANGE);
+        }
+    }
+}
+
+#endif
+
+void triggerInputsBegin(TriggerInputsHandler handler,
+                        TriggerCaptureHandler capture_handler) {
+    _handler = handler;
+    _capture_handler = capture_handler;
+    for (uint8_t i = 0; i < NUM_INPUT_PINS; i++) {
+        if (validInputPin(INPUT_PINS[i])) {
+            pinMode(INPUT_PINS[i], INPUT_PULLUP);
+        }
+    }
+
+    CriticalSection critical_section;
+    _enableCapture();
+    inputCaptureBegin(&_captured);
+    // Edges from here on are pending and diffed against this
+    _state = _readInputs();
+    // Report the initial levels of all inputs
+    _handler(micros(), _state, validInputs());
+}
+
+void triggerInputsSetFollower(TriggerInputsFollower follower) {
+    CriticalSection critical_section;
+    _follower = follower;
+}
+
+uint8_t triggerInputsState() { return _state; }
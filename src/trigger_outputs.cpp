@@ -0,0 +1,257 @@
+/*******************************************************************************
+ * File:        trigger_outputs.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "trigger_outputs.h"
+
+static uint8_t _num_ports = 0;
+static uint16_t _skew_cycles = 0;
+
+#if defined(__AVR__)
+// ################################################# AVR, masks at compile time
+#include <avr/io.h>
+
+static void _resolvePorts() {
+    _num_ports = (OUT_PORTB_MASK != 0) + (OUT_PORTC_MASK != 0) +
+                 (OUT_PORTD_MASK != 0);
+}
+
+void triggerOutputsMask(uint16_t outputs, TriggerOutputMask *mask) {
+    mask->portb = 0;
+    mask->portc = 0;
+    mask->portd = 0;
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        int16_t pin = OUTPUT_PINS[i];
+        if (!(outputs & (1U << i)) || !validOutputPin(pin)) {
+            continue;
+        }
+        uint8_t bit = 1 << avrPinBit(pin);
+        switch (avrPinPort(pin)) {
+        case AVR_PORTB:
+            mask->portb |= bit;
+            break;
+        case AVR_PORTC:
+            mask->portc |= bit;
+            break;
+        default:
+            mask->portd |= bit;
+            break;
+        }
+    }
+}
+
+void triggerOutputsMaskAdd(TriggerOutputMask *mask,
+                           const TriggerOutputMask *other) {
+    mask->portb |= other->portb;
+    mask->portc |= other->portc;
+    mask->portd |= other->portd;
+}
+
+void triggerOutputsWriteMasks(const TriggerOutputMask *set,
+                              const TriggerOutputMask *clear) {
+    // Ports without changes are not touched
+    if (set->portd | clear->portd)
+        PORTD = (PORTD | set->portd) & ~clear->portd;
+    if (set->portb | clear->portb)
+        PORTB = (PORTB | set->portb) & ~clear->portb;
+    if (set->portc | clear->portc)
+        PORTC = (PORTC | set->portc) & ~clear->portc;
+}
+
+/// @brief Cycles of one write of all outputs the way the pulse interrupt
+/// writes them, counted with Timer1 at prescaler 1
+static uint16_t _measureSkewCycles() {
+    TriggerOutputMask none = {0, 0, 0};
+    TriggerOutputMask all;
+    triggerOutputsMask(ALL_OUTPUTS, &all);
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t tccr1a = TCCR1A;
+    uint8_t tccr1b = TCCR1B;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    uint16_t t0 = TCNT1;
+    triggerOutputsWriteMasks(&none, &all);
+    uint16_t t1 = TCNT1;
+    uint16_t t2 = TCNT1;
+    TCCR1A = tccr1a;
+    TCCR1B = tccr1b;
+    SREG = sreg;
+    return (t1 - t0) - (t2 - t1);
+}
+
+#elif defined(TEENSYDUINO)
+// ######################################### Teensy, port table built at begin
+//
+// The GPIO set/clear registers of every output are looked up in the core pin
+// table once, outputs sharing a register are merged into one mask.
+struct OutputPort {
+    volatile uint32_t *set;
+    volatile uint32_t *clear;
+    uint32_t mask;
+};
+static OutputPort _ports[NUM_VALID_OUTPUT_PINS > 0 ? NUM_VALID_OUTPUT_PINS
+                                                   : 1];
+
+#if defined(KINETISK)
+// Teensy 3.x cores only expose bit-band aliases of the GPIO registers,
+// alias = 0x42000000 + (register - 0x40000000) * 32 + bit * 4
+static volatile uint32_t *_bitbandRegister(volatile uint8_t *alias) {
+    uint32_t offset = (uint32_t)alias - 0x42000000;
+    return (volatile uint32_t *)(0x40000000 + ((offset >> 5) & ~3UL));
+}
+static uint32_t _bitbandMask(volatile uint8_t *alias) {
+    return 1UL << ((((uint32_t)alias - 0x42000000) >> 2) & 31);
+}
+#define OUTPUT_SET_REGISTER(pin) _bitbandRegister(portSetRegister(pin))
+#define OUTPUT_CLEAR_REGISTER(pin) _bitbandRegister(portClearRegister(pin))
+#define OUTPUT_BIT_MASK(pin) _bitbandMask(portSetRegister(pin))
+#else
+// Teensy 4.x, GPIO6..9 DR_SET / DR_CLEAR
+#define OUTPUT_SET_REGISTER(pin) portSetRegister(pin)
+#define OUTPUT_CLEAR_REGISTER(pin) portClearRegister(pin)
+#define OUTPUT_BIT_MASK(pin) digitalPinToBitMask(pin)
+#endif
+
+static void _resolvePorts() {
+    _num_ports = 0;
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        int16_t pin = OUTPUT_PINS[i];
+        if (!validOutputPin(pin)) {
+            continue;
+        }
+        volatile uint32_t *set = OUTPUT_SET_REGISTER(pin);
+        uint8_t port = 0;
+        while (port < _num_ports && _ports[port].set != set) {
+            port++;
+        }
+        if (port == _num_ports) {
+            _ports[port].set = set;
+            _ports[port].clear = OUTPUT_CLEAR_REGISTER(pin);
+            _ports[port].mask = 0;
+            _num_ports++;
+        }
+        _ports[port].mask |= OUTPUT_BIT_MASK(pin);
+    }
+}
+
+void triggerOutputsMask(uint16_t outputs, TriggerOutputMask *mask) {
+    memset(mask, 0, sizeof(*mask));
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        int16_t pin = OUTPUT_PINS[i];
+        if (!(outputs & (1U << i)) || !validOutputPin(pin)) {
+            continue;
+        }
+        volatile uint32_t *set = OUTPUT_SET_REGISTER(pin);
+        for (uint8_t port = 0; port < _num_ports; port++) {
+            if (_ports[port].set == set) {
+                mask->port[port] |= OUTPUT_BIT_MASK(pin);
+                break;
+            }
+        }
+    }
+}
+
+void triggerOutputsMaskAdd(TriggerOutputMask *mask,
+                           const TriggerOutputMask *other) {
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        mask->port[i] |= other->port[i];
+    }
+}
+
+void triggerOutputsWriteMasks(const TriggerOutputMask *set,
+                              const TriggerOutputMask *clear) {
+    for (uint8_t i = 0; i < _num_ports; i++) {
+        if (set->port[i]) {
+            *_ports[i].set = set->port[i];
+        }
+        if (clear->port[i]) {
+            *_ports[i].clear = clear->port[i];
+        }
+    }
+}
+
+#if defined(__IMXRT1062__)
+volatile uint32_t *triggerOutputsToggleRegister(uint8_t port) {
+    // DR_SET, DR_CLEAR, DR_TOGGLE follow each other
+    return _ports[port].set + 2;
+}
+#endif
+
+/// @brief Cycles of one write of all outputs the way the pulse interrupt
+/// writes them, counted with the DWT cycle counter
+static uint16_t _measureSkewCycles() {
+    TriggerOutputMask none;
+    memset(&none, 0, sizeof(none));
+    TriggerOutputMask all;
+    triggerOutputsMask(ALL_OUTPUTS, &all);
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    noInterrupts();
+    uint32_t t0 = ARM_DWT_CYCCNT;
+    triggerOutputsWriteMasks(&none, &all);
+    uint32_t t1 = ARM_DWT_CYCCNT;
+    uint32_t t2 = ARM_DWT_CYCCNT;
+    interrupts();
+    return (t1 - t0) - (t2 - t1);
+}
+
+#elif defined(TRIGGER_SIM)
+// ############################################### Simulator, one 32 bit port
+#include "sim.h"
+
+static uint32_t _mask = 0;
+
+static void _resolvePorts() {
+    _mask = 0;
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        if (validOutputPin(OUTPUT_PINS[i])) {
+            _mask |= 1UL << OUTPUT_PINS[i];
+        }
+    }
+    _num_ports = _mask != 0;
+}
+
+void triggerOutputsMask(uint16_t outputs, TriggerOutputMask *mask) {
+    mask->pins = 0;
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        if ((outputs & (1U << i)) && validOutputPin(OUTPUT_PINS[i])) {
+            mask->pins |= 1UL << OUTPUT_PINS[i];
+        }
+    }
+}
+
+void triggerOutputsMaskAdd(TriggerOutputMask *mask,
+                           const TriggerOutputMask *other) {
+    mask->pins |= other->pins;
+}
+
+void triggerOutputsWriteMasks(const TriggerOutputMask *set,
+                              const TriggerOutputMask *clear) {
+    if (set->pins | clear->pins) {
+        simPortWrite(set->pins, clear->pins);
+    }
+}
+
+static uint16_t _measureSkewCycles() { return 0; }
+
+#endif
+
+void triggerOutputsBegin() {
+    for (uint8_t i = 0; i < NUM_OUTPUT_PINS; i++) {
+        if (validOutputPin(OUTPUT_PINS[i])) {
+            pinMode(OUTPUT_PINS[i], OUTPUT);
+        }
+    }
+    _resolvePorts();
+    _skew_cycles = _measureSkewCycles();
+}
+
+uint8_t triggerOutputsPorts() { return _num_ports; }
+
+uint16_t triggerOutputsSkewCycles() { return _skew_cycles; }
@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * File:        tx_queue.cpp
+ * Created:     17. October 2026
+ * Author:      Louis Frank
+ * Contact:     singulosta@gmail.com
+ * Copyright:   2021 Louis Frank
+ * License:     LGPL v3.0
+ ******************************************************************************/
+
+#include "tx_queue.h"
+
+#define _isPowerOfTwo(n) ((n) && ((n) & ((n)-1)) == 0)
+static_assert(_isPowerOfTwo(TX_QUEUE_CONTROL_SIZE) &&
+                  _isPowerOfTwo(TX_QUEUE_INPUTS_SIZE) &&
+                  _isPowerOfTwo(TX_QUEUE_STATS_SIZE) &&
+                  _isPowerOfTwo(TX_QUEUE_TEXT_SIZE),
+              "TX_QUEUE_*_SIZE must be powers of two");
+
+TxQueue::TxQueue() {
+    uint8_t *data[TX_PRIORITIES] = {_control, _inputs, _stats, _text};
+    uint16_t sizes[TX_PRIORITIES] = {TX_QUEUE_CONTROL_SIZE,
+                                     TX_QUEUE_INPUTS_SIZE, TX_QUEUE_STATS_SIZE,
+                                     TX_QUEUE_TEXT_SIZE};
+    for (uint8_t i = 0; i < TX_PRIORITIES; i++) {
+        _rings[i].data = data[i];
+        _rings[i].mask = sizes[i] - 1;
+        _rings[i].head = 0;
+        _rings[i].tail = 0;
+    }
+}
+
+uint16_t TxQueue::space(uint8_t priority) {
+    struct tx_ring_t *ring = &_rings[priority];
+    return ring->mask + 1 - (uint16_t)(ring->head - ring->tail);
+}
+
+uint8_t TxQueue::empty() {
+    for (uint8_t i = 0; i < TX_PRIORITIES; i++) {
+        if (_rings[i].head != _rings[i].tail) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief COBS, same encoding as PacketSerial, written modulo the ring size
+uint8_t TxQueue::push(uint8_t priority, const uint8_t *frame, size_t len) {
+    if (space(priority) < TX_QUEUE_FRAME_SPACE(len)) {
+        _dropped++;
+        return false;
+    }
+    struct tx_ring_t *ring = &_rings[priority];
+    uint16_t head = ring->head;
+    uint16_t code_at = head++;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (frame[i] == 0) {
+            ring->data[code_at & ring->mask] = code;
+            code_at = head++;
+            code = 1;
+            continue;
+        }
+        ring->data[head++ & ring->mask] = frame[i];
+        if (++code == 0xFF) {
+            ring->data[code_at & ring->mask] = code;
+            code_at = head++;
+            code = 1;
+        }
+    }
+    ring->data[code_at & ring->mask] = code;
+    ring->data[head++ & ring->mask] = 0; // packet marker
+    ring->head = head;
+    return true;
+}
+
+void TxQueue::update() {
+    int room = _stream->availableForWrite();
+    while (room > 0) {
+        if (_current < 0) {
+            if (_frameStartFunction) {
+                _frameStartFunction();
+            }
+            for (uint8_t i = 0; i < TX_PRIORITIES && _current < 0; i++) {
+                if (_rings[i].head != _rings[i].tail) {
+                    _current = i;
+                }
+            }
+            if (_current < 0) {
+                return;
+            }
+        }
+        struct tx_ring_t *ring = &_rings[_current];
+        // One contiguous piece, up to the end of the ring or of the frame
+        uint16_t tail = ring->tail & ring->mask;
+        uint16_t len = ring->head - ring->tail;
+        if (len > ring->mask + 1 - tail) {
+            len = ring->mask + 1 - tail;
+        }
+        if (len > (uint16_t)room) {
+            len = room;
+        }
+        const uint8_t *start = ring->data + tail;
+        const uint8_t *marker = (const uint8_t *)memchr(start, 0, len);
+        if (marker) {
+            len = marker - start + 1;
+            _current = -1;
+        }
+        _stream->write(start, len);
+        ring->tail += len;
+        room -= len;
+    }
+}
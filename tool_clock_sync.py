@@ -0,0 +1,126 @@
+#!/usr/bin/python
+# Reference host side clock estimator for TYPE_TIME_SYNC.
+#
+# Sends timestamp requests, keeps the exchanges with the shortest round trip
+# (least queuing in USB / OS buffers) and fits
+#
+#     host_us = offset_us + (1 + drift) * device_us
+#
+# with least squares over the exchange midpoints. Repeat the exchanges during
+# a recording (e.g. every few seconds) and refit to follow temperature drift.
+
+import struct
+import sys
+import time
+
+import serial
+from cobs import cobs
+
+SERIAL_PATH = "/dev/ttyUSB0"
+BAUDRATE = 115200
+
+TYPE_TIME_SYNC = 10
+# little endian, packed: header + host_tx + device_rx_us + device_tx_us
+TIME_SYNC_FORMAT = "<BBBQQQ"
+TIME_SYNC_PAYLOAD_LENGTH = struct.calcsize("<QQQ")
+
+
+def calculate_crc(payload: bytes) -> int:
+    return sum(payload) % 0x100
+
+
+def host_clock_us() -> int:
+    return time.perf_counter_ns() // 1000
+
+
+class ClockEstimator:
+    def __init__(self, keep_fraction: float = 0.25):
+        self.keep_fraction = keep_fraction
+        self.samples = []  # (round_trip_us, device_mid_us, host_mid_us)
+        self.offset_us = 0.0
+        self.drift = 0.0
+        self.residual_us = 0.0
+
+    def add_exchange(self, host_tx_us, device_rx_us, device_tx_us,
+                     host_rx_us):
+        round_trip_us = (host_rx_us - host_tx_us) - \
+            (device_tx_us - device_rx_us)
+        device_mid_us = (device_rx_us + device_tx_us) / 2
+        host_mid_us = (host_tx_us + host_rx_us) / 2
+        self.samples.append((round_trip_us, device_mid_us, host_mid_us))
+
+    def fit(self):
+        samples = sorted(self.samples)
+        samples = samples[:max(2, int(len(samples) * self.keep_fraction))]
+        if len(samples) < 2:
+            raise ValueError("at least two exchanges needed")
+        # centered least squares, keeps the 64 bit microsecond values precise
+        device_0 = samples[0][1]
+        host_0 = samples[0][2]
+        xs = [s[1] - device_0 for s in samples]
+        ys = [s[2] - host_0 for s in samples]
+        x_mean = sum(xs) / len(xs)
+        y_mean = sum(ys) / len(ys)
+        sxx = sum((x - x_mean) ** 2 for x in xs)
+        sxy = sum((x - x_mean) * (y - y_mean) for x, y in zip(xs, ys))
+        slope = sxy / sxx if sxx else 1.0
+        intercept = y_mean - slope * x_mean
+        self.drift = slope - 1.0
+        self.offset_us = host_0 + intercept - slope * device_0
+        residuals = [y - (intercept + slope * x) for x, y in zip(xs, ys)]
+        self.residual_us = (sum(r * r for r in residuals) /
+                            len(residuals)) ** 0.5
+
+    def to_host_us(self, device_us: float) -> float:
+        return self.offset_us + (1.0 + self.drift) * device_us
+
+
+def exchange(device: serial.Serial):
+    host_tx_us = host_clock_us()
+    payload = struct.pack("<QQQ", host_tx_us, 0, 0)
+    frame = struct.pack("<BBB", TYPE_TIME_SYNC, TIME_SYNC_PAYLOAD_LENGTH,
+                        calculate_crc(payload)) + payload
+    device.write(cobs.encode(frame) + b"\x00")
+    while True:
+        raw = device.read_until(b"\x00")
+        host_rx_us = host_clock_us()
+        if len(raw) == 0:
+            return None
+        try:
+            decoded = cobs.decode(raw[:-1])
+        except cobs.DecodeError:
+            continue
+        if len(decoded) != struct.calcsize(TIME_SYNC_FORMAT) or \
+                decoded[0] != TYPE_TIME_SYNC:
+            continue  # input events etc.
+        _, _, crc, echoed_us, device_rx_us, device_tx_us = struct.unpack(
+            TIME_SYNC_FORMAT, decoded)
+        if crc != calculate_crc(decoded[3:]) or echoed_us != host_tx_us:
+            continue
+        return host_tx_us, device_rx_us, device_tx_us, host_rx_us
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else SERIAL_PATH
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    device = serial.Serial(port=path, baudrate=BAUDRATE, timeout=.1)
+    time.sleep(2)
+    device.write(b"\x00")
+
+    estimator = ClockEstimator()
+    for _ in range(count):
+        result = exchange(device)
+        if result:
+            estimator.add_exchange(*result)
+        time.sleep(0.01)
+    device.close()
+
+    estimator.fit()
+    print("exchanges:   %d" % len(estimator.samples))
+    print("offset_us:   %.1f" % estimator.offset_us)
+    print("drift_ppm:   %.3f" % (estimator.drift * 1e6))
+    print("residual_us: %.2f" % estimator.residual_us)
+
+
+if __name__ == "__main__":
+    main()
@@ -22,26 +22,33 @@ else:
 device.timeout = 1
 
 
-def calculateCrc(bytes: bytearray) -> int:
-    return (sum(send_buffer_msgpack_packed_payload) % 0x100)
+def calculateCrc(payload: bytes) -> int:
+    return (sum(payload) % 0x100)
 
 
 print_padding = 30
 
 
 SECOUND = 1000000
+MILLIHZ_PER_HZ = 1000
+
+TYPE_SETUP = 1
+# The firmware reads packed little endian structs:
+# pulse_hz, pulse_limit, delay_us, flags, pulse_millihz
+SETUP_PAYLOAD_FORMAT = "<BIIBI"
 
 device.write(b"\x00")
 
-send_buffer_msgpack_packed = b"\x00\x03\x0A"+b"\x03\x03\x04"
 delay_us: int = 0 * SECOUND
 pulse_limit: int = 0
-pulse_hz: int = 0
+pulse_millihz: int = 0
+flags: int = 0
 send_buffer_msgpack_packed_payload = struct.pack(
-    ">BII",  pulse_hz, pulse_limit, delay_us)
+    SETUP_PAYLOAD_FORMAT, min(pulse_millihz // MILLIHZ_PER_HZ, 0xFF),
+    pulse_limit, delay_us, flags, pulse_millihz)
 crc = calculateCrc(send_buffer_msgpack_packed_payload)
 send_buffer_msgpack_packed_head = struct.pack(
-    ">BBB", 1, struct.calcsize(">IIB"), crc)
+    "<BBB", TYPE_SETUP, len(send_buffer_msgpack_packed_payload), crc)
 send_buffer_msgpack_packed = send_buffer_msgpack_packed_head + \
     send_buffer_msgpack_packed_payload
 print("send_buffer_structpack_packed:".ljust(print_padding, " ") +